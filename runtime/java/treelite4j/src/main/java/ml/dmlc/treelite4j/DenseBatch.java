@@ -1,7 +1,8 @@
 package ml.dmlc.treelite4j;
 
 /**
- * 2D dense batch, laid out in row-major layout
+ * 2D dense batch, laid out in row-major layout, column-major layout, or any
+ * other layout in which rows and columns are a fixed distance apart
  * @author Philip Cho
  */
 public class DenseBatch {
@@ -36,6 +37,65 @@ public class DenseBatch {
     handle = out[0];
   }
 
+  /**
+   * Create a dense batch representing a 2D dense matrix whose rows and
+   * columns are any fixed distance apart, such as a column-major matrix or a
+   * view of a padded buffer. The value in row ``i`` and column ``j`` is
+   * ``data[i * row_stride + j * col_stride]``.
+   * @param data array of entries
+   * @param missing_value floating-point value representing a missing value;
+   *                      usually set of ``Float.NaN``.
+   * @param num_row number of rows (data instances) in the matrix
+   * @param num_col number of columns (features) in the matrix
+   * @param row_stride distance between successive rows, in elements
+   * @param col_stride distance between successive columns, in elements
+   * @return Created dense batch
+   * @throws IllegalArgumentException if a stride is not positive or data is
+   *                                  too short for the given strides
+   * @throws TreeliteError
+   */
+  public DenseBatch(
+    float[] data, float missing_value, int num_row, int num_col,
+    int row_stride, int col_stride) throws TreeliteError {
+    if (row_stride <= 0 || col_stride <= 0) {
+      throw new IllegalArgumentException(
+        "row_stride and col_stride must be positive");
+    }
+    if (num_row > 0 && num_col > 0
+        && (long)(num_row - 1) * row_stride + (long)(num_col - 1) * col_stride
+           >= data.length) {
+      throw new IllegalArgumentException(
+        "data is too short for the given strides");
+    }
+    this.data = data;
+    this.missing_value = missing_value;
+    this.num_row = num_row;
+    this.num_col = num_col;
+
+    long[] out = new long[1];
+    TreeliteJNI.checkCall(TreeliteJNI.TreeliteAssembleDenseBatchStrided(
+      this.data, this.missing_value, this.num_row, this.num_col, row_stride,
+      col_stride, out));
+    handle = out[0];
+  }
+
+  /**
+   * Create a dense batch representing a 2D dense matrix laid out in
+   * column-major layout, i.e. one column after another
+   * @param data array of entries, should be of length ``[num_row]*[num_col]``
+   * @param missing_value floating-point value representing a missing value;
+   *                      usually set of ``Float.NaN``.
+   * @param num_row number of rows (data instances) in the matrix
+   * @param num_col number of columns (features) in the matrix
+   * @return Created dense batch
+   * @throws TreeliteError
+   */
+  public static DenseBatch columnMajor(
+    float[] data, float missing_value, int num_row, int num_col)
+      throws TreeliteError {
+    return new DenseBatch(data, missing_value, num_row, num_col, 1, num_row);
+  }
+
   /**
    * Get the underlying native handle
    * @return Integer representing memory address
@@ -40,6 +40,64 @@ public class Predictor {
   public Predictor(
     String libpath, int nthread, boolean verbose, boolean include_master_thread)
       throws TreeliteError {
+    String path = resolveLibPath(libpath);
+    long[] out = new long[1];
+    TreeliteJNI.checkCall(TreeliteJNI.TreelitePredictorLoad(
+      path, nthread, include_master_thread, out));
+    handle = out[0];
+    init(path, verbose);
+  }
+
+  /**
+   * Create a Predictor by loading a shared library (dll/so/dylib) held in
+   * memory, such as one read from a JAR resource or received over the
+   * network. On Linux, the library is loaded without touching the disk.
+   * @param libbuffer Content of the shared library
+   * @param nthread Number of workers threads to spawn. Set to -1 to use default,
+   *                i.e., to launch as many threads as CPU cores available on
+   *                the system.
+   * @param verbose Whether to print extra diagnostic messages
+   * @param include_master_thread Whether the master thread should itself be
+   *                              assigned work
+   * @return Created Predictor
+   * @throws TreeliteError
+   */
+  public Predictor(
+    byte[] libbuffer, int nthread, boolean verbose,
+    boolean include_master_thread) throws TreeliteError {
+    long[] out = new long[1];
+    TreeliteJNI.checkCall(TreeliteJNI.TreelitePredictorLoadFromMemory(
+      libbuffer, nthread, include_master_thread, out));
+    handle = out[0];
+    init("<memory>", verbose);
+  }
+
+  /**
+   * Create a Predictor by loading a shared library (dll/so/dylib), running
+   * predictions on a pool of worker threads shared with other predictors
+   * instead of spawning new threads.
+   * @param libpath Path to the shared library
+   * @param worker_pool Pool of worker threads to use
+   * @param verbose Whether to print extra diagnostic messages
+   * @param include_master_thread Whether the master thread (the thread calling
+   *                              the :java:ref:`predict()` method) should
+   *                              itself be assigned work. This option is
+   *                              applicable only to batch prediction.
+   * @return Created Predictor
+   * @throws TreeliteError
+   */
+  public Predictor(
+    String libpath, WorkerPool worker_pool, boolean verbose,
+    boolean include_master_thread) throws TreeliteError {
+    String path = resolveLibPath(libpath);
+    long[] out = new long[1];
+    TreeliteJNI.checkCall(TreeliteJNI.TreelitePredictorLoadWithWorkerPool(
+      path, worker_pool.getHandle(), include_master_thread, out));
+    handle = out[0];
+    init(path, verbose);
+  }
+
+  private static String resolveLibPath(String libpath) throws TreeliteError {
     File f = new File(libpath);
     String path = "";
     if (f.isDirectory()) {  // libpath is a diectory
@@ -71,12 +129,11 @@ public class Predictor {
           ".so / .dll / .dylib", libpath, fileext));
       }
     }
+    return path;
+  }
 
+  private void init(String path, boolean verbose) throws TreeliteError {
     long[] out = new long[1];
-    TreeliteJNI.checkCall(TreeliteJNI.TreelitePredictorLoad(
-      path, nthread, include_master_thread, out));
-    handle = out[0];
-
     // Save # of output groups and # of features
     TreeliteJNI.checkCall(TreeliteJNI.TreelitePredictorQueryNumOutputGroup(
       handle, out));
@@ -146,17 +203,16 @@ public class Predictor {
 
   /**
    * Perform batch prediction with a 2D sparse data matrix. Worker threads
-   * will internally divide up work for batch prediction. **Note that this
-   * function may be called by only one thread at a time.** In order to use
-   * multiple threads to process multiple prediction requests simultaneously,
-   * use :java:meth:`Predictor.predict(Data[], boolean)` instead.
+   * will internally divide up work for batch prediction. This method may be
+   * called by multiple threads at the same time; the worker threads will be
+   * shared among all pending requests.
    * @param batch a :java:ref:`SparseBatch`, representing a slice of a 2D
    *              sparse matrix
    * @param verbose whether to print extra diagnostic messages
    * @param pred_margin whether to predict probabilities or raw margin scores
    * @return Resulting predictions, of dimension ``[num_row]*[num_output_group]``
    */
-  public synchronized float[][] predict(
+  public float[][] predict(
     SparseBatch batch, boolean verbose, boolean pred_margin)
       throws TreeliteError {
     long[] out = new long[1];
@@ -173,17 +229,16 @@ public class Predictor {
 
   /**
    * Perform batch prediction with a 2D dense data matrix. Worker threads
-   * will internally divide up work for batch prediction. **Note that this
-   * function may be called by only one thread at a time.** In order to use
-   * multiple threads to process multiple prediction requests simultaneously,
-   * use :java:meth:`Predictor.predict(Data[], boolean)` instead.
+   * will internally divide up work for batch prediction. This method may be
+   * called by multiple threads at the same time; the worker threads will be
+   * shared among all pending requests.
    * @param batch a :java:ref:`DenseBatch`, representing a slice of a 2D dense
    *              matrix
    * @param verbose whether to print extra diagnostic messages
    * @param pred_margin whether to predict probabilities or raw margin scores
    * @return Resulting predictions, of dimension ``[num_row]*[num_output_group]``
    */
-  public synchronized float[][] predict(
+  public float[][] predict(
     DenseBatch batch, boolean verbose, boolean pred_margin)
       throws TreeliteError {
     long[] out = new long[1];
@@ -198,6 +253,65 @@ public class Predictor {
     return reshape(out_result, actual_result_size, this.num_output_group);
   }
 
+  /**
+   * Replace the loaded library with another one, without pausing predictions
+   * made from other threads. Predictions already in progress finish with the
+   * old library, which is unloaded once they are done. If the new library
+   * cannot be loaded, the old one stays in place.
+   * @param libpath Path to the shared library. The model must have the same
+   *                number of features and output groups as the one loaded.
+   * @throws TreeliteError
+   */
+  public void Reload(String libpath) throws TreeliteError {
+    String path = resolveLibPath(libpath);
+    TreeliteJNI.checkCall(TreeliteJNI.TreelitePredictorReload(
+      this.handle, path));
+  }
+
+  /**
+   * Get the version of the library new predictions go to. It is 1 after the
+   * predictor is created and goes up by one with every :java:meth:`Reload`.
+   * @return Model version
+   */
+  public long GetModelVersion() throws TreeliteError {
+    long[] out = new long[1];
+    TreeliteJNI.checkCall(TreeliteJNI.TreelitePredictorQueryModelVersion(
+      this.handle, out));
+    return out[0];
+  }
+
+  /**
+   * Get the statistics of batch predictions made since the library was
+   * loaded or the statistics were last reset: throughput, latency quantiles
+   * of each stage of a batch prediction (in seconds), and the busy and idle
+   * time of each worker thread.
+   * @return Statistics, as a JSON string
+   */
+  public String GetStats() throws TreeliteError {
+    String[] out = new String[1];
+    TreeliteJNI.checkCall(TreeliteJNI.TreelitePredictorGetStats(
+      this.handle, out));
+    return out[0];
+  }
+
+  /**
+   * Reset the statistics returned by :java:meth:`GetStats`
+   */
+  public void ResetStats() throws TreeliteError {
+    TreeliteJNI.checkCall(TreeliteJNI.TreelitePredictorResetStats(
+      this.handle));
+  }
+
+  /**
+   * Write the statistics returned by :java:meth:`GetStats` to a file in the
+   * Prometheus text exposition format. The file is replaced atomically.
+   * @param path path of the file
+   */
+  public void DumpStats(String path) throws TreeliteError {
+    TreeliteJNI.checkCall(TreeliteJNI.TreelitePredictorDumpStats(
+      this.handle, path));
+  }
+
   private float[][] reshape(float[] array, int rend, int num_col) {
     assert rend <= array.length;
     assert rend % num_col == 0;
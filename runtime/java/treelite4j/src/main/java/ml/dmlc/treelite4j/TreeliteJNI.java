@@ -41,6 +41,10 @@ class TreeliteJNI {
   public final static native int TreeliteAssembleDenseBatch(
     float[] data, float missing_value, long num_row, long num_col, long[] out);
 
+  public final static native int TreeliteAssembleDenseBatchStrided(
+    float[] data, float missing_value, long num_row, long num_col,
+    long row_stride, long col_stride, long[] out);
+
   public final static native int TreeliteDeleteDenseBatch(
     long handle, float[] data);
 
@@ -73,4 +77,32 @@ class TreeliteJNI {
 
   public final static native int TreelitePredictorFree(long handle);
 
+  public final static native int TreeliteWorkerPoolCreate(
+    int num_worker_thread, String affinity_policy, int[] cpu_list,
+    int numa_node, String wait_strategy, long queue_depth, long[] out);
+
+  public final static native int TreeliteWorkerPoolFree(long handle);
+
+  public final static native int TreelitePredictorLoadWithWorkerPool(
+    String library_path, long worker_pool, boolean include_master_thread,
+    long[] out);
+
+  public final static native int TreelitePredictorGetStats(
+    long handle, String[] out);
+
+  public final static native int TreelitePredictorResetStats(long handle);
+
+  public final static native int TreelitePredictorDumpStats(
+    long handle, String path);
+
+  public final static native int TreelitePredictorLoadFromMemory(
+    byte[] buf, int num_worker_thread, boolean include_master_thread,
+    long[] out);
+
+  public final static native int TreelitePredictorReload(
+    long handle, String library_path);
+
+  public final static native int TreelitePredictorQueryModelVersion(
+    long handle, long[] out);
+
 }
@@ -0,0 +1,77 @@
+package ml.dmlc.treelite4j;
+
+/**
+ * Pool of worker threads that can be shared by many predictors, so that a
+ * process serving many models runs only one set of worker threads. The pool
+ * is kept alive as long as any predictor using it is alive.
+ * @author Philip Cho
+ */
+public class WorkerPool {
+  private long handle = 0;
+
+  /**
+   * Create a pool of worker threads, placed compactly on CPUs.
+   * @param nthread Number of workers threads to spawn. Set to -1 to use
+   *                default, i.e., to launch as many threads as CPU cores
+   *                available on the system.
+   * @return Created WorkerPool
+   * @throws TreeliteError
+   */
+  public WorkerPool(int nthread) throws TreeliteError {
+    this(nthread, "compact", new int[0], -1, "spin_then_sleep", 256);
+  }
+
+  /**
+   * Create a pool of worker threads.
+   * @param nthread Number of workers threads to spawn. Set to -1 to use
+   *                default, i.e., to launch as many threads as CPU cores
+   *                available on the system.
+   * @param affinity_policy How worker threads are placed on CPUs. One of
+   *                        "none", "compact", "scatter", "explicit", or
+   *                        "numa_local"
+   * @param cpu_list List of CPUs to pin workers to, for the "explicit" policy
+   * @param numa_node NUMA node to place workers on, for the "numa_local"
+   *                  policy. Set to -1 to use the node on which the calling
+   *                  thread is running.
+   * @param wait_strategy How idle worker threads wait for new tasks. One of
+   *                      "spin", "spin_then_sleep", "adaptive", or
+   *                      "blocking"
+   * @param queue_depth Number of tasks that can be queued up for each worker
+   *                    thread
+   * @return Created WorkerPool
+   * @throws TreeliteError
+   */
+  public WorkerPool(int nthread, String affinity_policy, int[] cpu_list,
+                    int numa_node, String wait_strategy, long queue_depth)
+      throws TreeliteError {
+    long[] out = new long[1];
+    TreeliteJNI.checkCall(TreeliteJNI.TreeliteWorkerPoolCreate(
+      nthread, affinity_policy, cpu_list, numa_node, wait_strategy,
+      queue_depth, out));
+    handle = out[0];
+  }
+
+  /**
+   * Get the underlying native handle
+   * @return Integer representing memory address
+   */
+  public long getHandle() {
+    return this.handle;
+  }
+
+  @Override
+  protected void finalize() throws Throwable {
+    super.finalize();
+    dispose();
+  }
+
+  /**
+   * Destructor, to be called when the object is garbage collected
+   */
+  public synchronized void dispose() {
+    if (handle != 0L) {
+      TreeliteJNI.TreeliteWorkerPoolFree(handle);
+      handle = 0;
+    }
+  }
+}
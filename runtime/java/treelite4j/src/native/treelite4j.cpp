@@ -101,6 +101,31 @@ Java_ml_dmlc_treelite4j_TreeliteJNI_TreeliteAssembleDenseBatch(
   return ret;
 }
 
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreeliteAssembleDenseBatchStrided
+ * Signature: ([FFJJJJ[J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreeliteAssembleDenseBatchStrided(
+  JNIEnv* jenv, jclass jcls, jfloatArray jdata, jfloat jmissing_value,
+  jlong jnum_row, jlong jnum_col, jlong jrow_stride, jlong jcol_stride,
+  jlongArray jout) {
+
+  jfloat* data = jenv->GetFloatArrayElements(jdata, 0);
+  DenseBatchHandle out;
+  const jint ret = (jint)TreeliteAssembleDenseBatchStrided((const float*)data,
+    (float)jmissing_value, (size_t)jnum_row, (size_t)jnum_col,
+    (size_t)jrow_stride, (size_t)jcol_stride, &out);
+  if (ret != 0) {
+    jenv->ReleaseFloatArrayElements(jdata, data, JNI_ABORT);
+    return ret;
+  }
+  setHandle(jenv, jout, out);
+
+  return ret;
+}
+
 /*
  * Class:     ml_dmlc_treelite4j_TreeliteJNI
  * Method:    TreeliteDeleteDenseBatch
@@ -317,3 +342,169 @@ Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorFree(
   JNIEnv* jenv, jclass jcls, jlong jhandle) {
   return (jint)TreelitePredictorFree((PredictorHandle)jhandle);
 }
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreeliteWorkerPoolCreate
+ * Signature: (ILjava/lang/String;[IILjava/lang/String;J[J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreeliteWorkerPoolCreate(
+  JNIEnv* jenv, jclass jcls, jint jnum_worker_thread, jstring jaffinity_policy,
+  jintArray jcpu_list, jint jnuma_node, jstring jwait_strategy,
+  jlong jqueue_depth, jlongArray jout) {
+
+  const char* affinity_policy = jenv->GetStringUTFChars(jaffinity_policy, 0);
+  const char* wait_strategy = jenv->GetStringUTFChars(jwait_strategy, 0);
+  jint* cpu_list = jenv->GetIntArrayElements(jcpu_list, 0);
+  const size_t num_cpu = (size_t)jenv->GetArrayLength(jcpu_list);
+  WorkerPoolHandle out;
+  const jint ret = (jint)TreeliteWorkerPoolCreate((int)jnum_worker_thread,
+    affinity_policy, (const int*)cpu_list, num_cpu, (int)jnuma_node,
+    wait_strategy, (size_t)jqueue_depth, &out);
+  setHandle(jenv, jout, out);
+
+  // release arrays
+  jenv->ReleaseIntArrayElements(jcpu_list, cpu_list, 0);
+  jenv->ReleaseStringUTFChars(jaffinity_policy, affinity_policy);
+  jenv->ReleaseStringUTFChars(jwait_strategy, wait_strategy);
+
+  return ret;
+}
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreeliteWorkerPoolFree
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreeliteWorkerPoolFree(
+  JNIEnv* jenv, jclass jcls, jlong jhandle) {
+  return (jint)TreeliteWorkerPoolFree((WorkerPoolHandle)jhandle);
+}
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorLoadWithWorkerPool
+ * Signature: (Ljava/lang/String;JZ[J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorLoadWithWorkerPool(
+  JNIEnv* jenv, jclass jcls, jstring jlibrary_path, jlong jworker_pool,
+  jboolean jinclude_master_thread, jlongArray jout) {
+
+  const char* library_path = jenv->GetStringUTFChars(jlibrary_path, 0);
+  PredictorHandle out;
+  const jint ret = (jint)TreelitePredictorLoadWithWorkerPool(library_path,
+    (WorkerPoolHandle)jworker_pool,
+    (jinclude_master_thread == JNI_TRUE ? 1 : 0), &out);
+  setHandle(jenv, jout, out);
+  jenv->ReleaseStringUTFChars(jlibrary_path, library_path);
+
+  return ret;
+}
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorGetStats
+ * Signature: (J[Ljava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorGetStats(
+  JNIEnv* jenv, jclass jcls, jlong jhandle, jobjectArray jout) {
+
+  const char* json;
+  const jint ret = (jint)TreelitePredictorGetStats((PredictorHandle)jhandle,
+                                                   &json);
+  if (ret == 0) {
+    jenv->SetObjectArrayElement(jout, 0, jenv->NewStringUTF(json));
+  }
+
+  return ret;
+}
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorResetStats
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorResetStats(
+  JNIEnv* jenv, jclass jcls, jlong jhandle) {
+  return (jint)TreelitePredictorResetStats((PredictorHandle)jhandle);
+}
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorDumpStats
+ * Signature: (JLjava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorDumpStats(
+  JNIEnv* jenv, jclass jcls, jlong jhandle, jstring jpath) {
+
+  const char* path = jenv->GetStringUTFChars(jpath, 0);
+  const jint ret = (jint)TreelitePredictorDumpStats((PredictorHandle)jhandle,
+                                                    path);
+  jenv->ReleaseStringUTFChars(jpath, path);
+
+  return ret;
+}
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorLoadFromMemory
+ * Signature: ([BIZ[J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorLoadFromMemory(
+  JNIEnv* jenv, jclass jcls, jbyteArray jbuf, jint jnum_worker_thread,
+  jboolean jinclude_master_thread, jlongArray jout) {
+
+  jbyte* buf = jenv->GetByteArrayElements(jbuf, 0);
+  const size_t len = static_cast<size_t>(jenv->GetArrayLength(jbuf));
+  PredictorHandle out;
+  const jint ret = (jint)TreelitePredictorLoadFromMemory(buf, len,
+    (int)jnum_worker_thread, (jinclude_master_thread == JNI_TRUE ? 1 : 0), &out);
+  // the library has been copied; nothing to write back
+  jenv->ReleaseByteArrayElements(jbuf, buf, JNI_ABORT);
+  setHandle(jenv, jout, out);
+
+  return ret;
+}
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorReload
+ * Signature: (JLjava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorReload(
+  JNIEnv* jenv, jclass jcls, jlong jhandle, jstring jlibrary_path) {
+
+  const char* library_path = jenv->GetStringUTFChars(jlibrary_path, 0);
+  const jint ret = (jint)TreelitePredictorReload((PredictorHandle)jhandle,
+                                                 library_path);
+  jenv->ReleaseStringUTFChars(jlibrary_path, library_path);
+
+  return ret;
+}
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorQueryModelVersion
+ * Signature: (J[J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorQueryModelVersion(
+  JNIEnv* jenv, jclass jcls, jlong jhandle, jlongArray jout) {
+
+  uint64_t model_version;
+  const jint ret = (jint)TreelitePredictorQueryModelVersion(
+    (PredictorHandle)jhandle, &model_version);
+  jlong* out = jenv->GetLongArrayElements(jout, 0);
+  out[0] = (jlong)model_version;
+  jenv->ReleaseLongArrayElements(jout, out, 0);
+
+  return ret;
+}
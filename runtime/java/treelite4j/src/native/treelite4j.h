@@ -42,6 +42,16 @@ JNIEXPORT jint JNICALL
 Java_ml_dmlc_treelite4j_TreeliteJNI_TreeliteAssembleDenseBatch(
   JNIEnv*, jclass, jfloatArray, jfloat, jlong, jlong, jlongArray);
 
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreeliteAssembleDenseBatchStrided
+ * Signature: ([FFJJJJ[J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreeliteAssembleDenseBatchStrided(
+  JNIEnv*, jclass, jfloatArray, jfloat, jlong, jlong, jlong, jlong,
+  jlongArray);
+
 /*
  * Class:     ml_dmlc_treelite4j_TreeliteJNI
  * Method:    TreeliteDeleteDenseBatch
@@ -133,6 +143,88 @@ JNIEXPORT jint JNICALL
 Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorFree(
   JNIEnv*, jclass, jlong);
 
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreeliteWorkerPoolCreate
+ * Signature: (ILjava/lang/String;[IILjava/lang/String;J[J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreeliteWorkerPoolCreate(
+  JNIEnv*, jclass, jint, jstring, jintArray, jint, jstring, jlong,
+  jlongArray);
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreeliteWorkerPoolFree
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreeliteWorkerPoolFree(
+  JNIEnv*, jclass, jlong);
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorLoadWithWorkerPool
+ * Signature: (Ljava/lang/String;JZ[J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorLoadWithWorkerPool(
+  JNIEnv*, jclass, jstring, jlong, jboolean, jlongArray);
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorGetStats
+ * Signature: (J[Ljava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorGetStats(
+  JNIEnv*, jclass, jlong, jobjectArray);
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorResetStats
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorResetStats(
+  JNIEnv*, jclass, jlong);
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorDumpStats
+ * Signature: (JLjava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorDumpStats(
+  JNIEnv*, jclass, jlong, jstring);
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorLoadFromMemory
+ * Signature: ([BIZ[J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorLoadFromMemory(
+  JNIEnv*, jclass, jbyteArray, jint, jboolean, jlongArray);
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorReload
+ * Signature: (JLjava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorReload(
+  JNIEnv*, jclass, jlong, jstring);
+
+/*
+ * Class:     ml_dmlc_treelite4j_TreeliteJNI
+ * Method:    TreelitePredictorQueryModelVersion
+ * Signature: (J[J)I
+ */
+JNIEXPORT jint JNICALL
+Java_ml_dmlc_treelite4j_TreeliteJNI_TreelitePredictorQueryModelVersion(
+  JNIEnv*, jclass, jlong, jlongArray);
+
 #ifdef __cplusplus
 }
 #endif
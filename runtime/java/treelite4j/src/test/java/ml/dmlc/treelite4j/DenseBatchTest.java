@@ -28,4 +28,18 @@ public class DenseBatchTest {
       TestCase.assertEquals(num_col, out_num_col[0]);
     }
   }
+
+  @Test
+  public void testDenseBatchInvalidStride() throws TreeliteError {
+    float[] data = new float[12];
+    int[][] strides = new int[][] { {0, 1}, {4, 0}, {-4, 1}, {4, -1}, {4, 2} };
+    for (int[] stride : strides) {
+      try {
+        new DenseBatch(data, Float.NaN, 3, 4, stride[0], stride[1]);
+        TestCase.fail("expected IllegalArgumentException");
+      } catch (IllegalArgumentException e) {
+        // expected
+      }
+    }
+  }
 }
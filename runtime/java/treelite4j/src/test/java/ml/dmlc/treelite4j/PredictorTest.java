@@ -41,6 +41,92 @@ public class PredictorTest {
     TestCase.assertEquals(127, predictor.GetNumFeature());
   }
 
+  @Test
+  public void testPredictorSharedWorkerPool() throws TreeliteError, IOException {
+    WorkerPool pool = new WorkerPool(1);
+    Predictor predictor = new Predictor(mushroomLibLocation, pool, true, true);
+    Predictor predictor2 = new Predictor(mushroomLibLocation, pool, true, true);
+    pool.dispose();  // the predictors keep the pool alive
+    List<List<MatrixEntry>> dmat
+      = LoadDatasetFromLibSVM(mushroomTestDataLocation);
+    SparseBatch sparse_batch = CreateSparseBatch(dmat);
+    float[] expected_result
+      = LoadArrayFromText(mushroomTestDataPredProbResultLocation);
+
+    for (Predictor p : new Predictor[]{predictor, predictor2}) {
+      float[][] result = p.predict(sparse_batch, true, false);
+      for (int i = 0; i < result.length; ++i) {
+        TestCase.assertEquals(1, result[i].length);
+        TestCase.assertEquals(expected_result[i], result[i][0]);
+      }
+    }
+    predictor.dispose();
+    predictor2.dispose();
+  }
+
+  @Test
+  public void testPredictorStats() throws TreeliteError, IOException {
+    Predictor predictor = new Predictor(mushroomLibLocation, 1, true, true);
+    List<List<MatrixEntry>> dmat
+      = LoadDatasetFromLibSVM(mushroomTestDataLocation);
+    SparseBatch sparse_batch = CreateSparseBatch(dmat);
+    predictor.predict(sparse_batch, true, false);
+    predictor.predict(sparse_batch, true, false);
+    String stats = predictor.GetStats();
+    TestCase.assertTrue(stats.contains("\"num_batch\": 2,"));
+    TestCase.assertTrue(stats.contains("\"compute\": {\"count\": 2,"));
+
+    File statsFile = File.createTempFile("treelite", ".prom");
+    predictor.DumpStats(statsFile.getAbsolutePath());
+    String text = FileUtils.readFileToString(statsFile, "UTF-8");
+    statsFile.delete();
+    TestCase.assertTrue(text.contains("treelite_predictor_batches_total 2\n"));
+
+    predictor.ResetStats();
+    TestCase.assertTrue(predictor.GetStats().contains("\"num_batch\": 0,"));
+    predictor.dispose();
+  }
+
+  @Test
+  public void testPredictorLoadFromMemory() throws TreeliteError, IOException {
+    byte[] libbuffer
+      = FileUtils.readFileToByteArray(new File(mushroomLibLocation));
+    Predictor predictor = new Predictor(libbuffer, -1, true, true);
+    List<List<MatrixEntry>> dmat
+      = LoadDatasetFromLibSVM(mushroomTestDataLocation);
+    SparseBatch sparse_batch = CreateSparseBatch(dmat);
+    float[] expected_result
+      = LoadArrayFromText(mushroomTestDataPredProbResultLocation);
+    float[][] result = predictor.predict(sparse_batch, true, false);
+    for (int i = 0; i < result.length; ++i) {
+      TestCase.assertEquals(expected_result[i], result[i][0]);
+    }
+    predictor.dispose();
+  }
+
+  @Test
+  public void testPredictorReload() throws TreeliteError, IOException {
+    Predictor predictor = new Predictor(mushroomLibLocation, -1, true, true);
+    // a second copy of the library, so that it is loaded anew
+    String libCopyLocation = NativeLibLoader.createTempFileFromResource(
+      "/mushroom_example/" + System.mapLibraryName("mushroom"));
+    List<List<MatrixEntry>> dmat
+      = LoadDatasetFromLibSVM(mushroomTestDataLocation);
+    SparseBatch sparse_batch = CreateSparseBatch(dmat);
+    float[] expected_result
+      = LoadArrayFromText(mushroomTestDataPredProbResultLocation);
+    TestCase.assertEquals(1, predictor.GetModelVersion());
+
+    predictor.Reload(libCopyLocation);
+    TestCase.assertEquals(2, predictor.GetModelVersion());
+    TestCase.assertTrue(predictor.GetStats().contains("\"model_version\": 2,"));
+    float[][] result = predictor.predict(sparse_batch, true, false);
+    for (int i = 0; i < result.length; ++i) {
+      TestCase.assertEquals(expected_result[i], result[i][0]);
+    }
+    predictor.dispose();
+  }
+
   @Test
   public void testPredict() throws TreeliteError, IOException {
     Predictor predictor = new Predictor(mushroomLibLocation, -1, true, true);
@@ -66,6 +152,52 @@ public class PredictorTest {
     }
   }
 
+  @Test
+  public void testPredictStrided() throws TreeliteError, IOException {
+    Predictor predictor = new Predictor(mushroomLibLocation, -1, true, true);
+    List<List<MatrixEntry>> dmat
+      = LoadDatasetFromLibSVM(mushroomTestDataLocation);
+    float[] expected_result
+      = LoadArrayFromText(mushroomTestDataPredProbResultLocation);
+    int num_row = dmat.size();
+    int num_col = 0;
+    for (List<MatrixEntry> inst : dmat) {
+      for (MatrixEntry e : inst) {
+        num_col = Math.max(num_col, e.fid + 1);
+      }
+    }
+
+    /* column-major batch */
+    float[] col_data = new float[num_row * num_col];
+    Arrays.fill(col_data, Float.NaN);
+    /* row-major batch with each row padded by 3 extra entries */
+    int padded_num_col = num_col + 3;
+    float[] padded_data = new float[num_row * padded_num_col];
+    Arrays.fill(padded_data, 1.0f);
+    for (int i = 0; i < num_row; ++i) {
+      for (int j = 0; j < num_col; ++j) {
+        padded_data[i * padded_num_col + j] = Float.NaN;
+      }
+      for (MatrixEntry e : dmat.get(i)) {
+        col_data[e.fid * num_row + i] = e.fval;
+        padded_data[i * padded_num_col + e.fid] = e.fval;
+      }
+    }
+    DenseBatch[] batches = new DenseBatch[] {
+      DenseBatch.columnMajor(col_data, Float.NaN, num_row, num_col),
+      new DenseBatch(padded_data, Float.NaN, num_row, num_col,
+                     padded_num_col, 1)
+    };
+    for (DenseBatch batch : batches) {
+      float[][] result = predictor.predict(batch, true, false);
+      TestCase.assertEquals(num_row, result.length);
+      for (int i = 0; i < result.length; ++i) {
+        TestCase.assertEquals(1, result[i].length);
+        TestCase.assertEquals(expected_result[i], result[i][0]);
+      }
+    }
+  }
+
   @Test
   public void testPredictMargin() throws TreeliteError, IOException {
     Predictor predictor = new Predictor(mushroomLibLocation, -1, true, true);
@@ -0,0 +1,80 @@
+/*!
+ * Copyright (c) 2018 by Contributors
+ * \file cli_main.cc
+ * \author Philip Cho
+ * \brief Command-line program to make predictions for a data file
+ *
+ * Usage:
+ *   treelite_score libpath input_uri output_uri [key=value ...]
+ * where the keys are
+ *   format       format of the data file: libsvm (default), csv or libfm
+ *   nthread      number of worker threads; -1 (default) to use all cores
+ *   pred_margin  1 to produce raw margin scores instead of probabilities
+ *   verbose      1 to print extra messages
+ */
+
+#include <treelite/predictor.h>
+#include <dmlc/logging.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace {
+
+void PrintUsage(const char* prog) {
+  std::cerr << "Usage: " << prog
+            << " libpath input_uri output_uri [key=value ...]\n"
+            << "Keys:\n"
+            << "  format       format of the data file: libsvm (default), "
+            << "csv or libfm\n"
+            << "  nthread      number of worker threads; -1 (default) to use "
+            << "all cores\n"
+            << "  pred_margin  1 to produce raw margin scores instead of "
+            << "probabilities\n"
+            << "  verbose      1 to print extra messages\n";
+}
+
+int CLIRunTask(int argc, char* argv[]) {
+  std::string format = "libsvm";
+  int nthread = -1;
+  bool pred_margin = false;
+  int verbose = 0;
+  for (int i = 4; i < argc; ++i) {
+    const char* eq = std::strchr(argv[i], '=');
+    CHECK(eq != nullptr) << "Expected key=value, got `" << argv[i] << "'";
+    const std::string key(argv[i], eq - argv[i]);
+    const char* value = eq + 1;
+    if (key == "format") {
+      format = value;
+    } else if (key == "nthread") {
+      nthread = std::atoi(value);
+    } else if (key == "pred_margin") {
+      pred_margin = (std::atoi(value) != 0);
+    } else if (key == "verbose") {
+      verbose = std::atoi(value);
+    } else {
+      LOG(FATAL) << "Unknown key `" << key << "'";
+    }
+  }
+  treelite::Predictor predictor(nthread);
+  predictor.Load(argv[1]);
+  predictor.PredictFile(argv[2], format.c_str(), argv[3], pred_margin,
+                        verbose);
+  return 0;
+}
+
+}  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 4) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  try {
+    return CLIRunTask(argc, argv);
+  } catch (const dmlc::Error& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 2;
+  }
+}
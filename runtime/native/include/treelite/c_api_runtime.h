@@ -26,8 +26,24 @@ typedef void* PredictorHandle;
 typedef void* CSRBatchHandle;
 /*! \brief handle to batch of dense data rows */
 typedef void* DenseBatchHandle;
+/*! \brief handle to asynchronous prediction in progress */
+typedef void* AsyncPredictionHandle;
+/*! \brief handle to pool of worker threads shared by predictors */
+typedef void* WorkerPoolHandle;
+/*! \brief handle to queue of finished predictions */
+typedef void* CompletionQueueHandle;
 /*! \} */
 
+/*!
+ * \brief function to be called from a worker thread when an asynchronous
+ *        prediction finishes
+ * \param callback_data opaque pointer given to
+ *                      TreelitePredictorPredictBatchAsync()
+ * \param result_size length of the output vector
+ */
+typedef void (*TreelitePredictCallback)(void* callback_data,
+                                        size_t result_size);
+
 /*!
  * \defgroup predictor
  * Predictor interface
@@ -48,6 +64,32 @@ TREELITE_DLL int TreeliteAssembleSparseBatch(const float* data,
                                              const size_t* row_ptr,
                                              size_t num_row, size_t num_col,
                                              CSRBatchHandle* out);
+/*!
+ * \brief assemble a sparse batch whose arrays are of other types than those
+ *        taken by TreeliteAssembleSparseBatch(), such as a SciPy CSR matrix
+ *        holding float64 values and int32 indices. The arrays are read as
+ *        they are; values are converted to float as rows are laid out for
+ *        prediction.
+ * \param data feature values
+ * \param data_type type of feature values: "float32", "float64", "float16",
+ *                  "int32" or "int64"
+ * \param col_ind feature indices
+ * \param row_ptr pointer to row headers
+ * \param index_type type of both feature indices and row headers: "int32" or
+ *                   "int64"
+ * \param num_row number of data rows in the batch
+ * \param num_col number of columns (features) in the batch
+ * \param out handle to sparse batch
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreeliteAssembleSparseBatchTyped(const void* data,
+                                                  const char* data_type,
+                                                  const void* col_ind,
+                                                  const void* row_ptr,
+                                                  const char* index_type,
+                                                  size_t num_row,
+                                                  size_t num_col,
+                                                  CSRBatchHandle* out);
 /*!
  * \brief delete a sparse batch from memory
  * \param handle sparse batch
@@ -67,6 +109,55 @@ TREELITE_DLL int TreeliteAssembleDenseBatch(const float* data,
                                             float missing_value,
                                             size_t num_row, size_t num_col,
                                             DenseBatchHandle* out);
+/*!
+ * \brief assemble a dense batch whose rows and columns are any fixed distance
+ *        apart, so that column-major matrices and views of padded buffers
+ *        can be predicted without copying them first. The value in row i and
+ *        column j is taken from data[i * row_stride + j * col_stride]; for a
+ *        column-major matrix, set row_stride to 1 and col_stride to the
+ *        length of a column.
+ * \param data feature values
+ * \param missing_value value to represent the missing value
+ * \param num_row number of data rows in the batch
+ * \param num_col number of columns (features) in the batch
+ * \param row_stride distance between successive rows, in elements
+ * \param col_stride distance between successive columns, in elements
+ * \param out handle to dense batch
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreeliteAssembleDenseBatchStrided(const float* data,
+                                                   float missing_value,
+                                                   size_t num_row,
+                                                   size_t num_col,
+                                                   size_t row_stride,
+                                                   size_t col_stride,
+                                                   DenseBatchHandle* out);
+/*!
+ * \brief assemble a dense batch holding values of another type than float32,
+ *        such as a float64 NumPy array. The values are read as they are and
+ *        converted to float as rows are laid out for prediction, before being
+ *        compared with the missing value. Rows and columns may be any fixed
+ *        distance apart, as in TreeliteAssembleDenseBatchStrided(); if both
+ *        strides are zero, the batch is taken to be row-major and contiguous.
+ * \param data feature values
+ * \param data_type type of feature values: "float32", "float64", "float16",
+ *                  "int32" or "int64"
+ * \param missing_value value to represent the missing value
+ * \param num_row number of data rows in the batch
+ * \param num_col number of columns (features) in the batch
+ * \param row_stride distance between successive rows, in elements
+ * \param col_stride distance between successive columns, in elements
+ * \param out handle to dense batch
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreeliteAssembleDenseBatchTyped(const void* data,
+                                                 const char* data_type,
+                                                 float missing_value,
+                                                 size_t num_row,
+                                                 size_t num_col,
+                                                 size_t row_stride,
+                                                 size_t col_stride,
+                                                 DenseBatchHandle* out);
 /*!
  * \brief delete a dense batch from memory
  * \param handle dense batch
@@ -103,9 +194,304 @@ TREELITE_DLL int TreelitePredictorLoad(const char* library_path,
                                        int num_worker_thread,
                                        int include_master_thread,
                                        PredictorHandle* out);
+/*!
+ * \brief load prediction code from a dynamic shared library held in memory,
+ *        such as one received over the network. On Linux, the library is
+ *        loaded through an anonymous in-memory file, without touching the
+ *        disk; elsewhere it goes through a temporary file.
+ * \param buf content of the library file (.so/.dll/.dylib)
+ * \param len length of buf, in bytes
+ * \param num_worker_thread number of worker threads (-1 to use max number)
+ * \param include_master_thread whether to assign workload to the master
+ *                              thread
+ * \param out handle to predictor
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorLoadFromMemory(const void* buf, size_t len,
+                                                 int num_worker_thread,
+                                                 int include_master_thread,
+                                                 PredictorHandle* out);
+/*!
+ * \brief create a predictor without loading any prediction code yet, so
+ *        that it can be configured (see TreelitePredictorSetLoadOptions())
+ *        before TreelitePredictorLoadLibrary() starts the worker threads
+ * \param num_worker_thread number of worker threads (-1 to use max number)
+ * \param include_master_thread whether to assign workload to the master
+ *                              thread
+ * \param out handle to predictor
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorCreate(int num_worker_thread,
+                                         int include_master_thread,
+                                         PredictorHandle* out);
+/*!
+ * \brief load prediction code into a predictor made with
+ *        TreelitePredictorCreate() or TreelitePredictorCreateWithWorkerPool()
+ * \param handle predictor
+ * \param library_path path to library object file containing prediction code
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorLoadLibrary(PredictorHandle handle,
+                                              const char* library_path);
+/*!
+ * \brief load prediction code held in memory into a predictor made with
+ *        TreelitePredictorCreate() or TreelitePredictorCreateWithWorkerPool()
+ * \param handle predictor
+ * \param buf content of the library file (.so/.dll/.dylib)
+ * \param len length of buf, in bytes
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorLoadLibraryFromMemory(PredictorHandle handle,
+                                                        const void* buf,
+                                                        size_t len);
+/*!
+ * \brief set what to do when prediction code is loaded, so that the first
+ *        predictions afterwards are no slower than the rest. Applies to
+ *        libraries loaded afterwards, including by
+ *        TreelitePredictorReload(). The time taken by each phase of loading
+ *        is reported by TreelitePredictorGetStats().
+ * \param handle predictor
+ * \param bind_now whether to resolve all symbols of the library while
+ *                 loading it, instead of on first use
+ * \param prefault how to bring the library's code and data into memory (Linux
+ *                 only): "none" (fault pages in on first use; default),
+ *                 "touch" (read every page once) or "lock" (lock every page
+ *                 in memory; falls back to "touch" if not permitted)
+ * \param num_warmup_row number of synthetic rows each worker thread predicts
+ *                       after loading; 0 to skip the warm-up
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorSetLoadOptions(PredictorHandle handle,
+                                                 int bind_now,
+                                                 const char* prefault,
+                                                 size_t num_warmup_row);
+/*!
+ * \brief replace the loaded prediction code with another library, without
+ *        pausing predictions made from other threads. Predictions already in
+ *        progress finish with the old library, which is unloaded once they
+ *        are done. If the new library cannot be loaded, the old one stays in
+ *        place.
+ * \param handle predictor
+ * \param library_path path to library object file containing prediction
+ *                     code. The model must have the same number of features
+ *                     and output groups as the one loaded.
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorReload(PredictorHandle handle,
+                                         const char* library_path);
+/*!
+ * \brief set how the rows of a batch are divided among threads. Must not be
+ *        called while predictions are in progress.
+ * \param handle predictor
+ * \param policy name of scheduling policy: "static" (split rows evenly
+ *               before any work runs) or "work_stealing" (hand out rows in
+ *               chunks; idle threads steal chunks from busy ones)
+ * \param grain_size number of rows in each chunk for "work_stealing"
+ *                   (0 to choose automatically)
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorSetSchedulingPolicy(PredictorHandle handle,
+                                                      const char* policy,
+                                                      size_t grain_size);
+
+/*!
+ * \brief set how much work a batch must hold for each thread working on it.
+ *        A batch is given one thread per this many tree nodes it is
+ *        estimated to visit; a synchronous batch that gets only one thread
+ *        runs on the calling thread. Must not be called while predictions
+ *        are in progress.
+ * \param handle predictor
+ * \param min_work_per_thread number of tree nodes visited (20000 by
+ *                            default); 0 to always use every thread
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorSetMinWorkPerThread(
+    PredictorHandle handle, double min_work_per_thread);
+
+/*!
+ * \brief set how worker threads are placed on CPUs. The worker threads are
+ *        re-created; this must not be called while predictions are in
+ *        progress.
+ * \param handle predictor
+ * \param policy name of affinity policy: "none" (don't pin workers),
+ *               "compact" (pin workers to consecutive CPUs, leaving the
+ *               first CPU for the calling thread and any CPUs held by
+ *               other live pools), "scatter" (spread workers
+ *               evenly over NUMA nodes), "explicit" (pin workers to the CPUs
+ *               in cpu_list, in order), or "numa_local" (pin workers to the
+ *               CPUs of NUMA node numa_node)
+ * \param cpu_list list of CPU ids ("explicit" only; may be NULL otherwise)
+ * \param num_cpu length of cpu_list
+ * \param numa_node id of NUMA node ("numa_local" only); -1 to use the node
+ *                  on which the calling thread is running
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorSetAffinityPolicy(PredictorHandle handle,
+                                                   const char* policy,
+                                                   const int* cpu_list,
+                                                   size_t num_cpu,
+                                                   int numa_node);
+/*!
+ * \brief set how idle worker threads wait for new tasks, trading idle CPU
+ *        usage for the time it takes a worker to pick up a new task. If a
+ *        library has already been loaded, the worker threads are re-created;
+ *        this must not be done while predictions are in progress. A thread
+ *        waiting for a prediction to finish waits the same way.
+ * \param handle predictor
+ * \param strategy one of the following:
+ *                 "spin" (spin until a task arrives),
+ *                 "spin_then_sleep" (spin for a while, then sleep; default),
+ *                 "adaptive" (spin with backoff for longer or shorter
+ *                 depending on how soon tasks arrived before, then sleep), or
+ *                 "blocking" (sleep right away)
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorSetWaitStrategy(PredictorHandle handle,
+                                                 const char* strategy);
+/*!
+ * \brief get the time each worker thread has spent waiting for and running
+ *        tasks since it was created. Each output array must have room for
+ *        as many elements as there are worker threads; see
+ *        TreelitePredictorQueryNumWorkerThread().
+ * \param handle predictor
+ * \param out_spin_time time spent spinning, in seconds
+ * \param out_sleep_time time spent asleep, in seconds
+ * \param out_work_time time spent running tasks, in seconds
+ * \param out_num_task number of tasks run
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorGetWorkerStats(PredictorHandle handle,
+                                                double* out_spin_time,
+                                                double* out_sleep_time,
+                                                double* out_work_time,
+                                                size_t* out_num_task);
+/*!
+ * \brief set how many tasks can be queued up for each worker thread (256 by
+ *        default). Submitting a task to a worker whose queue is full blocks
+ *        until the worker catches up. If a library has already been loaded,
+ *        the worker threads are re-created; this must not be done while
+ *        predictions are in progress.
+ * \param handle predictor
+ * \param queue_depth number of tasks; rounded up to a power of two, and
+ *                    to at least 2
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorSetQueueDepth(PredictorHandle handle,
+                                               size_t queue_depth);
+/*!
+ * \brief get the statistics of batch predictions made since the library was
+ *        loaded or the statistics were last reset, as a JSON string. It
+ *        holds the elapsed time, number of batches and rows, rows per second,
+ *        summaries (count, mean, p50, p90, p99, p999, max; in seconds) of
+ *        the latency of a batch and of its queue wait, compute and reshape
+ *        stages, the busy and idle time of each worker thread, and the time
+ *        taken by each phase of loading the current library.
+ * \param handle predictor
+ * \param out_json JSON string; valid until the next call to this function
+ *                 from the same thread
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorGetStats(PredictorHandle handle,
+                                          const char** out_json);
+/*!
+ * \brief reset the statistics returned by TreelitePredictorGetStats()
+ * \param handle predictor
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorResetStats(PredictorHandle handle);
+/*!
+ * \brief write the statistics returned by TreelitePredictorGetStats() to a
+ *        file, in the Prometheus text exposition format. The file is
+ *        replaced atomically, so it can be read by the node exporter's
+ *        textfile collector at any time.
+ * \param handle predictor
+ * \param path path of the file
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorDumpStats(PredictorHandle handle,
+                                           const char* path);
+
+/*!
+ * \brief create a pool of worker threads that can be shared by many
+ *        predictors, so that a process serving many models needs only one
+ *        worker per core. The pool is freed once the handle and all
+ *        predictors using the pool have been freed.
+ * \param num_worker_thread number of worker threads (-1 to use max number)
+ * \param affinity_policy how worker threads are placed on CPUs; see
+ *                        TreelitePredictorSetAffinityPolicy()
+ * \param cpu_list list of CPU ids ("explicit" only; may be NULL otherwise)
+ * \param num_cpu length of cpu_list
+ * \param numa_node id of NUMA node ("numa_local" only); -1 to use the node
+ *                  on which the calling thread is running
+ * \param wait_strategy how idle worker threads wait for new tasks; see
+ *                      TreelitePredictorSetWaitStrategy()
+ * \param queue_depth number of tasks that can be queued up for each worker
+ *                    thread; see TreelitePredictorSetQueueDepth()
+ * \param out handle to worker pool
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreeliteWorkerPoolCreate(int num_worker_thread,
+                                         const char* affinity_policy,
+                                         const int* cpu_list,
+                                         size_t num_cpu,
+                                         int numa_node,
+                                         const char* wait_strategy,
+                                         size_t queue_depth,
+                                         WorkerPoolHandle* out);
+/*!
+ * \brief release a handle to a worker pool. Predictors using the pool keep
+ *        it alive until they are freed.
+ * \param handle worker pool
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreeliteWorkerPoolFree(WorkerPoolHandle handle);
+/*!
+ * \brief load prediction code into memory, like TreelitePredictorLoad(),
+ *        but run predictions on a shared pool of worker threads instead of
+ *        spawning new ones
+ * \param library_path path to library object file containing prediction code
+ * \param worker_pool pool created with TreeliteWorkerPoolCreate()
+ * \param include_master_thread whether to assign workload to the master
+ *                              thread
+ * \param out handle to predictor
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorLoadWithWorkerPool(
+    const char* library_path, WorkerPoolHandle worker_pool,
+    int include_master_thread, PredictorHandle* out);
+/*!
+ * \brief create a predictor without loading any prediction code yet, like
+ *        TreelitePredictorCreate(), but run predictions on a shared pool of
+ *        worker threads instead of spawning new ones
+ * \param worker_pool pool created with TreeliteWorkerPoolCreate()
+ * \param include_master_thread whether to assign workload to the master
+ *                              thread
+ * \param out handle to predictor
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorCreateWithWorkerPool(
+    WorkerPoolHandle worker_pool, int include_master_thread,
+    PredictorHandle* out);
+/*!
+ * \brief load prediction code from a library held in memory, like
+ *        TreelitePredictorLoadFromMemory(), but run predictions on a shared
+ *        pool of worker threads instead of spawning new ones
+ * \param buf content of the library file (.so/.dll/.dylib)
+ * \param len length of buf, in bytes
+ * \param worker_pool pool created with TreeliteWorkerPoolCreate()
+ * \param include_master_thread whether to assign workload to the master
+ *                              thread
+ * \param out handle to predictor
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorLoadFromMemoryWithWorkerPool(
+    const void* buf, size_t len, WorkerPoolHandle worker_pool,
+    int include_master_thread, PredictorHandle* out);
 /*!
  * \brief Make predictions on a batch of data rows (synchronously). This
  *        function internally divides the workload among all worker threads.
+ *        It may be called from multiple threads at the same time; the
+ *        worker threads are shared among all pending requests.
  * \param handle predictor
  * \param batch a batch of rows (must be of type SparseBatch or DenseBatch)
  * \param batch_sparse whether batch is sparse (1) or dense (0)
@@ -127,10 +513,169 @@ TREELITE_DLL int TreelitePredictorPredictBatch(PredictorHandle handle,
                                                int pred_margin,
                                                float* out_result,
                                                size_t* out_result_size);
+/*!
+ * \brief Start making predictions on a batch of data rows, without waiting
+ *        for them to finish. The workload is divided among all worker
+ *        threads; the calling thread is never assigned any work. The batch
+ *        and the output vector must stay valid until the prediction
+ *        finishes.
+ * \param handle predictor
+ * \param batch a batch of rows (must be of type SparseBatch or DenseBatch)
+ * \param batch_sparse whether batch is sparse (1) or dense (0)
+ * \param verbose whether to produce extra messages
+ * \param pred_margin whether to produce raw margin scores instead of
+ *                    transformed probabilities
+ * \param out_result resulting output vector; use
+ *                   TreelitePredictorQueryResultSize() to allocate sufficient
+ *                   space
+ * \param callback (optional) function to call from a worker thread once the
+ *                 prediction finishes; set to NULL if not needed. It must
+ *                 not call TreelitePredictorWait(). If the prediction
+ *                 failed, it is given an output length of 0.
+ * \param callback_data opaque pointer to pass to callback
+ * \param out used to save handle to the prediction in progress. The handle
+ *            must be released by calling TreelitePredictorWait() exactly
+ *            once, even if a callback is given.
+ * \return 0 for success, -1 for failure. Errors raised on worker threads
+ *         (e.g. a NaN entry in a dense batch whose missing_value is not NaN)
+ *         are reported by TreelitePredictorWait().
+ */
+TREELITE_DLL int TreelitePredictorPredictBatchAsync(
+    PredictorHandle handle, void* batch, int batch_sparse, int verbose,
+    int pred_margin, float* out_result, TreelitePredictCallback callback,
+    void* callback_data, AsyncPredictionHandle* out);
+/*!
+ * \brief Check whether an asynchronous prediction has finished, without
+ *        blocking
+ * \param handle predictor
+ * \param prediction handle returned by TreelitePredictorPredictBatchAsync()
+ * \param out_done used to save whether the prediction has finished (1) or
+ *                 not (0)
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorPoll(PredictorHandle handle,
+                                       AsyncPredictionHandle prediction,
+                                       int* out_done);
+/*!
+ * \brief Wait for an asynchronous prediction to finish, and release its
+ *        handle
+ * \param handle predictor
+ * \param prediction handle returned by TreelitePredictorPredictBatchAsync()
+ * \param out_result_size used to save length of the output vector,
+ *                        which is guaranteed to be less than or equal to
+ *                        TreelitePredictorQueryResultSize()
+ * \return 0 for success, -1 for failure, including when the prediction
+ *         failed. The handle is released either way.
+ */
+TREELITE_DLL int TreelitePredictorWait(PredictorHandle handle,
+                                       AsyncPredictionHandle prediction,
+                                       size_t* out_result_size);
+/*!
+ * \brief create a queue through which predictions submitted with
+ *        TreelitePredictorSubmitBatches() report that they have finished, in
+ *        the order in which they finish. It may only be used with the
+ *        predictor that created it.
+ * \param handle predictor
+ * \param out used to save handle to the completion queue
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorCreateCompletionQueue(
+    PredictorHandle handle, CompletionQueueHandle* out);
+/*!
+ * \brief free a completion queue, after waiting for all predictions
+ *        submitted to it that have not been reported yet
+ * \param handle predictor
+ * \param cq completion queue
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorFreeCompletionQueue(
+    PredictorHandle handle, CompletionQueueHandle cq);
+/*!
+ * \brief start making predictions on many batches at once, without waiting
+ *        for them to finish; meant for streams of small batches. Workers
+ *        move on to the next batch without a round trip to the caller. The
+ *        batches and output vectors must stay valid until the predictions
+ *        are reported by TreelitePredictorWaitNext() or
+ *        TreelitePredictorTryNext().
+ * \param handle predictor
+ * \param batches array of [num_batch] batches, all of the same type and
+ *                with arrays of the same types
+ * \param batch_sparse whether the batches are sparse (1) or dense (0)
+ * \param num_batch number of batches
+ * \param verbose whether to produce extra messages
+ * \param pred_margin whether to produce raw margin scores instead of
+ *                    transformed probabilities
+ * \param out_results array of [num_batch] output vectors, one per batch
+ * \param cq completion queue to report finished predictions to
+ * \param out_first_seq_id used to save the sequence id of the first batch;
+ *                         the i-th batch is given the sequence id
+ *                         (*out_first_seq_id + i)
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorSubmitBatches(
+    PredictorHandle handle, void* const* batches, int batch_sparse,
+    size_t num_batch, int verbose, int pred_margin, float* const* out_results,
+    CompletionQueueHandle cq, uint64_t* out_first_seq_id);
+/*!
+ * \brief wait until any prediction submitted to a completion queue
+ *        finishes, and report it. Each prediction is reported once. At least
+ *        one prediction must be pending.
+ * \param handle predictor
+ * \param cq completion queue
+ * \param out_seq_id used to save the sequence id of the prediction
+ * \param out_result_size used to save length of the output vector
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorWaitNext(PredictorHandle handle,
+                                           CompletionQueueHandle cq,
+                                           uint64_t* out_seq_id,
+                                           size_t* out_result_size);
+/*!
+ * \brief report a finished prediction from a completion queue, if any,
+ *        without blocking
+ * \param handle predictor
+ * \param cq completion queue
+ * \param out_found used to save whether a prediction was reported (1) or
+ *                  not (0)
+ * \param out_seq_id used to save the sequence id of the prediction
+ * \param out_result_size used to save length of the output vector
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorTryNext(PredictorHandle handle,
+                                          CompletionQueueHandle cq,
+                                          int* out_found,
+                                          uint64_t* out_seq_id,
+                                          size_t* out_result_size);
+
+/*!
+ * \brief make predictions for all rows of a data file and write them to
+ *        another file, one line per row with comma-separated outputs. The
+ *        data file is parsed one chunk at a time, while the previous chunk
+ *        is being predicted by the worker threads, so that memory use stays
+ *        bounded no matter how large the file is.
+ * \param handle predictor
+ * \param input_uri location of the data file; may carry parser arguments,
+ *                  e.g. "data.csv?label_column=0"
+ * \param format format of the data file ("libsvm", "csv" or "libfm")
+ * \param output_uri location of the file to write predictions to
+ * \param pred_margin whether to produce raw margin scores instead of
+ *                    transformed probabilities
+ * \param verbose whether to produce extra messages
+ * \param out_num_row used to save the number of rows predicted
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorPredictFile(PredictorHandle handle,
+                                             const char* input_uri,
+                                             const char* format,
+                                             const char* output_uri,
+                                             int pred_margin,
+                                             int verbose,
+                                             size_t* out_num_row);
 
 /*!
  * \brief Make predictions on a single data row (synchronously). The work
- *        will be scheduled to the calling thread.
+ *        will be scheduled to the calling thread, unless coalescing is
+ *        turned on; see TreelitePredictorSetCoalescing().
  * \param handle predictor
  * \param inst single data row
  * \param pred_margin whether to produce raw margin scores instead of
@@ -146,6 +691,39 @@ TREELITE_DLL int TreelitePredictorPredictInst(PredictorHandle handle,
                                               int pred_margin, float* out_result,
                                               size_t* out_result_size);
 
+/*!
+ * \brief merge single-row predictions requested from many threads at the
+ *        same time into small batches, which go through the batch
+ *        prediction path. The first row of a batch waits until either
+ *        max_batch_size rows have arrived or max_delay_us microseconds have
+ *        passed. This must not be done while predictions are in progress.
+ * \param handle predictor
+ * \param max_batch_size maximum number of rows in a batch; 0 or 1 to turn
+ *                       coalescing off (default)
+ * \param max_delay_us maximum time, in microseconds, a row waits for other
+ *                     rows to arrive
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorSetCoalescing(PredictorHandle handle,
+                                               size_t max_batch_size,
+                                               uint32_t max_delay_us);
+/*!
+ * \brief get the number of rows and batches predicted by
+ *        TreelitePredictorPredictInst() since coalescing was turned on
+ * \param handle predictor
+ * \param out_num_request used to save the number of rows requested
+ * \param out_num_batch used to save the number of batches the rows were
+ *                      merged into
+ * \param out_num_full_batch used to save the number of batches closed for
+ *                           reaching the maximum size
+ * \param out_coalescing_ratio used to save the average number of rows per
+ *                             batch
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorGetCoalescingStats(
+    PredictorHandle handle, size_t* out_num_request, size_t* out_num_batch,
+    size_t* out_num_full_batch, double* out_coalescing_ratio);
+
 /*!
  * \brief Given a batch of data rows, query the necessary size of array to
  *        hold predictions for all data points.
@@ -189,7 +767,36 @@ TREELITE_DLL int TreelitePredictorQueryNumOutputGroup(PredictorHandle handle,
 TREELITE_DLL int TreelitePredictorQueryNumFeature(PredictorHandle handle,
                                                   size_t* out);
 /*!
- * \brief delete predictor from memory
+ * \brief get the number of worker threads the predictor runs its work on
+ * \param handle predictor
+ * \param out number of worker threads
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorQueryNumWorkerThread(PredictorHandle handle,
+                                                       size_t* out);
+/*!
+ * \brief get the CPU each worker thread is pinned to, as decided by the
+ *        affinity policy
+ * \param handle predictor
+ * \param out CPU of each worker thread, -1 for a worker that is not pinned.
+ *            Must have as many elements as the number of worker threads given
+ *            by TreelitePredictorQueryNumWorkerThread().
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorQueryWorkerCPUs(PredictorHandle handle,
+                                                  int* out);
+/*!
+ * \brief get the version of the library new predictions go to. It is 1 after
+ *        the predictor is loaded and goes up by one with every reload.
+ * \param handle predictor
+ * \param out model version
+ * \return 0 for success, -1 for failure
+ */
+TREELITE_DLL int TreelitePredictorQueryModelVersion(PredictorHandle handle,
+                                                    uint64_t* out);
+/*!
+ * \brief delete predictor from memory. All asynchronous predictions must have
+ *        been released with TreelitePredictorWait() beforehand.
  * \param handle predictor to remove
  * \return 0 for success, -1 for failure
  */
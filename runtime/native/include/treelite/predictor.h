@@ -10,41 +10,101 @@
 #include <dmlc/logging.h>
 #include <treelite/entry.h>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace treelite {
 
-namespace common {
-namespace filesystem {
-class TemporaryDirectory;  // forward declaration
-}
-}
+class WorkerPool;  // forward declaration
+class CompletionQueue;  // forward declaration
+class StatsCollector;  // forward declaration
+class Coalescer;  // forward declaration
+class LoadedLibrary;  // forward declaration
 
-/*! \brief sparse batch in Compressed Sparse Row (CSR) format */
-struct CSRBatch {
+/*!
+ * \brief half-precision (IEEE 754 binary16) value, such as an element of a
+ *        numpy.float16 array. Only the bits are stored; they are converted to
+ *        float as rows are laid out for the prediction function.
+ */
+struct Float16 {
+  uint16_t bits;
+};
+
+/*!
+ * \brief sparse batch in Compressed Sparse Row (CSR) format. Feature values
+ *        may be of type float, double, Float16, int32_t or int64_t; they are
+ *        converted to float as rows are laid out, so no converted copy of the
+ *        batch is ever made. Column indices and row pointers may be uint32_t
+ *        and size_t respectively (as in CSRBatch), or both int32_t or both
+ *        int64_t, as found in SciPy. Column indices outside [0, num_col) are
+ *        ignored.
+ */
+template <typename ElementType, typename IndexType, typename OffsetType>
+struct CSRBatchT {
   /*! \brief feature values */
-  const float* data;
+  const ElementType* data;
   /*! \brief feature indices */
-  const uint32_t* col_ind;
+  const IndexType* col_ind;
   /*! \brief pointer to row headers; length of [num_row] + 1 */
-  const size_t* row_ptr;
+  const OffsetType* row_ptr;
   /*! \brief number of rows */
   size_t num_row;
   /*! \brief number of columns (i.e. # of features used) */
   size_t num_col;
 };
 
-/*! \brief dense batch */
-struct DenseBatch {
+/*! \brief sparse batch with float values */
+typedef CSRBatchT<float, uint32_t, size_t> CSRBatch;
+
+/*!
+ * \brief dense batch. The value in row i and column j is found at
+ *        data[i * row_stride + j * col_stride]. If both strides are left at
+ *        zero, the batch is taken to be row-major and contiguous (row_stride
+ *        = num_col, col_stride = 1), so that batches written as
+ *        DenseBatch{data, missing_value, num_row, num_col} keep working.
+ *        Values may be of type float, double, Float16, int32_t or int64_t;
+ *        they are converted to float as rows are laid out, before being
+ *        compared with [missing_value].
+ */
+template <typename ElementType>
+struct DenseBatchT {
   /*! \brief feature values */
-  const float* data;
+  const ElementType* data;
   /*! \brief value representing the missing value (usually nan) */
   float missing_value;
   /*! \brief number of rows */
   size_t num_row;
   /*! \brief number of columns (i.e. # of features used) */
   size_t num_col;
+  /*! \brief distance between successive rows, in elements */
+  size_t row_stride;
+  /*! \brief distance between successive columns, in elements */
+  size_t col_stride;
+
+  /*! \brief describe a row-major matrix whose rows are [row_stride]
+   *         elements apart, such as a view of a padded buffer */
+  static inline DenseBatchT RowMajor(const ElementType* data,
+                                     float missing_value,
+                                     size_t num_row, size_t num_col,
+                                     size_t row_stride) {
+    return DenseBatchT{data, missing_value, num_row, num_col, row_stride, 1};
+  }
+  /*! \brief describe a column-major matrix whose columns are [col_stride]
+   *         elements apart, such as a data frame stored column by column */
+  static inline DenseBatchT ColumnMajor(const ElementType* data,
+                                        float missing_value,
+                                        size_t num_row, size_t num_col,
+                                        size_t col_stride) {
+    return DenseBatchT{data, missing_value, num_row, num_col, 1, col_stride};
+  }
 };
 
+/*! \brief dense batch with float values */
+typedef DenseBatchT<float> DenseBatch;
+
 /*! \brief predictor class: wrapper for optimized prediction code */
 class Predictor {
  public:
@@ -52,24 +112,356 @@ class Predictor {
   typedef void* QueryFuncHandle;
   typedef void* PredFuncHandle;
   typedef void* LibraryHandle;
-  typedef void* ThreadPoolHandle;
+  typedef void* AsyncHandle;
+  typedef void* CompletionQueueHandle;
+  /*!
+   * \brief function to be called from a worker thread when an asynchronous
+   *        prediction finishes; the argument is the length of the output
+   *        vector
+   */
+  typedef std::function<void(size_t)> PredictCallback;
+
+  /*! \brief how the rows of a batch are divided among threads */
+  enum class SchedulingPolicy : int {
+    /*! \brief split rows evenly among threads before any work runs */
+    kStatic = 0,
+    /*! \brief hand out rows in small chunks; idle threads steal chunks
+               from busy ones */
+    kWorkStealing = 1
+  };
+
+  /*! \brief how worker threads are placed on CPUs */
+  enum class AffinityPolicy : int {
+    /*! \brief don't pin worker threads; let the OS place them */
+    kNone = 0,
+    /*! \brief pin workers to consecutive CPUs, leaving the first CPU for
+               the calling thread. Pools that are alive at the same time
+               get separate CPUs until all CPUs have been given out; the
+               CPUs of a pool are freed once it is destroyed. */
+    kCompact = 1,
+    /*! \brief spread workers evenly over NUMA nodes, and over the CPUs of
+               each node */
+    kScatter = 2,
+    /*! \brief pin workers to a list of CPUs given by the user */
+    kExplicit = 3,
+    /*! \brief pin workers to consecutive CPUs of a single NUMA node */
+    kNUMALocal = 4
+  };
+
+  /*!
+   * \brief how idle worker threads wait for new tasks. A thread waiting for
+   *        a prediction to finish waits the same way.
+   */
+  enum class WaitStrategy : int {
+    /*! \brief spin until a task arrives. Picks up tasks the fastest, but
+               idle workers keep their cores fully busy. */
+    kSpin = 0,
+    /*! \brief spin for a fixed while, then sleep until woken up */
+    kSpinThenSleep = 1,
+    /*! \brief spin with exponential backoff, for longer or shorter
+               depending on how soon tasks arrived in the past, then sleep */
+    kAdaptive = 2,
+    /*! \brief sleep right away. Idle workers use no CPU, but are slower to
+               pick up new tasks. */
+    kBlocking = 3
+  };
+
+  /*! \brief how the pages of a library are brought into memory on loading */
+  enum class PrefaultMode : int {
+    /*! \brief leave pages to be faulted in by the first predictions */
+    kNone = 0,
+    /*! \brief read every page of the library's code and data once */
+    kTouch = 1,
+    /*! \brief lock every page of the library's code and data in memory
+               with mlock(), so that it is never paged out. Falls back to
+               kTouch if the process isn't allowed to lock that much. */
+    kLock = 2
+  };
+
+  /*!
+   * \brief what to do when a library is loaded, so that the first
+   *        predictions after loading are no slower than the rest
+   */
+  struct LoadOptions {
+    /*! \brief resolve all symbols of the library while loading it, instead
+     *         of on first use (RTLD_NOW) */
+    bool bind_now;
+    /*! \brief how to bring the library's code and data into memory (Linux
+     *         only; ignored elsewhere) */
+    PrefaultMode prefault;
+    /*! \brief number of synthetic rows each worker thread predicts after
+     *         loading; 0 to skip the warm-up */
+    size_t num_warmup_row;
+  };
+
+  /*! \brief time taken by each phase of loading a library, in seconds */
+  struct LoadStats {
+    /*! \brief reading and loading the library, and looking up its functions */
+    double open_time;
+    /*! \brief faulting in or locking the library's pages */
+    double prefault_time;
+    /*! \brief starting the worker threads, if needed, and allocating their
+     *         scratch memory */
+    double worker_init_time;
+    /*! \brief predicting synthetic rows on every worker */
+    double warmup_time;
+    /*! \brief whole load, from start to finish */
+    double total_time;
+    /*! \brief number of bytes of the library faulted in or locked */
+    size_t prefault_bytes;
+    /*! \brief whether the pages were locked in memory */
+    bool locked;
+  };
+
+  /*! \brief notice of a finished prediction, from a completion queue */
+  struct Completion {
+    /*! \brief sequence id given to the batch when it was submitted */
+    uint64_t seq_id;
+    /*! \brief length of the output vector of the batch */
+    size_t result_size;
+  };
+
+  /*! \brief time a worker thread has spent in each state, in seconds */
+  struct WorkerStats {
+    /*! \brief time spent spinning while waiting for a task */
+    double spin_time;
+    /*! \brief time spent asleep while waiting for a task */
+    double sleep_time;
+    /*! \brief time spent running tasks */
+    double work_time;
+    /*! \brief number of tasks run */
+    size_t num_task;
+  };
+
+  /*! \brief statistics of single-row predictions merged into batches */
+  struct CoalescingStats {
+    /*! \brief number of rows requested with PredictInst() */
+    size_t num_request;
+    /*! \brief number of batches the rows were merged into */
+    size_t num_batch;
+    /*! \brief number of batches closed for reaching the maximum size, as
+     *         opposed to reaching the deadline */
+    size_t num_full_batch;
+    /*! \brief average number of rows per batch */
+    double coalescing_ratio;
+  };
+
+  /*! \brief summary of a distribution of durations, in seconds */
+  struct LatencySummary {
+    /*! \brief number of durations recorded */
+    size_t count;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+  };
+
+  /*! \brief statistics of batch predictions since the last reset */
+  struct Stats {
+    /*! \brief version of the library new predictions go to; see
+     *         QueryModelVersion() */
+    uint64_t model_version;
+    /*! \brief seconds elapsed since the last reset */
+    double elapsed_time;
+    /*! \brief number of batches predicted */
+    size_t num_batch;
+    /*! \brief number of rows predicted */
+    size_t num_row;
+    /*! \brief num_row / elapsed_time */
+    double rows_per_sec;
+    /*! \brief time from submitting a batch until its results are ready */
+    LatencySummary latency;
+    /*! \brief time a batch waits in the worker queues before the last of
+     *         its threads gets to it */
+    LatencySummary queue_wait;
+    /*! \brief longest time any thread spends on its share of a batch */
+    LatencySummary compute;
+    /*! \brief time spent compacting the output of a batch */
+    LatencySummary reshape;
+    /*! \brief time each worker thread has spent in each state */
+    std::vector<WorkerStats> worker;
+    /*! \brief how long it took to load the current library */
+    LoadStats load;
+  };
 
   Predictor(int num_worker_thread = -1,
             bool include_master_thread = false);
+  /*!
+   * \brief create a predictor that runs its work on a pool of worker threads
+   *        shared with other predictors, instead of spawning its own
+   * \param worker_pool pool created with CreateWorkerPool()
+   * \param include_master_thread whether to assign work to the calling thread
+   */
+  explicit Predictor(std::shared_ptr<WorkerPool> worker_pool,
+                     bool include_master_thread = false);
   ~Predictor();
   /*!
-   * \brief load the prediction function from dynamic shared library.
+   * \brief load the prediction function from dynamic shared library. See
+   *        SetLoadOptions() for ways to make the first predictions faster.
    * \param name name of dynamic shared library (.so/.dll/.dylib).
    */
   void Load(const char* name);
   /*!
-   * \brief unload the prediction function
+   * \brief load the prediction function from a dynamic shared library held
+   *        in memory, such as one received over the network. On Linux, the
+   *        library is loaded through an anonymous in-memory file, without
+   *        touching the disk; elsewhere it goes through a temporary file.
+   *        Libraries at remote locations given to Load() are loaded the same
+   *        way.
+   * \param buf content of the library file (.so/.dll/.dylib)
+   * \param len length of buf, in bytes
+   */
+  void LoadFromMemory(const void* buf, size_t len);
+  /*!
+   * \brief replace the loaded library with another one, without pausing
+   *        predictions. The new library is loaded, checked and warmed up
+   *        (each worker allocates its scratch memory and predicts a few
+   *        rows; see also SetLoadOptions()) while other threads keep
+   *        predicting with the old library. Predictions started afterwards
+   *        use the new library; those already in progress finish with the
+   *        old one, which is unloaded once the last of them is done. If
+   *        anything goes wrong, the old library stays in place. Only one
+   *        reload runs at a time.
+   * \param name name of dynamic shared library (.so/.dll/.dylib). The model
+   *             must have the same number of features and output groups as
+   *             the one loaded, so that output vectors allocated for the old
+   *             model fit the new one.
+   */
+  void Reload(const char* name);
+  /*!
+   * \brief set what to do when a library is loaded. Applies to libraries
+   *        loaded afterwards by Load(), LoadFromMemory() and Reload(). By
+   *        default, symbols are bound lazily, pages are faulted in on first
+   *        use, and there is no warm-up. The time taken by each phase of
+   *        loading is reported by GetStats(). Settings that re-create the
+   *        worker threads are best made before Load(), since new threads
+   *        aren't warmed up again.
+   * \param options load options
+   */
+  void SetLoadOptions(const LoadOptions& options);
+  /*!
+   * \brief unload the prediction function. All asynchronous predictions must
+   *        have been released with Wait() beforehand.
    */
   void Free();
+  /*!
+   * \brief set how rows of a batch are divided among threads. Must not be
+   *        called while predictions are in progress.
+   * \param policy scheduling policy
+   * \param grain_size number of rows in each chunk handed out to a thread
+   *                   (kWorkStealing only). Set it to 0 to choose a grain
+   *                   size automatically for each batch.
+   */
+  void SetSchedulingPolicy(SchedulingPolicy policy, size_t grain_size = 0);
+  /*!
+   * \brief set how much work a batch must hold for each thread working on
+   *        it. A batch is given one thread per this many tree nodes it is
+   *        estimated to visit, up to the number of threads available; a
+   *        synchronous batch that gets only one thread runs on the calling
+   *        thread. Must not be called while predictions are in progress.
+   * \param min_work_per_thread number of tree nodes visited (20000 by
+   *                            default). Set it to 0 to always use every
+   *                            thread available.
+   */
+  void SetMinWorkPerThread(double min_work_per_thread);
+  /*!
+   * \brief set how worker threads are placed on CPUs. Only the CPUs that
+   *        this process is allowed to run on are used. Each worker allocates
+   *        its own scratch memory after being placed, so that the memory is
+   *        local to the worker's NUMA node. If a library has already been
+   *        loaded, the worker threads are re-created; this must not be done
+   *        while predictions are in progress. Not applicable to predictors
+   *        using a shared worker pool; set the policy in CreateWorkerPool()
+   *        instead.
+   * \param policy affinity policy; kCompact by default
+   * \param cpu_list list of CPUs to pin workers to, in order (kExplicit only)
+   * \param numa_node NUMA node whose CPUs to use (kNUMALocal only); -1 to use
+   *                  the node on which the calling thread is running
+   */
+  void SetAffinityPolicy(AffinityPolicy policy,
+                         const std::vector<int>& cpu_list = {},
+                         int numa_node = -1);
+  /*!
+   * \brief set how idle worker threads wait for new tasks. If a library has
+   *        already been loaded, the worker threads are re-created; this must
+   *        not be done while predictions are in progress. Not applicable to
+   *        predictors using a shared worker pool; set the strategy in
+   *        CreateWorkerPool() instead.
+   * \param strategy wait strategy; kSpinThenSleep by default
+   */
+  void SetWaitStrategy(WaitStrategy strategy);
+  /*!
+   * \brief get the time each worker thread has spent spinning, sleeping and
+   *        working since it was created. For a shared worker pool, the work
+   *        of all predictors using the pool is counted.
+   * \return statistics of each worker thread
+   */
+  std::vector<WorkerStats> GetWorkerStats() const;
+  /*!
+   * \brief get the statistics of batch predictions made since the library
+   *        was loaded or the statistics were last reset. Quantiles are
+   *        accurate to within about 6%. For a shared worker pool, the worker
+   *        statistics include the work of all predictors using the pool.
+   * \return statistics
+   */
+  Stats GetStats() const;
+  /*! \brief reset the statistics returned by GetStats() */
+  void ResetStats();
+  /*!
+   * \brief write the statistics to a file in the Prometheus text exposition
+   *        format, to be picked up by the node exporter's textfile
+   *        collector. The file is replaced atomically.
+   * \param path path of the file
+   */
+  void DumpStats(const std::string& path) const;
+  /*!
+   * \brief set how many tasks can be queued up for each worker thread. A
+   *        caller submitting a task to a worker whose queue is full blocks
+   *        until the worker catches up. If a library has already been
+   *        loaded, the worker threads are re-created; this must not be done
+   *        while predictions are in progress. Not applicable to predictors
+   *        using a shared worker pool; set the depth in CreateWorkerPool()
+   *        instead.
+   * \param queue_depth number of tasks; rounded up to a power of two, and
+   *                    to at least 2
+   */
+  void SetQueueDepth(size_t queue_depth);
+  /*!
+   * \brief create a pool of worker threads that can be shared by many
+   *        predictors, so that a process serving many models needs only one
+   *        worker per core. The pool lives as long as anyone holds a
+   *        reference to it. Each predictor gets its tasks run first-come,
+   *        first-served, and successive batches are spread over all
+   *        workers. A worker that has tasks waiting won't take on more rows
+   *        of the batch it is working on than it was originally given.
+   * \param num_worker_thread number of worker threads (-1 to use as many as
+   *                          there are hardware threads)
+   * \param policy how worker threads are placed on CPUs
+   * \param cpu_list list of CPUs to pin workers to (kExplicit only)
+   * \param numa_node NUMA node whose CPUs to use (kNUMALocal only)
+   * \param wait_strategy how idle worker threads wait for new tasks
+   * \param queue_depth number of tasks that can be queued up for each
+   *                    worker thread
+   * \return the pool, to be passed to the constructor of Predictor
+   */
+  static std::shared_ptr<WorkerPool> CreateWorkerPool(
+      int num_worker_thread = -1,
+      AffinityPolicy policy = AffinityPolicy::kCompact,
+      const std::vector<int>& cpu_list = {}, int numa_node = -1,
+      WaitStrategy wait_strategy = WaitStrategy::kSpinThenSleep,
+      size_t queue_depth = 256);
 
   /*!
    * \brief Make predictions on a batch of data rows (synchronously). This
-   *        function internally divides the workload among all worker threads.
+   *        function internally divides the workload among worker threads,
+   *        using only as many threads as the size of the batch justifies;
+   *        small batches are processed on the calling thread alone.
+   *        It is safe to call from multiple threads at the same time; the
+   *        worker threads are shared among all pending requests.
+   *        BatchType is one of the CSRBatchT or DenseBatchT types described
+   *        above; the same goes for the other functions taking batches.
    * \param batch a batch of rows
    * \param verbose whether to produce extra messages
    * \param pred_margin whether to produce raw margin scores instead of
@@ -79,13 +471,124 @@ class Predictor {
    * \return length of the output vector, which is guaranteed to be less than
    *         or equal to QueryResultSize()
    */
-  size_t PredictBatch(const CSRBatch* batch, int verbose,
-                      bool pred_margin, float* out_result);
-  size_t PredictBatch(const DenseBatch* batch, int verbose,
+  template <typename BatchType>
+  size_t PredictBatch(const BatchType* batch, int verbose,
                       bool pred_margin, float* out_result);
+  /*!
+   * \brief Start making predictions on a batch of data rows, without waiting
+   *        for them to finish. The work is divided among worker threads, as
+   *        many as the size of the batch justifies; the calling thread is
+   *        never assigned any work, even if include_master_thread is set.
+   *        The batch and the output vector must stay valid until the
+   *        prediction finishes.
+   * \param batch a batch of rows
+   * \param verbose whether to produce extra messages
+   * \param pred_margin whether to produce raw margin scores instead of
+   *                    transformed probabilities
+   * \param out_result resulting output vector; use
+   *                   QueryResultSize() to allocate sufficient space
+   * \param callback (optional) function to call from a worker thread once
+   *                 the prediction finishes. It must not call Wait(). If the
+   *                 prediction failed, it is given an output length of 0.
+   * \return handle to the prediction in progress. It must be released by
+   *         calling Wait() exactly once, even if a callback is given. An
+   *         error raised on a worker thread (e.g. a NaN entry in a dense
+   *         batch whose missing_value is not NaN) is thrown again by Wait().
+   */
+  template <typename BatchType>
+  AsyncHandle PredictBatchAsync(const BatchType* batch, int verbose,
+                                bool pred_margin, float* out_result,
+                                PredictCallback callback = nullptr);
+  /*!
+   * \brief Check whether an asynchronous prediction has finished, without
+   *        blocking
+   * \param handle handle returned by PredictBatchAsync()
+   * \return whether the prediction has finished
+   */
+  bool Poll(AsyncHandle handle) const;
+  /*!
+   * \brief Wait for an asynchronous prediction to finish, and release the
+   *        handle. If the prediction failed, the handle is released and the
+   *        first error raised while predicting is thrown.
+   * \param handle handle returned by PredictBatchAsync()
+   * \return length of the output vector, which is guaranteed to be less than
+   *         or equal to QueryResultSize()
+   */
+  size_t Wait(AsyncHandle handle);
+  /*!
+   * \brief Create a queue through which predictions submitted with
+   *        SubmitBatches() report that they have finished, in the order in
+   *        which they finish. It may only be used with this predictor.
+   * \return handle to the completion queue
+   */
+  CompletionQueueHandle CreateCompletionQueue();
+  /*!
+   * \brief Free a completion queue, after waiting for all predictions
+   *        submitted to it that have not been reported by WaitNext() or
+   *        TryNext()
+   * \param cq completion queue
+   */
+  void FreeCompletionQueue(CompletionQueueHandle cq);
+  /*!
+   * \brief Start making predictions on many batches at once, without waiting
+   *        for them to finish; meant for streams of small batches. Each batch
+   *        is divided among worker threads as in PredictBatchAsync(), and
+   *        batches are spread over the workers, so that the workers can move
+   *        on to the next batch without a round trip to the caller. The
+   *        batches and the output vectors must stay valid until the
+   *        predictions are reported by the completion queue.
+   * \param batches array of [num_batch] batches
+   * \param num_batch number of batches
+   * \param verbose whether to produce extra messages
+   * \param pred_margin whether to produce raw margin scores instead of
+   *                    transformed probabilities
+   * \param out_results array of [num_batch] output vectors, one per batch
+   * \param cq completion queue to report finished predictions to
+   * \return sequence id of the first batch; the i-th batch is given the
+   *         sequence id (return value + i)
+   */
+  template <typename BatchType>
+  uint64_t SubmitBatches(const BatchType* const* batches, size_t num_batch,
+                         int verbose, bool pred_margin,
+                         float* const* out_results, CompletionQueueHandle cq);
+  /*!
+   * \brief Wait until any prediction submitted to a completion queue
+   *        finishes, and report it. Each prediction is reported once. At
+   *        least one prediction must be pending.
+   * \param cq completion queue
+   * \return sequence id and output length of the prediction
+   */
+  Completion WaitNext(CompletionQueueHandle cq);
+  /*!
+   * \brief Report a finished prediction from a completion queue, if any,
+   *        without blocking
+   * \param cq completion queue
+   * \param out_completion sequence id and output length of the prediction
+   * \return whether a finished prediction was reported
+   */
+  bool TryNext(CompletionQueueHandle cq, Completion* out_completion);
+  /*!
+   * \brief Make predictions for all rows of a data file and write them to
+   *        another file, one line per row with comma-separated outputs. The
+   *        file is read one chunk at a time; each chunk is predicted on the
+   *        worker threads while the calling thread parses the next chunk,
+   *        so that memory use stays bounded no matter how large the file is.
+   * \param input_uri location of the data file; any URI accepted by
+   *                  dmlc::Parser, including arguments such as
+   *                  "data.csv?label_column=0"
+   * \param format format of the data file ("libsvm", "csv" or "libfm")
+   * \param output_uri location of the file to write predictions to
+   * \param pred_margin whether to produce raw margin scores instead of
+   *                    transformed probabilities
+   * \param verbose whether to produce extra messages
+   * \return number of rows predicted
+   */
+  size_t PredictFile(const char* input_uri, const char* format,
+                     const char* output_uri, bool pred_margin, int verbose);
   /*!
    * \brief Make predictions on a single data row (synchronously). The work
-   *        will be scheduled to the calling thread.
+   *        will be scheduled to the calling thread, unless coalescing is
+   *        turned on with SetCoalescing().
    * \param inst single data row
    * \param pred_margin whether to produce raw margin scores instead of
    *                    transformed probabilities
@@ -96,43 +599,40 @@ class Predictor {
    */
   size_t PredictInst(TreelitePredictorEntry* inst, bool pred_margin,
                      float* out_result);
-
   /*!
-   * \brief Given a batch of data rows, query the necessary size of array to
-   *        hold predictions for all data points.
-   * \param batch a batch of rows
-   * \return length of prediction array
+   * \brief Merge single-row predictions requested from many threads at the
+   *        same time into small batches, which go through the batch
+   *        prediction path. The first row of a batch waits until either
+   *        [max_batch_size] rows have arrived or [max_delay_us] microseconds
+   *        have passed; each caller of PredictInst() then receives its own
+   *        result. Must not be called while predictions are in progress.
+   *        While coalescing is on, PredictInst() rejects rows with a
+   *        present entry holding NaN, since the batch marks missing values
+   *        with NaN.
+   * \param max_batch_size maximum number of rows in a batch; 0 or 1 to
+   *                       turn coalescing off (default)
+   * \param max_delay_us maximum time, in microseconds, a row waits for
+   *                     other rows to arrive
    */
-  inline size_t QueryResultSize(const CSRBatch* batch) const {
-    CHECK(pred_func_handle_ != nullptr)
-      << "A shared library needs to be loaded first using Load()";
-    return batch->num_row * num_output_group_;
-  }
+  void SetCoalescing(size_t max_batch_size, uint32_t max_delay_us);
   /*!
-   * \brief Given a batch of data rows, query the necessary size of array to
-   *        hold predictions for all data points.
-   * \param batch a batch of rows
-   * \return length of prediction array
+   * \brief get the number of rows and batches predicted by PredictInst()
+   *        since coalescing was turned on
+   * \return statistics
    */
-  inline size_t QueryResultSize(const DenseBatch* batch) const {
-    CHECK(pred_func_handle_ != nullptr)
-      << "A shared library needs to be loaded first using Load()";
-    return batch->num_row * num_output_group_;
-  }
+  CoalescingStats GetCoalescingStats() const;
+
   /*!
    * \brief Given a batch of data rows, query the necessary size of array to
    *        hold predictions for all data points.
    * \param batch a batch of rows
-   * \param rbegin beginning of range of rows
-   * \param rend end of range of rows
    * \return length of prediction array
    */
-  inline size_t QueryResultSize(const CSRBatch* batch,
-                                size_t rbegin, size_t rend) const {
-    CHECK(pred_func_handle_ != nullptr)
+  template <typename BatchType>
+  inline size_t QueryResultSize(const BatchType* batch) const {
+    CHECK(loaded_)
       << "A shared library needs to be loaded first using Load()";
-    CHECK(rbegin < rend && rend <= batch->num_row);
-    return (rend - rbegin) * num_output_group_;
+    return batch->num_row * num_output_group_;
   }
   /*!
    * \brief Given a batch of data rows, query the necessary size of array to
@@ -142,9 +642,10 @@ class Predictor {
    * \param rend end of range of rows
    * \return length of prediction array
    */
-  inline size_t QueryResultSize(const DenseBatch* batch,
+  template <typename BatchType>
+  inline size_t QueryResultSize(const BatchType* batch,
                                 size_t rbegin, size_t rend) const {
-    CHECK(pred_func_handle_ != nullptr)
+    CHECK(loaded_)
       << "A shared library needs to be loaded first using Load()";
     CHECK(rbegin < rend && rend <= batch->num_row);
     return (rend - rbegin) * num_output_group_;
@@ -155,7 +656,7 @@ class Predictor {
    * \return length of prediction array
    */
   inline size_t QueryResultSizeSingleInst() const {
-    CHECK(pred_func_handle_ != nullptr)
+    CHECK(loaded_)
       << "A shared library needs to be loaded first using Load()";
     return num_output_group_;
   }
@@ -178,25 +679,100 @@ class Predictor {
     return num_feature_;
   }
 
+  /*!
+   * \brief Get the version of the library new predictions go to. It is 1
+   *        after the first Load() and goes up by one every time a library is
+   *        loaded or reloaded.
+   * \return model version
+   */
+  uint64_t QueryModelVersion() const;
+
+  /*!
+   * \brief Get the number of worker threads the predictor runs its work on
+   * \return number of worker threads
+   */
+  inline int QueryNumWorkerThread() const {
+    CHECK(loaded_)
+      << "A shared library needs to be loaded first using Load()";
+    return num_worker_thread_;
+  }
+
+  /*!
+   * \brief Get the CPU each worker thread is pinned to, as decided by the
+   *        affinity policy
+   * \return CPU of each worker thread; -1 for a worker that is not pinned
+   */
+  std::vector<int> QueryWorkerCPUs() const;
+
  private:
-  LibraryHandle lib_handle_;
-  QueryFuncHandle num_output_group_query_func_handle_;
-  QueryFuncHandle num_feature_query_func_handle_;
-  PredFuncHandle pred_func_handle_;
-  ThreadPoolHandle thread_pool_handle_;
+  // library new predictions go to, along with its scratch buffers. It is
+  // swapped atomically by Reload(); every prediction holds a reference to
+  // the library it started with. Use AcquireLibrary_() to read it.
+  std::shared_ptr<LoadedLibrary> library_;
+  bool loaded_;  // has Load() been called?
+  // version given to the most recently loaded library; guarded by
+  // reload_mutex_
+  uint64_t model_version_;
+  std::mutex reload_mutex_;
+  std::shared_ptr<WorkerPool> worker_pool_;
+  // same for all libraries loaded, since Reload() checks them
   size_t num_output_group_;
   size_t num_feature_;
   int num_worker_thread_;
   bool include_master_thread_;  // run task on master thread?
+  SchedulingPolicy scheduling_policy_;
+  size_t grain_size_;  // 0 = choose automatically
+  double min_work_per_thread_;  // 0 = always use every thread
+  AffinityPolicy affinity_policy_;
+  std::vector<int> cpu_list_;  // for kExplicit
+  int numa_node_;  // for kNUMALocal
+  WaitStrategy wait_strategy_;
+  size_t queue_depth_;
+  bool shared_worker_pool_;  // worker pool given by the user?
+  // latency histograms and counters, updated as batches finish
+  std::unique_ptr<StatsCollector> stats_;
+  // merges concurrent PredictInst() calls into batches; null if turned off
+  size_t coalesce_max_batch_size_;
+  uint32_t coalesce_max_delay_us_;
+  std::unique_ptr<Coalescer> coalescer_;
+  LoadOptions load_options_;
 
-  bool using_remote_lib_;  // load lib from remote location?
-  // information for temporary file to cache remote lib
-  std::unique_ptr<common::filesystem::TemporaryDirectory> tempdir_;
-  std::string temp_libfile_;
-
+  // Open a library and look up its functions, without making it current
+  std::shared_ptr<LoadedLibrary> OpenLibrary_(const char* name) const;
+  // Open a library held in memory, without looking up its functions
+  std::shared_ptr<LoadedLibrary> OpenLibraryFromMemory_(
+      const void* buf, size_t len, const std::string& basename) const;
+  // Look up the functions of an open library
+  void InitLibrary_(LoadedLibrary* library, const char* name) const;
+  // Make a newly opened library current and start the worker threads.
+  // [tstart] is when loading started, for the load statistics.
+  void Load_(std::shared_ptr<LoadedLibrary> library, double tstart);
+  // Take a reference to the current library
+  std::shared_ptr<LoadedLibrary> AcquireLibrary_() const;
+  // (Re-)create worker threads, unless the worker pool is shared, and
+  // allocate scratch buffers
+  void InitThreadPool_();
+  // Allocate scratch buffers for a library; each worker allocates its own
+  void InitScratchPool_(LoadedLibrary* library);
+  // Fault in or lock the pages of a library, as set by the load options
+  void PrefaultLibrary_(LoadedLibrary* library) const;
+  // Have every worker predict [num_row] synthetic rows with a library
+  void WarmUp_(LoadedLibrary* library, size_t num_row);
+  // (Re-)create the coalescer for PredictInst(), if turned on
+  void InitCoalescer_();
+  // Decide how many threads should work on a batch, given the number of
+  // threads available and the estimated cost of a row
+  int GetNumParticipant(size_t num_row, int max_participant,
+                        double row_cost) const;
+  // Submit a batch to worker threads. If async is false, also process the
+  // master thread's share of the batch before returning.
+  // If cq is given, report to it under [seq_id] once the batch finishes.
   template <typename BatchType>
-  size_t PredictBatchBase_(const BatchType* batch, int verbose,
-                           bool pred_margin, float* out_result);
+  AsyncHandle PredictBatchBase_(const BatchType* batch, int verbose,
+                                bool pred_margin, float* out_result,
+                                bool async, PredictCallback callback,
+                                CompletionQueue* cq = nullptr,
+                                uint64_t seq_id = 0);
 };
 
 }  // namespace treelite
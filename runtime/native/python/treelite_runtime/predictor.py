@@ -5,10 +5,12 @@ import ctypes
 import sys
 import os
 import re
+import json
 import numpy as np
 import scipy.sparse
 from .common.util import c_str, _get_log_callback_func, TreeliteError, \
                           lineno, log_info, _load_ver
+from .common.compat import py_str
 from .libpath import TreeliteLibraryNotFound, find_lib_path
 
 __version__ = _load_ver()
@@ -50,6 +52,46 @@ def _check_call(ret):
 class PredictorEntry(ctypes.Union):
   _fields_ = [('missing', ctypes.c_int), ('fvalue', ctypes.c_float)]
 
+# types of feature values that the runtime reads as they are, without
+# converting the whole array to float32 first
+_DATA_TYPES = {np.dtype(np.float32): 'float32',
+               np.dtype(np.float64): 'float64',
+               np.dtype(np.float16): 'float16',
+               np.dtype(np.int32): 'int32',
+               np.dtype(np.int64): 'int64'}
+# likewise for the feature indices and row headers of CSR matrices
+_INDEX_TYPES = {np.dtype(np.int32): 'int32',
+                np.dtype(np.int64): 'int64'}
+
+def _locate_library(libpath):
+  """Find the dynamic shared library to load, given a path to the library or
+  to the directory containing it"""
+  if os.path.isdir(libpath):  # libpath is a directory
+    # directory is given; locate shared library inside it
+    basename = os.path.basename(libpath.rstrip('/\\'))
+    lib_found = False
+    for ext in ['.so', '.dll', '.dylib']:
+      path = os.path.join(libpath, basename + ext)
+      if os.path.exists(path):
+        lib_found = True
+        break
+    if not lib_found:
+      raise TreeliteError('Directory {} doesn\'t appear '.format(libpath)+\
+                          'to have any dynamic shared library '+\
+                          '(.so/.dll/.dylib).')
+  else:      # libpath is actually the name of shared library file
+    fileext = os.path.splitext(libpath)[1]
+    if fileext == '.dll' or fileext == '.so' or fileext == '.dylib':
+      path = libpath
+    else:
+      raise TreeliteError('Specified path {} has wrong '.format(libpath) + \
+                          'file extension ({}); '.format(fileext) +\
+                          'the share library must have one of the '+\
+                          'following extensions: .so / .dll / .dylib')
+  if not re.match(r'^[a-zA-Z]+://', path):
+    path = os.path.abspath(path)
+  return path
+
 class Batch(object):
   """Batch of rows to be used for prediction"""
   def __init__(self):
@@ -89,12 +131,13 @@ class Batch(object):
   def from_npy2d(cls, mat, rbegin=0, rend=None, missing=None):
     """
     Get a dense batch from a 2D numpy matrix.
-    If ``mat`` does not have ``order='C'`` (also known as row-major) or is not
-    contiguous, a temporary copy will be made.
-    If ``mat`` does not have ``dtype=numpy.float32``, a temporary copy will be
-    made also.
-    Thus, as many as two temporary copies of data can be made. One should set
-    input layout and type judiciously to conserve memory.
+    The matrix may have any memory layout: row-major (``order='C'``),
+    column-major (``order='F'``, as held by many data frames), or a slice of
+    a larger matrix. It is read in place, without copying, as long as its
+    ``dtype`` is one of ``float32``, ``float64``, ``float16``, ``int32`` or
+    ``int64``; values are converted to float32 as rows are predicted.
+    Otherwise a temporary copy of type float32 is made, keeping the layout of
+    ``mat``. A copy is also made if ``mat`` has negative strides.
 
     Parameters
     ----------
@@ -127,22 +170,30 @@ class Batch(object):
       raise TreeliteError('rbegin must be nonnegative')
     if rend > num_row:
       raise TreeliteError('rend must be less than number of rows in mat')
-    # flatten the array by rows and ensure it is float32.
-    # we try to avoid data copies if possible
-    # (reshape returns a view when possible and we explicitly tell np.array to
-    #  avoid copying)
-    data_subset = np.array(mat[rbegin:rend, :].reshape((rend - rbegin)*num_col),
-                           copy=False, dtype=np.float32)
+    # take the subset as a view, converting to float32 only if needed; the
+    # strides of the view tell the runtime where each row and column is
+    data_subset = mat[rbegin:rend, :]
+    if data_subset.dtype not in _DATA_TYPES:
+      data_subset = data_subset.astype(np.float32, order='K')
+    itemsize = data_subset.itemsize
+    if any(x < 0 or x % itemsize != 0 for x in data_subset.strides) \
+       or data_subset.strides == (0, 0):
+      data_subset = np.ascontiguousarray(data_subset)
+    row_stride = data_subset.strides[0] // itemsize
+    col_stride = data_subset.strides[1] // itemsize
     missing = missing if missing is not None else np.nan
 
     batch = Batch()
     batch.handle = ctypes.c_void_p()
     batch.kind = 'dense'
-    _check_call(_LIB.TreeliteAssembleDenseBatch(
-        data_subset.ctypes.data_as(ctypes.POINTER(ctypes.c_float)),
+    _check_call(_LIB.TreeliteAssembleDenseBatchTyped(
+        data_subset.ctypes.data_as(ctypes.c_void_p),
+        c_str(_DATA_TYPES[data_subset.dtype]),
         ctypes.c_float(missing),
         ctypes.c_size_t(rend - rbegin),
         ctypes.c_size_t(num_col),
+        ctypes.c_size_t(row_stride),
+        ctypes.c_size_t(col_stride),
         ctypes.byref(batch.handle)))
     # save handles for internal arrays
     batch.data = data_subset
@@ -153,6 +204,10 @@ class Batch(object):
     """
     Get a sparse batch from a subset of rows in a CSR (Compressed Sparse Row)
     matrix. The subset is given by the range ``[rbegin, rend)``.
+    The arrays of a :py:class:`scipy.sparse.csr_matrix` are read in place,
+    without copying, as long as the values are of one of the types accepted
+    by :py:meth:`from_npy2d` and the indices are ``int32`` or ``int64``;
+    otherwise the subset is copied.
 
     Parameters
     ----------
@@ -190,6 +245,34 @@ class Batch(object):
     if rend > num_row:
       raise TreeliteError('rend must be less than number of rows in csr')
 
+    batch = Batch()
+    batch.handle = ctypes.c_void_p()
+    batch.kind = 'sparse'
+    data = np.asarray(csr.data)
+    indices = np.asarray(csr.indices)
+    indptr = np.asarray(csr.indptr)
+    if data.dtype in _DATA_TYPES and indices.dtype in _INDEX_TYPES \
+       and indptr.dtype == indices.dtype:
+      # row headers of the subset still point into the whole matrix, so
+      # none of the arrays need to be sliced
+      data = np.ascontiguousarray(data)
+      indices = np.ascontiguousarray(indices)
+      indptr_subset = np.ascontiguousarray(indptr[rbegin:(rend+1)])
+      _check_call(_LIB.TreeliteAssembleSparseBatchTyped(
+          data.ctypes.data_as(ctypes.c_void_p),
+          c_str(_DATA_TYPES[data.dtype]),
+          indices.ctypes.data_as(ctypes.c_void_p),
+          indptr_subset.ctypes.data_as(ctypes.c_void_p),
+          c_str(_INDEX_TYPES[indices.dtype]),
+          ctypes.c_size_t(rend - rbegin),
+          ctypes.c_size_t(num_col),
+          ctypes.byref(batch.handle)))
+      # save handles for internal arrays
+      batch.data = data
+      batch.indices = indices
+      batch.indptr = indptr_subset
+      return batch
+
     # compute submatrix with rows [rbegin, rend)
     ibegin = csr.indptr[rbegin]
     iend = csr.indptr[rend]
@@ -200,9 +283,6 @@ class Batch(object):
     indptr_subset = np.array(csr.indptr[rbegin:(rend+1)] - ibegin, copy=False,
                              dtype=np.uintp, order='C')
 
-    batch = Batch()
-    batch.handle = ctypes.c_void_p()
-    batch.kind = 'sparse'
     _check_call(_LIB.TreeliteAssembleSparseBatch(
         data_subset.ctypes.data_as(ctypes.POINTER(ctypes.c_float)),
         indices_subset.ctypes.data_as(ctypes.POINTER(ctypes.c_uint32)),
@@ -216,6 +296,52 @@ class Batch(object):
     batch.indptr = indptr_subset
     return batch
 
+class WorkerPool(object):
+  """
+  Pool of worker threads that can be shared by many predictors, so that a
+  process serving many models runs only one set of worker threads. The pool
+  is kept alive as long as any predictor using it is alive.
+
+  Parameters
+  ----------
+  nthread: :py:class:`int <python:int>`, optional
+      number of worker threads; if unspecified, use maximum number of
+      hardware threads
+  affinity_policy : :py:class:`str <python:str>`, optional
+      How worker threads are placed on CPUs; see :py:class:`Predictor`
+  cpu_list : :py:class:`list <python:list>` of \
+             :py:class:`int <python:int>`, optional
+      List of CPUs to pin workers to, for the ``'explicit'`` policy
+  numa_node : :py:class:`int <python:int>`, optional
+      NUMA node to place workers on, for the ``'numa_local'`` policy
+  wait_strategy : :py:class:`str <python:str>`, optional
+      How idle worker threads wait for new tasks; see :py:class:`Predictor`
+  queue_depth : :py:class:`int <python:int>`, optional
+      Number of tasks that can be queued up for each worker thread; see
+      :py:class:`Predictor`
+  """
+  # pylint: disable=R0903
+
+  def __init__(self, nthread=None, affinity_policy='compact', cpu_list=None,
+               numa_node=None, wait_strategy='spin_then_sleep',
+               queue_depth=256):
+    self.handle = ctypes.c_void_p()
+    cpu_list = cpu_list if cpu_list is not None else []
+    _check_call(_LIB.TreeliteWorkerPoolCreate(
+        ctypes.c_int(nthread if nthread is not None else -1),
+        c_str(affinity_policy),
+        (ctypes.c_int * len(cpu_list))(*cpu_list),
+        ctypes.c_size_t(len(cpu_list)),
+        ctypes.c_int(numa_node if numa_node is not None else -1),
+        c_str(wait_strategy),
+        ctypes.c_size_t(queue_depth),
+        ctypes.byref(self.handle)))
+
+  def __del__(self):
+    if self.handle is not None:
+      _check_call(_LIB.TreeliteWorkerPoolFree(self.handle))
+      self.handle = None
+
 class Predictor(object):
   """
   Predictor class: loader for compiled shared libraries
@@ -223,7 +349,8 @@ class Predictor(object):
   Parameters
   ----------
   libpath: :py:class:`str <python:str>`
-      location of dynamic shared library (.dll/.so/.dylib)
+      location of dynamic shared library (.dll/.so/.dylib). May be left
+      unspecified if ``libbuffer`` is given instead.
   nthread: :py:class:`int <python:int>`, optional
       number of worker threads to use; if unspecified, use maximum number of
       hardware threads
@@ -231,41 +358,135 @@ class Predictor(object):
       Whether to print extra messages during construction
   include_master_thread : :py:class:`bool <python:bool>`, optional
       Whether to assign work to the master thread
+  scheduling_policy : :py:class:`str <python:str>`, optional
+      How rows of a batch are divided among threads. Either ``'static'``
+      (split rows evenly before any work runs) or ``'work_stealing'`` (hand
+      out rows in chunks; idle threads steal chunks from busy ones)
+  grain_size : :py:class:`int <python:int>`, optional
+      Number of rows in each chunk, for the ``'work_stealing'`` policy; if
+      unspecified, choose automatically for each batch
+  min_work_per_thread : :py:class:`float <python:float>`, optional
+      Amount of work, in tree nodes visited, a batch must hold for each
+      thread working on it. Smaller batches use fewer threads; a batch that
+      gets only one thread runs on the calling thread. Set it to 0 to always
+      use every thread. If unspecified, 20000 nodes.
+  affinity_policy : :py:class:`str <python:str>`, optional
+      How worker threads are placed on CPUs. One of ``'none'`` (don't pin
+      workers), ``'compact'`` (pin workers to consecutive CPUs, skipping
+      those held by other live predictors and worker pools), ``'scatter'``
+      (spread workers evenly over NUMA nodes), ``'explicit'`` (pin workers
+      to the CPUs in ``cpu_list``), or ``'numa_local'`` (pin workers to the
+      CPUs of NUMA node ``numa_node``)
+  cpu_list : :py:class:`list <python:list>` of \
+             :py:class:`int <python:int>`, optional
+      List of CPUs to pin workers to, for the ``'explicit'`` policy
+  numa_node : :py:class:`int <python:int>`, optional
+      NUMA node to place workers on, for the ``'numa_local'`` policy; if
+      unspecified, use the node on which the calling thread is running
+  wait_strategy : :py:class:`str <python:str>`, optional
+      How idle worker threads wait for new tasks. One of ``'spin'`` (spin
+      until a task arrives), ``'spin_then_sleep'`` (spin for a while, then
+      sleep), ``'adaptive'`` (spin with backoff for longer or shorter
+      depending on how soon tasks arrived before, then sleep), or
+      ``'blocking'`` (sleep right away). Spinning picks up new tasks sooner,
+      while sleeping leaves idle cores free for other processes. A thread
+      waiting for a prediction to finish waits the same way.
+  queue_depth : :py:class:`int <python:int>`, optional
+      Number of tasks that can be queued up for each worker thread; rounded
+      up to a power of two, and to at least 2. Submitting a task to a worker
+      whose queue is full blocks until the worker catches up. If
+      unspecified, 256 tasks.
+  worker_pool : object of class :py:class:`WorkerPool`, optional
+      Run predictions on a pool of worker threads shared with other
+      predictors, instead of creating new threads. If given, ``nthread``,
+      ``affinity_policy``, ``cpu_list``, ``numa_node``, ``wait_strategy`` and
+      ``queue_depth`` are ignored; they are set when the pool is created.
+  libbuffer : :py:class:`bytes <python:bytes>`, optional
+      Content of the dynamic shared library, to be loaded from memory instead
+      of from ``libpath``. On Linux, the library is loaded without touching
+      the disk.
+  bind_now : :py:class:`bool <python:bool>`, optional
+      Whether to resolve all symbols of the library while loading it, instead
+      of on first use
+  prefault : :py:class:`str <python:str>`, optional
+      How to bring the code and data of the library into memory while loading
+      it (Linux only). One of ``'none'`` (leave pages to be faulted in by the
+      first predictions), ``'touch'`` (read every page once) or ``'lock'``
+      (lock every page in memory, so that it is never paged out; falls back
+      to ``'touch'`` if the process isn't allowed to lock that much)
+  num_warmup_row : :py:class:`int <python:int>`, optional
+      Number of synthetic rows each worker thread predicts after loading, so
+      that the first real predictions are no slower than the rest. These
+      options also apply to :py:meth:`reload`. The time taken by each phase
+      of loading is reported by :py:meth:`get_stats`.
   """
   # pylint: disable=R0903
 
-  def __init__(self, libpath, nthread=None, verbose=False,
-               include_master_thread=True):
-    if os.path.isdir(libpath):  # libpath is a directory
-      # directory is given; locate shared library inside it
-      basename = os.path.basename(libpath.rstrip('/\\'))
-      lib_found = False
-      for ext in ['.so', '.dll', '.dylib']:
-        path = os.path.join(libpath, basename + ext)
-        if os.path.exists(path):
-          lib_found = True
-          break
-      if not lib_found:
-        raise TreeliteError('Directory {} doesn\'t appear '.format(libpath)+\
-                            'to have any dynamic shared library '+\
-                            '(.so/.dll/.dylib).')
-    else:      # libpath is actually the name of shared library file
-      fileext = os.path.splitext(libpath)[1]
-      if fileext == '.dll' or fileext == '.so' or fileext == '.dylib':
-        path = libpath
-      else:
-        raise TreeliteError('Specified path {} has wrong '.format(libpath) + \
-                            'file extension ({}); '.format(fileext) +\
-                            'the share library must have one of the '+\
-                            'following extensions: .so / .dll / .dylib')
+  def __init__(self, libpath=None, nthread=None, verbose=False,
+               include_master_thread=True, scheduling_policy='work_stealing',
+               grain_size=None, min_work_per_thread=None,
+               affinity_policy='compact', cpu_list=None,
+               numa_node=None, wait_strategy='spin_then_sleep',
+               queue_depth=None, worker_pool=None, libbuffer=None,
+               bind_now=False, prefault='none', num_warmup_row=0):
+    self.handle = None
+    if libbuffer is not None:
+      if libpath is not None:
+        raise TreeliteError('Only one of libpath and libbuffer may be given')
+      path = '<memory>'
+      libbuffer = bytes(libbuffer)
+    elif libpath is None:
+      raise TreeliteError('Either libpath or libbuffer must be given')
+    else:
+      path = _locate_library(libpath)
+    # everything is set before loading, so that the worker threads are
+    # started (and warmed up) only once
     self.handle = ctypes.c_void_p()
-    if not re.match(r'^[a-zA-Z]+://', path):
-      path = os.path.abspath(path)
-    _check_call(_LIB.TreelitePredictorLoad(
-        c_str(path),
-        ctypes.c_int(nthread if nthread is not None else -1),
-        ctypes.c_int(1 if include_master_thread else 0),
-        ctypes.byref(self.handle)))
+    if worker_pool is not None:
+      _check_call(_LIB.TreelitePredictorCreateWithWorkerPool(
+          worker_pool.handle,
+          ctypes.c_int(1 if include_master_thread else 0),
+          ctypes.byref(self.handle)))
+    else:
+      _check_call(_LIB.TreelitePredictorCreate(
+          ctypes.c_int(nthread if nthread is not None else -1),
+          ctypes.c_int(1 if include_master_thread else 0),
+          ctypes.byref(self.handle)))
+    _check_call(_LIB.TreelitePredictorSetSchedulingPolicy(
+        self.handle,
+        c_str(scheduling_policy),
+        ctypes.c_size_t(grain_size if grain_size is not None else 0)))
+    if min_work_per_thread is not None:
+      _check_call(_LIB.TreelitePredictorSetMinWorkPerThread(
+          self.handle,
+          ctypes.c_double(min_work_per_thread)))
+    if worker_pool is None:
+      cpu_list = cpu_list if cpu_list is not None else []
+      _check_call(_LIB.TreelitePredictorSetAffinityPolicy(
+          self.handle,
+          c_str(affinity_policy),
+          (ctypes.c_int * len(cpu_list))(*cpu_list),
+          ctypes.c_size_t(len(cpu_list)),
+          ctypes.c_int(numa_node if numa_node is not None else -1)))
+      _check_call(_LIB.TreelitePredictorSetWaitStrategy(
+          self.handle,
+          c_str(wait_strategy)))
+      if queue_depth is not None:
+        _check_call(_LIB.TreelitePredictorSetQueueDepth(
+            self.handle,
+            ctypes.c_size_t(queue_depth)))
+    _check_call(_LIB.TreelitePredictorSetLoadOptions(
+        self.handle,
+        ctypes.c_int(1 if bind_now else 0),
+        c_str(prefault),
+        ctypes.c_size_t(num_warmup_row)))
+    if libbuffer is not None:
+      _check_call(_LIB.TreelitePredictorLoadLibraryFromMemory(
+          self.handle,
+          ctypes.c_char_p(libbuffer),
+          ctypes.c_size_t(len(libbuffer))))
+    else:
+      _check_call(_LIB.TreelitePredictorLoadLibrary(self.handle, c_str(path)))
     # save # of features
     num_feature = ctypes.c_size_t()
     _check_call(_LIB.TreelitePredictorQueryNumFeature(
@@ -280,13 +501,48 @@ class Predictor(object):
     self.num_output_group = num_output_group.value
 
     if verbose:
+      load = self.get_stats()['load']
       log_info(__file__, lineno(),
                'Dynamic shared library {} has been '.format(path)+\
-               'successfully loaded into memory')
+               'successfully loaded into memory in ' +\
+               '{:.3f} sec (open: {:.3f}, '.format(load['total_time'],
+                                                  load['open_time'])+\
+               'prefault: {:.3f}, '.format(load['prefault_time'])+\
+               'worker init: {:.3f}, '.format(load['worker_init_time'])+\
+               'warm-up: {:.3f})'.format(load['warmup_time']))
+
+  def reload(self, libpath, verbose=False):
+    """
+    Replace the loaded library with another one, without pausing predictions
+    made from other threads. Predictions already in progress finish with the
+    old library, which is unloaded once they are done; predictions started
+    afterwards use the new library. If the new library cannot be loaded, the
+    old one stays in place.
+
+    Parameters
+    ----------
+    libpath: :py:class:`str <python:str>`
+        location of dynamic shared library (.dll/.so/.dylib), or the
+        directory containing it. The model must have the same number of
+        features and output groups as the one loaded.
+    verbose : :py:class:`bool <python:bool>`, optional
+        Whether to print extra messages
+    """
+    path = _locate_library(libpath)
+    _check_call(_LIB.TreelitePredictorReload(self.handle, c_str(path)))
+    if verbose:
+      version = ctypes.c_uint64()
+      _check_call(_LIB.TreelitePredictorQueryModelVersion(
+          self.handle,
+          ctypes.byref(version)))
+      log_info(__file__, lineno(),
+               'Switched to dynamic shared library {} '.format(path)+\
+               '(model version {})'.format(version.value))
 
   def predict_instance(self, inst, missing=None, pred_margin=False):
     """
-    Perform single-instance prediction. Prediction is run by the calling thread.
+    Perform single-instance prediction. Prediction is run by the calling
+    thread, unless coalescing is turned on with :py:meth:`set_coalescing`.
 
     Parameters
     ----------
@@ -361,13 +617,60 @@ class Predictor(object):
       res = res.reshape((-1, self.num_output_group))
     return res
 
+  def set_coalescing(self, max_batch_size, max_delay_us):
+    """
+    Merge calls to :py:meth:`predict_instance` made from many threads at the
+    same time into small batches, which go through the batch prediction
+    path. The first row of a batch waits until either ``max_batch_size`` rows
+    have arrived or ``max_delay_us`` microseconds have passed; each caller
+    then receives its own result. Must not be called while predictions are
+    in progress. While coalescing is on, a row with a present entry holding
+    NaN is rejected, since the batch marks missing values with NaN.
+
+    Parameters
+    ----------
+    max_batch_size: :py:class:`int <python:int>`
+        maximum number of rows in a batch; 0 or 1 to turn coalescing off
+    max_delay_us: :py:class:`int <python:int>`
+        maximum time, in microseconds, a row waits for other rows to arrive
+    """
+    _check_call(_LIB.TreelitePredictorSetCoalescing(
+        self.handle,
+        ctypes.c_size_t(max_batch_size),
+        ctypes.c_uint32(max_delay_us)))
+
+  def get_coalescing_stats(self):
+    """
+    Get the number of rows and batches predicted by
+    :py:meth:`predict_instance` since coalescing was turned on
+
+    Returns
+    -------
+    stats: :py:class:`dict <python:dict>`
+        ``'num_request'`` (rows requested), ``'num_batch'`` (batches the rows
+        were merged into), ``'num_full_batch'`` (batches closed for reaching
+        the maximum size) and ``'coalescing_ratio'`` (average rows per batch)
+    """
+    num_request = ctypes.c_size_t()
+    num_batch = ctypes.c_size_t()
+    num_full_batch = ctypes.c_size_t()
+    coalescing_ratio = ctypes.c_double()
+    _check_call(_LIB.TreelitePredictorGetCoalescingStats(
+        self.handle,
+        ctypes.byref(num_request),
+        ctypes.byref(num_batch),
+        ctypes.byref(num_full_batch),
+        ctypes.byref(coalescing_ratio)))
+    return {'num_request': num_request.value, 'num_batch': num_batch.value,
+            'num_full_batch': num_full_batch.value,
+            'coalescing_ratio': coalescing_ratio.value}
+
   def predict(self, batch, verbose=False, pred_margin=False):
     """
     Perform batch prediction with a 2D sparse data matrix. Worker threads will
-    internally divide up work for batch prediction. **Note that this function
-    may be called by only one thread at a time.** In order to use multiple
-    threads to process multiple prediction requests simultaneously, use
-    :py:meth:`predict_instance` instead.
+    internally divide up work for batch prediction. This function may be
+    called by multiple threads at the same time; the worker threads will be
+    shared among all pending requests.
 
     Parameters
     ----------
@@ -404,9 +707,229 @@ class Predictor(object):
       res = res.reshape((-1, self.num_output_group))
     return res
 
+  def predict_unordered(self, batches, verbose=False, pred_margin=False):
+    """
+    Make predictions on many batches at once, and yield the results in the
+    order in which they finish. All batches are submitted to the worker
+    threads up front, so that the workers can move on from one batch to the
+    next without waiting for the caller; this suits streams of small batches.
+
+    Parameters
+    ----------
+    batches: :py:class:`list <python:list>` of objects of type \
+             :py:class:`Batch`
+        batches of rows for which predictions will be made. All batches must
+        be of the same kind (sparse or dense).
+    verbose : :py:class:`bool <python:bool>`, optional
+        Whether to print extra messages during prediction
+    pred_margin: :py:class:`bool <python:bool>`, optional
+        whether to produce raw margins rather than transformed probabilities
+
+    Yields
+    ------
+    (index, result): :py:class:`tuple <python:tuple>`
+        position of a batch in ``batches``, and the predictions for it
+    """
+    batches = list(batches)
+    if not batches:
+      return
+    for batch in batches:
+      if not isinstance(batch, Batch):
+        raise TreeliteError('batch must be of type Batch')
+      if batch.handle is None or batch.kind is None:
+        raise TreeliteError('batch cannot be empty')
+    if len(set(batch.kind for batch in batches)) > 1:
+      raise TreeliteError('all batches must be of the same kind')
+    batch_sparse = ctypes.c_int(1 if batches[0].kind == 'sparse' else 0)
+    num_batch = len(batches)
+    out_results = []
+    for batch in batches:
+      result_size = ctypes.c_size_t()
+      _check_call(_LIB.TreelitePredictorQueryResultSize(
+          self.handle,
+          batch.handle,
+          batch_sparse,
+          ctypes.byref(result_size)))
+      out_results.append(
+          np.zeros(result_size.value, dtype=np.float32, order='C'))
+    cq = ctypes.c_void_p()
+    _check_call(_LIB.TreelitePredictorCreateCompletionQueue(
+        self.handle,
+        ctypes.byref(cq)))
+    try:
+      first_seq_id = ctypes.c_uint64()
+      _check_call(_LIB.TreelitePredictorSubmitBatches(
+          self.handle,
+          (ctypes.c_void_p * num_batch)(*[x.handle for x in batches]),
+          batch_sparse,
+          ctypes.c_size_t(num_batch),
+          ctypes.c_int(1 if verbose else 0),
+          ctypes.c_int(1 if pred_margin else 0),
+          (ctypes.POINTER(ctypes.c_float) * num_batch)(
+              *[x.ctypes.data_as(ctypes.POINTER(ctypes.c_float))
+                for x in out_results]),
+          cq,
+          ctypes.byref(first_seq_id)))
+      for _ in range(num_batch):
+        seq_id = ctypes.c_uint64()
+        out_result_size = ctypes.c_size_t()
+        _check_call(_LIB.TreelitePredictorWaitNext(
+            self.handle,
+            cq,
+            ctypes.byref(seq_id),
+            ctypes.byref(out_result_size)))
+        i = seq_id.value - first_seq_id.value
+        idx = int(out_result_size.value)
+        res = out_results[i][0:idx].reshape((batches[i].shape()[0], -1))
+        res = res.squeeze()
+        if self.num_output_group > 1:
+          res = res.reshape((-1, self.num_output_group))
+        yield i, res
+    finally:
+      # waits for any batch not yet reported
+      _check_call(_LIB.TreelitePredictorFreeCompletionQueue(self.handle, cq))
+
+  def predict_file(self, input_path, output_path, data_format='libsvm',
+                   verbose=False, pred_margin=False):
+    """
+    Make predictions for all rows of a data file and write them to another
+    file, one line per row with comma-separated outputs. The data file is read
+    one chunk at a time, and each chunk is predicted while the next one is
+    being parsed, so memory use stays bounded no matter how large the file is.
+
+    Parameters
+    ----------
+    input_path: :py:class:`str <python:str>`
+        location of the data file. Parser arguments may be appended, e.g.
+        ``'data.csv?label_column=0'``
+    output_path: :py:class:`str <python:str>`
+        location of the file to write predictions to
+    data_format: :py:class:`str <python:str>`, optional
+        format of the data file (``'libsvm'``, ``'csv'`` or ``'libfm'``)
+    verbose : :py:class:`bool <python:bool>`, optional
+        Whether to print extra messages during prediction
+    pred_margin: :py:class:`bool <python:bool>`, optional
+        whether to produce raw margins rather than transformed probabilities
+
+    Returns
+    -------
+    num_row: :py:class:`int <python:int>`
+        number of rows predicted
+    """
+    num_row = ctypes.c_size_t()
+    _check_call(_LIB.TreelitePredictorPredictFile(
+        self.handle,
+        c_str(input_path),
+        c_str(data_format),
+        c_str(output_path),
+        ctypes.c_int(1 if pred_margin else 0),
+        ctypes.c_int(1 if verbose else 0),
+        ctypes.byref(num_row)))
+    return num_row.value
+
+  def get_worker_stats(self):
+    """
+    Get the time each worker thread has spent waiting for and running tasks
+    since it was created. For a shared worker pool, the work of all
+    predictors using the pool is counted.
+
+    Returns
+    -------
+    stats: :py:class:`dict <python:dict>`
+        ``'spin_time'``, ``'sleep_time'`` and ``'work_time'`` map to arrays
+        holding the time (in seconds) each worker has spent in that state;
+        ``'num_task'`` maps to an array holding the number of tasks each
+        worker has run.
+    """
+    num_worker = ctypes.c_size_t()
+    _check_call(_LIB.TreelitePredictorQueryNumWorkerThread(
+        self.handle,
+        ctypes.byref(num_worker)))
+    stats = {'spin_time': np.zeros(num_worker.value, dtype=np.float64),
+             'sleep_time': np.zeros(num_worker.value, dtype=np.float64),
+             'work_time': np.zeros(num_worker.value, dtype=np.float64),
+             'num_task': np.zeros(num_worker.value, dtype=np.uintp)}
+    _check_call(_LIB.TreelitePredictorGetWorkerStats(
+        self.handle,
+        stats['spin_time'].ctypes.data_as(ctypes.POINTER(ctypes.c_double)),
+        stats['sleep_time'].ctypes.data_as(ctypes.POINTER(ctypes.c_double)),
+        stats['work_time'].ctypes.data_as(ctypes.POINTER(ctypes.c_double)),
+        stats['num_task'].ctypes.data_as(ctypes.POINTER(ctypes.c_size_t))))
+    return stats
+
+  def get_worker_cpus(self):
+    """
+    Get the CPU each worker thread is pinned to, as decided by the affinity
+    policy.
+
+    Returns
+    -------
+    cpus: :py:class:`numpy.ndarray`
+        CPU of each worker thread; -1 for a worker that is not pinned
+    """
+    num_worker = ctypes.c_size_t()
+    _check_call(_LIB.TreelitePredictorQueryNumWorkerThread(
+        self.handle,
+        ctypes.byref(num_worker)))
+    cpus = np.zeros(num_worker.value, dtype=np.intc)
+    _check_call(_LIB.TreelitePredictorQueryWorkerCPUs(
+        self.handle,
+        cpus.ctypes.data_as(ctypes.POINTER(ctypes.c_int))))
+    return cpus
+
+  def get_stats(self):
+    """
+    Get the statistics of batch predictions made since the library was
+    loaded or the statistics were last reset with :py:meth:`reset_stats`.
+    Quantiles are accurate to within about 6%.
+
+    Returns
+    -------
+    stats: :py:class:`dict <python:dict>`
+        ``'model_version'`` is the version of the library new predictions go
+        to; it is 1 after loading and goes up by one with every
+        :py:meth:`reload`. ``'elapsed_time'``, ``'num_batch'``,
+        ``'num_row'`` and ``'rows_per_sec'`` describe the throughput.
+        ``'latency'`` (time from submitting a batch until its results are
+        ready), ``'queue_wait'``, ``'compute'`` and ``'reshape'`` each map to
+        a dict with keys
+        ``'count'``, ``'mean'``, ``'p50'``, ``'p90'``, ``'p99'``, ``'p999'``
+        and ``'max'``, in seconds. ``'worker'`` is a list holding the busy
+        and idle time of each worker thread; see :py:meth:`get_worker_stats`.
+        ``'load'`` holds the time taken by each phase of loading the current
+        library (``'open_time'``, ``'prefault_time'``,
+        ``'worker_init_time'``, ``'warmup_time'`` and ``'total_time'``, in
+        seconds), along with ``'prefault_bytes'`` and ``'locked'``.
+    """
+    out_json = ctypes.c_char_p()
+    _check_call(_LIB.TreelitePredictorGetStats(
+        self.handle,
+        ctypes.byref(out_json)))
+    return json.loads(py_str(out_json.value))
+
+  def reset_stats(self):
+    """
+    Reset the statistics returned by :py:meth:`get_stats`
+    """
+    _check_call(_LIB.TreelitePredictorResetStats(self.handle))
+
+  def dump_stats(self, path):
+    """
+    Write the statistics returned by :py:meth:`get_stats` to a file in the
+    Prometheus text exposition format. The file is replaced atomically, so
+    that it can be read by the node exporter's textfile collector at any
+    time.
+
+    Parameters
+    ----------
+    path: :py:class:`str <python:str>`
+        path of the file
+    """
+    _check_call(_LIB.TreelitePredictorDumpStats(self.handle, c_str(path)))
+
   def __del__(self):
     if self.handle is not None:
       _check_call(_LIB.TreelitePredictorFree(self.handle))
       self.handle = None
 
-__all__ = ['Predictor', 'Batch', '__version__']
+__all__ = ['Predictor', 'Batch', 'WorkerPool', '__version__']
@@ -7,29 +7,338 @@
 
 #include <treelite/predictor.h>
 #include <treelite/c_api_runtime.h>
+#include <dmlc/thread_local.h>
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
 #include "./c_api_error.h"
 
 using namespace treelite;
 
+namespace {
+
+/*! \brief entry to to easily hold returning information */
+struct TreeliteAPIThreadLocalEntry {
+  /*! \brief result holder for returning string */
+  std::string ret_str;
+};
+
+// define threadlocal store for returning information
+using TreeliteAPIThreadLocalStore
+  = dmlc::ThreadLocalStore<TreeliteAPIThreadLocalEntry>;
+
+void WriteLatencySummary(std::ostream& os, const char* name,
+                         const Predictor::LatencySummary& summary) {
+  os << "\"" << name << "\": {\"count\": " << summary.count
+     << ", \"mean\": " << summary.mean << ", \"p50\": " << summary.p50
+     << ", \"p90\": " << summary.p90 << ", \"p99\": " << summary.p99
+     << ", \"p999\": " << summary.p999 << ", \"max\": " << summary.max
+     << "}";
+}
+
+Predictor::AffinityPolicy ParseAffinityPolicy(const std::string& policy) {
+  if (policy == "none") {
+    return Predictor::AffinityPolicy::kNone;
+  } else if (policy == "compact") {
+    return Predictor::AffinityPolicy::kCompact;
+  } else if (policy == "scatter") {
+    return Predictor::AffinityPolicy::kScatter;
+  } else if (policy == "explicit") {
+    return Predictor::AffinityPolicy::kExplicit;
+  } else if (policy == "numa_local") {
+    return Predictor::AffinityPolicy::kNUMALocal;
+  } else {
+    LOG(FATAL) << "Unknown affinity policy: " << policy;
+    return Predictor::AffinityPolicy::kNone;
+  }
+}
+
+Predictor::WaitStrategy ParseWaitStrategy(const std::string& strategy) {
+  if (strategy == "spin") {
+    return Predictor::WaitStrategy::kSpin;
+  } else if (strategy == "spin_then_sleep") {
+    return Predictor::WaitStrategy::kSpinThenSleep;
+  } else if (strategy == "adaptive") {
+    return Predictor::WaitStrategy::kAdaptive;
+  } else if (strategy == "blocking") {
+    return Predictor::WaitStrategy::kBlocking;
+  } else {
+    LOG(FATAL) << "Unknown wait strategy: " << strategy;
+    return Predictor::WaitStrategy::kSpinThenSleep;
+  }
+}
+
+// types of the arrays of a batch assembled with the C API
+enum class DataType : uint8_t {
+  kFloat32 = 0, kFloat64 = 1, kFloat16 = 2, kInt32 = 3, kInt64 = 4
+};
+enum class IndexType : uint8_t {
+  kDefault = 0,  // uint32_t feature indices and size_t row headers
+  kInt32 = 1, kInt64 = 2
+};
+
+DataType ParseDataType(const std::string& type) {
+  if (type == "float32") {
+    return DataType::kFloat32;
+  } else if (type == "float64") {
+    return DataType::kFloat64;
+  } else if (type == "float16") {
+    return DataType::kFloat16;
+  } else if (type == "int32") {
+    return DataType::kInt32;
+  } else if (type == "int64") {
+    return DataType::kInt64;
+  } else {
+    LOG(FATAL) << "Unknown data type: " << type;
+    return DataType::kFloat32;
+  }
+}
+
+IndexType ParseIndexType(const std::string& type) {
+  if (type == "int32") {
+    return IndexType::kInt32;
+  } else if (type == "int64") {
+    return IndexType::kInt64;
+  } else {
+    LOG(FATAL) << "Unknown index type: " << type;
+    return IndexType::kDefault;
+  }
+}
+
+// Batches handed out by the C API. [batch] is the batch itself if its
+// arrays are of the types of CSRBatch or DenseBatch, so that language
+// bindings may read a handle as a plain CSRBatch* or DenseBatch*; otherwise
+// only its dimensions are filled in. [typed] points to the batch with the
+// types its arrays actually have, which is what predictions are made with.
+struct SparseBatchHolder {
+  CSRBatch batch;
+  DataType data_type;
+  IndexType index_type;
+  const void* typed;
+};
+
+struct DenseBatchHolder {
+  DenseBatch batch;
+  DataType data_type;
+  const void* typed;
+};
+
+// Call (*visitor)(batch) with the batch of a handle, cast to its actual type
+template <typename ElementType, typename Visitor>
+void VisitSparseBatch(const SparseBatchHolder* handle, Visitor* visitor) {
+  switch (handle->index_type) {
+   case IndexType::kDefault:
+    (*visitor)(static_cast<const CSRBatchT<ElementType, uint32_t, size_t>*>(
+      handle->typed));
+    break;
+   case IndexType::kInt32:
+    (*visitor)(static_cast<const CSRBatchT<ElementType, int32_t, int32_t>*>(
+      handle->typed));
+    break;
+   case IndexType::kInt64:
+    (*visitor)(static_cast<const CSRBatchT<ElementType, int64_t, int64_t>*>(
+      handle->typed));
+    break;
+  }
+}
+
+template <typename Visitor>
+void VisitBatch(const void* handle, int batch_sparse, Visitor* visitor) {
+  if (batch_sparse) {
+    const SparseBatchHolder* handle_
+      = static_cast<const SparseBatchHolder*>(handle);
+    switch (handle_->data_type) {
+     case DataType::kFloat32:
+      VisitSparseBatch<float>(handle_, visitor);
+      break;
+     case DataType::kFloat64:
+      VisitSparseBatch<double>(handle_, visitor);
+      break;
+     case DataType::kFloat16:
+      VisitSparseBatch<Float16>(handle_, visitor);
+      break;
+     case DataType::kInt32:
+      VisitSparseBatch<int32_t>(handle_, visitor);
+      break;
+     case DataType::kInt64:
+      VisitSparseBatch<int64_t>(handle_, visitor);
+      break;
+    }
+  } else {
+    const DenseBatchHolder* handle_
+      = static_cast<const DenseBatchHolder*>(handle);
+    switch (handle_->data_type) {
+     case DataType::kFloat32:
+      (*visitor)(static_cast<const DenseBatchT<float>*>(handle_->typed));
+      break;
+     case DataType::kFloat64:
+      (*visitor)(static_cast<const DenseBatchT<double>*>(handle_->typed));
+      break;
+     case DataType::kFloat16:
+      (*visitor)(static_cast<const DenseBatchT<Float16>*>(handle_->typed));
+      break;
+     case DataType::kInt32:
+      (*visitor)(static_cast<const DenseBatchT<int32_t>*>(handle_->typed));
+      break;
+     case DataType::kInt64:
+      (*visitor)(static_cast<const DenseBatchT<int64_t>*>(handle_->typed));
+      break;
+    }
+  }
+}
+
+// whether two batch handles hold arrays of the same types
+bool IsSameBatchType(const void* a, const void* b, int batch_sparse) {
+  if (batch_sparse) {
+    const SparseBatchHolder* a_ = static_cast<const SparseBatchHolder*>(a);
+    const SparseBatchHolder* b_ = static_cast<const SparseBatchHolder*>(b);
+    return a_->data_type == b_->data_type
+           && a_->index_type == b_->index_type;
+  } else {
+    return static_cast<const DenseBatchHolder*>(a)->data_type
+           == static_cast<const DenseBatchHolder*>(b)->data_type;
+  }
+}
+
+template <typename ElementType, typename IntType>
+void SetTypedSparseBatch(SparseBatchHolder* handle, const void* data,
+                         const void* col_ind, const void* row_ptr) {
+  handle->typed = new CSRBatchT<ElementType, IntType, IntType>{
+    static_cast<const ElementType*>(data),
+    static_cast<const IntType*>(col_ind),
+    static_cast<const IntType*>(row_ptr),
+    handle->batch.num_row, handle->batch.num_col};
+}
+
+template <typename ElementType>
+void SetTypedSparseBatch(SparseBatchHolder* handle, const void* data,
+                         const void* col_ind, const void* row_ptr) {
+  if (handle->index_type == IndexType::kInt32) {
+    SetTypedSparseBatch<ElementType, int32_t>(handle, data, col_ind, row_ptr);
+  } else {
+    SetTypedSparseBatch<ElementType, int64_t>(handle, data, col_ind, row_ptr);
+  }
+}
+
+template <typename ElementType>
+void SetTypedDenseBatch(DenseBatchHolder* handle, const void* data) {
+  const DenseBatch& batch = handle->batch;
+  handle->typed = new DenseBatchT<ElementType>{
+    static_cast<const ElementType*>(data), batch.missing_value,
+    batch.num_row, batch.num_col, batch.row_stride, batch.col_stride};
+}
+
+struct DeleteVisitor {
+  const void* handle_batch;
+  template <typename BatchType>
+  void operator()(const BatchType* batch) {
+    if (static_cast<const void*>(batch) != handle_batch) {
+      delete batch;
+    }
+  }
+};
+
+struct PredictBatchVisitor {
+  Predictor* predictor;
+  int verbose;
+  bool pred_margin;
+  float* out_result;
+  Predictor::PredictCallback callback;
+  bool async;
+  size_t result_size;
+  Predictor::AsyncHandle async_handle;
+  template <typename BatchType>
+  void operator()(const BatchType* batch) {
+    if (async) {
+      async_handle = predictor->PredictBatchAsync(batch, verbose, pred_margin,
+                                                  out_result, callback);
+    } else {
+      result_size = predictor->PredictBatch(batch, verbose, pred_margin,
+                                            out_result);
+    }
+  }
+};
+
+struct SubmitBatchesVisitor {
+  Predictor* predictor;
+  void* const* batches;
+  int batch_sparse;
+  size_t num_batch;
+  int verbose;
+  bool pred_margin;
+  float* const* out_results;
+  CompletionQueueHandle cq;
+  uint64_t first_seq_id;
+  // called with the first batch; the others are of the same type
+  template <typename BatchType>
+  void operator()(const BatchType*) {
+    std::vector<const BatchType*> batches_(num_batch);
+    for (size_t i = 0; i < num_batch; ++i) {
+      batches_[i] = static_cast<const BatchType*>(
+        batch_sparse ? static_cast<SparseBatchHolder*>(batches[i])->typed
+                     : static_cast<DenseBatchHolder*>(batches[i])->typed);
+    }
+    first_seq_id = predictor->SubmitBatches(
+      batches_.data(), num_batch, verbose, pred_margin, out_results, cq);
+  }
+};
+
+}  // anonymous namespace
+
 int TreeliteAssembleSparseBatch(const float* data,
                                 const uint32_t* col_ind,
                                 const size_t* row_ptr,
                                 size_t num_row, size_t num_col,
                                 CSRBatchHandle* out) {
   API_BEGIN();
-  CSRBatch* batch = new CSRBatch();
-  batch->data = data;
-  batch->col_ind = col_ind;
-  batch->row_ptr = row_ptr;
-  batch->num_row = num_row;
-  batch->num_col = num_col;
-  *out = static_cast<CSRBatchHandle>(batch);
+  SparseBatchHolder* handle = new SparseBatchHolder();
+  handle->batch = CSRBatch{data, col_ind, row_ptr, num_row, num_col};
+  handle->data_type = DataType::kFloat32;
+  handle->index_type = IndexType::kDefault;
+  handle->typed = &handle->batch;
+  *out = static_cast<CSRBatchHandle>(handle);
+  API_END();
+}
+
+int TreeliteAssembleSparseBatchTyped(const void* data, const char* data_type,
+                                     const void* col_ind, const void* row_ptr,
+                                     const char* index_type,
+                                     size_t num_row, size_t num_col,
+                                     CSRBatchHandle* out) {
+  API_BEGIN();
+  std::unique_ptr<SparseBatchHolder> handle(new SparseBatchHolder());
+  handle->batch = CSRBatch{nullptr, nullptr, nullptr, num_row, num_col};
+  handle->data_type = ParseDataType(data_type);
+  handle->index_type = ParseIndexType(index_type);
+  switch (handle->data_type) {
+   case DataType::kFloat32:
+    SetTypedSparseBatch<float>(handle.get(), data, col_ind, row_ptr);
+    break;
+   case DataType::kFloat64:
+    SetTypedSparseBatch<double>(handle.get(), data, col_ind, row_ptr);
+    break;
+   case DataType::kFloat16:
+    SetTypedSparseBatch<Float16>(handle.get(), data, col_ind, row_ptr);
+    break;
+   case DataType::kInt32:
+    SetTypedSparseBatch<int32_t>(handle.get(), data, col_ind, row_ptr);
+    break;
+   case DataType::kInt64:
+    SetTypedSparseBatch<int64_t>(handle.get(), data, col_ind, row_ptr);
+    break;
+  }
+  *out = static_cast<CSRBatchHandle>(handle.release());
   API_END();
 }
 
 int TreeliteDeleteSparseBatch(CSRBatchHandle handle) {
   API_BEGIN();
-  delete static_cast<CSRBatch*>(handle);
+  SparseBatchHolder* handle_ = static_cast<SparseBatchHolder*>(handle);
+  DeleteVisitor visitor{&handle_->batch};
+  VisitBatch(handle_, 1, &visitor);
+  delete handle_;
   API_END();
 }
 
@@ -37,18 +346,68 @@ int TreeliteAssembleDenseBatch(const float* data, float missing_value,
                                size_t num_row, size_t num_col,
                                DenseBatchHandle* out) {
   API_BEGIN();
-  DenseBatch* batch = new DenseBatch();
-  batch->data = data;
-  batch->missing_value = missing_value;
-  batch->num_row = num_row;
-  batch->num_col = num_col;
-  *out = static_cast<DenseBatchHandle>(batch);
+  DenseBatchHolder* handle = new DenseBatchHolder();
+  handle->batch = DenseBatch{data, missing_value, num_row, num_col};
+  handle->data_type = DataType::kFloat32;
+  handle->typed = &handle->batch;
+  *out = static_cast<DenseBatchHandle>(handle);
+  API_END();
+}
+
+int TreeliteAssembleDenseBatchStrided(const float* data, float missing_value,
+                                      size_t num_row, size_t num_col,
+                                      size_t row_stride, size_t col_stride,
+                                      DenseBatchHandle* out) {
+  API_BEGIN();
+  CHECK(row_stride > 0 || col_stride > 0)
+    << "Row and column strides cannot both be zero";
+  DenseBatchHolder* handle = new DenseBatchHolder();
+  handle->batch = DenseBatch{data, missing_value, num_row, num_col,
+                             row_stride, col_stride};
+  handle->data_type = DataType::kFloat32;
+  handle->typed = &handle->batch;
+  *out = static_cast<DenseBatchHandle>(handle);
+  API_END();
+}
+
+int TreeliteAssembleDenseBatchTyped(const void* data, const char* data_type,
+                                    float missing_value,
+                                    size_t num_row, size_t num_col,
+                                    size_t row_stride, size_t col_stride,
+                                    DenseBatchHandle* out) {
+  API_BEGIN();
+  std::unique_ptr<DenseBatchHolder> handle(new DenseBatchHolder());
+  handle->batch = DenseBatch{nullptr, missing_value, num_row, num_col,
+                             row_stride, col_stride};
+  handle->data_type = ParseDataType(data_type);
+  switch (handle->data_type) {
+   case DataType::kFloat32:
+    handle->batch.data = static_cast<const float*>(data);
+    handle->typed = &handle->batch;
+    break;
+   case DataType::kFloat64:
+    SetTypedDenseBatch<double>(handle.get(), data);
+    break;
+   case DataType::kFloat16:
+    SetTypedDenseBatch<Float16>(handle.get(), data);
+    break;
+   case DataType::kInt32:
+    SetTypedDenseBatch<int32_t>(handle.get(), data);
+    break;
+   case DataType::kInt64:
+    SetTypedDenseBatch<int64_t>(handle.get(), data);
+    break;
+  }
+  *out = static_cast<DenseBatchHandle>(handle.release());
   API_END();
 }
 
 int TreeliteDeleteDenseBatch(DenseBatchHandle handle) {
   API_BEGIN();
-  delete static_cast<DenseBatch*>(handle);
+  DenseBatchHolder* handle_ = static_cast<DenseBatchHolder*>(handle);
+  DeleteVisitor visitor{&handle_->batch};
+  VisitBatch(handle_, 0, &visitor);
+  delete handle_;
   API_END();
 }
 
@@ -58,13 +417,13 @@ int TreeliteBatchGetDimension(void* handle,
                               size_t* out_num_col) {
   API_BEGIN();
   if (batch_sparse) {
-    const CSRBatch* batch_ = static_cast<CSRBatch*>(handle);
-    *out_num_row = batch_->num_row;
-    *out_num_col = batch_->num_col;
+    const CSRBatch& batch_ = static_cast<SparseBatchHolder*>(handle)->batch;
+    *out_num_row = batch_.num_row;
+    *out_num_col = batch_.num_col;
   } else {
-    const DenseBatch* batch_ = static_cast<DenseBatch*>(handle);
-    *out_num_row = batch_->num_row;
-    *out_num_col = batch_->num_col;
+    const DenseBatch& batch_ = static_cast<DenseBatchHolder*>(handle)->batch;
+    *out_num_row = batch_.num_row;
+    *out_num_col = batch_.num_col;
   }
   API_END();
 }
@@ -81,6 +440,270 @@ int TreelitePredictorLoad(const char* library_path,
   API_END();
 }
 
+int TreelitePredictorLoadFromMemory(const void* buf, size_t len,
+                                    int num_worker_thread,
+                                    int include_master_thread,
+                                    PredictorHandle* out) {
+  API_BEGIN();
+  std::unique_ptr<Predictor> predictor(
+    new Predictor(num_worker_thread, static_cast<bool>(include_master_thread)));
+  predictor->LoadFromMemory(buf, len);
+  *out = static_cast<PredictorHandle>(predictor.release());
+  API_END();
+}
+
+int TreelitePredictorCreate(int num_worker_thread,
+                            int include_master_thread,
+                            PredictorHandle* out) {
+  API_BEGIN();
+  Predictor* predictor = new Predictor(num_worker_thread,
+                                       static_cast<bool>(include_master_thread));
+  *out = static_cast<PredictorHandle>(predictor);
+  API_END();
+}
+
+int TreelitePredictorLoadLibrary(PredictorHandle handle,
+                                 const char* library_path) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  predictor_->Load(library_path);
+  API_END();
+}
+
+int TreelitePredictorLoadLibraryFromMemory(PredictorHandle handle,
+                                           const void* buf, size_t len) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  predictor_->LoadFromMemory(buf, len);
+  API_END();
+}
+
+int TreelitePredictorSetLoadOptions(PredictorHandle handle,
+                                    int bind_now,
+                                    const char* prefault,
+                                    size_t num_warmup_row) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  const std::string prefault_(prefault);
+  Predictor::LoadOptions options;
+  options.bind_now = static_cast<bool>(bind_now);
+  if (prefault_ == "none") {
+    options.prefault = Predictor::PrefaultMode::kNone;
+  } else if (prefault_ == "touch") {
+    options.prefault = Predictor::PrefaultMode::kTouch;
+  } else if (prefault_ == "lock") {
+    options.prefault = Predictor::PrefaultMode::kLock;
+  } else {
+    LOG(FATAL) << "Unknown prefault mode: " << prefault_;
+  }
+  options.num_warmup_row = num_warmup_row;
+  predictor_->SetLoadOptions(options);
+  API_END();
+}
+
+int TreelitePredictorReload(PredictorHandle handle,
+                            const char* library_path) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  predictor_->Reload(library_path);
+  API_END();
+}
+
+int TreelitePredictorSetSchedulingPolicy(PredictorHandle handle,
+                                         const char* policy,
+                                         size_t grain_size) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  const std::string policy_(policy);
+  if (policy_ == "static") {
+    predictor_->SetSchedulingPolicy(Predictor::SchedulingPolicy::kStatic,
+                                    grain_size);
+  } else if (policy_ == "work_stealing") {
+    predictor_->SetSchedulingPolicy(Predictor::SchedulingPolicy::kWorkStealing,
+                                    grain_size);
+  } else {
+    LOG(FATAL) << "Unknown scheduling policy: " << policy_;
+  }
+  API_END();
+}
+
+int TreelitePredictorSetMinWorkPerThread(PredictorHandle handle,
+                                         double min_work_per_thread) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  predictor_->SetMinWorkPerThread(min_work_per_thread);
+  API_END();
+}
+
+int TreelitePredictorSetAffinityPolicy(PredictorHandle handle,
+                                       const char* policy,
+                                       const int* cpu_list,
+                                       size_t num_cpu,
+                                       int numa_node) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  std::vector<int> cpu_list_;
+  if (cpu_list != nullptr) {
+    cpu_list_.assign(cpu_list, cpu_list + num_cpu);
+  }
+  predictor_->SetAffinityPolicy(ParseAffinityPolicy(policy), cpu_list_,
+                                numa_node);
+  API_END();
+}
+
+int TreelitePredictorSetWaitStrategy(PredictorHandle handle,
+                                     const char* strategy) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  predictor_->SetWaitStrategy(ParseWaitStrategy(strategy));
+  API_END();
+}
+
+int TreelitePredictorGetWorkerStats(PredictorHandle handle,
+                                    double* out_spin_time,
+                                    double* out_sleep_time,
+                                    double* out_work_time,
+                                    size_t* out_num_task) {
+  API_BEGIN();
+  const Predictor* predictor_ = static_cast<Predictor*>(handle);
+  const std::vector<Predictor::WorkerStats> stats
+    = predictor_->GetWorkerStats();
+  for (size_t i = 0; i < stats.size(); ++i) {
+    out_spin_time[i] = stats[i].spin_time;
+    out_sleep_time[i] = stats[i].sleep_time;
+    out_work_time[i] = stats[i].work_time;
+    out_num_task[i] = stats[i].num_task;
+  }
+  API_END();
+}
+
+int TreelitePredictorSetQueueDepth(PredictorHandle handle,
+                                   size_t queue_depth) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  predictor_->SetQueueDepth(queue_depth);
+  API_END();
+}
+
+int TreelitePredictorGetStats(PredictorHandle handle, const char** out_json) {
+  API_BEGIN();
+  const Predictor* predictor_ = static_cast<Predictor*>(handle);
+  const Predictor::Stats stats = predictor_->GetStats();
+  std::ostringstream oss;
+  oss.precision(9);
+  oss << "{\"model_version\": " << stats.model_version
+      << ", \"elapsed_time\": " << stats.elapsed_time
+      << ", \"num_batch\": " << stats.num_batch
+      << ", \"num_row\": " << stats.num_row
+      << ", \"rows_per_sec\": " << stats.rows_per_sec << ", ";
+  WriteLatencySummary(oss, "latency", stats.latency);
+  oss << ", ";
+  WriteLatencySummary(oss, "queue_wait", stats.queue_wait);
+  oss << ", ";
+  WriteLatencySummary(oss, "compute", stats.compute);
+  oss << ", ";
+  WriteLatencySummary(oss, "reshape", stats.reshape);
+  oss << ", \"worker\": [";
+  for (size_t i = 0; i < stats.worker.size(); ++i) {
+    const Predictor::WorkerStats& e = stats.worker[i];
+    oss << (i > 0 ? ", " : "") << "{\"spin_time\": " << e.spin_time
+        << ", \"sleep_time\": " << e.sleep_time
+        << ", \"work_time\": " << e.work_time
+        << ", \"num_task\": " << e.num_task << "}";
+  }
+  oss << "], \"load\": {\"open_time\": " << stats.load.open_time
+      << ", \"prefault_time\": " << stats.load.prefault_time
+      << ", \"worker_init_time\": " << stats.load.worker_init_time
+      << ", \"warmup_time\": " << stats.load.warmup_time
+      << ", \"total_time\": " << stats.load.total_time
+      << ", \"prefault_bytes\": " << stats.load.prefault_bytes
+      << ", \"locked\": " << (stats.load.locked ? "true" : "false") << "}}";
+  std::string& ret_str = TreeliteAPIThreadLocalStore::Get()->ret_str;
+  ret_str = oss.str();
+  *out_json = ret_str.c_str();
+  API_END();
+}
+
+int TreelitePredictorResetStats(PredictorHandle handle) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  predictor_->ResetStats();
+  API_END();
+}
+
+int TreelitePredictorDumpStats(PredictorHandle handle, const char* path) {
+  API_BEGIN();
+  const Predictor* predictor_ = static_cast<Predictor*>(handle);
+  predictor_->DumpStats(path);
+  API_END();
+}
+
+int TreeliteWorkerPoolCreate(int num_worker_thread,
+                             const char* affinity_policy,
+                             const int* cpu_list,
+                             size_t num_cpu,
+                             int numa_node,
+                             const char* wait_strategy,
+                             size_t queue_depth,
+                             WorkerPoolHandle* out) {
+  API_BEGIN();
+  std::vector<int> cpu_list_;
+  if (cpu_list != nullptr) {
+    cpu_list_.assign(cpu_list, cpu_list + num_cpu);
+  }
+  // the handle holds one reference to the pool
+  *out = static_cast<WorkerPoolHandle>(new std::shared_ptr<WorkerPool>(
+    Predictor::CreateWorkerPool(num_worker_thread,
+                                ParseAffinityPolicy(affinity_policy),
+                                cpu_list_, numa_node,
+                                ParseWaitStrategy(wait_strategy),
+                                queue_depth)));
+  API_END();
+}
+
+int TreeliteWorkerPoolFree(WorkerPoolHandle handle) {
+  API_BEGIN();
+  delete static_cast<std::shared_ptr<WorkerPool>*>(handle);
+  API_END();
+}
+
+int TreelitePredictorLoadWithWorkerPool(const char* library_path,
+                                        WorkerPoolHandle worker_pool,
+                                        int include_master_thread,
+                                        PredictorHandle* out) {
+  API_BEGIN();
+  Predictor* predictor = new Predictor(
+    *static_cast<std::shared_ptr<WorkerPool>*>(worker_pool),
+    static_cast<bool>(include_master_thread));
+  predictor->Load(library_path);
+  *out = static_cast<PredictorHandle>(predictor);
+  API_END();
+}
+
+int TreelitePredictorCreateWithWorkerPool(WorkerPoolHandle worker_pool,
+                                          int include_master_thread,
+                                          PredictorHandle* out) {
+  API_BEGIN();
+  Predictor* predictor = new Predictor(
+    *static_cast<std::shared_ptr<WorkerPool>*>(worker_pool),
+    static_cast<bool>(include_master_thread));
+  *out = static_cast<PredictorHandle>(predictor);
+  API_END();
+}
+
+int TreelitePredictorLoadFromMemoryWithWorkerPool(const void* buf, size_t len,
+                                                  WorkerPoolHandle worker_pool,
+                                                  int include_master_thread,
+                                                  PredictorHandle* out) {
+  API_BEGIN();
+  std::unique_ptr<Predictor> predictor(new Predictor(
+    *static_cast<std::shared_ptr<WorkerPool>*>(worker_pool),
+    static_cast<bool>(include_master_thread)));
+  predictor->LoadFromMemory(buf, len);
+  *out = static_cast<PredictorHandle>(predictor.release());
+  API_END();
+}
+
 int TreelitePredictorPredictBatch(PredictorHandle handle,
                                   void* batch,
                                   int batch_sparse,
@@ -89,19 +712,135 @@ int TreelitePredictorPredictBatch(PredictorHandle handle,
                                   float* out_result,
                                   size_t* out_result_size) {
   API_BEGIN();
+  PredictBatchVisitor visitor{static_cast<Predictor*>(handle), verbose,
+                              (pred_margin != 0), out_result, nullptr, false,
+                              0, nullptr};
+  VisitBatch(batch, batch_sparse, &visitor);
+  *out_result_size = visitor.result_size;
+  API_END();
+}
+
+int TreelitePredictorPredictBatchAsync(
+    PredictorHandle handle, void* batch, int batch_sparse, int verbose,
+    int pred_margin, float* out_result, TreelitePredictCallback callback,
+    void* callback_data, AsyncPredictionHandle* out) {
+  API_BEGIN();
+  Predictor::PredictCallback callback_ = nullptr;
+  if (callback != nullptr) {
+    callback_ = [callback, callback_data](size_t result_size) {
+      callback(callback_data, result_size);
+    };
+  }
+  PredictBatchVisitor visitor{static_cast<Predictor*>(handle), verbose,
+                              (pred_margin != 0), out_result, callback_, true,
+                              0, nullptr};
+  VisitBatch(batch, batch_sparse, &visitor);
+  *out = visitor.async_handle;
+  API_END();
+}
+
+int TreelitePredictorPoll(PredictorHandle handle,
+                          AsyncPredictionHandle prediction,
+                          int* out_done) {
+  API_BEGIN();
+  const Predictor* predictor_ = static_cast<Predictor*>(handle);
+  *out_done = predictor_->Poll(prediction) ? 1 : 0;
+  API_END();
+}
+
+int TreelitePredictorWait(PredictorHandle handle,
+                          AsyncPredictionHandle prediction,
+                          size_t* out_result_size) {
+  API_BEGIN();
   Predictor* predictor_ = static_cast<Predictor*>(handle);
-  if (batch_sparse) {
-    const CSRBatch* batch_ = static_cast<CSRBatch*>(batch);
-    *out_result_size = predictor_->PredictBatch(batch_, verbose,
-                                               (pred_margin != 0), out_result);
+  *out_result_size = predictor_->Wait(prediction);
+  API_END();
+}
+
+int TreelitePredictorCreateCompletionQueue(PredictorHandle handle,
+                                           CompletionQueueHandle* out) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  *out = predictor_->CreateCompletionQueue();
+  API_END();
+}
+
+int TreelitePredictorFreeCompletionQueue(PredictorHandle handle,
+                                         CompletionQueueHandle cq) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  predictor_->FreeCompletionQueue(cq);
+  API_END();
+}
+
+int TreelitePredictorSubmitBatches(
+    PredictorHandle handle, void* const* batches, int batch_sparse,
+    size_t num_batch, int verbose, int pred_margin, float* const* out_results,
+    CompletionQueueHandle cq, uint64_t* out_first_seq_id) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  if (num_batch == 0) {  // no batch to take the types from
+    *out_first_seq_id = predictor_->SubmitBatches(
+      static_cast<const DenseBatch* const*>(nullptr), 0, verbose,
+      (pred_margin != 0), out_results, cq);
   } else {
-    const DenseBatch* batch_ = static_cast<DenseBatch*>(batch);
-    *out_result_size = predictor_->PredictBatch(batch_, verbose,
-                                               (pred_margin != 0), out_result);
+    for (size_t i = 1; i < num_batch; ++i) {
+      CHECK(IsSameBatchType(batches[0], batches[i], batch_sparse))
+        << "All batches must hold arrays of the same types";
+    }
+    SubmitBatchesVisitor visitor{predictor_, batches, batch_sparse, num_batch,
+                                 verbose, (pred_margin != 0), out_results, cq,
+                                 0};
+    VisitBatch(batches[0], batch_sparse, &visitor);
+    *out_first_seq_id = visitor.first_seq_id;
   }
   API_END();
 }
 
+int TreelitePredictorWaitNext(PredictorHandle handle,
+                              CompletionQueueHandle cq,
+                              uint64_t* out_seq_id,
+                              size_t* out_result_size) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  const Predictor::Completion completion = predictor_->WaitNext(cq);
+  *out_seq_id = completion.seq_id;
+  *out_result_size = completion.result_size;
+  API_END();
+}
+
+int TreelitePredictorTryNext(PredictorHandle handle,
+                             CompletionQueueHandle cq,
+                             int* out_found,
+                             uint64_t* out_seq_id,
+                             size_t* out_result_size) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  Predictor::Completion completion;
+  if (predictor_->TryNext(cq, &completion)) {
+    *out_found = 1;
+    *out_seq_id = completion.seq_id;
+    *out_result_size = completion.result_size;
+  } else {
+    *out_found = 0;
+  }
+  API_END();
+}
+
+int TreelitePredictorPredictFile(PredictorHandle handle,
+                                 const char* input_uri,
+                                 const char* format,
+                                 const char* output_uri,
+                                 int pred_margin,
+                                 int verbose,
+                                 size_t* out_num_row) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  *out_num_row = predictor_->PredictFile(input_uri, format, output_uri,
+                                         (pred_margin != 0), verbose);
+  API_END();
+}
+
 int TreelitePredictorPredictInst(PredictorHandle handle,
                                  union TreelitePredictorEntry* inst,
                                  int pred_margin,
@@ -113,6 +852,30 @@ int TreelitePredictorPredictInst(PredictorHandle handle,
   API_END();
 }
 
+int TreelitePredictorSetCoalescing(PredictorHandle handle,
+                                   size_t max_batch_size,
+                                   uint32_t max_delay_us) {
+  API_BEGIN();
+  Predictor* predictor_ = static_cast<Predictor*>(handle);
+  predictor_->SetCoalescing(max_batch_size, max_delay_us);
+  API_END();
+}
+
+int TreelitePredictorGetCoalescingStats(PredictorHandle handle,
+                                        size_t* out_num_request,
+                                        size_t* out_num_batch,
+                                        size_t* out_num_full_batch,
+                                        double* out_coalescing_ratio) {
+  API_BEGIN();
+  const Predictor* predictor_ = static_cast<Predictor*>(handle);
+  const Predictor::CoalescingStats stats = predictor_->GetCoalescingStats();
+  *out_num_request = stats.num_request;
+  *out_num_batch = stats.num_batch;
+  *out_num_full_batch = stats.num_full_batch;
+  *out_coalescing_ratio = stats.coalescing_ratio;
+  API_END();
+}
+
 int TreelitePredictorQueryResultSize(PredictorHandle handle,
                                      void* batch,
                                      int batch_sparse,
@@ -120,11 +883,11 @@ int TreelitePredictorQueryResultSize(PredictorHandle handle,
   API_BEGIN();
   const Predictor* predictor_ = static_cast<Predictor*>(handle);
   if (batch_sparse) {
-    const CSRBatch* batch_ = static_cast<CSRBatch*>(batch);
-    *out = predictor_->QueryResultSize(batch_);
+    *out = predictor_->QueryResultSize(
+      &static_cast<SparseBatchHolder*>(batch)->batch);
   } else {
-    const DenseBatch* batch_ = static_cast<DenseBatch*>(batch);
-    *out = predictor_->QueryResultSize(batch_);
+    *out = predictor_->QueryResultSize(
+      &static_cast<DenseBatchHolder*>(batch)->batch);
   }
   API_END();
 }
@@ -151,6 +914,30 @@ int TreelitePredictorQueryNumFeature(PredictorHandle handle, size_t* out) {
   API_END();
 }
 
+int TreelitePredictorQueryNumWorkerThread(PredictorHandle handle,
+                                          size_t* out) {
+  API_BEGIN();
+  const Predictor* predictor_ = static_cast<Predictor*>(handle);
+  *out = static_cast<size_t>(predictor_->QueryNumWorkerThread());
+  API_END();
+}
+
+int TreelitePredictorQueryWorkerCPUs(PredictorHandle handle, int* out) {
+  API_BEGIN();
+  const Predictor* predictor_ = static_cast<Predictor*>(handle);
+  const std::vector<int> cpus = predictor_->QueryWorkerCPUs();
+  std::copy(cpus.begin(), cpus.end(), out);
+  API_END();
+}
+
+int TreelitePredictorQueryModelVersion(PredictorHandle handle,
+                                       uint64_t* out) {
+  API_BEGIN();
+  const Predictor* predictor_ = static_cast<Predictor*>(handle);
+  *out = predictor_->QueryModelVersion();
+  API_END();
+}
+
 int TreelitePredictorFree(PredictorHandle handle) {
   API_BEGIN();
   delete static_cast<Predictor*>(handle);
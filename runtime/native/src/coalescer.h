@@ -0,0 +1,176 @@
+/*!
+* Copyright by 2018 Contributors
+* \file coalescer.h
+* \brief Merging of concurrent single-row predictions into small batches
+* \author Philip Cho
+*/
+#ifndef TREELITE_COALESCER_H_
+#define TREELITE_COALESCER_H_
+
+#include <treelite/entry.h>
+#include <treelite/predictor.h>
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "common/math.h"
+
+namespace treelite {
+
+/*!
+ * \brief Merges single-row predictions requested by many threads at once
+ *        into small batches. The first caller to arrive becomes the leader
+ *        of a new batch: it waits until either the batch is full or the
+ *        deadline passes, then predicts the whole batch at once and hands
+ *        every caller its result. Other callers only add their row to the
+ *        open batch and wait. There is no background thread; while a leader
+ *        is busy predicting, the next caller to arrive starts a new batch.
+ */
+class Coalescer {
+ public:
+  /*!
+   * \brief function to predict a dense batch; returns the length of output
+   */
+  using PredictFunc
+    = std::function<size_t(const DenseBatch*, bool, float*)>;
+
+  /*!
+   * \param num_feature number of features in each row
+   * \param num_output_group maximum number of outputs for each row
+   * \param max_batch_size number of rows at which a batch is closed at once
+   * \param max_delay_us time, in microseconds, the first row of a batch
+   *                     waits for more rows to arrive
+   * \param func function to predict a batch
+   */
+  Coalescer(size_t num_feature, size_t num_output_group, size_t max_batch_size,
+            uint32_t max_delay_us, PredictFunc func)
+    : num_feature_(num_feature), num_output_group_(num_output_group),
+      max_batch_size_(max_batch_size), max_delay_(max_delay_us),
+      func_(func), num_request_(0), num_batch_(0), num_full_batch_(0) {
+    CHECK_GT(max_batch_size, 0);
+  }
+
+  /*!
+   * \brief make a prediction for a single row, along with other rows
+   *        requested at about the same time. Rows are copied into a dense
+   *        batch with NaN marking missing values, so a present entry holding
+   *        NaN is rejected, as it is in dense batches.
+   * \return length of the output for the row
+   */
+  inline size_t Predict(const TreelitePredictorEntry* inst, bool pred_margin,
+                        float* out_result) {
+    // check before joining a batch, so that a bad row doesn't leave a batch
+    // behind without a leader
+    for (size_t i = 0; i < num_feature_; ++i) {
+      CHECK(inst[i].missing == -1 || !common::math::CheckNAN(inst[i].fvalue))
+        << "The missing_value argument must be set to NaN if there is any "
+        << "NaN in the matrix.";
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    // rows of a batch must all want margins or all want probabilities
+    std::shared_ptr<Batch>& slot = open_batch_[pred_margin ? 1 : 0];
+    const bool leader = !slot;
+    if (leader) {
+      slot = std::make_shared<Batch>(max_batch_size_ * num_feature_);
+    }
+    std::shared_ptr<Batch> batch = slot;
+    float* row = &batch->data[batch->out.size() * num_feature_];
+    for (size_t i = 0; i < num_feature_; ++i) {
+      row[i] = (inst[i].missing == -1)
+               ? std::numeric_limits<float>::quiet_NaN() : inst[i].fvalue;
+    }
+    batch->out.push_back(out_result);
+    ++num_request_;
+    if (batch->out.size() == max_batch_size_) {
+      // full; close the batch and let the leader know
+      slot.reset();
+      ++num_full_batch_;
+      leader_cv_.notify_all();
+    }
+
+    if (!leader) {
+      batch->done_cv.wait(lock, [&batch] { return batch->done; });
+      if (batch->error) {
+        std::rethrow_exception(batch->error);
+      }
+      return batch->result_size_per_row;
+    }
+
+    leader_cv_.wait_until(lock, std::chrono::steady_clock::now() + max_delay_,
+                          [&slot, &batch] { return slot != batch; });
+    if (slot == batch) {  // deadline passed before the batch filled up
+      slot.reset();
+    }
+    ++num_batch_;
+    lock.unlock();  // no more rows can be added to the batch
+
+    const size_t num_row = batch->out.size();
+    try {
+      DenseBatch dense_batch{batch->data.data(),
+                             std::numeric_limits<float>::quiet_NaN(),
+                             num_row, num_feature_};
+      std::vector<float> out(num_row * num_output_group_);
+      const size_t result_size = func_(&dense_batch, pred_margin, out.data());
+      batch->result_size_per_row = result_size / num_row;
+      for (size_t i = 0; i < num_row; ++i) {
+        std::copy(&out[i * batch->result_size_per_row],
+                  &out[(i + 1) * batch->result_size_per_row], batch->out[i]);
+      }
+    } catch (...) {
+      batch->error = std::current_exception();
+    }
+
+    lock.lock();
+    batch->done = true;
+    batch->done_cv.notify_all();
+    if (batch->error) {
+      std::rethrow_exception(batch->error);
+    }
+    return batch->result_size_per_row;
+  }
+
+  /*! \brief get the number of rows and batches predicted so far */
+  inline void GetStats(size_t* out_num_request, size_t* out_num_batch,
+                       size_t* out_num_full_batch) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *out_num_request = num_request_;
+    *out_num_batch = num_batch_;
+    *out_num_full_batch = num_full_batch_;
+  }
+
+ private:
+  struct Batch {
+    explicit Batch(size_t num_entry)
+      : data(num_entry), result_size_per_row(0), done(false) {}
+    std::vector<float> data;  // rows, laid out in the order they arrived
+    std::vector<float*> out;  // where each row's output goes
+    size_t result_size_per_row;
+    bool done;
+    std::exception_ptr error;  // raised while predicting the batch
+    std::condition_variable done_cv;
+  };
+
+  size_t num_feature_;
+  size_t num_output_group_;
+  size_t max_batch_size_;
+  std::chrono::microseconds max_delay_;
+  PredictFunc func_;
+  // batch accepting rows, one for margins and one for probabilities
+  std::shared_ptr<Batch> open_batch_[2];
+  size_t num_request_;
+  size_t num_batch_;
+  size_t num_full_batch_;  // batches closed for being full
+  mutable std::mutex mutex_;
+  std::condition_variable leader_cv_;
+};
+
+}  // namespace treelite
+
+#endif  // TREELITE_COALESCER_H_
@@ -0,0 +1,153 @@
+/*!
+ * Copyright (c) 2018 by Contributors
+ * \file predict_file.cc
+ * \author Philip Cho
+ * \brief Make predictions for a data file, one chunk of rows at a time
+ */
+
+#include <treelite/predictor.h>
+#include <dmlc/data.h>
+#include <dmlc/io.h>
+#include <dmlc/logging.h>
+#include <dmlc/timer.h>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace {
+
+// rows copied out of the parser, along with room for their predictions.
+// Buffers are kept between chunks, so that memory use is set by the size of
+// the largest chunk rather than by the size of the file.
+struct Chunk {
+  std::vector<float> data;
+  std::vector<uint32_t> col_ind;
+  std::vector<size_t> row_ptr;
+  std::vector<float> out_result;
+  treelite::CSRBatch batch;
+};
+
+// the parser re-uses its memory once it moves on, so the rows have to be
+// copied for them to be predicted while the next chunk is being parsed
+void FillChunk(const dmlc::RowBlock<uint32_t>& block, size_t num_output_group,
+               Chunk* chunk) {
+  const size_t begin = block.offset[0];
+  const size_t end = block.offset[block.size];
+  chunk->data.resize(end - begin);
+  chunk->col_ind.assign(block.index + begin, block.index + end);
+  for (size_t i = begin; i < end; ++i) {
+    chunk->data[i - begin]
+      = (block.value == nullptr) ? 1.0f : static_cast<float>(block.value[i]);
+  }
+  chunk->row_ptr.resize(block.size + 1);
+  for (size_t i = 0; i <= block.size; ++i) {
+    chunk->row_ptr[i] = block.offset[i] - begin;
+  }
+  const uint32_t max_col_ind = chunk->col_ind.empty() ? 0
+    : *std::max_element(chunk->col_ind.begin(), chunk->col_ind.end());
+  chunk->out_result.resize(block.size * num_output_group);
+  chunk->batch = treelite::CSRBatch{chunk->data.data(),
+                                    chunk->col_ind.data(),
+                                    chunk->row_ptr.data(), block.size,
+                                    static_cast<size_t>(max_col_ind) + 1};
+}
+
+// write one line per row, with comma-separated outputs
+void WriteChunk(const Chunk& chunk, size_t result_size, std::ostream* os) {
+  const size_t num_row = chunk.batch.num_row;
+  const size_t num_output = result_size / num_row;
+  const float* out_result = chunk.out_result.data();
+  for (size_t rid = 0; rid < num_row; ++rid) {
+    for (size_t k = 0; k < num_output; ++k) {
+      if (k > 0) {
+        *os << ',';
+      }
+      *os << out_result[rid * num_output + k];
+    }
+    *os << '\n';
+  }
+}
+
+// advance to the next non-empty block of rows
+bool NextBlock(dmlc::Parser<uint32_t>* parser) {
+  while (parser->Next()) {
+    if (parser->Value().size > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // anonymous namespace
+
+namespace treelite {
+
+size_t
+Predictor::PredictFile(const char* input_uri, const char* format,
+                       const char* output_uri, bool pred_margin,
+                       int verbose) {
+  CHECK(loaded_)
+    << "A shared library needs to be loaded first using Load()";
+  const double tstart = dmlc::GetTime();
+  std::unique_ptr<dmlc::Parser<uint32_t>> parser(
+    dmlc::Parser<uint32_t>::Create(input_uri, 0, 1, format));
+  std::unique_ptr<dmlc::Stream> fo(dmlc::Stream::Create(output_uri, "w"));
+  dmlc::ostream os(fo.get());
+  os.precision(std::numeric_limits<float>::max_digits10);
+
+  // A chunk is predicted on the worker threads while the calling thread
+  // parses the next chunk and writes out the previous one
+  Chunk chunk[2];
+  // make sure no prediction is left writing into the chunks if an error is
+  // raised halfway; declared after the chunks so that it goes first
+  struct PendingGuard {
+    Predictor* predictor;
+    AsyncHandle handle;
+    ~PendingGuard() {
+      if (handle != nullptr) {
+        // the error that got us here is the one to report
+        try {
+          predictor->Wait(handle);
+        } catch (...) {}
+      }
+    }
+  } pending{this, nullptr};
+
+  size_t num_row = 0, num_chunk = 0;
+  parser->BeforeFirst();
+  bool has_next = NextBlock(parser.get());
+  if (has_next) {
+    FillChunk(parser->Value(), num_output_group_, &chunk[0]);
+    pending.handle = PredictBatchAsync(&chunk[0].batch, 0, pred_margin,
+                                       chunk[0].out_result.data());
+  }
+  for (int cur = 0; has_next; cur = 1 - cur) {
+    Chunk& current = chunk[cur];
+    Chunk& next = chunk[1 - cur];
+    has_next = NextBlock(parser.get());
+    if (has_next) {
+      FillChunk(parser->Value(), num_output_group_, &next);
+    }
+    AsyncHandle handle = pending.handle;
+    pending.handle = nullptr;
+    const size_t result_size = Wait(handle);
+    if (has_next) {
+      pending.handle = PredictBatchAsync(&next.batch, 0, pred_margin,
+                                         next.out_result.data());
+    }
+    WriteChunk(current, result_size, &os);
+    num_row += current.batch.num_row;
+    ++num_chunk;
+  }
+  os.flush();
+  CHECK(os) << "Failed to write to `" << output_uri << "'";
+  if (verbose > 0) {
+    LOG(INFO) << "Treelite: Predicted " << num_row << " rows in " << num_chunk
+              << " chunk(s), taking " << dmlc::GetTime() - tstart << " sec";
+  }
+  return num_row;
+}
+
+}  // namespace treelite
@@ -12,42 +12,101 @@
 #include <dmlc/timer.h>
 #include <cstdint>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <memory>
+#include <mutex>
 #include <fstream>
 #include <limits>
 #include <functional>
+#include <sstream>
 #include <type_traits>
+#include <utility>
 #include "common/math.h"
 #include "common/filesystem.h"
 #include "thread_pool/thread_pool.h"
+#include "thread_pool/work_stealing.h"
+#include "thread_pool/affinity.h"
+#include "scratch_buffer.h"
+#include "stats.h"
+#include "coalescer.h"
 
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
 #else
 #include <dlfcn.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#ifdef __linux__
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
 #endif
 
 namespace {
 
 enum class InputType : uint8_t {
-  kSparseBatch = 0, kDenseBatch = 1, kSingleInst = 2
+  kSparseBatch = 0, kDenseBatch = 1, kSingleInst = 2,
+  kInitWorker = 3  // allocate the worker's scratch buffer
 };
 
+struct InputToken;
+struct OutputToken;
+using PredThreadPool = treelite::ThreadPool<InputToken, OutputToken>;
+
+// runs PredictRows_() on a batch task, with the batch cast back to its type
+using PredictRowsFunc = size_t (*)(const InputToken&, const PredThreadPool*,
+                                   int);
+
 struct InputToken {
   InputType input_type;
   const void* data;
+  PredictRowsFunc predict_rows;  // set for batches only
   bool pred_margin;
   size_t num_output_group;
+  size_t num_feature;
   treelite::Predictor::PredFuncHandle pred_func_handle;
+  treelite::Predictor::PredFuncHandle pred_batch_func_handle;
+  treelite::Predictor::PredFuncHandle pred_dense_func_handle;
+  treelite::Predictor::PredFuncHandle pred_masked_func_handle;
   size_t rbegin, rend;
+  // if not null, ignore [rbegin, rend) and obtain rows from the scheduler
+  treelite::WorkStealingRange* row_scheduler;
+  int participant_id;
+  // buffer for laying out rows; if null, the worker running the task uses
+  // its own buffer from [scratch_pool]
+  treelite::ScratchBuffer* scratch;
+  treelite::ScratchPool* scratch_pool;
   float* out_pred;
+  // when the batch was submitted, to measure how long the task was queued
+  std::chrono::steady_clock::time_point tsubmit;
 };
 
 struct OutputToken {
   size_t query_result_size;
+  // time between submission and start of the task, and time spent on it
+  uint64_t queue_ns;
+  uint64_t compute_ns;
 };
 
+inline uint64_t ElapsedNanoseconds(std::chrono::steady_clock::time_point from,
+                                   std::chrono::steady_clock::time_point to) {
+  return (to > from)
+    ? static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count())
+    : 0;
+}
+
 inline std::string GetProtocol(const char* name) {
   const char *p = std::strstr(name, "://");
   if (p == NULL) {
@@ -57,14 +116,87 @@ inline std::string GetProtocol(const char* name) {
   }
 }
 
-using PredThreadPool
-  = treelite::ThreadPool<InputToken, OutputToken, treelite::Predictor>;
+using PredTaskGroup = PredThreadPool::TaskGroupType;
 
-inline treelite::Predictor::LibraryHandle OpenLibrary(const char* name) {
+// State of a single call to PredictBatch() or PredictBatchAsync(); must stay
+// alive until all of its tasks have finished
+struct BatchJob {
+  BatchJob(int num_task, size_t num_row, size_t num_output_group,
+           float* out_result, treelite::Predictor::PredictCallback callback,
+           treelite::StatsCollector* stats)
+    : group(num_task,
+            [this](const std::vector<OutputToken>& response) {
+              Finalize(response);
+            }),
+      num_row(num_row), num_output_group(num_output_group),
+      out_result(out_result), result_size(0), callback(callback),
+      stats(stats) {}
+
+  // called once, by whichever thread finishes the last task
+  void Finalize(const std::vector<OutputToken>& response) {
+    // a failed batch has no output to compact; Wait() reports the error
+    if (group.HasError()) {
+      if (callback) {
+        callback(0);
+      }
+      return;
+    }
+    // the batch is held up by its slowest task
+    uint64_t queue_ns = 0, compute_ns = 0;
+    for (const OutputToken& e : response) {
+      result_size += e.query_result_size;
+      queue_ns = std::max(queue_ns, e.queue_ns);
+      compute_ns = std::max(compute_ns, e.compute_ns);
+    }
+    const auto treshape = std::chrono::steady_clock::now();
+    // re-shape output if result_size < dimension of out_result. This has to
+    // wait until all rows are done, since the compacted output of one range
+    // of rows overlaps the uncompacted output of the next.
+    if (result_size < num_row * num_output_group) {
+      CHECK_GT(num_output_group, 1);
+      CHECK_EQ(result_size % num_row, 0);
+      const size_t query_size_per_instance = result_size / num_row;
+      CHECK_GT(query_size_per_instance, 0);
+      CHECK_LT(query_size_per_instance, num_output_group);
+      for (size_t rid = 0; rid < num_row; ++rid) {
+        for (size_t k = 0; k < query_size_per_instance; ++k) {
+          out_result[rid * query_size_per_instance + k]
+            = out_result[rid * num_output_group + k];
+        }
+      }
+    }
+    const auto tend = std::chrono::steady_clock::now();
+    stats->RecordBatch(num_row, ElapsedNanoseconds(tsubmit, tend), queue_ns,
+                       compute_ns, ElapsedNanoseconds(treshape, tend));
+    if (callback) {
+      callback(result_size);
+    }
+  }
+
+  PredTaskGroup group;
+  std::unique_ptr<treelite::WorkStealingRange> row_scheduler;
+  size_t num_row;
+  size_t num_output_group;
+  float* out_result;
+  size_t result_size;
+  treelite::Predictor::PredictCallback callback;
+  treelite::StatsCollector* stats;
+  // library the batch is predicted with; kept loaded until the job is
+  // released, even if the predictor moves on to another library
+  std::shared_ptr<treelite::LoadedLibrary> library;
+  std::chrono::steady_clock::time_point tsubmit;
+  double tstart;
+  int verbose;
+};
+
+// If [bind_now] is set, all symbols are resolved right away rather than on
+// first use (not applicable to Windows, which always does so)
+inline treelite::Predictor::LibraryHandle OpenLibrary(const char* name,
+                                                      bool bind_now) {
 #ifdef _WIN32
   HMODULE handle = LoadLibraryA(name);
 #else
-  void* handle = dlopen(name, RTLD_LAZY | RTLD_LOCAL);
+  void* handle = dlopen(name, (bind_now ? RTLD_NOW : RTLD_LAZY) | RTLD_LOCAL);
 #endif
   return static_cast<treelite::Predictor::LibraryHandle>(handle);
 }
@@ -77,6 +209,131 @@ inline void CloseLibrary(treelite::Predictor::LibraryHandle handle) {
 #endif
 }
 
+// Create an anonymous file that lives in memory, and copy [len] bytes from
+// [buf] into it. Returns the file descriptor, or -1 if this isn't supported
+// (anywhere other than Linux 3.17 or later).
+inline int CreateMemoryFile(const char* name, const void* buf, size_t len) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+  const int fd
+    = static_cast<int>(syscall(SYS_memfd_create, name, MFD_CLOEXEC));
+  if (fd < 0) {
+    return -1;
+  }
+  const char* p = static_cast<const char*>(buf);
+  while (len > 0) {
+    const ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      return -1;
+    }
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+#ifdef __linux__
+// loadable segments of the library containing [addr], as [begin, end)
+struct SegmentSearch {
+  uintptr_t addr;
+  std::vector<std::pair<uintptr_t, uintptr_t>> segments;
+};
+
+int FindSegments(struct dl_phdr_info* info, size_t, void* data) {
+  SegmentSearch* search = static_cast<SegmentSearch*>(data);
+  bool found = false;
+  for (int i = 0; i < info->dlpi_phnum && !found; ++i) {
+    const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+    const uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+    found = (phdr.p_type == PT_LOAD && search->addr >= begin
+             && search->addr < begin + phdr.p_memsz);
+  }
+  if (!found) {
+    return 0;  // some other library; keep looking
+  }
+  for (int i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+    if (phdr.p_type == PT_LOAD) {
+      const uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+      search->segments.emplace_back(begin, begin + phdr.p_memsz);
+    }
+  }
+  return 1;
+}
+#endif
+
+// Bring every page of the code and data of the library containing [addr]
+// into memory, by reading each page once or, if [lock] is set, by locking
+// the pages with mlock(). Returns the number of bytes covered; sets
+// [out_locked] if all of them were locked. Does nothing outside Linux.
+inline size_t PrefaultLibrary(const void* addr, bool lock, bool* out_locked) {
+  *out_locked = false;
+#ifdef __linux__
+  SegmentSearch search{reinterpret_cast<uintptr_t>(addr), {}};
+  dl_iterate_phdr(FindSegments, &search);
+  const uintptr_t page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  size_t total = 0;
+  for (const auto& e : search.segments) {
+    const uintptr_t begin = e.first & ~(page_size - 1);
+    const uintptr_t end = (e.second + page_size - 1) & ~(page_size - 1);
+    if (lock && mlock(reinterpret_cast<void*>(begin), end - begin) != 0) {
+      LOG(WARNING) << "Couldn't lock the library in memory ("
+                   << std::strerror(errno) << "); reading its pages instead."
+                   << " Consider raising RLIMIT_MEMLOCK.";
+      lock = false;
+    }
+    if (!lock) {
+      for (uintptr_t p = begin; p < end; p += page_size) {
+        (void)*reinterpret_cast<const volatile char*>(p);
+      }
+    }
+    total += end - begin;
+  }
+  *out_locked = (lock && !search.segments.empty());
+  return total;
+#else
+  return 0;
+#endif
+}
+
+// Fill [num_row] rows of [num_feature] made-up feature values, for warming
+// up a library. Values are spread over many orders of magnitude and both
+// signs, with some small integers and some missing values mixed in, so that
+// the rows go down many different paths of the trees.
+inline void FillSyntheticRows(size_t num_row, size_t num_feature,
+                              float* out) {
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  for (size_t i = 0; i < num_row * num_feature; ++i) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    const uint32_t r = static_cast<uint32_t>(state >> 32);
+    if (r % 8 == 0) {
+      out[i] = std::numeric_limits<float>::quiet_NaN();
+    } else if (r % 8 == 1) {
+      out[i] = static_cast<float>((r >> 8) % 16);
+    } else {
+      // magnitude between 1e-3 and 1e3
+      const double exponent = ((r >> 8) % 4096) / 4096.0 * 6.0 - 3.0;
+      out[i] = static_cast<float>(((r >> 4) & 1) ? -std::pow(10.0, exponent)
+                                                 : std::pow(10.0, exponent));
+    }
+  }
+}
+
+// name given to libraries loaded with LoadFromMemory(), for messages
+const char* const kMemoryLibraryName = "libtreelite_predictor.so";
+
+inline void CloseMemoryFile(int fd) {
+#ifndef _WIN32
+  close(fd);
+#endif
+}
+
 template <typename HandleType>
 inline HandleType LoadFunction(treelite::Predictor::LibraryHandle lib_handle,
                                const char* name) {
@@ -88,43 +345,152 @@ inline HandleType LoadFunction(treelite::Predictor::LibraryHandle lib_handle,
   return static_cast<HandleType>(func_handle);
 }
 
-template <typename PredFunc>
-inline size_t PredLoop(const treelite::CSRBatch* batch,
+// default minimum amount of work (in tree nodes visited) worth handing to
+// another thread. Passing a task through a worker's queue and waiting for it
+// to finish costs roughly as much as visiting this many nodes.
+const constexpr double kMinWorkPerThread = 20000.0;
+
+// maximum number of rows to pass to the batch prediction function at once
+const constexpr size_t kMaxBlockSize = 32;
+// maximum size (in bytes) of the buffer holding a block of rows; this keeps
+// the buffer from crowding the model out of cache when rows are wide
+const constexpr size_t kMaxBlockBytes = 256 * 1024;
+
+/*!
+ * \brief choose how many rows to evaluate at once with the batch prediction
+ *        function. Returns 1 if rows should be evaluated one at a time.
+ */
+inline size_t GetBlockSize(
+    treelite::Predictor::PredFuncHandle pred_batch_func_handle,
+    size_t num_feature) {
+  if (pred_batch_func_handle == nullptr) {
+    return 1;
+  }
+  const size_t row_bytes = num_feature * sizeof(TreelitePredictorEntry);
+  return std::max(static_cast<size_t>(1),
+                  std::min(kMaxBlockSize, kMaxBlockBytes / row_bytes));
+}
+
+// Convert a feature value to float, the type the prediction functions take
+inline float ToFloat(float value) {
+  return value;
+}
+
+inline float ToFloat(double value) {
+  return static_cast<float>(value);
+}
+
+inline float ToFloat(int32_t value) {
+  return static_cast<float>(value);
+}
+
+inline float ToFloat(int64_t value) {
+  return static_cast<float>(value);
+}
+
+inline float ToFloat(treelite::Float16 value) {
+  const uint32_t sign = static_cast<uint32_t>(value.bits & 0x8000U) << 16;
+  const uint32_t exponent = (value.bits >> 10) & 0x1FU;
+  const uint32_t mantissa = value.bits & 0x3FFU;
+  uint32_t bits;
+  if (exponent == 0x1FU) {         // infinity or NaN
+    bits = sign | 0x7F800000U | (mantissa << 13);
+  } else if (exponent != 0) {      // normal number
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {      // zero
+    bits = sign;
+  } else {                         // subnormal; exact in float as well
+    const float magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -magnitude : magnitude;
+  }
+  float out;
+  std::memcpy(&out, &bits, sizeof(out));
+  return out;
+}
+
+// func(rid, nrow, inst, out_pred) makes predictions for rows
+// [rid, rid + nrow), which have been laid out in inst[] with stride of
+// [num_feature] entries. nrow is always 1 unless block_size > 1.
+// The rows are laid out in [scratch], which must hold at least
+// [block_size] * [num_feature] entries.
+template <typename ElementType, typename IndexType, typename OffsetType,
+          typename PredFunc>
+inline size_t PredLoop(const treelite::CSRBatchT<ElementType, IndexType,
+                                                 OffsetType>* batch,
+                       size_t num_feature, size_t block_size,
+                       treelite::ScratchBuffer* scratch,
                        size_t rbegin, size_t rend,
                        float* out_pred, PredFunc func) {
-  std::vector<TreelitePredictorEntry> inst(batch->num_col, {-1});
+  const size_t stride = num_feature;
+  CHECK_GE(scratch->Size(), block_size * stride);
+  TreelitePredictorEntry* inst = scratch->Acquire();
   CHECK(rbegin < rend && rend <= batch->num_row);
   CHECK(sizeof(size_t) < sizeof(int64_t)
      || (rbegin <= static_cast<size_t>(std::numeric_limits<int64_t>::max())
         && rend <= static_cast<size_t>(std::numeric_limits<int64_t>::max())));
   const int64_t rbegin_ = static_cast<int64_t>(rbegin);
   const int64_t rend_ = static_cast<int64_t>(rend);
-  const size_t num_col = batch->num_col;
-  const float* data = batch->data;
-  const uint32_t* col_ind = batch->col_ind;
-  const size_t* row_ptr = batch->row_ptr;
+  const ElementType* data = batch->data;
+  const IndexType* col_ind = batch->col_ind;
+  const OffsetType* row_ptr = batch->row_ptr;
+  const int64_t block_size_ = static_cast<int64_t>(block_size);
   size_t total_output_size = 0;
-  for (int64_t rid = rbegin_; rid < rend_; ++rid) {
-    const size_t ibegin = row_ptr[rid];
-    const size_t iend = row_ptr[rid + 1];
-    for (size_t i = ibegin; i < iend; ++i) {
-      inst[col_ind[i]].fvalue = data[i];
+  for (int64_t rid = rbegin_; rid < rend_; rid += block_size_) {
+    const int64_t nrow = std::min(block_size_, rend_ - rid);
+    for (int64_t k = 0; k < nrow; ++k) {
+      TreelitePredictorEntry* row = &inst[k * stride];
+      const size_t ibegin = static_cast<size_t>(row_ptr[rid + k]);
+      const size_t iend = static_cast<size_t>(row_ptr[rid + k + 1]);
+      // features the model doesn't know about are never looked at; negative
+      // indices wrap around to large ones and are skipped as well
+      for (size_t i = ibegin; i < iend; ++i) {
+        const size_t j = static_cast<size_t>(col_ind[i]);
+        if (j < stride) {
+          row[j].fvalue = ToFloat(data[i]);
+        }
+      }
     }
-    total_output_size += func(rid, &inst[0], out_pred);
-    for (size_t i = ibegin; i < iend; ++i) {
-      inst[col_ind[i]].missing = -1;
+    total_output_size += func(rid, nrow, inst, out_pred);
+    for (int64_t k = 0; k < nrow; ++k) {
+      TreelitePredictorEntry* row = &inst[k * stride];
+      const size_t ibegin = static_cast<size_t>(row_ptr[rid + k]);
+      const size_t iend = static_cast<size_t>(row_ptr[rid + k + 1]);
+      for (size_t i = ibegin; i < iend; ++i) {
+        const size_t j = static_cast<size_t>(col_ind[i]);
+        if (j < stride) {
+          row[j].missing = -1;
+        }
+      }
     }
   }
+  scratch->Release();
   return total_output_size;
 }
 
-template <typename PredFunc>
-inline size_t PredLoop(const treelite::DenseBatch* batch,
+// distance between rows and between columns of a dense batch, in elements
+template <typename ElementType>
+inline void GetStrides(const treelite::DenseBatchT<ElementType>* batch,
+                       size_t* out_row_stride, size_t* out_col_stride) {
+  if (batch->row_stride == 0 && batch->col_stride == 0) {
+    *out_row_stride = batch->num_col;  // row-major and contiguous
+    *out_col_stride = 1;
+  } else {
+    *out_row_stride = batch->row_stride;
+    *out_col_stride = batch->col_stride;
+  }
+}
+
+template <typename ElementType, typename PredFunc>
+inline size_t PredLoop(const treelite::DenseBatchT<ElementType>* batch,
+                       size_t num_feature, size_t block_size,
+                       treelite::ScratchBuffer* scratch,
                        size_t rbegin, size_t rend,
                        float* out_pred, PredFunc func) {
   const bool nan_missing
                       = treelite::common::math::CheckNAN(batch->missing_value);
-  std::vector<TreelitePredictorEntry> inst(batch->num_col, {-1});
+  const size_t stride = num_feature;
+  CHECK_GE(scratch->Size(), block_size * stride);
+  TreelitePredictorEntry* inst = scratch->Acquire();
   CHECK(rbegin < rend && rend <= batch->num_row);
   CHECK(sizeof(size_t) < sizeof(int64_t)
      || (rbegin <= static_cast<size_t>(std::numeric_limits<int64_t>::max())
@@ -133,34 +499,224 @@ inline size_t PredLoop(const treelite::DenseBatch* batch,
   const int64_t rend_ = static_cast<int64_t>(rend);
   const size_t num_col = batch->num_col;
   const float missing_value = batch->missing_value;
-  const float* data = batch->data;
-  const float* row;
+  const ElementType* data = batch->data;
+  size_t row_stride, col_stride;
+  GetStrides(batch, &row_stride, &col_stride);
+  // features the model doesn't know about are never looked at
+  const size_t ncol = std::min(num_col, stride);
+  const int64_t block_size_ = static_cast<int64_t>(block_size);
+  auto set_entry = [nan_missing, missing_value]
+                   (float value, TreelitePredictorEntry* entry) {
+    if (treelite::common::math::CheckNAN(value)) {
+      CHECK(nan_missing)
+        << "The missing_value argument must be set to NaN if there is any "
+        << "NaN in the matrix.";
+    } else if (nan_missing || value != missing_value) {
+      entry->fvalue = value;
+    }
+  };
   size_t total_output_size = 0;
-  for (int64_t rid = rbegin_; rid < rend_; ++rid) {
-    row = &data[rid * num_col];
-    for (size_t j = 0; j < num_col; ++j) {
-      if (treelite::common::math::CheckNAN(row[j])) {
+  for (int64_t rid = rbegin_; rid < rend_; rid += block_size_) {
+    const int64_t nrow = std::min(block_size_, rend_ - rid);
+    if (col_stride == 1) {
+      // row-major; copy one row at a time
+      for (int64_t k = 0; k < nrow; ++k) {
+        const ElementType* row = &data[(rid + k) * row_stride];
+        TreelitePredictorEntry* entry = &inst[k * stride];
+        for (size_t j = 0; j < ncol; ++j) {
+          set_entry(ToFloat(row[j]), &entry[j]);
+        }
+      }
+    } else {
+      // column-major or otherwise strided; copy the block one column at a
+      // time, so that memory is read in order when rows are adjacent
+      for (size_t j = 0; j < ncol; ++j) {
+        const ElementType* col = &data[rid * row_stride + j * col_stride];
+        for (int64_t k = 0; k < nrow; ++k) {
+          set_entry(ToFloat(col[k * row_stride]), &inst[k * stride + j]);
+        }
+      }
+    }
+    total_output_size += func(rid, nrow, inst, out_pred);
+    for (int64_t k = 0; k < nrow; ++k) {
+      TreelitePredictorEntry* entry = &inst[k * stride];
+      for (size_t j = 0; j < ncol; ++j) {
+        entry[j].missing = -1;
+      }
+    }
+  }
+  scratch->Release();
+  return total_output_size;
+}
+
+// func(rid, values, missing, out_pred) makes a prediction for row [rid],
+// whose feature values have been laid out in values[] and whose missing
+// features are marked in the bitmask missing[]. The bitmask is null if no
+// feature is missing. values[] holds leftovers of earlier rows at the
+// positions of missing features.
+template <typename ElementType, typename IndexType, typename OffsetType,
+          typename PredFunc>
+inline size_t PredMaskedLoop(const treelite::CSRBatchT<ElementType, IndexType,
+                                                       OffsetType>* batch,
+                             size_t num_feature,
+                             treelite::ScratchBuffer* scratch,
+                             size_t rbegin, size_t rend,
+                             float* out_pred, PredFunc func) {
+  const size_t mask_size = (num_feature + 63) / 64;
+  CHECK_GE(scratch->Size(), num_feature);
+  CHECK_GE(scratch->MaskSize(), mask_size);
+  float* values = &scratch->Acquire()[0].fvalue;
+  uint64_t* mask = scratch->Mask();
+  CHECK(rbegin < rend && rend <= batch->num_row);
+  const ElementType* data = batch->data;
+  const IndexType* col_ind = batch->col_ind;
+  const OffsetType* row_ptr = batch->row_ptr;
+  size_t total_output_size = 0;
+  for (size_t rid = rbegin; rid < rend; ++rid) {
+    const size_t ibegin = static_cast<size_t>(row_ptr[rid]);
+    const size_t iend = static_cast<size_t>(row_ptr[rid + 1]);
+    size_t num_present = 0;
+    for (size_t i = ibegin; i < iend; ++i) {
+      const size_t j = static_cast<size_t>(col_ind[i]);
+      if (j < num_feature) {
+        values[j] = ToFloat(data[i]);
+        const uint64_t bit = static_cast<uint64_t>(1) << (j % 64);
+        // a feature given more than once is counted once
+        num_present += ((mask[j / 64] & bit) != 0);
+        mask[j / 64] &= ~bit;
+      }
+    }
+    total_output_size
+      += func(rid, values, (num_present == num_feature) ? nullptr : mask,
+              out_pred);
+    if (num_present > 0) {
+      std::fill(mask, mask + mask_size, ~static_cast<uint64_t>(0));
+    }
+  }
+  scratch->Release();
+  return total_output_size;
+}
+
+template <typename ElementType, typename PredFunc>
+inline size_t PredMaskedLoop(const treelite::DenseBatchT<ElementType>* batch,
+                             size_t num_feature,
+                             treelite::ScratchBuffer* scratch,
+                             size_t rbegin, size_t rend,
+                             float* out_pred, PredFunc func) {
+  const bool nan_missing
+                      = treelite::common::math::CheckNAN(batch->missing_value);
+  const size_t mask_size = (num_feature + 63) / 64;
+  CHECK_GE(scratch->Size(), num_feature);
+  CHECK_GE(scratch->MaskSize(), mask_size);
+  float* values = &scratch->Acquire()[0].fvalue;
+  uint64_t* mask = scratch->Mask();
+  CHECK(rbegin < rend && rend <= batch->num_row);
+  const float missing_value = batch->missing_value;
+  const ElementType* data = batch->data;
+  size_t row_stride, col_stride;
+  GetStrides(batch, &row_stride, &col_stride);
+  // features the model doesn't know about are never looked at
+  const size_t ncol = std::min(batch->num_col, num_feature);
+  size_t total_output_size = 0;
+  for (size_t rid = rbegin; rid < rend; ++rid) {
+    const ElementType* row = &data[rid * row_stride];
+    size_t num_present = 0;
+    for (size_t j = 0; j < ncol; ++j) {
+      const float value = ToFloat(row[j * col_stride]);
+      if (treelite::common::math::CheckNAN(value)) {
         CHECK(nan_missing)
           << "The missing_value argument must be set to NaN if there is any "
           << "NaN in the matrix.";
-      } else if (nan_missing || row[j] != missing_value) {
-        inst[j].fvalue = row[j];
+      } else if (nan_missing || value != missing_value) {
+        values[j] = value;
+        mask[j / 64] &= ~(static_cast<uint64_t>(1) << (j % 64));
+        ++num_present;
       }
     }
-    total_output_size += func(rid, &inst[0], out_pred);
-    for (size_t j = 0; j < num_col; ++j) {
-      inst[j].missing = -1;
+    total_output_size
+      += func(rid, values, (num_present == num_feature) ? nullptr : mask,
+              out_pred);
+    if (num_present > 0) {
+      std::fill(mask, mask + mask_size, ~static_cast<uint64_t>(0));
     }
   }
+  scratch->Release();
   return total_output_size;
 }
 
+// Make predictions by passing rows of a dense batch to predict_dense_row()
+// directly, without building an array of entries first. Returns false if
+// this isn't possible, i.e. the batch is sparse or doesn't hold floats, the
+// library doesn't have the function, the batch has fewer columns than the
+// model expects, or the values of a row aren't next to each other. Batches
+// whose missing_value isn't NaN are left to PredLoop() as well:
+// predict_dense_row() takes NaN as missing, while PredLoop() rejects NaN
+// entries in such a batch as it copies them.
+template <typename BatchType>
+inline bool PredictDenseRows_(const BatchType* batch,
+                              bool pred_margin, size_t num_output_group,
+                              size_t num_feature,
+                              treelite::Predictor::PredFuncHandle
+                                pred_dense_func_handle,
+                              size_t rbegin, size_t rend, float* out_pred,
+                              size_t* out_query_result_size) {
+  return false;
+}
+
+inline bool PredictDenseRows_(const treelite::DenseBatch* batch,
+                              bool pred_margin, size_t num_output_group,
+                              size_t num_feature,
+                              treelite::Predictor::PredFuncHandle
+                                pred_dense_func_handle,
+                              size_t rbegin, size_t rend, float* out_pred,
+                              size_t* out_query_result_size) {
+  size_t row_stride, col_stride;
+  GetStrides(batch, &row_stride, &col_stride);
+  if (pred_dense_func_handle == nullptr || batch->num_col < num_feature
+      || col_stride != 1
+      || !treelite::common::math::CheckNAN(batch->missing_value)) {
+    return false;
+  }
+  CHECK(rbegin < rend && rend <= batch->num_row);
+  const float* data = batch->data;
+  size_t total_output_size = 0;
+  if (num_output_group > 1) {  // multi-class classification task
+    using PredDenseFunc = size_t (*)(const float*, int, float*);
+    PredDenseFunc pred_dense_func
+      = reinterpret_cast<PredDenseFunc>(pred_dense_func_handle);
+    for (size_t rid = rbegin; rid < rend; ++rid) {
+      total_output_size
+        += pred_dense_func(&data[rid * row_stride],
+                           static_cast<int>(pred_margin),
+                           &out_pred[rid * num_output_group]);
+    }
+  } else {                     // every other task
+    using PredDenseFunc = float (*)(const float*, int);
+    PredDenseFunc pred_dense_func
+      = reinterpret_cast<PredDenseFunc>(pred_dense_func_handle);
+    for (size_t rid = rbegin; rid < rend; ++rid) {
+      out_pred[rid] = pred_dense_func(&data[rid * row_stride],
+                                      static_cast<int>(pred_margin));
+    }
+    total_output_size = rend - rbegin;
+  }
+  *out_query_result_size = total_output_size;
+  return true;
+}
+
 template <typename BatchType>
 inline size_t PredictBatch_(const BatchType* batch,
                             bool pred_margin, size_t num_output_group,
+                            size_t num_feature,
                             treelite::Predictor::PredFuncHandle pred_func_handle,
-                            size_t rbegin, size_t rend,
-                            size_t expected_query_result_size, float* out_pred) {
+                            treelite::Predictor::PredFuncHandle
+                              pred_batch_func_handle,
+                            treelite::Predictor::PredFuncHandle
+                              pred_dense_func_handle,
+                            treelite::Predictor::PredFuncHandle
+                              pred_masked_func_handle,
+                            treelite::ScratchBuffer* scratch,
+                            size_t rbegin, size_t rend, float* out_pred) {
   CHECK(pred_func_handle != nullptr)
     << "A shared library needs to be loaded first using Load()";
   /* Pass the correct prediction function to PredLoop.
@@ -169,45 +725,151 @@ inline size_t PredictBatch_(const BatchType* batch,
     // Dimension of output vector:
     // can be either [num_data] or [num_class]*[num_data].
     // Note that size of prediction may be smaller than out_pred (this occurs
-    // when pred_function is set to "max_index").
-  if (num_output_group > 1) {  // multi-class classification task
-    using PredFunc = size_t (*)(TreelitePredictorEntry*, int, float*);
-    PredFunc pred_func = reinterpret_cast<PredFunc>(pred_func_handle);
-    query_result_size =
-     PredLoop(batch, rbegin, rend, out_pred,
-      [pred_func, num_output_group, pred_margin]
-      (int64_t rid, TreelitePredictorEntry* inst, float* out_pred) -> size_t {
-        return pred_func(inst, static_cast<int>(pred_margin),
-                         &out_pred[rid * num_output_group]);
-      });
+    // when pred_function is set to "max_index"); see BatchJob::Finalize().
+  const size_t block_size = GetBlockSize(pred_batch_func_handle, num_feature);
+  if (PredictDenseRows_(batch, pred_margin, num_output_group, num_feature,
+                        pred_dense_func_handle, rbegin, rend, out_pred,
+                        &query_result_size)) {
+    // done; rows were given to predict_dense_row() directly
+  } else if (pred_masked_func_handle != nullptr) {
+    // mark missing values with a bitmask rather than in the entries
+    if (num_output_group > 1) {  // multi-class classification task
+      using PredMaskedFunc
+        = size_t (*)(const float*, const uint64_t*, int, float*);
+      PredMaskedFunc pred_masked_func
+        = reinterpret_cast<PredMaskedFunc>(pred_masked_func_handle);
+      query_result_size =
+       PredMaskedLoop(batch, num_feature, scratch, rbegin, rend, out_pred,
+        [pred_masked_func, num_output_group, pred_margin]
+        (size_t rid, const float* values, const uint64_t* missing,
+         float* out_pred) -> size_t {
+          return pred_masked_func(values, missing,
+                                  static_cast<int>(pred_margin),
+                                  &out_pred[rid * num_output_group]);
+        });
+    } else {                     // every other task
+      using PredMaskedFunc = float (*)(const float*, const uint64_t*, int);
+      PredMaskedFunc pred_masked_func
+        = reinterpret_cast<PredMaskedFunc>(pred_masked_func_handle);
+      query_result_size =
+       PredMaskedLoop(batch, num_feature, scratch, rbegin, rend, out_pred,
+        [pred_masked_func, pred_margin]
+        (size_t rid, const float* values, const uint64_t* missing,
+         float* out_pred) -> size_t {
+          out_pred[rid] = pred_masked_func(values, missing,
+                                           static_cast<int>(pred_margin));
+          return 1;
+        });
+    }
+  } else if (num_output_group > 1) {  // multi-class classification task
+    if (block_size > 1) {
+      using PredBatchFunc
+        = size_t (*)(TreelitePredictorEntry*, size_t, int, float*);
+      PredBatchFunc pred_batch_func
+        = reinterpret_cast<PredBatchFunc>(pred_batch_func_handle);
+      query_result_size =
+       PredLoop(batch, num_feature, block_size, scratch, rbegin, rend, out_pred,
+        [pred_batch_func, num_output_group, pred_margin]
+        (int64_t rid, int64_t nrow, TreelitePredictorEntry* inst,
+         float* out_pred) -> size_t {
+          return nrow * pred_batch_func(inst, static_cast<size_t>(nrow),
+                                        static_cast<int>(pred_margin),
+                                        &out_pred[rid * num_output_group]);
+        });
+    } else {
+      using PredFunc = size_t (*)(TreelitePredictorEntry*, int, float*);
+      PredFunc pred_func = reinterpret_cast<PredFunc>(pred_func_handle);
+      query_result_size =
+       PredLoop(batch, num_feature, block_size, scratch, rbegin, rend, out_pred,
+        [pred_func, num_output_group, pred_margin]
+        (int64_t rid, int64_t nrow, TreelitePredictorEntry* inst,
+         float* out_pred) -> size_t {
+          return pred_func(inst, static_cast<int>(pred_margin),
+                           &out_pred[rid * num_output_group]);
+        });
+    }
   } else {                     // every other task
-    using PredFunc = float (*)(TreelitePredictorEntry*, int);
-    PredFunc pred_func = reinterpret_cast<PredFunc>(pred_func_handle);
-    query_result_size =
-     PredLoop(batch, rbegin, rend, out_pred,
-      [pred_func, pred_margin]
-      (int64_t rid, TreelitePredictorEntry* inst, float* out_pred) -> size_t {
-        out_pred[rid] = pred_func(inst, static_cast<int>(pred_margin));
-        return 1;
-      });
-  }
-  // re-shape output if query_result_size < dimension of out_pred
-  if (query_result_size < expected_query_result_size) {
-    CHECK_GT(num_output_group, 1);
-    CHECK_EQ(query_result_size % batch->num_row, 0);
-    const size_t query_size_per_instance = query_result_size / batch->num_row;
-    CHECK_GT(query_size_per_instance, 0);
-    CHECK_LT(query_size_per_instance, num_output_group);
-    for (size_t rid = 0; rid < batch->num_row; ++rid) {
-      for (size_t k = 0; k < query_size_per_instance; ++k) {
-        out_pred[rid * query_size_per_instance + k]
-          = out_pred[rid * num_output_group + k];
-      }
+    if (block_size > 1) {
+      using PredBatchFunc
+        = void (*)(TreelitePredictorEntry*, size_t, int, float*);
+      PredBatchFunc pred_batch_func
+        = reinterpret_cast<PredBatchFunc>(pred_batch_func_handle);
+      query_result_size =
+       PredLoop(batch, num_feature, block_size, scratch, rbegin, rend, out_pred,
+        [pred_batch_func, pred_margin]
+        (int64_t rid, int64_t nrow, TreelitePredictorEntry* inst,
+         float* out_pred) -> size_t {
+          pred_batch_func(inst, static_cast<size_t>(nrow),
+                          static_cast<int>(pred_margin), &out_pred[rid]);
+          return static_cast<size_t>(nrow);
+        });
+    } else {
+      using PredFunc = float (*)(TreelitePredictorEntry*, int);
+      PredFunc pred_func = reinterpret_cast<PredFunc>(pred_func_handle);
+      query_result_size =
+       PredLoop(batch, num_feature, block_size, scratch, rbegin, rend, out_pred,
+        [pred_func, pred_margin]
+        (int64_t rid, int64_t nrow, TreelitePredictorEntry* inst,
+         float* out_pred) -> size_t {
+          out_pred[rid] = pred_func(inst, static_cast<int>(pred_margin));
+          return 1;
+        });
     }
   }
   return query_result_size;
 }
 
+// Run PredictBatch_() over the rows assigned to a single task, either a fixed
+// range [rbegin, rend) or chunks obtained from a work-stealing scheduler.
+// [pool] and [tid] identify the worker running the task; [pool] is null if
+// the task runs on the master thread.
+template <typename BatchType>
+inline size_t PredictRows_(const BatchType* batch, const InputToken& input,
+                           const PredThreadPool* pool, int tid) {
+  treelite::ScratchBuffer* scratch
+    = (input.scratch != nullptr) ? input.scratch
+                                 : input.scratch_pool->GetWorkerBuffer(tid);
+  if (input.row_scheduler == nullptr) {
+    return PredictBatch_(batch, input.pred_margin, input.num_output_group,
+                         input.num_feature, input.pred_func_handle,
+                         input.pred_batch_func_handle,
+                         input.pred_dense_func_handle,
+                         input.pred_masked_func_handle, scratch,
+                         input.rbegin, input.rend, input.out_pred);
+  }
+  size_t rbegin, rend;
+  size_t query_result_size = 0;
+  // A worker with other tasks waiting (possibly for other predictors sharing
+  // the pool) finishes its own share but doesn't steal, so that one large
+  // batch doesn't hold up everyone else.
+  while (input.row_scheduler->Next(input.participant_id, &rbegin, &rend,
+                                   pool == nullptr
+                                   || !pool->HasPendingTask(tid))) {
+    query_result_size
+      += PredictBatch_(batch, input.pred_margin, input.num_output_group,
+                       input.num_feature, input.pred_func_handle,
+                       input.pred_batch_func_handle,
+                       input.pred_dense_func_handle,
+                       input.pred_masked_func_handle, scratch,
+                       rbegin, rend, input.out_pred);
+  }
+  return query_result_size;
+}
+
+template <typename BatchType>
+size_t PredictRowsOf(const InputToken& input, const PredThreadPool* pool,
+                     int tid) {
+  return PredictRows_(static_cast<const BatchType*>(input.data), input, pool,
+                      tid);
+}
+
+template <typename BatchType>
+struct IsSparseBatch : public std::false_type {};
+
+template <typename ElementType, typename IndexType, typename OffsetType>
+struct IsSparseBatch<treelite::CSRBatchT<ElementType, IndexType, OffsetType>>
+  : public std::true_type {};
+
 inline size_t PredictInst_(TreelitePredictorEntry* inst,
                            bool pred_margin, size_t num_output_group,
                            treelite::Predictor::PredFuncHandle pred_func_handle,
@@ -229,159 +891,859 @@ inline size_t PredictInst_(TreelitePredictorEntry* inst,
   return query_result_size;
 }
 
+// Run a task on a worker thread
+OutputToken RunTask(const InputToken& input, int tid,
+                    const PredThreadPool& pool) {
+  const auto tstart = std::chrono::steady_clock::now();
+  size_t query_result_size = 0;
+  switch (input.input_type) {
+   case InputType::kSparseBatch:
+   case InputType::kDenseBatch:
+    query_result_size = input.predict_rows(input, &pool, tid);
+    break;
+   case InputType::kInitWorker:
+    // the buffer is allocated by the worker itself, so that it is placed on
+    // the worker's NUMA node
+    input.scratch_pool->AllocateWorkerBuffer(tid);
+    break;
+   case InputType::kSingleInst:
+   default:
+    {
+      TreelitePredictorEntry* inst
+        = const_cast<TreelitePredictorEntry*>(
+            static_cast<const TreelitePredictorEntry*>(input.data));
+      query_result_size
+        = PredictInst_(inst, input.pred_margin, input.num_output_group,
+                       input.pred_func_handle, input.num_output_group,
+                       input.out_pred);
+    }
+    break;
+  }
+  return OutputToken{query_result_size,
+                     ElapsedNanoseconds(input.tsubmit, tstart),
+                     ElapsedNanoseconds(tstart,
+                                        std::chrono::steady_clock::now())};
+}
+
 }  // anonymous namespace
 
 namespace treelite {
 
+/*!
+ * \brief a loaded prediction library, along with everything tied to it. A
+ *        library is unloaded once the predictor and every prediction started
+ *        with it have let go of it.
+ */
+class LoadedLibrary {
+ public:
+  LoadedLibrary()
+    : lib_handle(nullptr), num_output_group_query_func_handle(nullptr),
+      num_feature_query_func_handle(nullptr), pred_func_handle(nullptr),
+      pred_batch_func_handle(nullptr), pred_dense_func_handle(nullptr),
+      pred_masked_func_handle(nullptr),
+      num_output_group(0), num_feature(0), row_cost(0.0), version(0),
+      load_stats{0.0, 0.0, 0.0, 0.0, 0.0, 0, false},
+      memfd(-1), using_temp_libfile(false) {}
+  ~LoadedLibrary() {
+    scratch_pool.reset();
+    if (lib_handle != nullptr) {
+      CloseLibrary(lib_handle);
+    }
+    if (memfd >= 0) {
+      CloseMemoryFile(memfd);
+    }
+    if (using_temp_libfile && std::remove(temp_libfile.c_str()) != 0) {
+      std::cerr << "Couldn't remove file " << temp_libfile << std::endl;
+    }
+  }
+
+  Predictor::LibraryHandle lib_handle;
+  Predictor::QueryFuncHandle num_output_group_query_func_handle;
+  Predictor::QueryFuncHandle num_feature_query_func_handle;
+  Predictor::PredFuncHandle pred_func_handle;
+  Predictor::PredFuncHandle pred_batch_func_handle;  // null if no batch func
+  Predictor::PredFuncHandle pred_dense_func_handle;  // null if no dense func
+  // null if the library takes missing values only in the entries
+  Predictor::PredFuncHandle pred_masked_func_handle;
+  size_t num_output_group;
+  size_t num_feature;
+  // estimated number of tree nodes visited per row; 0 if the library
+  // doesn't export enough information to make an estimate
+  double row_cost;
+  // buffers for laying out rows, allocated when the library is loaded
+  std::unique_ptr<ScratchPool> scratch_pool;
+  uint64_t version;  // see Predictor::QueryModelVersion()
+  Predictor::LoadStats load_stats;
+
+  // in-memory file the library was loaded from; -1 if loaded from a path.
+  // It is kept open for as long as the library is loaded, since the dynamic
+  // loader recognizes libraries by path: if the descriptor were reused for
+  // another library, loading that one would hand back this one.
+  int memfd;
+  // whether the library was loaded from a copy in a temporary file, where
+  // in-memory files aren't supported
+  bool using_temp_libfile;
+  std::unique_ptr<common::filesystem::TemporaryDirectory> tempdir;
+  std::string temp_libfile;
+};
+
+/*!
+ * \brief pool of worker threads, which may be shared by many predictors.
+ *        It lives as long as any predictor (or other owner) holds on to it.
+ */
+class WorkerPool {
+ public:
+  /*!
+   * \param compact whether cpu_assignment was handed out by
+   *                affinity::AssignCompact(); if so, the CPUs are given back
+   *                when the pool is destroyed
+   */
+  WorkerPool(int num_worker, const std::vector<int>& cpu_assignment,
+             bool compact, const QueueWaitPolicy& wait_policy,
+             uint32_t queue_depth)
+    : pool(num_worker, RunTask, cpu_assignment, wait_policy, queue_depth),
+      compact_(compact), next_worker_(0) {}
+  ~WorkerPool() {
+    if (compact_) {
+      affinity::ReleaseCompact(pool.CPUAssignment());
+    }
+  }
+
+  /*!
+   * \brief choose the workers for a batch that needs [num_task] workers.
+   *        Successive batches start where the previous one left off, so that
+   *        small batches (possibly from different predictors) are spread
+   *        over all workers instead of piling up on the first few.
+   * \return id of the first worker; task i goes to worker
+   *         (first + i) % NumWorker()
+   */
+  inline int AssignWorkers(int num_task) {
+    return static_cast<int>(next_worker_.fetch_add(num_task)
+                            % static_cast<uint32_t>(pool.NumWorker()));
+  }
+
+  PredThreadPool pool;
+
+ private:
+  bool compact_;
+  std::atomic<uint32_t> next_worker_;
+};
+
+/*!
+ * \brief predictions submitted with SubmitBatches() that have finished, in
+ *        the order in which they finished
+ */
+class CompletionQueue {
+ public:
+  CompletionQueue() : next_seq_id_(0), num_pending_(0) {}
+
+  /*!
+   * \brief reserve sequence ids for batches about to be submitted
+   * \return sequence id of the first batch
+   */
+  inline uint64_t Reserve(size_t num_batch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const uint64_t first_seq_id = next_seq_id_;
+    next_seq_id_ += num_batch;
+    num_pending_ += num_batch;
+    return first_seq_id;
+  }
+  /*! \brief report a finished batch; called from the thread finishing it */
+  inline void Push(uint64_t seq_id, BatchJob* job) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_.emplace_back(seq_id, job);
+    cv_.notify_one();
+  }
+  /*!
+   * \brief take the batch that finished first
+   * \param block whether to wait for a batch to finish if none has
+   * \return whether a batch was taken
+   */
+  inline bool Pop(bool block, uint64_t* out_seq_id, BatchJob** out_job) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (block) {
+      CHECK_GT(num_pending_, 0) << "No prediction is pending";
+      cv_.wait(lock, [this] { return !done_.empty(); });
+    } else if (done_.empty()) {
+      return false;
+    }
+    *out_seq_id = done_.front().first;
+    *out_job = done_.front().second;
+    done_.pop_front();
+    --num_pending_;
+    return true;
+  }
+  /*! \brief number of batches submitted but not yet taken */
+  inline size_t NumPending() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_pending_;
+  }
+
+ private:
+  std::deque<std::pair<uint64_t, BatchJob*>> done_;
+  uint64_t next_seq_id_;
+  size_t num_pending_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+std::shared_ptr<WorkerPool>
+Predictor::CreateWorkerPool(int num_worker_thread, AffinityPolicy policy,
+                            const std::vector<int>& cpu_list, int numa_node,
+                            WaitStrategy wait_strategy, size_t queue_depth) {
+  CHECK(queue_depth > 0 && queue_depth <= (1U << 31))
+    << "Queue depth must be between 1 and " << (1U << 31);
+  if (num_worker_thread == -1) {
+    num_worker_thread = std::thread::hardware_concurrency();
+  }
+  QueueWaitPolicy wait_policy;
+  switch (wait_strategy) {
+   case WaitStrategy::kSpin:
+    wait_policy = QueueWaitPolicy{0, false, false};
+    break;
+   case WaitStrategy::kSpinThenSleep:
+    // the spin count follows the typical OpenMP convention
+    wait_policy = QueueWaitPolicy{300000, true, false};
+    break;
+   case WaitStrategy::kAdaptive:
+    wait_policy = QueueWaitPolicy{300000, true, true};
+    break;
+   case WaitStrategy::kBlocking:
+    wait_policy = QueueWaitPolicy{0, true, false};
+    break;
+   default:
+    LOG(FATAL) << "Unknown wait strategy";
+  }
+  std::vector<int> cpu_assignment;
+  switch (policy) {
+   case AffinityPolicy::kNone:
+    break;
+   case AffinityPolicy::kCompact:
+    cpu_assignment = affinity::AssignCompact(num_worker_thread);
+    break;
+   case AffinityPolicy::kScatter:
+    cpu_assignment = affinity::AssignScatter(num_worker_thread);
+    break;
+   case AffinityPolicy::kExplicit:
+    cpu_assignment = affinity::AssignExplicit(num_worker_thread, cpu_list);
+    break;
+   case AffinityPolicy::kNUMALocal:
+    cpu_assignment = affinity::AssignNUMALocal(num_worker_thread, numa_node);
+    break;
+   default:
+    LOG(FATAL) << "Unknown affinity policy";
+  }
+  try {
+    return std::make_shared<WorkerPool>(
+      num_worker_thread, cpu_assignment, policy == AffinityPolicy::kCompact,
+      wait_policy, static_cast<uint32_t>(queue_depth));
+  } catch (...) {
+    if (policy == AffinityPolicy::kCompact) {
+      affinity::ReleaseCompact(cpu_assignment);
+    }
+    throw;
+  }
+}
+
 Predictor::Predictor(int num_worker_thread,
                      bool include_master_thread)
-                       : lib_handle_(nullptr),
-                         num_output_group_query_func_handle_(nullptr),
-                         num_feature_query_func_handle_(nullptr),
-                         pred_func_handle_(nullptr),
-                         thread_pool_handle_(nullptr),
+                       : loaded_(false),
+                         model_version_(0),
+                         num_output_group_(0),
+                         num_feature_(0),
                          include_master_thread_(include_master_thread),
                          num_worker_thread_(num_worker_thread),
-                         tempdir_(nullptr) {}
+                         scheduling_policy_(SchedulingPolicy::kWorkStealing),
+                         grain_size_(0),
+                         min_work_per_thread_(kMinWorkPerThread),
+                         affinity_policy_(AffinityPolicy::kCompact),
+                         numa_node_(-1),
+                         wait_strategy_(WaitStrategy::kSpinThenSleep),
+                         queue_depth_(256),
+                         shared_worker_pool_(false),
+                         stats_(new StatsCollector()),
+                         coalesce_max_batch_size_(0),
+                         coalesce_max_delay_us_(0),
+                         load_options_{false, PrefaultMode::kNone, 0} {}
+Predictor::Predictor(std::shared_ptr<WorkerPool> worker_pool,
+                     bool include_master_thread)
+                       : Predictor(-1, include_master_thread) {
+  CHECK(worker_pool) << "Worker pool must not be null";
+  worker_pool_ = worker_pool;
+  shared_worker_pool_ = true;
+  num_worker_thread_ = worker_pool_->pool.NumWorker();
+}
 Predictor::~Predictor() {
   Free();
 }
 
-void
-Predictor::Load(const char* name) {
+std::shared_ptr<LoadedLibrary>
+Predictor::OpenLibrary_(const char* name) const {
+  std::shared_ptr<LoadedLibrary> library;
   const std::string protocol = GetProtocol(name);
   if (protocol == "file://" || protocol.empty()) {
     // local file
-    using_remote_lib_ = false;
-    lib_handle_ = OpenLibrary(name);
+    library = std::make_shared<LoadedLibrary>();
+    library->lib_handle = OpenLibrary(name, load_options_.bind_now);
+    if (library->lib_handle == nullptr) {
+      LOG(FATAL) << "Failed to load dynamic shared library `" << name << "'";
+    }
   } else {
-    // remote file
-    using_remote_lib_ = true;
-    tempdir_.reset(new treelite::common::filesystem::TemporaryDirectory());
-    temp_libfile_ = tempdir_->path
-                    + "/" + treelite::common::filesystem::GetBasename(name);
+    // remote file; read it into memory, so that it doesn't have to go
+    // through the local disk
+    std::string buf;
     {
       std::unique_ptr<dmlc::Stream> strm(dmlc::Stream::Create(name, "r"));
-      dmlc::istream is(strm.get());
-      std::ofstream of(temp_libfile_);
-      of << is.rdbuf();
+      std::vector<char> chunk(1 << 20);
+      size_t nread;
+      while ((nread = strm->Read(chunk.data(), chunk.size())) > 0) {
+        buf.append(chunk.data(), nread);
+      }
     }
-    lib_handle_ = OpenLibrary(temp_libfile_.c_str());
+    library = OpenLibraryFromMemory_(
+      buf.data(), buf.size(), common::filesystem::GetBasename(name));
   }
-  if (lib_handle_ == nullptr) {
-    if (using_remote_lib_) {
-      CHECK_EQ(std::remove(temp_libfile_.c_str()), 0);
-      tempdir_.release();
+  InitLibrary_(library.get(), name);
+  return library;
+}
+
+std::shared_ptr<LoadedLibrary>
+Predictor::OpenLibraryFromMemory_(const void* buf, size_t len,
+                                  const std::string& basename) const {
+  std::shared_ptr<LoadedLibrary> library = std::make_shared<LoadedLibrary>();
+  library->memfd = CreateMemoryFile(basename.c_str(), buf, len);
+  if (library->memfd >= 0) {
+    const std::string path
+      = "/proc/self/fd/" + std::to_string(library->memfd);
+    library->lib_handle = OpenLibrary(path.c_str(), load_options_.bind_now);
+  } else {
+    // in-memory files not supported; fall back to a temporary file, which
+    // is removed along with [library]
+    library->using_temp_libfile = true;
+    library->tempdir.reset(new common::filesystem::TemporaryDirectory());
+    library->temp_libfile = library->tempdir->path + "/" + basename;
+    {
+      std::ofstream of(library->temp_libfile, std::ios::binary);
+      of.write(static_cast<const char*>(buf), len);
+      CHECK(of) << "Failed to write to `" << library->temp_libfile << "'";
     }
-    LOG(FATAL) << "Failed to load dynamic shared library `" << name << "'";
+    library->lib_handle = OpenLibrary(library->temp_libfile.c_str(),
+                                      load_options_.bind_now);
   }
+  if (library->lib_handle == nullptr) {
+    LOG(FATAL) << "Failed to load dynamic shared library `" << basename
+               << "' from memory";
+  }
+  return library;
+}
+
+void
+Predictor::InitLibrary_(LoadedLibrary* library, const char* name) const {
+  const LibraryHandle lib_handle = library->lib_handle;
 
   /* 1. query # of output groups */
-  num_output_group_query_func_handle_
-    = LoadFunction<QueryFuncHandle>(lib_handle_, "get_num_output_group");
+  library->num_output_group_query_func_handle
+    = LoadFunction<QueryFuncHandle>(lib_handle, "get_num_output_group");
   using QueryFunc = size_t (*)(void);
   QueryFunc query_func
-    = reinterpret_cast<QueryFunc>(num_output_group_query_func_handle_);
+    = reinterpret_cast<QueryFunc>(library->num_output_group_query_func_handle);
   CHECK(query_func != nullptr)
     << "Dynamic shared library `" << name
     << "' does not contain valid get_num_output_group() function";
-  num_output_group_ = query_func();
+  library->num_output_group = query_func();
 
   /* 2. query # of features */
-  num_feature_query_func_handle_
-    = LoadFunction<QueryFuncHandle>(lib_handle_, "get_num_feature");
-  query_func = reinterpret_cast<QueryFunc>(num_feature_query_func_handle_);
+  library->num_feature_query_func_handle
+    = LoadFunction<QueryFuncHandle>(lib_handle, "get_num_feature");
+  query_func
+    = reinterpret_cast<QueryFunc>(library->num_feature_query_func_handle);
   CHECK(query_func != nullptr)
     << "Dynamic shared library `" << name
     << "' does not contain valid get_num_feature() function";
-  num_feature_ = query_func();
-  CHECK_GT(num_feature_, 0) << "num_feature cannot be zero";
+  library->num_feature = query_func();
+  CHECK_GT(library->num_feature, 0) << "num_feature cannot be zero";
 
   /* 3. load appropriate function for margin prediction */
-  CHECK_GT(num_output_group_, 0) << "num_output_group cannot be zero";
-  if (num_output_group_ > 1) {   // multi-class classification
-    pred_func_handle_ = LoadFunction<PredFuncHandle>(lib_handle_,
-                                                     "predict_multiclass");
+  const size_t num_output_group = library->num_output_group;
+  CHECK_GT(num_output_group, 0) << "num_output_group cannot be zero";
+  if (num_output_group > 1) {   // multi-class classification
+    library->pred_func_handle = LoadFunction<PredFuncHandle>(lib_handle,
+                                                      "predict_multiclass");
     using PredFunc = size_t (*)(TreelitePredictorEntry*, int, float*);
-    PredFunc pred_func = reinterpret_cast<PredFunc>(pred_func_handle_);
+    PredFunc pred_func = reinterpret_cast<PredFunc>(library->pred_func_handle);
     CHECK(pred_func != nullptr)
       << "Dynamic shared library `" << name
       << "' does not contain valid predict_multiclass() function";
   } else {                      // everything else
-    pred_func_handle_ = LoadFunction<PredFuncHandle>(lib_handle_, "predict");
+    library->pred_func_handle = LoadFunction<PredFuncHandle>(lib_handle,
+                                                             "predict");
     using PredFunc = float (*)(TreelitePredictorEntry*, int);
-    PredFunc pred_func = reinterpret_cast<PredFunc>(pred_func_handle_);
+    PredFunc pred_func = reinterpret_cast<PredFunc>(library->pred_func_handle);
     CHECK(pred_func != nullptr)
       << "Dynamic shared library `" << name
       << "' does not contain valid predict() function";
   }
 
+  /* 4. load batch prediction function, if available. Libraries generated
+        without the batch_function compiler option won't have it. */
+  library->pred_batch_func_handle = LoadFunction<PredFuncHandle>(lib_handle,
+    (num_output_group > 1) ? "predict_multiclass_batch" : "predict_batch");
+  /* 5. load prediction function for dense rows, if available. Libraries
+        generated without the dense_row_function compiler option won't
+        have it. */
+  library->pred_dense_func_handle = LoadFunction<PredFuncHandle>(lib_handle,
+    (num_output_group > 1) ? "predict_multiclass_dense_row"
+                           : "predict_dense_row");
+  /* 6. load prediction function taking a bitmask of missing values, if
+        available. Libraries generated without the missing_bitmask compiler
+        option won't have it; they mark missing values only with -1 in the
+        entries. */
+  library->pred_masked_func_handle = LoadFunction<PredFuncHandle>(lib_handle,
+    (num_output_group > 1) ? "predict_multiclass_masked" : "predict_masked");
+
+  /* 7. query the size of the model, if available, to estimate the cost of
+        predicting a row. Libraries generated by older versions of treelite
+        won't have the query functions. */
+  {
+    QueryFunc num_tree_query_func = reinterpret_cast<QueryFunc>(
+      LoadFunction<QueryFuncHandle>(lib_handle, "get_num_tree"));
+    using DepthQueryFunc = float (*)(void);
+    DepthQueryFunc depth_query_func = reinterpret_cast<DepthQueryFunc>(
+      LoadFunction<QueryFuncHandle>(lib_handle, "get_average_tree_depth"));
+    if (num_tree_query_func != nullptr && depth_query_func != nullptr) {
+      // count the leaf as well as the tests along the way
+      library->row_cost = num_tree_query_func() * (depth_query_func() + 1.0);
+    } else {
+      library->row_cost = 0.0;
+    }
+  }
+}
+
+std::shared_ptr<LoadedLibrary>
+Predictor::AcquireLibrary_() const {
+  // Reload() may be swapping the library at the same time
+  return std::atomic_load(&library_);
+}
+
+void
+Predictor::Load(const char* name) {
+  const double tstart = dmlc::GetTime();
+  Load_(OpenLibrary_(name), tstart);
+}
+
+void
+Predictor::LoadFromMemory(const void* buf, size_t len) {
+  const double tstart = dmlc::GetTime();
+  std::shared_ptr<LoadedLibrary> library
+    = OpenLibraryFromMemory_(buf, len, kMemoryLibraryName);
+  InitLibrary_(library.get(), kMemoryLibraryName);
+  Load_(library, tstart);
+}
+
+void
+Predictor::Load_(std::shared_ptr<LoadedLibrary> library, double tstart) {
+  LoadStats& load_stats = library->load_stats;
+  load_stats.open_time = dmlc::GetTime() - tstart;
+  PrefaultLibrary_(library.get());
+  num_output_group_ = library->num_output_group;
+  num_feature_ = library->num_feature;
+  {
+    std::lock_guard<std::mutex> lock(reload_mutex_);
+    library->version = ++model_version_;
+  }
+  std::atomic_store(&library_, library);
+  loaded_ = true;
+
   if (num_worker_thread_ == -1) {
     num_worker_thread_
       = std::thread::hardware_concurrency() - (int)include_master_thread_;
   }
-  thread_pool_handle_ = static_cast<ThreadPoolHandle>(
-      new PredThreadPool(num_worker_thread_, this,
-                         [](SpscQueue<InputToken>* incoming_queue,
-                            SpscQueue<OutputToken>* outgoing_queue,
-                            const treelite::Predictor* predictor) {
-      InputToken input;
-      while (incoming_queue->Pop(&input)) {
-        size_t query_result_size;
-        const size_t rbegin = input.rbegin;
-        const size_t rend = input.rend;
-        switch (input.input_type) {
-         case InputType::kSparseBatch:
-          {
-            const CSRBatch* batch = static_cast<const CSRBatch*>(input.data);
-            query_result_size
-              = PredictBatch_(batch, input.pred_margin, input.num_output_group,
-                              input.pred_func_handle,
-                              rbegin, rend,
-                              predictor->QueryResultSize(batch, rbegin, rend),
-                              input.out_pred);
-          }
-          break;
-         case InputType::kDenseBatch:
-          {
-            const DenseBatch* batch = static_cast<const DenseBatch*>(input.data);
-            query_result_size
-              = PredictBatch_(batch, input.pred_margin, input.num_output_group,
-                              input.pred_func_handle,
-                              rbegin, rend,
-                              predictor->QueryResultSize(batch, rbegin, rend),
-                              input.out_pred);
-          }
-          break;
-         case InputType::kSingleInst:
-         default:
-          {
-            TreelitePredictorEntry* inst
-              = const_cast<TreelitePredictorEntry*>(
-                  static_cast<const TreelitePredictorEntry*>(input.data));
-            query_result_size
-              = PredictInst_(inst, input.pred_margin, input.num_output_group,
-                             input.pred_func_handle,
-                             predictor->QueryResultSizeSingleInst(),
-                             input.out_pred);
-          }
-          break;
-        }
-        outgoing_queue->Push(OutputToken{query_result_size});
-      }
+  double tphase = dmlc::GetTime();
+  InitThreadPool_();
+  load_stats.worker_init_time = dmlc::GetTime() - tphase;
+  tphase = dmlc::GetTime();
+  WarmUp_(library.get(), load_options_.num_warmup_row);
+  load_stats.warmup_time = dmlc::GetTime() - tphase;
+  load_stats.total_time = dmlc::GetTime() - tstart;
+  InitCoalescer_();
+}
+
+void
+Predictor::Reload(const char* name) {
+  CHECK(loaded_) << "A shared library needs to be loaded first using Load()";
+  std::lock_guard<std::mutex> lock(reload_mutex_);
+  const double tstart = dmlc::GetTime();
+  std::shared_ptr<LoadedLibrary> library = OpenLibrary_(name);
+  LoadStats& load_stats = library->load_stats;
+  load_stats.open_time = dmlc::GetTime() - tstart;
+  CHECK_EQ(library->num_feature, num_feature_)
+    << "Dynamic shared library `" << name << "' expects "
+    << library->num_feature << " features, but the loaded one expects "
+    << num_feature_;
+  CHECK_EQ(library->num_output_group, num_output_group_)
+    << "Dynamic shared library `" << name << "' has "
+    << library->num_output_group << " output groups, but the loaded one has "
+    << num_output_group_;
+  PrefaultLibrary_(library.get());
+  double tphase = dmlc::GetTime();
+  InitScratchPool_(library.get());
+  load_stats.worker_init_time = dmlc::GetTime() - tphase;
+  // predict at least a block of rows even without a warm-up set, so that
+  // the first requests don't pay for faulting in the code of the new library
+  tphase = dmlc::GetTime();
+  WarmUp_(library.get(),
+          std::max(load_options_.num_warmup_row,
+                   GetBlockSize(library->pred_batch_func_handle,
+                                num_feature_)));
+  load_stats.warmup_time = dmlc::GetTime() - tphase;
+  load_stats.total_time = dmlc::GetTime() - tstart;
+  library->version = ++model_version_;
+  // from here on, new predictions go to the new library. The old library
+  // is unloaded by whoever lets go of it last.
+  std::atomic_store(&library_, library);
+}
+
+uint64_t
+Predictor::QueryModelVersion() const {
+  std::shared_ptr<LoadedLibrary> library = AcquireLibrary_();
+  return library ? library->version : 0;
+}
+
+std::vector<int>
+Predictor::QueryWorkerCPUs() const {
+  CHECK(loaded_)
+    << "A shared library needs to be loaded first using Load()";
+  return worker_pool_->pool.CPUAssignment();
+}
+
+void
+Predictor::InitThreadPool_() {
+  if (!shared_worker_pool_) {
+    worker_pool_.reset();  // stop the old workers first
+    worker_pool_ = CreateWorkerPool(num_worker_thread_, affinity_policy_,
+                                    cpu_list_, numa_node_, wait_strategy_,
+                                    queue_depth_);
+  }
+  InitScratchPool_(library_.get());
+  ResetStats();
+}
+
+void
+Predictor::InitScratchPool_(LoadedLibrary* library) {
+  PredThreadPool* pool = &worker_pool_->pool;
+  /* allocate scratch buffers for laying out rows, one for each worker
+     thread plus one for the master thread. Each buffer holds as many
+     rows as the batch prediction function is given at once, along with a
+     bitmask of missing values if the library takes one. */
+  const size_t mask_size
+    = (library->pred_masked_func_handle != nullptr) ? (num_feature_ + 63) / 64
+                                                    : 0;
+  library->scratch_pool.reset(new ScratchPool(
+    num_worker_thread_, 1,
+    GetBlockSize(library->pred_batch_func_handle, num_feature_)
+    * num_feature_, mask_size));
+  // each worker allocates its own buffer
+  InputToken request{InputType::kInitWorker, nullptr, nullptr, false,
+                     num_output_group_, num_feature_,
+                     library->pred_func_handle,
+                     library->pred_batch_func_handle,
+                     library->pred_dense_func_handle,
+                     library->pred_masked_func_handle,
+                     0, 0, nullptr, 0, nullptr, library->scratch_pool.get(),
+                     nullptr};
+  PredTaskGroup group(num_worker_thread_);
+  for (int tid = 0; tid < num_worker_thread_; ++tid) {
+    pool->SubmitTask(tid, request, &group, tid);
+  }
+  group.Wait(pool->WaitPolicy());
+}
+
+void
+Predictor::PrefaultLibrary_(LoadedLibrary* library) const {
+  const double tstart = dmlc::GetTime();
+  if (load_options_.prefault != PrefaultMode::kNone) {
+    library->load_stats.prefault_bytes
+      = PrefaultLibrary(library->pred_func_handle,
+                        load_options_.prefault == PrefaultMode::kLock,
+                        &library->load_stats.locked);
+  }
+  library->load_stats.prefault_time = dmlc::GetTime() - tstart;
+}
+
+void
+Predictor::WarmUp_(LoadedLibrary* library, size_t num_row) {
+  if (num_row == 0) {
+    return;
+  }
+  std::vector<float> data(num_row * num_feature_);
+  FillSyntheticRows(num_row, num_feature_, data.data());
+  const DenseBatch batch{data.data(), std::numeric_limits<float>::quiet_NaN(),
+                         num_row, num_feature_};
+  const size_t out_size = num_row * num_output_group_;
+  std::vector<float> out_pred((num_worker_thread_ + 1) * out_size);
+  // every worker predicts all the rows, each into its own output
+  PredThreadPool* pool = &worker_pool_->pool;
+  PredTaskGroup group(num_worker_thread_);
+  for (int tid = 0; tid < num_worker_thread_; ++tid) {
+    InputToken request{InputType::kDenseBatch, &batch,
+                       PredictRowsOf<DenseBatch>, false,
+                       num_output_group_, num_feature_,
+                       library->pred_func_handle,
+                       library->pred_batch_func_handle,
+                       library->pred_dense_func_handle,
+                       library->pred_masked_func_handle,
+                       0, num_row, nullptr, 0, nullptr,
+                       library->scratch_pool.get(), &out_pred[tid * out_size]};
+    pool->SubmitTask(tid, request, &group, tid);
+  }
+  group.Wait(pool->WaitPolicy());
+  // and so does the calling thread
+  std::unique_ptr<ScratchBuffer> scratch = library->scratch_pool->TakeSpare();
+  PredictBatch_(&batch, false, num_output_group_, num_feature_,
+                library->pred_func_handle, library->pred_batch_func_handle,
+                library->pred_dense_func_handle,
+                library->pred_masked_func_handle, scratch.get(), 0, num_row,
+                &out_pred[num_worker_thread_ * out_size]);
+  library->scratch_pool->ReturnSpare(std::move(scratch));
+}
+
+void
+Predictor::SetLoadOptions(const LoadOptions& options) {
+  load_options_ = options;
+}
+
+void
+Predictor::InitCoalescer_() {
+  if (coalesce_max_batch_size_ <= 1 || !loaded_) {
+    coalescer_.reset();
+    return;
+  }
+  coalescer_.reset(new Coalescer(num_feature_, num_output_group_,
+    coalesce_max_batch_size_, coalesce_max_delay_us_,
+    [this](const DenseBatch* batch, bool pred_margin, float* out_result) {
+      return PredictBatch(batch, 0, pred_margin, out_result);
     }));
 }
 
 void
 Predictor::Free() {
-  CloseLibrary(lib_handle_);
-  delete static_cast<PredThreadPool*>(thread_pool_handle_);
-  if (using_remote_lib_) {
-    if (std::remove(temp_libfile_.c_str()) != 0) {
-      std::cerr << "Couldn't remove file " << temp_libfile_ << std::endl;
-      exit(-1);
+  coalescer_.reset();
+  // the library is unloaded here, unless a prediction is still holding on
+  // to it
+  std::atomic_store(&library_, std::shared_ptr<LoadedLibrary>());
+  loaded_ = false;
+  if (!shared_worker_pool_) {
+    worker_pool_.reset();
+  }
+}
+
+void
+Predictor::SetAffinityPolicy(AffinityPolicy policy,
+                             const std::vector<int>& cpu_list, int numa_node) {
+  CHECK(!shared_worker_pool_)
+    << "Cannot change the affinity policy of a shared worker pool";
+  affinity_policy_ = policy;
+  cpu_list_ = cpu_list;
+  numa_node_ = numa_node;
+  if (worker_pool_) {
+    // re-create the worker threads, so that they are placed anew
+    InitThreadPool_();
+  }
+}
+
+void
+Predictor::SetWaitStrategy(WaitStrategy strategy) {
+  CHECK(!shared_worker_pool_)
+    << "Cannot change the wait strategy of a shared worker pool";
+  wait_strategy_ = strategy;
+  if (worker_pool_) {
+    InitThreadPool_();
+  }
+}
+
+void
+Predictor::SetQueueDepth(size_t queue_depth) {
+  CHECK(!shared_worker_pool_)
+    << "Cannot change the queue depth of a shared worker pool";
+  queue_depth_ = queue_depth;
+  if (worker_pool_) {
+    InitThreadPool_();
+  }
+}
+
+void
+Predictor::SetCoalescing(size_t max_batch_size, uint32_t max_delay_us) {
+  coalesce_max_batch_size_ = max_batch_size;
+  coalesce_max_delay_us_ = max_delay_us;
+  InitCoalescer_();
+}
+
+Predictor::CoalescingStats
+Predictor::GetCoalescingStats() const {
+  CoalescingStats stats{0, 0, 0, 0.0};
+  if (coalescer_) {
+    coalescer_->GetStats(&stats.num_request, &stats.num_batch,
+                         &stats.num_full_batch);
+    if (stats.num_batch > 0) {
+      stats.coalescing_ratio
+        = static_cast<double>(stats.num_request) / stats.num_batch;
     }
   }
+  return stats;
+}
+
+std::vector<Predictor::WorkerStats>
+Predictor::GetWorkerStats() const {
+  std::vector<WorkerStats> stats;
+  if (!worker_pool_) {
+    return stats;
+  }
+  const PredThreadPool& pool = worker_pool_->pool;
+  for (int tid = 0; tid < pool.NumWorker(); ++tid) {
+    uint64_t spin_ns, sleep_ns, work_ns, num_task;
+    pool.GetWorkerStats(tid, &spin_ns, &sleep_ns, &work_ns, &num_task);
+    stats.push_back(WorkerStats{spin_ns * 1e-9, sleep_ns * 1e-9,
+                                work_ns * 1e-9,
+                                static_cast<size_t>(num_task)});
+  }
+  return stats;
+}
+
+namespace {
+
+Predictor::LatencySummary Summarize(const LatencyHistogram& hist) {
+  const uint64_t count = hist.Count();
+  return Predictor::LatencySummary{
+    static_cast<size_t>(count),
+    (count > 0) ? hist.Sum() * 1e-9 / count : 0.0,
+    hist.Quantile(0.5) * 1e-9, hist.Quantile(0.9) * 1e-9,
+    hist.Quantile(0.99) * 1e-9, hist.Quantile(0.999) * 1e-9,
+    hist.Max() * 1e-9};
+}
+
+void WriteHistogram(std::ostream& os, const char* stage,
+                    const LatencyHistogram& hist) {
+  // buckets at powers of two, from about 1 microsecond to about 1 minute
+  const char* name = "treelite_predictor_latency_seconds";
+  for (int k = 10; k <= 36; ++k) {
+    os << name << "_bucket{stage=\"" << stage << "\",le=\""
+       << static_cast<double>(1ULL << k) * 1e-9 << "\"} "
+       << hist.CountBelowPowerOfTwo(k) << "\n";
+  }
+  os << name << "_bucket{stage=\"" << stage << "\",le=\"+Inf\"} "
+     << hist.Count() << "\n";
+  os << name << "_sum{stage=\"" << stage << "\"} " << hist.Sum() * 1e-9
+     << "\n";
+  os << name << "_count{stage=\"" << stage << "\"} " << hist.Count() << "\n";
+}
+
+}  // anonymous namespace
+
+Predictor::Stats
+Predictor::GetStats() const {
+  Stats stats;
+  std::shared_ptr<LoadedLibrary> library = AcquireLibrary_();
+  stats.model_version = library ? library->version : 0;
+  stats.load = library ? library->load_stats
+                       : LoadStats{0.0, 0.0, 0.0, 0.0, 0.0, 0, false};
+  stats.elapsed_time = stats_->ElapsedTime();
+  stats.num_batch = static_cast<size_t>(stats_->NumBatch());
+  stats.num_row = static_cast<size_t>(stats_->NumRow());
+  stats.rows_per_sec = (stats.elapsed_time > 0.0)
+                       ? stats.num_row / stats.elapsed_time : 0.0;
+  stats.latency = Summarize(stats_->total);
+  stats.queue_wait = Summarize(stats_->queue_wait);
+  stats.compute = Summarize(stats_->compute);
+  stats.reshape = Summarize(stats_->reshape);
+  stats.worker = GetWorkerStats();
+  stats_->SubtractBaseline(&stats.worker);
+  return stats;
+}
+
+void
+Predictor::ResetStats() {
+  stats_->Reset(GetWorkerStats());
+}
+
+void
+Predictor::DumpStats(const std::string& path) const {
+  const Stats stats = GetStats();
+  std::ostringstream os;
+  os.precision(12);
+  os << "# HELP treelite_predictor_latency_seconds Time taken by a batch "
+     << "prediction, by stage\n"
+     << "# TYPE treelite_predictor_latency_seconds histogram\n";
+  WriteHistogram(os, "total", stats_->total);
+  WriteHistogram(os, "queue_wait", stats_->queue_wait);
+  WriteHistogram(os, "compute", stats_->compute);
+  WriteHistogram(os, "reshape", stats_->reshape);
+  os << "# HELP treelite_predictor_model_version Version of the library new "
+     << "predictions go to\n"
+     << "# TYPE treelite_predictor_model_version gauge\n"
+     << "treelite_predictor_model_version " << stats.model_version << "\n"
+     << "# HELP treelite_predictor_load_seconds Time taken by each phase of "
+     << "loading the current library\n"
+     << "# TYPE treelite_predictor_load_seconds gauge\n"
+     << "treelite_predictor_load_seconds{phase=\"open\"} "
+     << stats.load.open_time << "\n"
+     << "treelite_predictor_load_seconds{phase=\"prefault\"} "
+     << stats.load.prefault_time << "\n"
+     << "treelite_predictor_load_seconds{phase=\"worker_init\"} "
+     << stats.load.worker_init_time << "\n"
+     << "treelite_predictor_load_seconds{phase=\"warmup\"} "
+     << stats.load.warmup_time << "\n"
+     << "treelite_predictor_load_seconds{phase=\"total\"} "
+     << stats.load.total_time << "\n"
+     << "# HELP treelite_predictor_batches_total Number of batches predicted\n"
+     << "# TYPE treelite_predictor_batches_total counter\n"
+     << "treelite_predictor_batches_total " << stats.num_batch << "\n"
+     << "# HELP treelite_predictor_rows_total Number of rows predicted\n"
+     << "# TYPE treelite_predictor_rows_total counter\n"
+     << "treelite_predictor_rows_total " << stats.num_row << "\n"
+     << "# HELP treelite_predictor_rows_per_second Rows predicted per second "
+     << "since the last reset\n"
+     << "# TYPE treelite_predictor_rows_per_second gauge\n"
+     << "treelite_predictor_rows_per_second " << stats.rows_per_sec << "\n"
+     << "# HELP treelite_worker_busy_seconds_total Time a worker thread has "
+     << "spent running tasks\n"
+     << "# TYPE treelite_worker_busy_seconds_total counter\n";
+  for (size_t i = 0; i < stats.worker.size(); ++i) {
+    os << "treelite_worker_busy_seconds_total{worker=\"" << i << "\"} "
+       << stats.worker[i].work_time << "\n";
+  }
+  os << "# HELP treelite_worker_idle_seconds_total Time a worker thread has "
+     << "spent waiting for tasks\n"
+     << "# TYPE treelite_worker_idle_seconds_total counter\n";
+  for (size_t i = 0; i < stats.worker.size(); ++i) {
+    os << "treelite_worker_idle_seconds_total{worker=\"" << i
+       << "\",state=\"spin\"} " << stats.worker[i].spin_time << "\n"
+       << "treelite_worker_idle_seconds_total{worker=\"" << i
+       << "\",state=\"sleep\"} " << stats.worker[i].sleep_time << "\n";
+  }
+  // write to a temporary file first, so that readers never see a partly
+  // written file
+  const std::string temp_path = path + ".tmp";
+  {
+    std::ofstream of(temp_path);
+    CHECK(of) << "Failed to open `" << temp_path << "' for writing";
+    of << os.str();
+    CHECK(of) << "Failed to write to `" << temp_path << "'";
+  }
+  CHECK_EQ(std::rename(temp_path.c_str(), path.c_str()), 0)
+    << "Failed to rename `" << temp_path << "' to `" << path << "'";
+}
+
+void
+Predictor::SetSchedulingPolicy(SchedulingPolicy policy, size_t grain_size) {
+  scheduling_policy_ = policy;
+  grain_size_ = grain_size;
+}
+
+void
+Predictor::SetMinWorkPerThread(double min_work_per_thread) {
+  CHECK_GE(min_work_per_thread, 0.0)
+    << "min_work_per_thread must not be negative";
+  min_work_per_thread_ = min_work_per_thread;
 }
 
 template <typename BatchType>
@@ -404,81 +1766,269 @@ std::vector<size_t> SplitBatch(const BatchType* batch, size_t nthread) {
   return row_ptr;
 }
 
+int
+Predictor::GetNumParticipant(size_t num_row, int max_participant,
+                             double row_cost) const {
+  // no estimate available, or told to use all threads
+  if (row_cost <= 0.0 || min_work_per_thread_ <= 0.0) {
+    return max_participant;
+  }
+  const double num_participant = num_row * row_cost / min_work_per_thread_;
+  if (num_participant >= max_participant) {
+    return max_participant;
+  }
+  return std::max(static_cast<int>(num_participant), 1);
+}
+
 template <typename BatchType>
-inline size_t
+inline Predictor::AsyncHandle
 Predictor::PredictBatchBase_(const BatchType* batch, int verbose,
-                             bool pred_margin, float* out_result) {
-  static_assert(std::is_same<BatchType, DenseBatch>::value
-                || std::is_same<BatchType, CSRBatch>::value,
-                "PredictBatchBase_: unrecognized batch type");
+                             bool pred_margin, float* out_result,
+                             bool async, PredictCallback callback,
+                             CompletionQueue* cq, uint64_t seq_id) {
   const double tstart = dmlc::GetTime();
-  PredThreadPool* pool = static_cast<PredThreadPool*>(thread_pool_handle_);
+  PredThreadPool* pool = &worker_pool_->pool;
+  // the whole batch goes to the same library, even if Reload() swaps it
+  // halfway through
+  std::shared_ptr<LoadedLibrary> library = AcquireLibrary_();
+  CHECK(library) << "A shared library needs to be loaded first using Load()";
   const InputType input_type
-    = std::is_same<BatchType, CSRBatch>::value
-      ? InputType::kSparseBatch : InputType::kDenseBatch;
-  InputToken request{input_type, static_cast<const void*>(batch), pred_margin,
-                     num_output_group_, pred_func_handle_,
-                     0, batch->num_row, out_result};
-  OutputToken response;
+    = IsSparseBatch<BatchType>::value ? InputType::kSparseBatch
+                                      : InputType::kDenseBatch;
+  InputToken request{input_type, static_cast<const void*>(batch),
+                     PredictRowsOf<BatchType>, pred_margin,
+                     num_output_group_, num_feature_,
+                     library->pred_func_handle,
+                     library->pred_batch_func_handle,
+                     library->pred_dense_func_handle,
+                     library->pred_masked_func_handle,
+                     0, batch->num_row, nullptr, 0, nullptr,
+                     library->scratch_pool.get(), out_result,
+                     std::chrono::steady_clock::now()};
   CHECK_GT(batch->num_row, 0);
-  const int nthread = std::min(num_worker_thread_,
-                               static_cast<int>(batch->num_row)
-                                 - static_cast<int>(include_master_thread_));
-  const std::vector<size_t> row_ptr
-    = SplitBatch(batch, nthread + static_cast<int>(include_master_thread_));
-  for (int tid = 0; tid < nthread; ++tid) {
-    request.rbegin = row_ptr[tid];
-    request.rend = row_ptr[tid + 1];
-    pool->SubmitTask(tid, request);
-  }
-  size_t total_size = 0;
-  if (include_master_thread_) {
-    const size_t rbegin = row_ptr[nthread];
-    const size_t rend = row_ptr[nthread + 1];
-    const size_t query_result_size
-      = PredictBatch_(batch, pred_margin, num_output_group_,
-                      pred_func_handle_,
-                      rbegin, rend, QueryResultSize(batch, rbegin, rend),
-                      out_result);
-    total_size += query_result_size;
-  }
-  for (int tid = 0; tid < nthread; ++tid) {
-    if (pool->WaitForTask(tid, &response)) {
-      total_size += response.query_result_size;
-    }
+  // Use only as many threads as the amount of work justifies. The master
+  // thread takes part only in synchronous predictions. A synchronous
+  // prediction that isn't worth splitting runs entirely on the master
+  // thread, skipping the trip through the worker queues, unless the cost
+  // model is turned off.
+  const int num_row = static_cast<int>(
+    std::min(batch->num_row,
+             static_cast<size_t>(std::numeric_limits<int>::max())));
+  const int max_participant = async
+    ? std::min(num_worker_thread_, num_row)
+    : std::max(std::min(num_worker_thread_
+                          + static_cast<int>(include_master_thread_), num_row),
+               1);
+  CHECK_GT(max_participant, 0)
+    << "Asynchronous prediction requires at least one worker thread";
+  const int num_participant
+    = GetNumParticipant(batch->num_row, max_participant, library->row_cost);
+  bool use_master_thread;
+  if (async) {
+    use_master_thread = false;
+  } else if (num_participant == 1 && min_work_per_thread_ > 0.0) {
+    use_master_thread = true;
+  } else {
+    use_master_thread = include_master_thread_ || num_worker_thread_ == 0;
   }
-  const double tend = dmlc::GetTime();
+  const int nthread = num_participant - static_cast<int>(use_master_thread);
   if (verbose > 0) {
-    LOG(INFO) << "Treelite: Finished prediction in "
-              << tend - tstart << " sec";
+    LOG(INFO) << "Treelite: Predicting " << batch->num_row << " rows with "
+              << num_participant << " thread(s)"
+              << (nthread == 0 ? ", on the calling thread" : "");
   }
-  return total_size;
+  const std::vector<size_t> row_ptr = SplitBatch(batch, num_participant);
+
+  // Results are reported to a task group owned by this call, so that
+  // multiple threads may call PredictBatch() at the same time. The master
+  // thread reports its share as the last task.
+  BatchJob* job = new BatchJob(num_participant, batch->num_row,
+                               num_output_group_, out_result, callback,
+                               stats_.get());
+  job->library = library;
+  job->tsubmit = request.tsubmit;
+  job->tstart = tstart;
+  job->verbose = verbose;
+  if (cq != nullptr) {
+    job->callback = [cq, seq_id, job](size_t) { cq->Push(seq_id, job); };
+  }
+  if (scheduling_policy_ == SchedulingPolicy::kWorkStealing
+      && num_participant > 1) {
+    // by default, give each thread about 8 chunks to start with
+    const size_t grain_size = (grain_size_ > 0) ? grain_size_
+      : std::max(static_cast<size_t>(1), batch->num_row / (8 * num_participant));
+    job->row_scheduler.reset(
+      new WorkStealingRange(batch->num_row, grain_size, num_participant));
+    request.row_scheduler = job->row_scheduler.get();
+  }
+  const int first_worker
+    = (nthread > 0) ? worker_pool_->AssignWorkers(nthread) : 0;
+  for (int i = 0; i < nthread; ++i) {
+    request.rbegin = row_ptr[i];
+    request.rend = row_ptr[i + 1];
+    request.participant_id = i;
+    pool->SubmitTask((first_worker + i) % num_worker_thread_, request,
+                     &job->group, i);
+  }
+  if (use_master_thread) {
+    // the calling thread borrows a buffer, since other threads may be
+    // calling PredictBatch() at the same time
+    std::unique_ptr<ScratchBuffer> scratch
+      = library->scratch_pool->TakeSpare();
+    request.rbegin = row_ptr[nthread];
+    request.rend = row_ptr[nthread + 1];
+    request.participant_id = nthread;
+    request.scratch = scratch.get();
+    const auto tcompute = std::chrono::steady_clock::now();
+    size_t query_result_size = 0;
+    std::exception_ptr error;
+    try {
+      query_result_size = PredictRows_(batch, request, nullptr, -1);
+    } catch (...) {
+      // report it the same way as an error on a worker, so that the job is
+      // released only after the workers are done with it
+      error = std::current_exception();
+    }
+    const uint64_t compute_ns
+      = ElapsedNanoseconds(tcompute, std::chrono::steady_clock::now());
+    library->scratch_pool->ReturnSpare(std::move(scratch));
+    if (error) {
+      job->group.Fail(nthread, error);
+    } else {
+      job->group.Finish(nthread,
+                        OutputToken{query_result_size, 0, compute_ns});
+    }
+  }
+  return static_cast<AsyncHandle>(job);
 }
 
+template <typename BatchType>
 size_t
-Predictor::PredictBatch(const CSRBatch* batch, int verbose,
+Predictor::PredictBatch(const BatchType* batch, int verbose,
                         bool pred_margin, float* out_result) {
-  return PredictBatchBase_(batch, verbose, pred_margin, out_result);
+  return Wait(PredictBatchBase_(batch, verbose, pred_margin, out_result,
+                                false, nullptr));
+}
+
+template <typename BatchType>
+Predictor::AsyncHandle
+Predictor::PredictBatchAsync(const BatchType* batch, int verbose,
+                             bool pred_margin, float* out_result,
+                             PredictCallback callback) {
+  return PredictBatchBase_(batch, verbose, pred_margin, out_result,
+                           true, callback);
+}
+
+bool
+Predictor::Poll(AsyncHandle handle) const {
+  return static_cast<const BatchJob*>(handle)->group.IsDone();
 }
 
 size_t
-Predictor::PredictBatch(const DenseBatch* batch, int verbose,
-                        bool pred_margin, float* out_result) {
-  return PredictBatchBase_(batch, verbose, pred_margin, out_result);
+Predictor::Wait(AsyncHandle handle) {
+  std::unique_ptr<BatchJob> job(static_cast<BatchJob*>(handle));
+  job->group.Wait(worker_pool_->pool.WaitPolicy());
+  const size_t total_size = job->result_size;
+  const double tend = dmlc::GetTime();
+  if (job->verbose > 0) {
+    LOG(INFO) << "Treelite: Finished prediction in "
+              << tend - job->tstart << " sec";
+    size_t num_alloc;
+    double alloc_time;
+    job->library->scratch_pool->GetAllocStats(&num_alloc, &alloc_time);
+    LOG(INFO) << "Treelite: " << num_alloc << " scratch buffer(s) allocated "
+              << "since the library was loaded, taking "
+              << alloc_time << " sec in total";
+  }
+  return total_size;
+}
+
+Predictor::CompletionQueueHandle
+Predictor::CreateCompletionQueue() {
+  return static_cast<CompletionQueueHandle>(new CompletionQueue());
+}
+
+void
+Predictor::FreeCompletionQueue(CompletionQueueHandle cq) {
+  CompletionQueue* cq_ = static_cast<CompletionQueue*>(cq);
+  while (cq_->NumPending() > 0) {
+    // the results are discarded, and so are errors
+    try {
+      WaitNext(cq);
+    } catch (...) {}
+  }
+  delete cq_;
+}
+
+template <typename BatchType>
+uint64_t
+Predictor::SubmitBatches(const BatchType* const* batches, size_t num_batch,
+                         int verbose, bool pred_margin,
+                         float* const* out_results, CompletionQueueHandle cq) {
+  // check up front, so that no batch is left unaccounted for in the queue
+  for (size_t i = 0; i < num_batch; ++i) {
+    CHECK_GT(batches[i]->num_row, 0);
+  }
+  CompletionQueue* cq_ = static_cast<CompletionQueue*>(cq);
+  const uint64_t first_seq_id = cq_->Reserve(num_batch);
+  for (size_t i = 0; i < num_batch; ++i) {
+    PredictBatchBase_(batches[i], verbose, pred_margin, out_results[i],
+                      true, nullptr, cq_, first_seq_id + i);
+  }
+  return first_seq_id;
+}
+
+// Instantiate the functions taking batches for every supported batch type
+#define TREELITE_INSTANTIATE_BATCH(...) \
+  template size_t Predictor::PredictBatch(const __VA_ARGS__*, int, bool, \
+                                          float*); \
+  template Predictor::AsyncHandle Predictor::PredictBatchAsync( \
+    const __VA_ARGS__*, int, bool, float*, PredictCallback); \
+  template uint64_t Predictor::SubmitBatches(const __VA_ARGS__* const*, \
+    size_t, int, bool, float* const*, CompletionQueueHandle);
+
+#define TREELITE_INSTANTIATE_BATCHES_OF(ElementType) \
+  TREELITE_INSTANTIATE_BATCH(DenseBatchT<ElementType>) \
+  TREELITE_INSTANTIATE_BATCH(CSRBatchT<ElementType, uint32_t, size_t>) \
+  TREELITE_INSTANTIATE_BATCH(CSRBatchT<ElementType, int32_t, int32_t>) \
+  TREELITE_INSTANTIATE_BATCH(CSRBatchT<ElementType, int64_t, int64_t>)
+
+TREELITE_INSTANTIATE_BATCHES_OF(float)
+TREELITE_INSTANTIATE_BATCHES_OF(double)
+TREELITE_INSTANTIATE_BATCHES_OF(Float16)
+TREELITE_INSTANTIATE_BATCHES_OF(int32_t)
+TREELITE_INSTANTIATE_BATCHES_OF(int64_t)
+
+Predictor::Completion
+Predictor::WaitNext(CompletionQueueHandle cq) {
+  uint64_t seq_id;
+  BatchJob* job;
+  static_cast<CompletionQueue*>(cq)->Pop(true, &seq_id, &job);
+  return Completion{seq_id, Wait(static_cast<AsyncHandle>(job))};
+}
+
+bool
+Predictor::TryNext(CompletionQueueHandle cq, Completion* out_completion) {
+  uint64_t seq_id;
+  BatchJob* job;
+  if (!static_cast<CompletionQueue*>(cq)->Pop(false, &seq_id, &job)) {
+    return false;
+  }
+  *out_completion = Completion{seq_id, Wait(static_cast<AsyncHandle>(job))};
+  return true;
 }
 
 size_t
 Predictor::PredictInst(TreelitePredictorEntry* inst, bool pred_margin,
                        float* out_result) {
-  PredThreadPool* pool = static_cast<PredThreadPool*>(thread_pool_handle_);
-  const InputType input_type = InputType::kSingleInst;
-  InputToken request{input_type, static_cast<const void*>(inst), pred_margin,
-                     num_output_group_, pred_func_handle_,
-                     0, 1, out_result};
-  OutputToken response;
+  if (coalescer_) {
+    return coalescer_->Predict(inst, pred_margin, out_result);
+  }
+  std::shared_ptr<LoadedLibrary> library = AcquireLibrary_();
+  CHECK(library) << "A shared library needs to be loaded first using Load()";
   size_t total_size;
   total_size = PredictInst_(inst, pred_margin, num_output_group_,
-                            pred_func_handle_,
+                            library->pred_func_handle,
                             QueryResultSizeSingleInst(), out_result);
   return total_size;
 }
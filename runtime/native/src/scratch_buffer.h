@@ -0,0 +1,194 @@
+/*!
+* Copyright by 2018 Contributors
+* \file scratch_buffer.h
+* \brief Reusable buffers for laying out rows before prediction
+* \author Philip Cho
+*/
+#ifndef TREELITE_SCRATCH_BUFFER_H_
+#define TREELITE_SCRATCH_BUFFER_H_
+
+#include <treelite/entry.h>
+#include <dmlc/logging.h>
+#include <dmlc/timer.h>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace treelite {
+
+/*!
+ * \brief Array of entries in which a thread lays out rows before passing them
+ *        to the prediction function. Every entry is kept missing between
+ *        uses, so that a user only needs to reset the entries it touched.
+ *        The array starts on a cache line boundary and is padded to a whole
+ *        number of cache lines, so that buffers of different threads never
+ *        share a cache line.
+ *
+ *        For prediction libraries taking a bitmask of missing values, the
+ *        buffer also holds such a bitmask, with every bit kept set between
+ *        uses. The entries then only carry feature values and need not be
+ *        reset.
+ */
+class ScratchBuffer {
+ public:
+  /*!
+   * \param size number of entries
+   * \param mask_size number of 64-bit words in the bitmask of missing
+   *                  values; 0 if no bitmask is needed
+   */
+  explicit ScratchBuffer(size_t size, size_t mask_size = 0)
+    : size_(size), mask_size_(mask_size), dirty_(false) {
+    const size_t entry_bytes = RoundUp(size * sizeof(TreelitePredictorEntry));
+    const size_t num_bytes = entry_bytes + mask_size * sizeof(uint64_t);
+    storage_.reset(new char[num_bytes + kAlignment]);
+    const uintptr_t addr = RoundUp(reinterpret_cast<uintptr_t>(storage_.get()));
+    data_ = reinterpret_cast<TreelitePredictorEntry*>(addr);
+    mask_ = reinterpret_cast<uint64_t*>(addr + entry_bytes);
+    Reset();
+  }
+
+  /*!
+   * \brief obtain the array for use. If the previous user failed to reset
+   *        the entries it touched (because an error was raised halfway), the
+   *        whole array is reset first.
+   * \return pointer to the array, with all entries set to missing
+   */
+  inline TreelitePredictorEntry* Acquire() {
+    if (dirty_) {
+      Reset();
+    }
+    dirty_ = true;
+    return data_;
+  }
+  /*! \brief give up the array, after resetting all touched entries */
+  inline void Release() {
+    dirty_ = false;
+  }
+  /*! \brief number of entries in the array */
+  inline size_t Size() const {
+    return size_;
+  }
+  /*!
+   * \brief get the bitmask of missing values. Valid between Acquire() and
+   *        Release(), and every bit must be set again before Release().
+   */
+  inline uint64_t* Mask() {
+    return mask_;
+  }
+  /*! \brief number of 64-bit words in the bitmask */
+  inline size_t MaskSize() const {
+    return mask_size_;
+  }
+
+ private:
+  static constexpr size_t kAlignment = 64;  // size of L1 cache line
+
+  std::unique_ptr<char[]> storage_;
+  TreelitePredictorEntry* data_;
+  uint64_t* mask_;
+  size_t size_;
+  size_t mask_size_;
+  bool dirty_;
+
+  inline void Reset() {
+    TreelitePredictorEntry missing;
+    missing.missing = -1;
+    std::fill(data_, data_ + size_, missing);
+    std::fill(mask_, mask_ + mask_size_, ~static_cast<uint64_t>(0));
+  }
+  static inline size_t RoundUp(size_t x) {
+    return (x + kAlignment - 1) / kAlignment * kAlignment;
+  }
+};
+
+/*!
+ * \brief Set of scratch buffers owned by a predictor, allocated once when
+ *        the prediction library is loaded. Each worker thread gets a buffer
+ *        of its own, which it allocates itself so that the buffer is placed
+ *        on the worker's NUMA node. Threads that call the predictor and take
+ *        part in the work borrow one from a list of spares; more spares are
+ *        allocated only when more threads call the predictor at the same
+ *        time than ever before.
+ */
+class ScratchPool {
+ public:
+  /*!
+   * \param num_worker number of worker threads
+   * \param num_spare number of spare buffers to allocate up front
+   * \param buffer_size number of entries in each buffer
+   * \param mask_size number of 64-bit words in the bitmask of missing values
+   *                  of each buffer; 0 if no bitmask is needed
+   */
+  ScratchPool(int num_worker, int num_spare, size_t buffer_size,
+              size_t mask_size = 0)
+    : buffer_size_(buffer_size), mask_size_(mask_size),
+      worker_buffer_(num_worker),
+      num_alloc_(0), alloc_time_(0.0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < num_spare; ++i) {
+      spare_buffer_.push_back(Allocate());
+    }
+  }
+
+  /*!
+   * \brief allocate the buffer belonging to a worker thread. Must be called
+   *        from the worker thread itself, before it takes any task.
+   */
+  inline void AllocateWorkerBuffer(int tid) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    worker_buffer_[tid] = Allocate();
+  }
+  /*! \brief get the buffer belonging to a worker thread */
+  inline ScratchBuffer* GetWorkerBuffer(int tid) {
+    return worker_buffer_[tid].get();
+  }
+  /*! \brief borrow a spare buffer, allocating one if none is left */
+  inline std::unique_ptr<ScratchBuffer> TakeSpare() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (spare_buffer_.empty()) {
+      return Allocate();
+    }
+    std::unique_ptr<ScratchBuffer> buffer = std::move(spare_buffer_.back());
+    spare_buffer_.pop_back();
+    return buffer;
+  }
+  /*! \brief return a buffer obtained with TakeSpare() */
+  inline void ReturnSpare(std::unique_ptr<ScratchBuffer> buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    spare_buffer_.push_back(std::move(buffer));
+  }
+  /*!
+   * \brief get the number of buffers allocated so far, and the time spent
+   *        allocating them
+   */
+  inline void GetAllocStats(size_t* out_num_alloc, double* out_alloc_time) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *out_num_alloc = num_alloc_;
+    *out_alloc_time = alloc_time_;
+  }
+
+ private:
+  size_t buffer_size_;
+  size_t mask_size_;
+  std::vector<std::unique_ptr<ScratchBuffer>> worker_buffer_;
+  std::vector<std::unique_ptr<ScratchBuffer>> spare_buffer_;
+  size_t num_alloc_;
+  double alloc_time_;  // in seconds
+  std::mutex mutex_;
+
+  // must be called with mutex_ held
+  inline std::unique_ptr<ScratchBuffer> Allocate() {
+    const double tstart = dmlc::GetTime();
+    std::unique_ptr<ScratchBuffer> buffer(new ScratchBuffer(buffer_size_,
+                                                               mask_size_));
+    alloc_time_ += dmlc::GetTime() - tstart;
+    ++num_alloc_;
+    return buffer;
+  }
+};
+
+}  // namespace treelite
+
+#endif  // TREELITE_SCRATCH_BUFFER_H_
@@ -0,0 +1,264 @@
+/*!
+* Copyright by 2018 Contributors
+* \file stats.h
+* \brief Always-on performance statistics of a predictor
+* \author Philip Cho
+*/
+#ifndef TREELITE_STATS_H_
+#define TREELITE_STATS_H_
+
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace treelite {
+
+/*!
+ * \brief Histogram of durations, with buckets of about the same relative
+ *        width, in the manner of HdrHistogram. Each power of two is split
+ *        into 16 buckets, so a duration is known to within 1/16 (about 6%).
+ *        Durations up to 2^44 ns (about 5 hours) are told apart; longer ones
+ *        share the last bucket. Any number of threads may record at the same
+ *        time, without locking.
+ */
+class LatencyHistogram {
+ public:
+  LatencyHistogram() : count_(0), sum_ns_(0), max_ns_(0) {
+    for (auto& e : bucket_) {
+      e.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /*! \brief record a duration, in nanoseconds */
+  inline void Record(uint64_t ns) {
+    bucket_[BucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max_ns = max_ns_.load(std::memory_order_relaxed);
+    while (ns > max_ns
+           && !max_ns_.compare_exchange_weak(max_ns, ns,
+                                             std::memory_order_relaxed)) {}
+  }
+  /*!
+   * \brief forget all recorded durations. Durations being recorded at the
+   *        same time may be partly forgotten.
+   */
+  inline void Reset() {
+    for (auto& e : bucket_) {
+      e.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_ns_.store(0, std::memory_order_relaxed);
+    max_ns_.store(0, std::memory_order_relaxed);
+  }
+
+  /*! \brief number of recorded durations */
+  inline uint64_t Count() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+  /*! \brief sum of recorded durations, in nanoseconds */
+  inline uint64_t Sum() const {
+    return sum_ns_.load(std::memory_order_relaxed);
+  }
+  /*! \brief longest recorded duration, in nanoseconds */
+  inline uint64_t Max() const {
+    return max_ns_.load(std::memory_order_relaxed);
+  }
+  /*!
+   * \brief estimate a quantile of the recorded durations
+   * \param q quantile, between 0 and 1
+   * \return the quantile in nanoseconds; 0 if nothing was recorded
+   */
+  inline double Quantile(double q) const {
+    uint64_t total = 0;
+    std::vector<uint64_t> count(kNumBucket);
+    for (int i = 0; i < kNumBucket; ++i) {
+      count[i] = bucket_[i].load(std::memory_order_relaxed);
+      total += count[i];
+    }
+    if (total == 0) {
+      return 0.0;
+    }
+    const uint64_t rank = std::max(static_cast<uint64_t>(1),
+        static_cast<uint64_t>(std::ceil(q * static_cast<double>(total))));
+    uint64_t seen = 0;
+    for (int i = 0; i < kNumBucket; ++i) {
+      seen += count[i];
+      if (seen >= rank) {
+        // middle of the bucket, but never beyond the longest duration
+        const double mid = 0.5 * static_cast<double>(LowerBound(i)
+                                                     + UpperBound(i) - 1);
+        return std::min(mid, static_cast<double>(Max()));
+      }
+    }
+    return static_cast<double>(Max());
+  }
+  /*!
+   * \brief number of recorded durations shorter than 2^k nanoseconds. This
+   *        is exact, since powers of two fall on bucket boundaries.
+   */
+  inline uint64_t CountBelowPowerOfTwo(int k) const {
+    uint64_t total = 0;
+    for (int i = 0; i < kNumBucket && UpperBound(i) <= (1ULL << k); ++i) {
+      total += bucket_[i].load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+ private:
+  static constexpr int kSubBucketBits = 4;
+  static constexpr int kNumSubBucket = 1 << kSubBucketBits;
+  static constexpr int kMaxExponent = 43;  // last bucket starts below 2^44
+  // durations below kNumSubBucket get a bucket each; above that, there are
+  // kNumSubBucket buckets for each power of two
+  static constexpr int kNumBucket
+    = (kMaxExponent - kSubBucketBits + 2) * kNumSubBucket;
+
+  std::atomic<uint64_t> bucket_[kNumBucket];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_ns_;
+  std::atomic<uint64_t> max_ns_;
+
+  static inline int MostSignificantBit(uint64_t x) {
+    int msb = 0;
+    while (x >>= 1) {
+      ++msb;
+    }
+    return msb;
+  }
+  static inline int BucketIndex(uint64_t ns) {
+    if (ns < kNumSubBucket) {
+      return static_cast<int>(ns);
+    }
+    int msb = MostSignificantBit(ns);
+    uint64_t top = ns >> (msb - kSubBucketBits);  // leading bits of ns
+    if (msb > kMaxExponent) {  // too long; put in the last bucket
+      msb = kMaxExponent;
+      top = 2 * kNumSubBucket - 1;
+    }
+    return (msb - kSubBucketBits + 1) * kNumSubBucket
+           + static_cast<int>(top - kNumSubBucket);
+  }
+  // smallest duration falling in bucket i
+  static inline uint64_t LowerBound(int i) {
+    if (i < kNumSubBucket) {
+      return static_cast<uint64_t>(i);
+    }
+    const int shift = i / kNumSubBucket - 1;
+    return static_cast<uint64_t>(kNumSubBucket + i % kNumSubBucket) << shift;
+  }
+  // smallest duration falling beyond bucket i
+  static inline uint64_t UpperBound(int i) {
+    if (i < kNumSubBucket) {
+      return static_cast<uint64_t>(i + 1);
+    }
+    const int shift = i / kNumSubBucket - 1;
+    return static_cast<uint64_t>(kNumSubBucket + i % kNumSubBucket + 1)
+           << shift;
+  }
+};
+
+/*!
+ * \brief Statistics of the batch predictions made by a predictor since it
+ *        was created or last reset. Cheap enough to be always on: every
+ *        batch costs a handful of relaxed atomic additions.
+ */
+class StatsCollector {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  StatsCollector() : num_batch_(0), num_row_(0), reset_time_(Clock::now()) {}
+
+  /*!
+   * \brief record a finished batch
+   * \param num_row number of rows in the batch
+   * \param total_ns time from submission until the results were ready
+   * \param queue_wait_ns time from submission until the last thread working
+   *                      on the batch got to it
+   * \param compute_ns longest time any thread spent on its share of rows
+   * \param reshape_ns time spent compacting the output
+   */
+  inline void RecordBatch(size_t num_row, uint64_t total_ns,
+                          uint64_t queue_wait_ns, uint64_t compute_ns,
+                          uint64_t reshape_ns) {
+    num_batch_.fetch_add(1, std::memory_order_relaxed);
+    num_row_.fetch_add(num_row, std::memory_order_relaxed);
+    total.Record(total_ns);
+    queue_wait.Record(queue_wait_ns);
+    compute.Record(compute_ns);
+    reshape.Record(reshape_ns);
+  }
+  /*!
+   * \brief start over. Worker counters only ever grow, so the current
+   *        values are kept, to be subtracted from later readings.
+   * \param worker_baseline current busy/idle counters of each worker
+   */
+  template <typename WorkerStatsType>
+  inline void Reset(const std::vector<WorkerStatsType>& worker_baseline) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_batch_.store(0, std::memory_order_relaxed);
+    num_row_.store(0, std::memory_order_relaxed);
+    total.Reset();
+    queue_wait.Reset();
+    compute.Reset();
+    reshape.Reset();
+    reset_time_ = Clock::now();
+    worker_baseline_.clear();
+    for (const auto& e : worker_baseline) {
+      worker_baseline_.push_back(
+        WorkerBaseline{e.spin_time, e.sleep_time, e.work_time, e.num_task});
+    }
+  }
+  /*! \brief subtract the baseline taken at the last reset */
+  template <typename WorkerStatsType>
+  inline void SubtractBaseline(std::vector<WorkerStatsType>* worker) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < worker->size() && i < worker_baseline_.size();
+         ++i) {
+      WorkerStatsType& e = (*worker)[i];
+      e.spin_time -= worker_baseline_[i].spin_time;
+      e.sleep_time -= worker_baseline_[i].sleep_time;
+      e.work_time -= worker_baseline_[i].work_time;
+      e.num_task -= worker_baseline_[i].num_task;
+    }
+  }
+  /*! \brief seconds elapsed since the last reset */
+  inline double ElapsedTime() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::chrono::duration<double>(Clock::now() - reset_time_).count();
+  }
+  inline uint64_t NumBatch() const {
+    return num_batch_.load(std::memory_order_relaxed);
+  }
+  inline uint64_t NumRow() const {
+    return num_row_.load(std::memory_order_relaxed);
+  }
+
+  LatencyHistogram total;
+  LatencyHistogram queue_wait;
+  LatencyHistogram compute;
+  LatencyHistogram reshape;
+
+ private:
+  struct WorkerBaseline {
+    double spin_time;
+    double sleep_time;
+    double work_time;
+    size_t num_task;
+  };
+
+  std::atomic<uint64_t> num_batch_;
+  std::atomic<uint64_t> num_row_;
+  Clock::time_point reset_time_;
+  std::vector<WorkerBaseline> worker_baseline_;
+  mutable std::mutex mutex_;
+};
+
+}  // namespace treelite
+
+#endif  // TREELITE_STATS_H_
@@ -0,0 +1,266 @@
+/*!
+* Copyright by 2018 Contributors
+* \file affinity.h
+* \brief Placement of worker threads on CPUs
+* \author Philip Cho
+*/
+#ifndef TREELITE_THREAD_POOL_AFFINITY_H_
+#define TREELITE_THREAD_POOL_AFFINITY_H_
+
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__APPLE__) && defined(__MACH__)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace treelite {
+namespace affinity {
+
+// CPUs this process is allowed to run on, in ascending order
+inline std::vector<int> GetAvailableCPUs() {
+  std::vector<int> cpus;
+#if !defined(_WIN32) && !(defined(__APPLE__) && defined(__MACH__))
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) == 0) {
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &cpuset)) {
+        cpus.push_back(i);
+      }
+    }
+  }
+#endif
+  if (cpus.empty()) {
+    const int num_cpu = static_cast<int>(std::thread::hardware_concurrency());
+    for (int i = 0; i < num_cpu; ++i) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+// parse a CPU list such as "0-3,8-11"
+inline std::vector<int> ParseCPUList(const std::string& str) {
+  std::vector<int> cpus;
+  std::istringstream iss(str);
+  std::string range;
+  while (std::getline(iss, range, ',')) {
+    int first, last;
+    const size_t pos = range.find('-');
+    try {
+      if (pos == std::string::npos) {
+        first = last = std::stoi(range);
+      } else {
+        first = std::stoi(range.substr(0, pos));
+        last = std::stoi(range.substr(pos + 1));
+      }
+    } catch (const std::exception&) {
+      continue;  // skip blank or malformed ranges
+    }
+    for (int i = first; i <= last; ++i) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+/*!
+ * \brief get the available CPUs of each NUMA node, indexed by node id. A
+ *        node has an empty list if none of its CPUs are available. If the
+ *        NUMA topology is unknown (e.g. on platforms other than Linux), all
+ *        available CPUs are put in a single node.
+ */
+inline std::vector<std::vector<int>> GetNUMANodes() {
+  const std::vector<int> available = GetAvailableCPUs();
+  std::vector<std::vector<int>> nodes;
+#if !defined(_WIN32) && !(defined(__APPLE__) && defined(__MACH__))
+  for (int node_id = 0; ; ++node_id) {
+    std::ifstream fi("/sys/devices/system/node/node"
+                     + std::to_string(node_id) + "/cpulist");
+    if (!fi) {
+      break;
+    }
+    std::string line;
+    std::getline(fi, line);
+    std::vector<int> cpus;
+    for (int cpu : ParseCPUList(line)) {
+      if (std::binary_search(available.begin(), available.end(), cpu)) {
+        cpus.push_back(cpu);
+      }
+    }
+    nodes.push_back(cpus);
+  }
+#endif
+  if (nodes.empty()) {
+    nodes.push_back(available);
+  }
+  return nodes;
+}
+
+// NUMA node the calling thread is running on; 0 if unknown
+inline int GetCurrentNUMANode(const std::vector<std::vector<int>>& nodes) {
+#if !defined(_WIN32) && !(defined(__APPLE__) && defined(__MACH__))
+  const int cpu = sched_getcpu();
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    if (std::find(nodes[i].begin(), nodes[i].end(), cpu) != nodes[i].end()) {
+      return static_cast<int>(i);
+    }
+  }
+#endif
+  return 0;
+}
+
+// Each of the following functions decides which CPU each of [num_worker]
+// worker threads should be pinned to.
+
+// number of workers of live pools that AssignCompact() has placed on each CPU
+struct CompactUsage {
+  std::mutex mutex;
+  std::map<int, int> num_worker;
+};
+
+inline CompactUsage& GetCompactUsage() {
+  static CompactUsage usage;
+  return usage;
+}
+
+// consecutive CPUs, leaving the first CPU for the calling thread. Each worker
+// goes to the lowest CPU holding the fewest workers of live pools, so that
+// separate pools in one process don't share CPUs until all CPUs are taken,
+// and a pool re-created after the old one is released gets the same CPUs
+// back. The CPUs must be given back with ReleaseCompact() once the pool is
+// gone.
+inline std::vector<int> AssignCompact(int num_worker) {
+  std::vector<int> cpus = GetAvailableCPUs();
+  CHECK(!cpus.empty()) << "No CPU available";
+  // try the first CPU last
+  std::rotate(cpus.begin(), cpus.begin() + 1, cpus.end());
+  CompactUsage& usage = GetCompactUsage();
+  std::lock_guard<std::mutex> lock(usage.mutex);
+  std::vector<int> assignment(num_worker);
+  for (int i = 0; i < num_worker; ++i) {
+    int best = cpus[0];
+    for (int cpu : cpus) {
+      if (usage.num_worker[cpu] < usage.num_worker[best]) {
+        best = cpu;
+      }
+    }
+    ++usage.num_worker[best];
+    assignment[i] = best;
+  }
+  return assignment;
+}
+
+// give back CPUs handed out by AssignCompact()
+inline void ReleaseCompact(const std::vector<int>& assignment) {
+  CompactUsage& usage = GetCompactUsage();
+  std::lock_guard<std::mutex> lock(usage.mutex);
+  for (int cpu : assignment) {
+    if (--usage.num_worker[cpu] == 0) {
+      usage.num_worker.erase(cpu);
+    }
+  }
+}
+
+// CPUs dealt from NUMA nodes in turn, spread out evenly within each node
+inline std::vector<int> AssignScatter(int num_worker) {
+  std::vector<std::vector<int>> nodes = GetNUMANodes();
+  nodes.erase(std::remove_if(nodes.begin(), nodes.end(),
+                             [](const std::vector<int>& x) {
+                               return x.empty();
+                             }),
+              nodes.end());
+  CHECK(!nodes.empty()) << "No CPU available";
+  const int num_node = static_cast<int>(nodes.size());
+  std::vector<int> assignment(num_worker);
+  for (int i = 0; i < num_worker; ++i) {
+    const std::vector<int>& cpus = nodes[i % num_node];
+    // number of workers placed on this node, and the index of this one
+    const size_t num_on_node = num_worker / num_node
+                               + (i % num_node < num_worker % num_node);
+    const size_t idx = i / num_node;
+    assignment[i] = cpus[(idx * cpus.size() / num_on_node) % cpus.size()];
+  }
+  return assignment;
+}
+
+// CPUs given by the user, in order, wrapping around if there are more
+// workers than CPUs
+inline std::vector<int> AssignExplicit(int num_worker,
+                                       const std::vector<int>& cpu_list) {
+  CHECK(!cpu_list.empty())
+    << "A list of CPUs must be given for the explicit affinity policy";
+  int num_cpu = static_cast<int>(std::thread::hardware_concurrency());
+#ifdef _WIN32
+  // an affinity mask only covers the CPUs of one processor group
+  num_cpu = std::min(num_cpu, static_cast<int>(sizeof(DWORD_PTR) * 8));
+#endif
+  for (int cpu : cpu_list) {
+    CHECK(cpu >= 0 && cpu < num_cpu)
+      << "CPU " << cpu << " in cpu_list does not exist; "
+      << "valid ids are 0 to " << (num_cpu - 1);
+  }
+  std::vector<int> assignment(num_worker);
+  for (int i = 0; i < num_worker; ++i) {
+    assignment[i] = cpu_list[i % cpu_list.size()];
+  }
+  return assignment;
+}
+
+// consecutive CPUs of a single NUMA node; if numa_node is -1, use the node
+// the calling thread is running on
+inline std::vector<int> AssignNUMALocal(int num_worker, int numa_node) {
+  const std::vector<std::vector<int>> nodes = GetNUMANodes();
+  if (numa_node < 0) {
+    numa_node = GetCurrentNUMANode(nodes);
+  }
+  CHECK_LT(static_cast<size_t>(numa_node), nodes.size())
+    << "NUMA node " << numa_node << " does not exist";
+  const std::vector<int>& cpus = nodes[numa_node];
+  CHECK(!cpus.empty()) << "NUMA node " << numa_node << " has no CPU available";
+  std::vector<int> assignment(num_worker);
+  for (int i = 0; i < num_worker; ++i) {
+    assignment[i] = cpus[i % cpus.size()];
+  }
+  return assignment;
+}
+
+// pin the calling thread to a CPU
+inline void PinCurrentThread(int cpu) {
+#ifdef _WIN32
+  /* Windows */
+  SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#elif defined(__APPLE__) && defined(__MACH__)
+  /* Mac OSX: only an affinity hint is available */
+  thread_port_t mach_thread = pthread_mach_thread_np(pthread_self());
+  thread_affinity_policy_data_t policy = {cpu + 1};
+  thread_policy_set(mach_thread, THREAD_AFFINITY_POLICY,
+                    (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
+#else
+  /* Linux and others */
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu, &cpuset);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+#endif
+}
+
+}  // namespace affinity
+}  // namespace treelite
+
+#endif  // TREELITE_THREAD_POOL_AFFINITY_H_
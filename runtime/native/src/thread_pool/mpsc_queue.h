@@ -0,0 +1,287 @@
+/*!
+* Copyright by 2018 Contributors
+* \file mpsc_queue.h
+* \brief Lock-free multi-producer-single-consumer queue
+* \author Yida Wang, Philip Cho
+*/
+#ifndef TREELITE_THREAD_POOL_MPSC_QUEUE_H_
+#define TREELITE_THREAD_POOL_MPSC_QUEUE_H_
+
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) \
+    || defined(_M_X64)
+#include <immintrin.h>
+#define TREELITE_CPU_RELAX() _mm_pause()
+#else
+#define TREELITE_CPU_RELAX() std::atomic_signal_fence(std::memory_order_seq_cst)
+#endif
+
+const constexpr int kL1CacheBytes = 64;
+
+/*!
+ * \brief How the consumer of a queue waits for an element to arrive when the
+ *        queue is empty. Spinning picks up a new element sooner, at the cost
+ *        of keeping a core busy; sleeping frees the core, but waking up
+ *        takes a trip through the OS scheduler.
+ */
+struct QueueWaitPolicy {
+  /*! \brief number of rounds to spin before going to sleep */
+  uint32_t spin_count;
+  /*! \brief whether to go to sleep at all; if false, spin until an element
+             arrives */
+  bool can_sleep;
+  /*!
+   * \brief whether to back off exponentially while spinning, and to adapt
+   *        the number of rounds to how soon elements arrived in the past:
+   *        spin longer after an element arrived while spinning, and shorter
+   *        after having to sleep. spin_count is the upper limit.
+   */
+  bool adaptive;
+};
+
+/*!
+ * \brief Lock-free multi-producer-single-consumer queue for each thread.
+ *        Any number of threads may call Push() at the same time; only the
+ *        owning worker may call Pop(). Each slot carries a sequence number
+ *        so that producers can claim slots with a single CAS on the tail.
+ */
+template <typename T>
+class MpscQueue {
+ public:
+  /*! \brief default number of elements the queue can hold at once */
+  static constexpr const uint32_t kDefaultRingSize = 256;
+
+  /*!
+   * \param ring_size number of elements the queue can hold at once; rounded
+   *                  up to a power of two, and to at least 2. Push() blocks
+   *                  while the queue is full.
+   * \param wait_policy how the consumer waits while the queue is empty
+   */
+  explicit MpscQueue(uint32_t ring_size = kDefaultRingSize,
+                     const QueueWaitPolicy& wait_policy
+                       = QueueWaitPolicy{300000, true, false}) :
+    ring_size_(RoundUpToPowerOfTwo(ring_size)),
+    buffer_(new Cell[ring_size_]),
+    head_(0),
+    tail_(0),
+    wait_policy_(wait_policy),
+    spin_budget_(wait_policy.spin_count),
+    spin_ns_(0),
+    sleep_ns_(0) {
+    for (uint32_t i = 0; i < ring_size_; ++i) {
+      buffer_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~MpscQueue() {
+    delete[] buffer_;
+  }
+
+  void Push(const T& input) {
+    while (!Enqueue(input)) {
+      std::this_thread::yield();
+    }
+    if (pending_.fetch_add(1) == -1) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.notify_one();
+    }
+  }
+
+  bool Pop(T* output) {
+    if (pending_.load() == 0) {
+      // Busy wait a bit when the queue is empty.
+      // If a new element comes to the queue quickly, this wait avoid the
+      // worker from sleeping.
+      const Clock::time_point tstart = Clock::now();
+      if (!wait_policy_.can_sleep) {
+        while (!Spin(UINT32_MAX)) {}
+      } else if (wait_policy_.adaptive) {
+        if (Spin(spin_budget_)) {
+          spin_budget_ = std::min(spin_budget_ * 2, wait_policy_.spin_count);
+        } else {
+          spin_budget_ = std::max(spin_budget_ / 2,
+                                  std::min(kMinSpinBudget,
+                                           wait_policy_.spin_count));
+        }
+      } else {
+        Spin(wait_policy_.spin_count);
+      }
+      AddTime(&spin_ns_, Clock::now() - tstart);
+    }
+    if (pending_.fetch_sub(1) == 0) {
+      const Clock::time_point tstart = Clock::now();
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] {
+        return pending_.load() >= 0 || exit_now_.load();
+      });
+      AddTime(&sleep_ns_, Clock::now() - tstart);
+    }
+    if (exit_now_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    Cell* cell = &buffer_[head & (ring_size_ - 1)];
+    // Another producer may have claimed an earlier slot and still be writing
+    // to it, even though a later element has already been counted in
+    // pending_; wait for the slot at head to be published.
+    while (cell->sequence.load(std::memory_order_acquire) != head + 1) {
+      std::this_thread::yield();
+    }
+    *output = cell->data;
+    cell->sequence.store(head + ring_size_, std::memory_order_release);
+    head_.store(head + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /*!
+   * \brief Check whether any element is waiting to be popped. The answer may
+   *        be out of date by the time it is returned.
+   */
+  bool HasPending() const {
+    return pending_.load(std::memory_order_relaxed) > 0;
+  }
+
+  /*! \brief total time the consumer has spent spinning, in nanoseconds */
+  uint64_t SpinTime() const {
+    return spin_ns_.load(std::memory_order_relaxed);
+  }
+  /*! \brief total time the consumer has spent asleep, in nanoseconds */
+  uint64_t SleepTime() const {
+    return sleep_ns_.load(std::memory_order_relaxed);
+  }
+
+  /*!
+   * \brief Signal to terminate the worker.
+   */
+  void SignalForKill() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    exit_now_.store(true);
+    cv_.notify_all();
+  }
+
+ protected:
+  using Clock = std::chrono::steady_clock;
+  // spin budget never shrinks below this, so that the adaptive policy can
+  // notice when elements start arriving quickly again
+  static constexpr const uint32_t kMinSpinBudget = 64;
+  // longest run of pause instructions between two checks, before switching
+  // to yielding the CPU
+  static constexpr const uint32_t kMaxPause = 64;
+
+  // spin for up to [num_round] rounds; return whether an element arrived
+  // (or the worker was told to exit) in the meantime
+  bool Spin(uint32_t num_round) {
+    uint32_t num_pause = 1;
+    for (uint32_t i = 0; i < num_round; ++i) {
+      if (pending_.load() > 0 || exit_now_.load(std::memory_order_relaxed)) {
+        return true;
+      }
+      if (wait_policy_.adaptive && num_pause <= kMaxPause) {
+        for (uint32_t j = 0; j < num_pause; ++j) {
+          TREELITE_CPU_RELAX();
+        }
+        num_pause *= 2;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    return false;
+  }
+
+  // counters are written by the consumer only, so no read-modify-write is
+  // needed
+  static void AddTime(std::atomic<uint64_t>* counter,
+                      Clock::duration elapsed) {
+    counter->store(counter->load(std::memory_order_relaxed)
+                   + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       elapsed).count(),
+                   std::memory_order_relaxed);
+  }
+
+  static uint32_t RoundUpToPowerOfTwo(uint32_t x) {
+    CHECK(x > 0 && x <= (1U << 31)) << "Invalid queue depth: " << x;
+    // with a single slot, a filled slot would look free to the next producer
+    uint32_t y = 2;
+    while (y < x) {
+      y <<= 1;
+    }
+    return y;
+  }
+
+  bool Enqueue(const T& input) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell* cell = &buffer_[tail & (ring_size_ - 1)];
+      const uint32_t seq = cell->sequence.load(std::memory_order_acquire);
+      const int32_t diff = static_cast<int32_t>(seq - tail);
+      if (diff == 0) {  // slot is free; try to claim it
+        if (tail_.compare_exchange_weak(tail, tail + 1,
+                                        std::memory_order_relaxed)) {
+          cell->data = input;
+          cell->sequence.store(tail + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {  // queue is full
+        return false;
+      } else {  // another producer got here first
+        tail = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  struct Cell {
+    std::atomic<uint32_t> sequence;
+    T data;
+  };
+
+  // the cache line paddings are used for avoid false sharing between atomic variables
+  typedef char cache_line_pad_t[kL1CacheBytes];
+  cache_line_pad_t pad0_;
+  // size of the queue, the queue can host ring_size_ items at most; must be
+  // a power of two so that slot indices stay consistent when counters wrap.
+  const uint32_t ring_size_;
+  // pointer to access the item
+  Cell* const buffer_;
+
+  cache_line_pad_t pad1_;
+  // queue head, where the consumer gets an element from the queue
+  std::atomic<uint32_t> head_;
+
+  cache_line_pad_t pad2_;
+  // queue tail, where producers put elements to the queue
+  std::atomic<uint32_t> tail_;
+
+  cache_line_pad_t pad3_;
+  // pending elements in the queue
+  std::atomic<int32_t> pending_{0};
+
+  cache_line_pad_t pad4_;
+  // signal for exit now
+  std::atomic<bool> exit_now_{false};
+
+  // internal mutex
+  std::mutex mutex_;
+  // cv for consumer
+  std::condition_variable cv_;
+
+  cache_line_pad_t pad5_;
+  // fields below are touched by the consumer only (the counters may be read
+  // by anyone)
+  const QueueWaitPolicy wait_policy_;
+  // number of rounds to spin next time, for the adaptive policy
+  uint32_t spin_budget_;
+  std::atomic<uint64_t> spin_ns_;
+  std::atomic<uint64_t> sleep_ns_;
+};
+
+template <typename T>
+constexpr const uint32_t MpscQueue<T>::kMinSpinBudget;
+
+#endif  // TREELITE_THREAD_POOL_MPSC_QUEUE_H_
@@ -8,105 +8,270 @@
 #define TREELITE_THREAD_POOL_THREAD_POOL_H_
 
 #include <treelite/common.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
 #include <vector>
-#ifdef _WIN32
-#define NOMINMAX
-#include <windows.h>
-#else
-#include <sched.h>
-#endif
-#include "spsc_queue.h"
+#include "affinity.h"
+#include "mpsc_queue.h"
 
 namespace treelite {
 
-template <typename InputToken, typename OutputToken, typename TaskContext>
+/*!
+ * \brief Set of tasks submitted together by one caller. Workers report each
+ *        finished task with Finish(), or a task that threw with Fail(); the
+ *        caller blocks in Wait() until all tasks in the group are done. Each
+ *        caller owns its own group, so callers never wait on one another's
+ *        tasks.
+ */
+template <typename OutputToken>
+class TaskGroup {
+ public:
+  /*! \brief function to run once all tasks have finished */
+  using Callback = std::function<void(const std::vector<OutputToken>&)>;
+
+  explicit TaskGroup(int num_task, Callback on_finish = nullptr)
+    : response_(num_task), pending_(num_task), done_(num_task == 0),
+      on_finish_(on_finish) {}
+
+  void Finish(int task_id, const OutputToken& response) {
+    response_[task_id] = response;
+    FinishTask_();
+  }
+
+  /*!
+   * \brief report a task that threw an exception. The group still finishes
+   *        once all of its tasks are done, and Wait() rethrows the first
+   *        error reported.
+   */
+  void Fail(int task_id, std::exception_ptr error) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) {
+        error_ = error;
+      }
+    }
+    FinishTask_();
+  }
+
+  /*! \brief whether any task has failed */
+  bool HasError() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<bool>(error_);
+  }
+
+  /*! \brief whether all tasks have finished, without blocking */
+  bool IsDone() const {
+    return done_.load();
+  }
+
+  /*!
+   * \brief wait for all tasks to finish, the same way the workers of the
+   *        pool wait for tasks: spin until the tasks finish if the policy
+   *        never sleeps, or else spin for up to wait_policy.spin_count rounds
+   *        before going to sleep. If a task failed, its error is rethrown.
+   * \param wait_policy wait policy of the pool running the tasks
+   */
+  const std::vector<OutputToken>& Wait(const QueueWaitPolicy& wait_policy) {
+    if (!wait_policy.can_sleep) {
+      while (!done_.load()) {
+        std::this_thread::yield();
+      }
+    }
+    for (uint32_t i = 0; i < wait_policy.spin_count && !done_.load(); ++i) {
+      std::this_thread::yield();
+    }
+    // Always take the lock, so that the last worker is done touching this
+    // object before the caller is allowed to destroy it
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return done_.load(); });
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    return response_;
+  }
+
+ private:
+  std::vector<OutputToken> response_;
+  std::atomic<int> pending_;
+  std::atomic<bool> done_;
+  std::exception_ptr error_;  // first error reported; guarded by mutex_
+  Callback on_finish_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+
+  inline void FinishTask_() {
+    if (pending_.fetch_sub(1) == 1) {  // last task to finish
+      // run the callback before Wait() returns, so that the group is still
+      // alive while the callback runs
+      if (on_finish_) {
+        on_finish_(response_);
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_.store(true);
+      cv_.notify_all();
+    }
+  }
+};
+
+template <typename InputToken, typename OutputToken>
 class ThreadPool {
  public:
-  using TaskFunc = void(*)(SpscQueue<InputToken>*, SpscQueue<OutputToken>*,
-                           const TaskContext*);
+  /*!
+   * \brief function that runs a task; it is given the id of the worker
+   *        running it and the pool itself
+   */
+  using TaskFunc = OutputToken(*)(const InputToken&, int, const ThreadPool&);
+  using TaskGroupType = TaskGroup<OutputToken>;
 
-  ThreadPool(int num_worker, const TaskContext* context, TaskFunc task)
-    : num_worker_(num_worker), context_(context), task_(task) {
+  /*!
+   * \param num_worker number of worker threads
+   * \param task function that runs tasks
+   * \param cpu_assignment CPU to pin each worker to; -1 (or an empty list)
+   *                       to leave the worker unpinned
+   * \param wait_policy how idle workers wait for new tasks
+   * \param queue_depth number of tasks that can be queued up for each
+   *                    worker; SubmitTask() blocks while the queue of the
+   *                    worker is full
+   */
+  ThreadPool(int num_worker, TaskFunc task,
+             const std::vector<int>& cpu_assignment = {},
+             const QueueWaitPolicy& wait_policy
+               = QueueWaitPolicy{300000, true, false},
+             uint32_t queue_depth = MpscQueue<Task>::kDefaultRingSize)
+    : num_worker_(num_worker), task_(task), cpu_assignment_(cpu_assignment),
+      wait_policy_(wait_policy), counter_(num_worker) {
     CHECK(num_worker_ > 0 && num_worker_ <= std::thread::hardware_concurrency())
     << "Number of worker threads must be between 1 and "
     << std::thread::hardware_concurrency();
+    cpu_assignment_.resize(num_worker_, -1);
     for (int i = 0; i < num_worker_; ++i) {
-      incoming_queue_.emplace_back(common::make_unique<SpscQueue<InputToken>>());
-      outgoing_queue_.emplace_back(common::make_unique<SpscQueue<OutputToken>>());
+      incoming_queue_.emplace_back(
+        common::make_unique<MpscQueue<Task>>(queue_depth, wait_policy));
     }
     thread_.resize(num_worker_);
     for (int i = 0; i < num_worker_; ++i) {
-      thread_[i] = std::thread(task_, incoming_queue_[i].get(),
-                                      outgoing_queue_[i].get(),
-                                      context_);
+      thread_[i] = std::thread(&ThreadPool::RunWorker, this, i);
     }
-    /* bind threads to cores */
-    SetAffinity();
   }
   ~ThreadPool() {
     for (int i = 0; i < num_worker_; ++i) {
       incoming_queue_[i]->SignalForKill();
-      outgoing_queue_[i]->SignalForKill();
       thread_[i].join();
     }
   }
 
-  void SubmitTask(int tid, InputToken request) {
-    incoming_queue_[tid]->Push(request);
+  /*!
+   * \brief Submit a task to a worker. May be called from many threads at
+   *        once; tasks given to the same worker run in the order they
+   *        arrive, so concurrent callers share the workers first-come,
+   *        first-served.
+   * \param tid id of worker thread
+   * \param request task to run
+   * \param group group to notify when the task finishes
+   * \param task_id index of the task within the group
+   */
+  void SubmitTask(int tid, InputToken request,
+                  TaskGroupType* group, int task_id) {
+    incoming_queue_[tid]->Push(Task{request, group, task_id});
+  }
+
+  /*!
+   * \brief Check whether tasks are waiting for a worker, besides the one it
+   *        is running. Meant to be called by the worker itself, to decide
+   *        whether to take on more work for the current task.
+   * \param tid id of worker thread
+   */
+  bool HasPendingTask(int tid) const {
+    return incoming_queue_[tid]->HasPending();
+  }
+
+  /*! \brief number of worker threads */
+  int NumWorker() const {
+    return num_worker_;
   }
 
-  bool WaitForTask(int tid, OutputToken* response) {
-    return outgoing_queue_[tid]->Pop(response);
+  /*! \brief CPU each worker is pinned to; -1 if the worker is not pinned */
+  const std::vector<int>& CPUAssignment() const {
+    return cpu_assignment_;
+  }
+
+  /*! \brief how idle workers wait for new tasks */
+  const QueueWaitPolicy& WaitPolicy() const {
+    return wait_policy_;
+  }
+
+  /*!
+   * \brief Get the time a worker has spent in each state so far, in
+   *        nanoseconds, and the number of tasks it has run. The numbers are
+   *        updated each time the worker finishes waiting or running a task.
+   * \param tid id of worker thread
+   */
+  void GetWorkerStats(int tid, uint64_t* out_spin_ns, uint64_t* out_sleep_ns,
+                      uint64_t* out_work_ns, uint64_t* out_num_task) const {
+    *out_spin_ns = incoming_queue_[tid]->SpinTime();
+    *out_sleep_ns = incoming_queue_[tid]->SleepTime();
+    *out_work_ns = counter_[tid].work_ns.load(std::memory_order_relaxed);
+    *out_num_task = counter_[tid].num_task.load(std::memory_order_relaxed);
   }
 
  private:
+  struct Task {
+    InputToken request;
+    TaskGroupType* group;
+    int task_id;
+  };
+  // written by the worker only; padded so that workers don't share a line
+  struct WorkCounter {
+    std::atomic<uint64_t> work_ns{0};
+    std::atomic<uint64_t> num_task{0};
+    char pad[kL1CacheBytes];
+  };
+
   int num_worker_;
   std::vector<std::thread> thread_;
-  std::vector<std::unique_ptr<SpscQueue<InputToken>>> incoming_queue_;
-  std::vector<std::unique_ptr<SpscQueue<OutputToken>>> outgoing_queue_;
+  std::vector<std::unique_ptr<MpscQueue<Task>>> incoming_queue_;
   TaskFunc task_;
-  const TaskContext* context_;
+  std::vector<int> cpu_assignment_;
+  QueueWaitPolicy wait_policy_;
+  std::vector<WorkCounter> counter_;
 
-  inline void SetAffinity() {
-#ifdef _WIN32
-    /* Windows */
-    SetThreadAffinityMask(GetCurrentThread(), 0x1);
-    for (int i = 0; i < num_worker_; ++i) {
-      const int core_id = i + 1;
-      SetThreadAffinityMask(thread_[i].native_handle(), (1 << core_id));
-    }
-#elif defined(__APPLE__) && defined(__MACH__)
-#include <TargetConditionals.h>
-#if TARGET_OS_MAC == 1
-    /* Mac OSX */
-    thread_port_t mach_thread = pthread_mach_thread_np(pthread_self());
-    thread_affinity_policy_data_t policy = {0};
-    thread_policy_set(mach_thread, THREAD_AFFINITY_POLICY,
-                      (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
-    for (int i = 0; i < num_worker_; ++i) {
-      const int core_id = i + 1;
-      mach_thread = pthread_mach_thread_np(thread_[i].native_handle());
-      policy = {core_id};
-      thread_policy_set(mach_thread, THREAD_AFFINITY_POLICY,
-                        (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
+  void RunWorker(int tid) {
+    // a thread pins itself, so that everything it allocates from here on is
+    // placed on its NUMA node
+    if (cpu_assignment_[tid] >= 0) {
+      affinity::PinCurrentThread(cpu_assignment_[tid]);
     }
-#else
-    #error "iPhone not supported yet"
-#endif
-#else
-    /* Linux and others */
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(0, &cpuset);
-    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-    for (int i = 0; i < num_worker_; ++i) {
-      const int core_id = i + 1;
-      CPU_ZERO(&cpuset);
-      CPU_SET(core_id, &cpuset);
-      pthread_setaffinity_np(thread_[i].native_handle(),
-                             sizeof(cpu_set_t), &cpuset);
+    using Clock = std::chrono::steady_clock;
+    WorkCounter& counter = counter_[tid];
+    Task task;
+    while (incoming_queue_[tid]->Pop(&task)) {
+      const Clock::time_point tstart = Clock::now();
+      OutputToken response{};
+      std::exception_ptr error;
+      try {
+        response = task_(task.request, tid, *this);
+      } catch (...) {
+        // hand the error to the thread waiting for the group; letting it
+        // escape would terminate the process
+        error = std::current_exception();
+      }
+      counter.work_ns.store(
+        counter.work_ns.load(std::memory_order_relaxed)
+        + std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - tstart).count(),
+        std::memory_order_relaxed);
+      counter.num_task.store(counter.num_task.load(std::memory_order_relaxed)
+                             + 1, std::memory_order_relaxed);
+      if (error) {
+        task.group->Fail(task.task_id, error);
+      } else {
+        task.group->Finish(task.task_id, response);
+      }
     }
-#endif
   }
 };
 
@@ -0,0 +1,127 @@
+/*!
+* Copyright by 2018 Contributors
+* \file work_stealing.h
+* \brief Lock-free work-stealing scheduler for a range of rows
+* \author Philip Cho
+*/
+#ifndef TREELITE_THREAD_POOL_WORK_STEALING_H_
+#define TREELITE_THREAD_POOL_WORK_STEALING_H_
+
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "mpsc_queue.h"
+
+namespace treelite {
+
+/*!
+ * \brief Hands out rows [0, num_row) in chunks of [grain_size] rows to a
+ *        fixed number of participating threads. Each participant starts
+ *        with an equal, contiguous share of chunks and takes chunks from
+ *        the front of its share. Once its share runs out, it steals the
+ *        back half of another participant's share, so that a participant
+ *        that got stuck with expensive rows doesn't hold up everyone else.
+ *
+ * Each share is kept as a pair of 32-bit chunk indices packed into a single
+ * atomic word, so that the owner and thieves can shrink it with one CAS.
+ */
+class WorkStealingRange {
+ public:
+  WorkStealingRange(size_t num_row, size_t grain_size, int num_participant)
+    : num_row_(num_row), slot_(num_participant) {
+    CHECK_GT(num_participant, 0);
+    CHECK_GT(grain_size, 0);
+    // make sure chunk indices fit in 32 bits
+    const size_t max_chunk = std::numeric_limits<uint32_t>::max();
+    grain_size_ = std::max(grain_size, (num_row + max_chunk - 1) / max_chunk);
+    const size_t num_chunk = (num_row + grain_size_ - 1) / grain_size_;
+    const size_t portion = num_chunk / num_participant;
+    const size_t remainder = num_chunk % num_participant;
+    size_t begin = 0;
+    for (int i = 0; i < num_participant; ++i) {
+      const size_t end = begin + portion + (static_cast<size_t>(i) < remainder);
+      slot_[i].range.store(Pack(begin, end), std::memory_order_relaxed);
+      begin = end;
+    }
+  }
+
+  /*!
+   * \brief obtain the next range of rows for a participant to process
+   * \param pid id of the participant, in [0, num_participant)
+   * \param out_rbegin beginning of the range of rows
+   * \param out_rend end of the range of rows
+   * \param steal whether to steal from others once our own share runs out.
+   *              A participant that has other work waiting can turn this off
+   *              and leave the remaining chunks to the others.
+   * \return whether a range was obtained; false if all rows have been
+   *         handed out (or, if steal is false, our own share ran out)
+   */
+  bool Next(int pid, size_t* out_rbegin, size_t* out_rend,
+            bool steal = true) {
+    // 1. take a chunk from the front of our own share
+    std::atomic<uint64_t>& own = slot_[pid].range;
+    uint64_t cur = own.load(std::memory_order_acquire);
+    while (Begin(cur) < End(cur)) {
+      if (own.compare_exchange_weak(cur, Pack(Begin(cur) + 1, End(cur)),
+                                    std::memory_order_acq_rel)) {
+        return GetChunk(Begin(cur), out_rbegin, out_rend);
+      }
+    }
+    if (!steal) {
+      return false;
+    }
+    // 2. steal the back half of someone else's share. Only the owner ever
+    //    replaces an empty share, so no one else can be writing to ours.
+    const int num_participant = static_cast<int>(slot_.size());
+    for (int k = 1; k < num_participant; ++k) {
+      std::atomic<uint64_t>& victim = slot_[(pid + k) % num_participant].range;
+      uint64_t v = victim.load(std::memory_order_acquire);
+      while (Begin(v) < End(v)) {
+        const uint32_t begin = Begin(v);
+        const uint32_t end = End(v);
+        const uint32_t mid = end - (end - begin + 1) / 2;
+        if (victim.compare_exchange_weak(v, Pack(begin, mid),
+                                         std::memory_order_acq_rel)) {
+          // process chunk [mid] now and keep the rest as our new share
+          own.store(Pack(mid + 1, end), std::memory_order_release);
+          return GetChunk(mid, out_rbegin, out_rend);
+        }
+      }
+    }
+    return false;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> range;
+    // keep each share on its own cache line
+    char pad[kL1CacheBytes - sizeof(std::atomic<uint64_t>)];
+  };
+
+  size_t num_row_;
+  size_t grain_size_;
+  std::vector<Slot> slot_;
+
+  static inline uint64_t Pack(uint64_t begin, uint64_t end) {
+    return (begin << 32) | end;
+  }
+  static inline uint32_t Begin(uint64_t range) {
+    return static_cast<uint32_t>(range >> 32);
+  }
+  static inline uint32_t End(uint64_t range) {
+    return static_cast<uint32_t>(range);
+  }
+  inline bool GetChunk(uint32_t chunk_id,
+                       size_t* out_rbegin, size_t* out_rend) const {
+    *out_rbegin = chunk_id * grain_size_;
+    *out_rend = std::min(num_row_, *out_rbegin + grain_size_);
+    return true;
+  }
+};
+
+}  // namespace treelite
+
+#endif  // TREELITE_THREAD_POOL_WORK_STEALING_H_
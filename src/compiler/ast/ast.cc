@@ -91,6 +91,18 @@ void CodeFolderNode::Serialize(treelite_ast_protobuf::ASTNode* out) {
 #endif  // TREELITE_PROTOBUF_SUPPORT
 }
 
+void CompleteTreeNode::Serialize(treelite_ast_protobuf::ASTNode* out) {
+#ifdef TREELITE_PROTOBUF_SUPPORT
+  ASTNode::Serialize(out);
+  treelite_ast_protobuf::CompleteTreeNode* e
+    = out->mutable_complete_tree_variant();
+  e->set_depth(depth);
+  e->set_oblivious(oblivious);
+#else  // TREELITE_PROTOBUF_SUPPORT
+  LOG(FATAL) << "Treelite was not compiled with Protobuf!";
+#endif  // TREELITE_PROTOBUF_SUPPORT
+}
+
 void ConditionNode::Serialize(treelite_ast_protobuf::ASTNode* out) {
 #ifdef TREELITE_PROTOBUF_SUPPORT
   ASTNode::Serialize(out);
@@ -92,6 +92,15 @@ class CodeFolderNode : public ASTNode {
   void Serialize(treelite_ast_protobuf::ASTNode* out) override;
 };
 
+class CompleteTreeNode : public ASTNode {
+ public:
+  CompleteTreeNode(int depth, bool oblivious)
+    : depth(depth), oblivious(oblivious) {}
+  int depth;  // all leaves of the tree are at this depth
+  bool oblivious;  // all tests at the same depth are identical
+  void Serialize(treelite_ast_protobuf::ASTNode* out) override;
+};
+
 class ConditionNode : public ASTNode {
  public:
   ConditionNode(unsigned split_index, bool default_left)
@@ -22,6 +22,9 @@ class ASTBuilder;
 struct CodeFoldingContext;
 bool fold_code(ASTNode*, CodeFoldingContext*, ASTBuilder*);
 bool breakup(ASTNode*, int, int*, ASTBuilder*);
+bool mark_complete_tree(ConditionNode*, double, ASTBuilder*);
+ASTNode* pad_leaf(OutputNode*, size_t, const std::vector<const ConditionNode*>&,
+                  ASTNode*, ASTBuilder*);
 
 class ASTBuilder {
  public:
@@ -53,6 +56,18 @@ class ASTBuilder {
    * \param parallel_comp number of translation units
    */
   void Split(int parallel_comp);
+  /*
+   * \brief mark member trees whose leaves are all at the same depth
+   *        (complete trees), so that they can be evaluated without branches.
+   *        Call this function after Split() and before QuantizeThresholds().
+   * \param padding_req a tree that is not complete is padded into one, by
+   *                    growing its shallower leaves into subtrees whose
+   *                    leaves all carry the same output, if no more than
+   *                    this fraction of the test nodes of the padded tree
+   *                    are added. To disable padding, set to 0
+   * \return number of trees marked
+   */
+  int MarkCompleteTrees(double padding_req);
   /* \brief replace split thresholds with integers */
   void QuantizeThresholds();
   /* \brief call this function before BreakUpLargeTranslationUnits() */
@@ -79,6 +94,11 @@ class ASTBuilder {
   friend bool treelite::compiler::breakup(ASTNode*, int, int*, ASTBuilder*);
   friend bool treelite::compiler::fold_code(ASTNode*, CodeFoldingContext*,
                                             ASTBuilder*);
+  friend bool treelite::compiler::mark_complete_tree(ConditionNode*, double,
+                                                     ASTBuilder*);
+  friend ASTNode* treelite::compiler::pad_leaf(OutputNode*, size_t,
+                    const std::vector<const ConditionNode*>&, ASTNode*,
+                    ASTBuilder*);
 
   template <typename NodeType, typename ...Args>
   NodeType* AddNode(ASTNode* parent, Args&& ...args) {
@@ -0,0 +1,212 @@
+/*!
+ * Copyright 2018 by Contributors
+ * \file complete_tree.cc
+ * \brief AST manipulation logic to find (and pad) complete trees, which can
+ *        be evaluated without branches
+ * \author Philip Cho
+ */
+#include <cmath>
+#include <vector>
+#include "./builder.h"
+
+namespace treelite {
+namespace compiler {
+
+DMLC_REGISTRY_FILE_TAG(complete_tree);
+
+// the leaves of a marked tree are looked up in a table with 2^depth entries
+static const int kMaxCompleteTreeDepth = 16;
+// padding may multiply the number of leaves of a tree by at most this much,
+// so that a deep but sparse tree doesn't blow up the leaf table
+static const double kMaxPaddedLeafRatio = 4.0;
+
+// whether two test nodes perform the same test
+static bool same_test(const ConditionNode* a, const ConditionNode* b) {
+  if (a->split_index != b->split_index || a->default_left != b->default_left) {
+    return false;
+  }
+  const NumericalConditionNode* na
+    = dynamic_cast<const NumericalConditionNode*>(a);
+  const NumericalConditionNode* nb
+    = dynamic_cast<const NumericalConditionNode*>(b);
+  if (na || nb) {
+    if (!na || !nb || na->op != nb->op || na->quantized != nb->quantized) {
+      return false;
+    }
+    return na->quantized ? (na->threshold.int_val == nb->threshold.int_val)
+                         : (na->threshold.float_val == nb->threshold.float_val);
+  }
+  const CategoricalConditionNode* ca
+    = dynamic_cast<const CategoricalConditionNode*>(a);
+  const CategoricalConditionNode* cb
+    = dynamic_cast<const CategoricalConditionNode*>(b);
+  CHECK(ca && cb);
+  return ca->left_categories == cb->left_categories;
+}
+
+ASTNode* pad_leaf(OutputNode* leaf, size_t depth,
+                  const std::vector<const ConditionNode*>& level_test,
+                  ASTNode* parent, ASTBuilder* builder) {
+  if (depth == level_test.size()) {
+    OutputNode* copy
+      = leaf->is_vector ? builder->AddNode<OutputNode>(parent, leaf->vector)
+                        : builder->AddNode<OutputNode>(parent, leaf->scalar);
+    copy->tree_id = leaf->tree_id;
+    return copy;
+  }
+  // both children of the new test carry the same output, so any test will
+  // do; take the one other nodes at this depth perform, to keep oblivious
+  // trees oblivious
+  const ConditionNode* test = level_test[depth];
+  ConditionNode* node = nullptr;
+  const NumericalConditionNode* t
+    = dynamic_cast<const NumericalConditionNode*>(test);
+  if (t) {
+    node = builder->AddNode<NumericalConditionNode>(parent, t->split_index,
+             t->default_left, t->quantized, t->op, t->threshold);
+  } else {
+    const CategoricalConditionNode* t2
+      = dynamic_cast<const CategoricalConditionNode*>(test);
+    CHECK(t2);
+    node = builder->AddNode<CategoricalConditionNode>(parent, t2->split_index,
+             t2->default_left, t2->left_categories);
+  }
+  node->tree_id = leaf->tree_id;
+  for (int i = 0; i < 2; ++i) {
+    node->children.push_back(
+      pad_leaf(leaf, depth + 1, level_test, node, builder));
+  }
+  return node;
+}
+
+// replace [old_child] of [parent] with [new_child]
+static void replace_child(ASTNode* parent, ASTNode* old_child,
+                          ASTNode* new_child) {
+  for (ASTNode*& child : parent->children) {
+    if (child == old_child) {
+      child = new_child;
+      new_child->parent = parent;
+      return;
+    }
+  }
+  LOG(FATAL) << "parent should have a link to current node";
+}
+
+bool mark_complete_tree(ConditionNode* tree_head, double padding_req,
+                        ASTBuilder* builder) {
+  /* collect test nodes level by level, and leaves with their depths */
+  std::vector<std::vector<const ConditionNode*>> level_tests;
+  std::vector<std::pair<OutputNode*, size_t>> leaves;
+  std::vector<ASTNode*> level{tree_head};
+  for (size_t depth = 0; !level.empty(); ++depth) {
+    std::vector<ASTNode*> next_level;
+    for (ASTNode* node : level) {
+      const ConditionNode* test = dynamic_cast<const ConditionNode*>(node);
+      OutputNode* leaf = dynamic_cast<OutputNode*>(node);
+      if (test && node->children.size() == 2) {
+        if (level_tests.size() <= depth) {
+          level_tests.resize(depth + 1);
+        }
+        level_tests[depth].push_back(test);
+        next_level.push_back(node->children[0]);
+        next_level.push_back(node->children[1]);
+      } else if (leaf) {
+        leaves.emplace_back(leaf, depth);
+      } else {
+        return false;  // the tree contains a folded subtree
+      }
+    }
+    level = std::move(next_level);
+  }
+  // every level above the deepest leaves has at least one test
+  const size_t depth = level_tests.size();
+  if (depth > kMaxCompleteTreeDepth) {
+    return false;
+  }
+  size_t num_test = 0;
+  for (const auto& tests : level_tests) {
+    num_test += tests.size();
+  }
+  const double num_test_complete = std::ldexp(1.0, depth) - 1.0;
+  if (1.0 - num_test / num_test_complete > padding_req
+      || num_test_complete + 1.0 > kMaxPaddedLeafRatio * leaves.size()) {
+    return false;
+  }
+
+  bool oblivious = true;
+  for (const auto& tests : level_tests) {
+    for (const ConditionNode* test : tests) {
+      oblivious &= same_test(test, tests[0]);
+    }
+  }
+  if (!oblivious) {
+    // Tests will be looked up in a table, so they must all compare a
+    // feature against a finite threshold, with the same operator
+    const NumericalConditionNode* first
+      = dynamic_cast<const NumericalConditionNode*>(level_tests[0][0]);
+    for (const auto& tests : level_tests) {
+      for (const ConditionNode* test : tests) {
+        const NumericalConditionNode* t
+          = dynamic_cast<const NumericalConditionNode*>(test);
+        if (!t || !first || t->quantized || t->op != first->op
+            || !std::isfinite(t->threshold.float_val)) {
+          return false;
+        }
+      }
+    }
+  }
+
+  /* pad the tree, so that all leaves are at the same depth */
+  std::vector<const ConditionNode*> level_test;
+  for (const auto& tests : level_tests) {
+    level_test.push_back(tests[0]);
+  }
+  for (const auto& e : leaves) {
+    if (e.second < depth) {
+      OutputNode* leaf = e.first;
+      ASTNode* parent = leaf->parent;
+      replace_child(parent, leaf,
+                    pad_leaf(leaf, e.second, level_test, parent, builder));
+    }
+  }
+
+  ASTNode* parent = tree_head->parent;
+  CompleteTreeNode* tree_node
+    = builder->AddNode<CompleteTreeNode>(parent, static_cast<int>(depth),
+                                         oblivious);
+  tree_node->tree_id = tree_head->tree_id;
+  replace_child(parent, tree_head, tree_node);
+  tree_node->children.push_back(tree_head);
+  tree_head->parent = tree_node;
+  return true;
+}
+
+static int mark_complete_trees(ASTNode* node, double padding_req,
+                               ASTBuilder* builder) {
+  int num_marked = 0;
+  if (dynamic_cast<AccumulatorContextNode*>(node)) {
+    for (size_t i = 0; i < node->children.size(); ++i) {
+      ConditionNode* tree_head = dynamic_cast<ConditionNode*>(node->children[i]);
+      if (tree_head) {
+        num_marked += mark_complete_tree(tree_head, padding_req, builder);
+      } else {
+        num_marked += mark_complete_trees(node->children[i], padding_req,
+                                          builder);
+      }
+    }
+  } else if (dynamic_cast<MainNode*>(node)
+             || dynamic_cast<TranslationUnitNode*>(node)
+             || dynamic_cast<QuantizerNode*>(node)) {
+    for (ASTNode* child : node->children) {
+      num_marked += mark_complete_trees(child, padding_req, builder);
+    }
+  }
+  return num_marked;
+}
+
+int ASTBuilder::MarkCompleteTrees(double padding_req) {
+  return mark_complete_trees(this->main_node, padding_req, this);
+}
+
+}  // namespace compiler
+}  // namespace treelite
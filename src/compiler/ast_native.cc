@@ -9,7 +9,9 @@
 #include <treelite/annotator.h>
 #include <fmt/format.h>
 #include <algorithm>
+#include <functional>
 #include <unordered_map>
+#include <unordered_set>
 #include <queue>
 #include <cmath>
 #include "./param.h"
@@ -29,10 +31,15 @@ namespace compiler {
 
 DMLC_REGISTRY_FILE_TAG(ast_native);
 
+// features with at most this many thresholds are quantized by comparing the
+// feature value against every threshold, rather than by a tree search
+static const size_t kMaxLinearQuantizeLen = 8;
+
 class ASTNativeCompiler : public Compiler {
  public:
   explicit ASTNativeCompiler(const CompilerParam& param)
-    : param(param) {
+    : param(param), batch_mode_(false), input_mode_(InputMode::kEntry),
+      cut_pts_(nullptr) {
     if (param.verbose > 0) {
       LOG(INFO) << "Using ASTNativeCompiler";
     }
@@ -45,16 +52,17 @@ class ASTNativeCompiler : public Compiler {
 
     num_feature_ = model.num_feature;
     num_output_group_ = model.num_output_group;
+    average_tree_depth_ = GetAverageTreeDepth(model);
     pred_tranform_func_ = PredTransformFunction("native", model);
     files_.clear();
 
     ASTBuilder builder;
     builder.BuildAST(model);
-    if (builder.FoldCode(param.code_folding_req)
-        || param.quantize > 0) {
+    has_folded_code_ = builder.FoldCode(param.code_folding_req);
+    if (has_folded_code_ || param.quantize > 0) {
       // is_categorical[i] : is i-th feature categorical?
-      array_is_categorical_
-        = RenderIsCategoricalArray(builder.GenerateIsCategoricalArray());
+      is_categorical_ = builder.GenerateIsCategoricalArray();
+      array_is_categorical_ = RenderIsCategoricalArray(is_categorical_);
     }
     if (param.annotate_in != "NULL") {
       BranchAnnotator annotator;
@@ -67,6 +75,12 @@ class ASTNativeCompiler : public Compiler {
                 << param.annotate_in << "'";
     }
     builder.Split(param.parallel_comp);
+    if (param.branchless_tree > 0) {
+      const int num_marked
+        = builder.MarkCompleteTrees(param.branchless_tree_padding);
+      LOG(INFO) << num_marked << " complete trees will be evaluated without "
+                << "branches";
+    }
     if (param.quantize > 0) {
       builder.QuantizeThresholds();
     }
@@ -106,9 +120,30 @@ class ASTNativeCompiler : public Compiler {
   CompilerParam param;
   int num_feature_;
   int num_output_group_;
+  double average_tree_depth_;
   std::string pred_tranform_func_;
+  std::vector<bool> is_categorical_;
   std::string array_is_categorical_;
   std::unordered_map<std::string, std::string> files_;
+  bool batch_mode_;  // generating code for the batch prediction function?
+  // how the function being generated receives feature values: as an array
+  // of entries, as a dense row of floats (predict_dense_row()), or as an
+  // array of floats plus a bitmask of missing features (predict_masked())
+  enum class InputMode { kEntry, kDenseRow, kMasked };
+  InputMode input_mode_;
+  bool has_folded_code_;
+  // thresholds for quantized features; used to recover the original
+  // thresholds when generating the dense row prediction function
+  const std::vector<std::vector<tl_float>>* cut_pts_;
+  // loop that converts feature values of a row into bin indices; rendered
+  // by HandleQNode() and shared with the batch prediction function
+  std::string quantize_loop_;
+  // arrays rendered so far for complete trees, which are shared by all
+  // prediction functions
+  std::unordered_set<std::string> complete_tree_arrays_;
+  // arrays rendered so far for folded subtrees; predict() and the batch
+  // prediction function walk the same subtrees
+  std::unordered_set<std::string> code_folder_arrays_;
 
   void WalkAST(const ASTNode* node,
                const std::string& dest,
@@ -120,6 +155,7 @@ class ASTNativeCompiler : public Compiler {
     const TranslationUnitNode* t5;
     const QuantizerNode* t6;
     const CodeFolderNode* t7;
+    const CompleteTreeNode* t8;
     if ( (t1 = dynamic_cast<const MainNode*>(node)) ) {
       HandleMainNode(t1, dest, indent);
     } else if ( (t2 = dynamic_cast<const AccumulatorContextNode*>(node)) ) {
@@ -134,6 +170,8 @@ class ASTNativeCompiler : public Compiler {
       HandleQNode(t6, dest, indent);
     } else if ( (t7 = dynamic_cast<const CodeFolderNode*>(node)) ) {
       HandleCodeFolderNode(t7, dest, indent);
+    } else if ( (t8 = dynamic_cast<const CompleteTreeNode*>(node)) ) {
+      HandleCompleteTreeNode(t8, dest, indent);
     } else {
       LOG(FATAL) << "Unrecognized AST node type";
     }
@@ -161,6 +199,10 @@ class ASTNativeCompiler : public Compiler {
       = "size_t get_num_output_group(void)";
     const char* get_num_feature_function_signature
       = "size_t get_num_feature(void)";
+    const char* get_num_tree_function_signature
+      = "size_t get_num_tree(void)";
+    const char* get_average_tree_depth_function_signature
+      = "float get_average_tree_depth(void)";
     const char* predict_function_signature
       = (num_output_group_ > 1) ?
           "size_t predict_multiclass(union Entry* data, int pred_margin, "
@@ -174,10 +216,16 @@ class ASTNativeCompiler : public Compiler {
           = get_num_output_group_function_signature,
         "get_num_feature_function_signature"_a
           = get_num_feature_function_signature,
+        "get_num_tree_function_signature"_a = get_num_tree_function_signature,
+        "get_average_tree_depth_function_signature"_a
+          = get_average_tree_depth_function_signature,
         "pred_transform_function"_a = pred_tranform_func_,
         "predict_function_signature"_a = predict_function_signature,
         "num_output_group"_a = num_output_group_,
-        "num_feature"_a = node->num_feature),
+        "num_feature"_a = node->num_feature,
+        "num_tree"_a = node->num_tree,
+        "average_tree_depth"_a
+          = common::ToStringHighPrecision(average_tree_depth_)),
       indent);
     AppendToBuffer("header.h",
       fmt::format(native::header_template,
@@ -185,12 +233,80 @@ class ASTNativeCompiler : public Compiler {
           = get_num_output_group_function_signature,
         "get_num_feature_function_signature"_a
           = get_num_feature_function_signature,
+        "get_num_tree_function_signature"_a = get_num_tree_function_signature,
+        "get_average_tree_depth_function_signature"_a
+          = get_average_tree_depth_function_signature,
         "predict_function_signature"_a = predict_function_signature,
-        "threshold_type"_a = (param.quantize > 0 ? "int" : "float")),
+        "threshold_type"_a = (param.quantize > 0 ? "int" : "float"),
+        "missing_bitmask_macro"_a
+          = (param.missing_bitmask > 0 ? native::missing_bitmask_macro : "")),
+      indent);
+
+    CHECK_EQ(node->children.size(), 1);
+    WalkAST(node->children[0], dest, indent + 2);
+
+    const std::string optional_average_field
+      = (node->average_result) ? fmt::format(" / {}", node->num_tree)
+                               : std::string("");
+    if (num_output_group_ > 1) {
+      AppendToBuffer(dest,
+        fmt::format(native::main_end_multiclass_template,
+          "num_output_group"_a = num_output_group_,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = common::ToStringHighPrecision(node->global_bias)),
+        indent);
+    } else {
+      AppendToBuffer(dest,
+        fmt::format(native::main_end_template,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = common::ToStringHighPrecision(node->global_bias)),
+        indent);
+    }
+
+    if (param.batch_function > 0) {
+      HandleMainNodeBatch(node, dest, indent);
+    }
+    if (param.dense_row_function > 0) {
+      if (has_folded_code_ && param.quantize > 0) {
+        LOG(INFO) << "Not generating predict_dense_row(), since folded "
+                  << "subtrees use quantized thresholds";
+      } else {
+        HandleMainNodeDense(node, dest, indent);
+      }
+    }
+    if (param.missing_bitmask > 0) {
+      if (has_folded_code_ && param.quantize > 0) {
+        LOG(INFO) << "Not generating predict_masked(), since folded "
+                  << "subtrees use quantized thresholds";
+      } else {
+        HandleMainNodeMasked(node, dest, indent);
+      }
+    }
+  }
+
+  // Generate predict_dense_row(), which reads feature values from a dense
+  // row of floats. A feature is considered missing if it is NaN.
+  void HandleMainNodeDense(const MainNode* node,
+                           const std::string& dest,
+                           size_t indent) {
+    const char* predict_dense_row_function_signature
+      = (num_output_group_ > 1) ?
+          "size_t predict_multiclass_dense_row(const float* row, "
+                                              "int pred_margin, float* result)"
+        : "float predict_dense_row(const float* row, int pred_margin)";
+
+    AppendToBuffer(dest,
+      fmt::format(native::main_dense_start_template,
+        "predict_dense_row_function_signature"_a
+          = predict_dense_row_function_signature),
       indent);
+    AppendToBuffer("header.h",
+      fmt::format("{};\n", predict_dense_row_function_signature), 0);
 
     CHECK_EQ(node->children.size(), 1);
+    input_mode_ = InputMode::kDenseRow;
     WalkAST(node->children[0], dest, indent + 2);
+    input_mode_ = InputMode::kEntry;
 
     const std::string optional_average_field
       = (node->average_result) ? fmt::format(" / {}", node->num_tree)
@@ -211,6 +327,134 @@ class ASTNativeCompiler : public Compiler {
     }
   }
 
+  // Generate predict_masked(), which reads feature values from an array of
+  // floats and tells missing features by a packed bitmask, with bit (i % 64)
+  // of word (i / 64) set if feature i is missing. The bitmask may be null if
+  // no feature is missing, in which case no split tests for missing values.
+  void HandleMainNodeMasked(const MainNode* node,
+                            const std::string& dest,
+                            size_t indent) {
+    const char* predict_masked_function_signature
+      = (num_output_group_ > 1) ?
+          "size_t predict_multiclass_masked(const float* values, "
+                                           "const uint64_t* missing, "
+                                           "int pred_margin, float* result)"
+        : "float predict_masked(const float* values, const uint64_t* missing, "
+                               "int pred_margin)";
+
+    AppendToBuffer(dest,
+      fmt::format(native::main_dense_start_template,
+        "predict_dense_row_function_signature"_a
+          = predict_masked_function_signature),
+      indent);
+    AppendToBuffer("header.h",
+      fmt::format("{};\n", predict_masked_function_signature), 0);
+
+    CHECK_EQ(node->children.size(), 1);
+    input_mode_ = InputMode::kMasked;
+    WalkAST(node->children[0], dest, indent + 2);
+    input_mode_ = InputMode::kEntry;
+
+    const std::string optional_average_field
+      = (node->average_result) ? fmt::format(" / {}", node->num_tree)
+                               : std::string("");
+    if (num_output_group_ > 1) {
+      AppendToBuffer(dest,
+        fmt::format(native::main_end_multiclass_template,
+          "num_output_group"_a = num_output_group_,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = common::ToStringHighPrecision(node->global_bias)),
+        indent);
+    } else {
+      AppendToBuffer(dest,
+        fmt::format(native::main_end_template,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = common::ToStringHighPrecision(node->global_bias)),
+        indent);
+    }
+  }
+
+  // Generate predict_batch(), which evaluates a block of rows one tree (or
+  // translation unit) at a time. The rows are laid out contiguously, with
+  // [num_feature] entries per row.
+  void HandleMainNodeBatch(const MainNode* node,
+                           const std::string& dest,
+                           size_t indent) {
+    const char* predict_batch_function_signature
+      = (num_output_group_ > 1) ?
+          "size_t predict_multiclass_batch(union Entry* rows, size_t num_row, "
+                                          "int pred_margin, float* result)"
+        : "void predict_batch(union Entry* rows, size_t num_row, "
+                             "int pred_margin, float* result)";
+
+    AppendToBuffer(dest,
+      fmt::format(native::main_batch_start_template,
+        "predict_batch_function_signature"_a = predict_batch_function_signature,
+        "num_output_group"_a = num_output_group_),
+      indent);
+    AppendToBuffer("header.h",
+      fmt::format("{};\n", predict_batch_function_signature), 0);
+
+    CHECK_EQ(node->children.size(), 1);
+    WalkASTBatch(node->children[0], dest, indent + 2);
+
+    const std::string optional_average_field
+      = (node->average_result) ? fmt::format(" / {}", node->num_tree)
+                               : std::string("");
+    if (num_output_group_ > 1) {
+      AppendToBuffer(dest,
+        fmt::format(native::main_batch_end_multiclass_template,
+          "num_output_group"_a = num_output_group_,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = common::ToStringHighPrecision(node->global_bias)),
+        indent);
+    } else {
+      AppendToBuffer(dest,
+        fmt::format(native::main_batch_end_template,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = common::ToStringHighPrecision(node->global_bias)),
+        indent);
+    }
+  }
+
+  // Walk the AST in the batch prediction function. Each member tree gets its
+  // own loop over the block of rows, and its output is accumulated into
+  // result[] directly.
+  void WalkASTBatch(const ASTNode* node,
+                    const std::string& dest,
+                    size_t indent) {
+    const AccumulatorContextNode* t1;
+    const QuantizerNode* t2;
+    const TranslationUnitNode* t3;
+    if ( (t1 = dynamic_cast<const AccumulatorContextNode*>(node)) ) {
+      for (ASTNode* child : t1->children) {
+        WalkASTBatch(child, dest, indent);
+      }
+    } else if ( (t2 = dynamic_cast<const QuantizerNode*>(node)) ) {
+      // arrays for the quantizer have been already rendered by HandleQNode()
+      if (!quantize_loop_.empty()) {
+        AppendToBuffer(dest,
+          fmt::format(native::row_loop_start_template,
+            "num_feature"_a = num_feature_), indent);
+        AppendToBuffer(dest, quantize_loop_, indent + 2);
+        AppendToBuffer(dest, "}\n", indent);
+      }
+      CHECK_EQ(t2->children.size(), 1);
+      WalkASTBatch(t2->children[0], dest, indent);
+    } else if ( (t3 = dynamic_cast<const TranslationUnitNode*>(node)) ) {
+      HandleTUNodeBatch(t3, dest, indent);
+    } else {
+      // head of a member tree
+      AppendToBuffer(dest,
+        fmt::format(native::row_loop_start_template,
+          "num_feature"_a = num_feature_), indent);
+      batch_mode_ = true;
+      WalkAST(node, dest, indent + 2);
+      batch_mode_ = false;
+      AppendToBuffer(dest, "}\n", indent);
+    }
+  }
+
   void HandleACNode(const AccumulatorContextNode* node,
                     const std::string& dest,
                     size_t indent) {
@@ -218,13 +462,15 @@ class ASTNativeCompiler : public Compiler {
       AppendToBuffer(dest,
         fmt::format("float sum[{num_output_group}] = {{0.0f}};\n"
                     "unsigned int tmp;\n"
-                    "int nid, cond, fid;  /* used for folded subtrees */\n",
+                    "int nid, cond, fid;  "
+                    "/* used for folded subtrees and complete trees */\n",
           "num_output_group"_a = num_output_group_), indent);
     } else {
       AppendToBuffer(dest,
         "float sum = 0.0f;\n"
         "unsigned int tmp;\n"
-        "int nid, cond, fid;  /* used for folded subtrees */\n", indent);
+        "int nid, cond, fid;  "
+        "/* used for folded subtrees and complete trees */\n", indent);
     }
     for (ASTNode* child : node->children) {
       WalkAST(child, dest, indent);
@@ -234,25 +480,7 @@ class ASTNativeCompiler : public Compiler {
   void HandleCondNode(const ConditionNode* node,
                       const std::string& dest,
                       size_t indent) {
-    const NumericalConditionNode* t;
-    std::string condition;
-    if ( (t = dynamic_cast<const NumericalConditionNode*>(node)) ) {
-      /* numerical split */
-      condition = ExtractNumericalCondition(t);
-    } else {   /* categorical split */
-      const CategoricalConditionNode* t2
-        = dynamic_cast<const CategoricalConditionNode*>(node);
-      CHECK(t2);
-      condition = ExtractCategoricalCondition(t2);
-    }
-    const char* condition_with_na_check_template
-      = (node->default_left) ?
-          "!(data[{split_index}].missing != -1) || ({condition})"
-        : " (data[{split_index}].missing != -1) && ({condition})";
-    std::string condition_with_na_check
-      = fmt::format(condition_with_na_check_template,
-          "split_index"_a = node->split_index,
-          "condition"_a = condition);
+    std::string condition_with_na_check = RenderCondition(node);
     if (node->children[0]->data_count && node->children[1]->data_count) {
       const int left_freq = node->children[0]->data_count.value();
       const int right_freq = node->children[1]->data_count.value();
@@ -270,6 +498,167 @@ class ASTNativeCompiler : public Compiler {
     AppendToBuffer(dest, "}\n", indent);
   }
 
+  // Evaluate a complete tree without branches: find the index of the leaf
+  // reached one level at a time, then look up its output in a table. Tests
+  // of an oblivious tree are written inline, one per level; those of other
+  // complete trees are stored in tables, in heap order (children of node i
+  // are 2i+1 and 2i+2).
+  void HandleCompleteTreeNode(const CompleteTreeNode* node,
+                              const std::string& dest,
+                              size_t indent) {
+    CHECK_EQ(node->children.size(), 1);
+    const int tree_id = node->tree_id;
+    const int depth = node->depth;
+    /* collect tests and leaves in heap order */
+    std::vector<const ConditionNode*> tests;
+    std::vector<const OutputNode*> leaves;
+    std::queue<const ASTNode*> Q;
+    Q.push(node->children[0]);
+    while (!Q.empty()) {
+      const ASTNode* e = Q.front();
+      Q.pop();
+      const ConditionNode* test = dynamic_cast<const ConditionNode*>(e);
+      if (test) {
+        CHECK_EQ(e->children.size(), 2);
+        tests.push_back(test);
+        Q.push(e->children[0]);
+        Q.push(e->children[1]);
+      } else {
+        const OutputNode* leaf = dynamic_cast<const OutputNode*>(e);
+        CHECK(leaf) << "Ill-formed complete tree";
+        leaves.push_back(leaf);
+      }
+    }
+    CHECK_EQ(leaves.size(), static_cast<size_t>(1) << depth)
+      << "Ill-formed complete tree";
+
+    const std::string leaf_array_name = fmt::format("leaf_tree{}", tree_id);
+    if (complete_tree_arrays_.insert(leaf_array_name).second) {
+      common::ArrayFormatter formatter(80, 2);
+      for (const OutputNode* leaf : leaves) {
+        if (leaf->is_vector) {
+          CHECK_EQ(leaf->vector.size(), static_cast<size_t>(num_output_group_))
+            << "Ill-formed model: leaf vector must be of length "
+            << "[num_output_group]";
+          for (tl_float e : leaf->vector) {
+            formatter << common::ToStringHighPrecision(e);
+          }
+        } else {
+          formatter << common::ToStringHighPrecision(leaf->scalar);
+        }
+      }
+      AppendToBuffer("header.h",
+        fmt::format("extern const float {}[];\n", leaf_array_name), 0);
+      AppendToBuffer("arrays.c",
+        fmt::format("const float {}[] = {{\n{}\n}};\n",
+                    leaf_array_name, formatter.str()), 0);
+    }
+
+    std::string code = "nid = 0;\n";
+    std::string leaf_index;
+    if (node->oblivious) {
+      // leaf index: bit (depth - 1 - k) is set if the row goes right at
+      // depth k
+      for (int k = 0; k < depth; ++k) {
+        code += fmt::format("nid = 2 * nid + !({});\n",
+                            RenderCondition(tests[(1 << k) - 1]));
+      }
+      leaf_index = "nid";
+    } else {
+      code += RenderCompleteTreeTests(tests, tree_id, depth);
+      leaf_index = fmt::format("nid - {}", (1 << depth) - 1);
+    }
+    code += RenderLeafLookup(leaf_array_name, leaf_index, tree_id,
+                             leaves[0]->is_vector);
+    AppendToBuffer(dest, code, indent);
+  }
+
+  // Render the loop-free walk down a complete (but not oblivious) tree,
+  // whose tests all compare a feature against a threshold with the same
+  // operator
+  std::string
+  RenderCompleteTreeTests(const std::vector<const ConditionNode*>& tests,
+                          int tree_id, int depth) {
+    std::vector<const NumericalConditionNode*> num_tests;
+    for (const ConditionNode* e : tests) {
+      const NumericalConditionNode* t
+        = dynamic_cast<const NumericalConditionNode*>(e);
+      CHECK(t && (num_tests.empty() || t->op == num_tests[0]->op))
+        << "Ill-formed complete tree";
+      num_tests.push_back(t);
+    }
+    CHECK(!num_tests.empty());
+    // quantized thresholds are compared against bin indices, except in the
+    // dense row and masked prediction functions
+    const bool quantized = num_tests[0]->quantized;
+    const bool use_bin_index = quantized && input_mode_ == InputMode::kEntry;
+    const std::string split_index_name
+      = fmt::format("split_index_tree{}", tree_id);
+    const std::string default_left_name
+      = fmt::format("default_left_tree{}", tree_id);
+    const std::string threshold_name
+      = fmt::format(use_bin_index ? "qthreshold_tree{}" : "threshold_tree{}",
+                    tree_id);
+    if (complete_tree_arrays_.insert(split_index_name).second) {
+      common::ArrayFormatter split_index_formatter(80, 2),
+                             default_left_formatter(80, 2);
+      for (const NumericalConditionNode* t : num_tests) {
+        split_index_formatter << t->split_index;
+        default_left_formatter << (t->default_left ? 1 : 0);
+      }
+      AppendToBuffer("header.h",
+        fmt::format("extern const unsigned int {}[];\n"
+                    "extern const unsigned char {}[];\n",
+                    split_index_name, default_left_name), 0);
+      AppendToBuffer("arrays.c",
+        fmt::format("const unsigned int {}[] = {{\n{}\n}};\n"
+                    "const unsigned char {}[] = {{\n{}\n}};\n",
+                    split_index_name, split_index_formatter.str(),
+                    default_left_name, default_left_formatter.str()), 0);
+    }
+    if (complete_tree_arrays_.insert(threshold_name).second) {
+      common::ArrayFormatter formatter(80, 2);
+      for (const NumericalConditionNode* t : num_tests) {
+        if (use_bin_index) {
+          formatter << t->threshold.int_val;
+        } else if (quantized) {
+          // recover the original threshold; see
+          // ASTBuilder::QuantizeThresholds()
+          CHECK(cut_pts_);
+          formatter << common::ToStringHighPrecision(
+            (*cut_pts_)[t->split_index][t->threshold.int_val / 2]);
+        } else {
+          formatter << common::ToStringHighPrecision(t->threshold.float_val);
+        }
+      }
+      const char* threshold_type = use_bin_index ? "int" : "double";
+      AppendToBuffer("header.h",
+        fmt::format("extern const {} {}[];\n", threshold_type,
+                    threshold_name), 0);
+      AppendToBuffer("arrays.c",
+        fmt::format("const {} {}[] = {{\n{}\n}};\n",
+                    threshold_type, threshold_name, formatter.str()), 0);
+    }
+    const std::string feature_value
+      = use_bin_index ? std::string("data[fid].qvalue")
+                      : RenderFeatureValue(std::string("fid"));
+    const std::string step
+      = fmt::format("fid = {split_index}[nid];\n"
+                    "nid = 2 * nid + 2 - ({present} ? ({feature} {opname} "
+                    "{threshold}[nid]) : {default_left}[nid]);\n",
+          "split_index"_a = split_index_name,
+          "present"_a = RenderPresentCheck(std::string("fid")),
+          "feature"_a = feature_value,
+          "opname"_a = OpName(num_tests[0]->op),
+          "threshold"_a = threshold_name,
+          "default_left"_a = default_left_name);
+    std::string code;
+    for (int k = 0; k < depth; ++k) {
+      code += step;
+    }
+    return code;
+  }
+
   void HandleOutputNode(const OutputNode* node,
                         const std::string& dest,
                         size_t indent) {
@@ -285,32 +674,48 @@ class ASTNativeCompiler : public Compiler {
 
     std::string unit_function_name, unit_function_signature,
                 unit_function_call_signature;
+    // in the dense row and masked prediction functions, units take floats
+    const char* unit_suffix = "";
+    const char* unit_args = "union Entry* data";
+    const char* unit_call_args = "data";
+    if (input_mode_ == InputMode::kDenseRow) {
+      unit_suffix = "_dense";
+      unit_args = "const float* row";
+      unit_call_args = "row";
+    } else if (input_mode_ == InputMode::kMasked) {
+      unit_suffix = "_masked";
+      unit_args = "const float* values, const uint64_t* missing";
+      unit_call_args = "values, missing";
+    }
     if (num_output_group_ > 1) {
       unit_function_name
-        = fmt::format("predict_margin_multiclass_unit{}", unit_id);
+        = fmt::format("predict_margin_multiclass_unit{}{}", unit_id,
+                      unit_suffix);
       unit_function_signature
-        = fmt::format("void {}(union Entry* data, float* result)",
-            unit_function_name);
+        = fmt::format("void {}({}, float* result)",
+            unit_function_name, unit_args);
       unit_function_call_signature
-        = fmt::format("{}(data, sum);\n", unit_function_name);
+        = fmt::format("{}({}, sum);\n", unit_function_name, unit_call_args);
     } else {
       unit_function_name
-        = fmt::format("predict_margin_unit{}", unit_id);
+        = fmt::format("predict_margin_unit{}{}", unit_id, unit_suffix);
       unit_function_signature
-        = fmt::format("float {}(union Entry* data)", unit_function_name);
+        = fmt::format("float {}({})", unit_function_name, unit_args);
       unit_function_call_signature
-        = fmt::format("sum += {}(data);\n", unit_function_name);
+        = fmt::format("sum += {}({});\n", unit_function_name, unit_call_args);
     }
     AppendToBuffer(dest, unit_function_call_signature, indent);
+    if (input_mode_ == InputMode::kEntry) {
+      AppendToBuffer(new_file, "#include \"header.h\"\n", 0);
+    }
     AppendToBuffer(new_file,
-                   fmt::format("#include \"header.h\"\n"
-                               "{} {{\n", unit_function_signature), 0);
+                   fmt::format("{} {{\n", unit_function_signature), 0);
     CHECK_EQ(node->children.size(), 1);
     WalkAST(node->children[0], new_file, 2);
     if (num_output_group_ > 1) {
       AppendToBuffer(new_file,
         fmt::format("  for (int i = 0; i < {num_output_group}; ++i) {{\n"
-                    "    result[i] = sum[i];\n"
+                    "    result[i] += sum[i];\n"
                     "  }}\n"
                     "}}\n",
           "num_output_group"_a = num_output_group_), 0);
@@ -320,54 +725,142 @@ class ASTNativeCompiler : public Compiler {
     AppendToBuffer("header.h", fmt::format("{};\n", unit_function_signature), 0);
   }
 
+  void HandleTUNodeBatch(const TranslationUnitNode* node,
+                         const std::string& dest,
+                         int indent) {
+    const int unit_id = node->unit_id;
+    const std::string new_file = fmt::format("tu{}.c", unit_id);
+
+    const std::string unit_function_name
+      = (num_output_group_ > 1)
+        ? fmt::format("predict_margin_multiclass_unit{}_batch", unit_id)
+        : fmt::format("predict_margin_unit{}_batch", unit_id);
+    const std::string unit_function_signature
+      = fmt::format("void {}(union Entry* rows, size_t num_row, float* result)",
+          unit_function_name);
+    AppendToBuffer(dest,
+      fmt::format("{}(rows, num_row, result);\n", unit_function_name), indent);
+    AppendToBuffer(new_file,
+      fmt::format(native::unit_batch_start_template,
+        "unit_function_signature"_a = unit_function_signature), 0);
+    CHECK_EQ(node->children.size(), 1);
+    WalkASTBatch(node->children[0], new_file, 2);
+    AppendToBuffer(new_file, "}\n", 0);
+    AppendToBuffer("header.h", fmt::format("{};\n", unit_function_signature), 0);
+  }
+
   void HandleQNode(const QuantizerNode* node,
                    const std::string& dest,
                    size_t indent) {
+    if (input_mode_ != InputMode::kEntry) {
+      // the dense row and masked prediction functions compare feature values
+      // against the original thresholds, so there's nothing to quantize
+      cut_pts_ = &node->cut_pts;
+      CHECK_EQ(node->children.size(), 1);
+      WalkAST(node->children[0], dest, indent);
+      return;
+    }
     /* render arrays needed to convert feature values into bin indices */
-    std::string array_threshold, array_th_begin, array_th_len;
+    // qfeature[] : list of features to quantize, i.e. those used in
+    //   numerical splits. Features with at most kMaxLinearQuantizeLen
+    //   thresholds come first, followed by the rest.
+    std::vector<unsigned> qfeature;
+    size_t num_linear_feature = 0;
+    for (int linear = 1; linear >= 0; --linear) {
+      for (int fid = 0; fid < num_feature_; ++fid) {
+        const size_t len = node->cut_pts[fid].size();
+        if (len > 0 && !is_categorical_[fid]
+            && (len <= kMaxLinearQuantizeLen) == (linear == 1)) {
+          qfeature.push_back(static_cast<unsigned>(fid));
+        }
+      }
+      if (linear == 1) {
+        num_linear_feature = qfeature.size();
+      }
+    }
+    if (qfeature.empty()) {  // no numerical split with a finite threshold
+      quantize_loop_.clear();
+      CHECK_EQ(node->children.size(), 1);
+      WalkAST(node->children[0], dest, indent);
+      return;
+    }
     // threshold[] : list of all thresholds that occur at least once in the
-    //   ensemble model. For each feature, an ascending list of unique
-    //   thresholds is generated. The range th_begin[i]:(th_begin[i]+th_len[i])
-    //   of the threshold[] array stores the threshold list for feature i.
-    size_t total_num_threshold;
-      // to hold total number of (distinct) thresholds
+    //   ensemble model. The range th_begin[i]:(th_begin[i]+th_len[i]) of
+    //   the threshold[] array stores the thresholds for feature qfeature[i],
+    //   in ascending order; if the feature has many thresholds, they are
+    //   instead stored in a block of (2^th_depth[i] - 1) entries, in the
+    //   order of a breadth-first walk of a complete binary search tree.
+    std::string array_threshold, array_th_begin, array_th_len, array_th_depth;
+    std::vector<size_t> th_begin, th_len;
     {
       common::ArrayFormatter formatter(80, 2);
-      for (const auto& e : node->cut_pts) {
+      common::ArrayFormatter depth_formatter(80, 2);
+      size_t accum = 0;  // used to compute cumulative sum over block sizes
+      for (size_t i = 0; i < qfeature.size(); ++i) {
         // cut_pts had been generated in ASTBuilder::QuantizeThresholds
         // cut_pts[i][k] stores the k-th threshold of feature i.
-        for (tl_float v : e) {
+        const std::vector<tl_float>& cut_pts = node->cut_pts[qfeature[i]];
+        std::vector<tl_float> block;
+        int depth = 0;
+        if (i < num_linear_feature) {
+          block = cut_pts;
+        } else {
+          while ((static_cast<size_t>(1) << depth) - 1 < cut_pts.size()) {
+            ++depth;
+          }
+          block = EytzingerLayout(cut_pts, depth);
+        }
+        for (tl_float v : block) {
           formatter << v;
         }
+        depth_formatter << depth;
+        th_begin.push_back(accum);
+        th_len.push_back(cut_pts.size());
+        accum += block.size();
       }
       array_threshold = formatter.str();
+      array_th_depth = depth_formatter.str();
     }
     {
       common::ArrayFormatter formatter(80, 2);
-      size_t accum = 0;  // used to compute cumulative sum over threshold counts
-      for (const auto& e : node->cut_pts) {
-        formatter << accum;
-        accum += e.size();  // e.size() = number of thresholds for each feature
+      for (size_t v : th_begin) {
+        formatter << v;
       }
-      total_num_threshold = accum;
       array_th_begin = formatter.str();
     }
     {
       common::ArrayFormatter formatter(80, 2);
-      for (const auto& e : node->cut_pts) {
-        formatter << e.size();
+      for (size_t v : th_len) {
+        formatter << v;
       }
       array_th_len = formatter.str();
     }
+    std::string array_qfeature;
+    {
+      common::ArrayFormatter formatter(80, 2);
+      for (unsigned fid : qfeature) {
+        formatter << fid;
+      }
+      array_qfeature = formatter.str();
+    }
     PrependToBuffer(dest,
       fmt::format(native::qnode_template,
         "array_threshold"_a = array_threshold,
+        "th_begin_type"_a = NarrowestUnsignedType(th_begin.back()),
         "array_th_begin"_a = array_th_begin,
+        "th_len_type"_a
+          = NarrowestUnsignedType(*std::max_element(th_len.begin(),
+                                                    th_len.end())),
         "array_th_len"_a = array_th_len,
-        "total_num_threshold"_a = total_num_threshold), 0);
-    AppendToBuffer(dest,
-      fmt::format(native::quantize_loop_template,
-        "num_feature"_a = num_feature_), indent);
+        "array_th_depth"_a = array_th_depth,
+        "qfeature_type"_a
+          = NarrowestUnsignedType(*std::max_element(qfeature.begin(),
+                                                    qfeature.end())),
+        "array_qfeature"_a = array_qfeature), 0);
+    quantize_loop_ = fmt::format(native::quantize_loop_template,
+                       "num_linear_feature"_a = num_linear_feature,
+                       "num_quantized_feature"_a = qfeature.size());
+    AppendToBuffer(dest, quantize_loop_, indent);
     CHECK_EQ(node->children.size(), 1);
     WalkAST(node->children[0], dest, indent);
   }
@@ -403,19 +896,36 @@ class ASTNativeCompiler : public Compiler {
       &array_nodes, &array_cat_bitmap, &array_cat_begin,
       &output_switch_statement, &common_comp_op);
 
-    AppendToBuffer("header.h",
-                   fmt::format(native::code_folder_arrays_declaration_template,
-                     "node_array_name"_a = node_array_name,
-                     "cat_bitmap_name"_a = cat_bitmap_name,
-                     "cat_begin_name"_a = cat_begin_name), 0);
-    AppendToBuffer("arrays.c",
-                   fmt::format(native::code_folder_arrays_template,
-                     "node_array_name"_a = node_array_name,
-                     "array_nodes"_a = array_nodes,
-                     "cat_bitmap_name"_a = cat_bitmap_name,
-                     "array_cat_bitmap"_a = array_cat_bitmap,
-                     "cat_begin_name"_a = cat_begin_name,
-                     "array_cat_begin"_a = array_cat_begin), 0);
+    if (input_mode_ != InputMode::kEntry) {
+      // arrays have been already rendered for predict()
+      AppendToBuffer(dest,
+                     fmt::format(input_mode_ == InputMode::kDenseRow
+                                   ? native::dense_eval_loop_template
+                                   : native::masked_eval_loop_template,
+                       "node_array_name"_a = node_array_name,
+                       "cat_bitmap_name"_a = cat_bitmap_name,
+                       "cat_begin_name"_a = cat_begin_name,
+                       "comp_op"_a = OpName(common_comp_op),
+                       "output_switch_statement"_a
+                         = output_switch_statement), indent);
+      return;
+    }
+
+    if (code_folder_arrays_.insert(node_array_name).second) {
+      AppendToBuffer("header.h",
+        fmt::format(native::code_folder_arrays_declaration_template,
+          "node_array_name"_a = node_array_name,
+          "cat_bitmap_name"_a = cat_bitmap_name,
+          "cat_begin_name"_a = cat_begin_name), 0);
+      AppendToBuffer("arrays.c",
+                     fmt::format(native::code_folder_arrays_template,
+                       "node_array_name"_a = node_array_name,
+                       "array_nodes"_a = array_nodes,
+                       "cat_bitmap_name"_a = cat_bitmap_name,
+                       "array_cat_bitmap"_a = array_cat_bitmap,
+                       "cat_begin_name"_a = cat_begin_name,
+                       "array_cat_begin"_a = array_cat_begin), 0);
+    }
     AppendToBuffer(dest,
                    fmt::format(native::eval_loop_template,
                      "node_array_name"_a = node_array_name,
@@ -430,7 +940,16 @@ class ASTNativeCompiler : public Compiler {
   inline std::string
   ExtractNumericalCondition(const NumericalConditionNode* node) {
     std::string result;
-    if (node->quantized) {  // quantized threshold
+    if (node->quantized && input_mode_ != InputMode::kEntry) {
+      // recover the original threshold; see ASTBuilder::QuantizeThresholds()
+      CHECK(cut_pts_);
+      const tl_float threshold
+        = (*cut_pts_)[node->split_index][node->threshold.int_val / 2];
+      result = fmt::format("{feature} {opname} {threshold}",
+                 "feature"_a = RenderFeatureValue(node->split_index),
+                 "opname"_a = OpName(node->op),
+                 "threshold"_a = common::ToStringHighPrecision(threshold));
+    } else if (node->quantized) {  // quantized threshold
       result = fmt::format("data[{split_index}].qvalue {opname} {threshold}",
                  "split_index"_a = node->split_index,
                  "opname"_a = OpName(node->op),
@@ -441,8 +960,8 @@ class ASTNativeCompiler : public Compiler {
       result = (common::CompareWithOp(0.0, node->op, node->threshold.float_val)
                 ? "1" : "0");
     } else {  // finite threshold
-      result = fmt::format("data[{split_index}].fvalue {opname} {threshold}",
-                 "split_index"_a = node->split_index,
+      result = fmt::format("{feature} {opname} {threshold}",
+                 "feature"_a = RenderFeatureValue(node->split_index),
                  "opname"_a = OpName(node->op),
                  "threshold"_a
                    = common::ToStringHighPrecision(node->threshold.float_val));
@@ -450,6 +969,29 @@ class ASTNativeCompiler : public Compiler {
     return result;
   }
 
+  // condition for going left at a test node, including the test for missing
+  // values
+  inline std::string RenderCondition(const ConditionNode* node) {
+    const NumericalConditionNode* t;
+    std::string condition;
+    if ( (t = dynamic_cast<const NumericalConditionNode*>(node)) ) {
+      /* numerical split */
+      condition = ExtractNumericalCondition(t);
+    } else {   /* categorical split */
+      const CategoricalConditionNode* t2
+        = dynamic_cast<const CategoricalConditionNode*>(node);
+      CHECK(t2);
+      condition = ExtractCategoricalCondition(t2);
+    }
+    const char* condition_with_na_check_template
+      = (node->default_left) ?
+          "!{present} || ({condition})"
+        : " {present} && ({condition})";
+    return fmt::format(condition_with_na_check_template,
+             "present"_a = RenderPresentCheck(node->split_index),
+             "condition"_a = condition);
+  }
+
   inline std::string
   ExtractCategoricalCondition(const CategoricalConditionNode* node) {
     std::string result;
@@ -464,7 +1006,8 @@ class ASTNativeCompiler : public Compiler {
       result = "0";
     } else {
       std::ostringstream oss;
-      oss << "(tmp = (unsigned int)(data[" << node->split_index << "].fvalue) ), "
+      oss << "(tmp = (unsigned int)(" << RenderFeatureValue(node->split_index)
+          << ") ), "
           << "(tmp >= 0 && tmp < 64 && (( (uint64_t)"
           << bitmap[0] << "U >> tmp) & 1) )";
       for (size_t i = 1; i < bitmap.size(); ++i) {
@@ -478,6 +1021,99 @@ class ASTNativeCompiler : public Compiler {
     return result;
   }
 
+  // average depth of leaves, over all trees in the model; the runtime uses
+  // it to estimate how much work it takes to predict a single row
+  static double GetAverageTreeDepth(const Model& model) {
+    double sum = 0.0;
+    for (const Tree& tree : model.trees) {
+      size_t num_leaf = 0, depth_sum = 0;
+      std::queue<std::pair<int, size_t>> Q;  // (node id, depth)
+      Q.push({0, 0});
+      while (!Q.empty()) {
+        const int nid = Q.front().first;
+        const size_t depth = Q.front().second;
+        Q.pop();
+        if (tree[nid].is_leaf()) {
+          ++num_leaf;
+          depth_sum += depth;
+        } else {
+          Q.push({tree[nid].cleft(), depth + 1});
+          Q.push({tree[nid].cright(), depth + 1});
+        }
+      }
+      sum += static_cast<double>(depth_sum) / num_leaf;
+    }
+    return model.trees.empty() ? 0.0 : sum / model.trees.size();
+  }
+
+  // expression for the value of a feature, as a float
+  inline std::string RenderFeatureValue(unsigned split_index) {
+    return RenderFeatureValue(std::to_string(split_index));
+  }
+
+  // same, with the feature index given by an expression
+  inline std::string RenderFeatureValue(const std::string& split_index) {
+    switch (input_mode_) {
+     case InputMode::kDenseRow:
+      return fmt::format("row[{}]", split_index);
+     case InputMode::kMasked:
+      return fmt::format("values[{}]", split_index);
+     case InputMode::kEntry:
+     default:
+      return fmt::format("data[{}].fvalue", split_index);
+    }
+  }
+
+  // expression testing whether a feature is present (not missing)
+  inline std::string RenderPresentCheck(unsigned split_index) {
+    return RenderPresentCheck(std::to_string(split_index));
+  }
+
+  // same, with the feature index given by an expression
+  inline std::string RenderPresentCheck(const std::string& split_index) {
+    switch (input_mode_) {
+     case InputMode::kDenseRow:
+      return fmt::format("(row[{0}] == row[{0}])", split_index);
+     case InputMode::kMasked:
+      return fmt::format("(!IS_MISSING(missing, {}))", split_index);
+     case InputMode::kEntry:
+     default:
+      return fmt::format("(data[{}].missing != -1)", split_index);
+    }
+  }
+
+  // smallest unsigned integer type that can hold [max_value]
+  inline const char* NarrowestUnsignedType(size_t max_value) {
+    if (max_value <= 0xFFU) {
+      return "uint8_t";
+    } else if (max_value <= 0xFFFFU) {
+      return "uint16_t";
+    } else {
+      CHECK_LE(max_value, 0xFFFFFFFFU) << "too many thresholds to quantize";
+      return "uint32_t";
+    }
+  }
+
+  // lay out ascending [cut_pts] as a complete binary search tree with [depth]
+  // levels, in breadth-first order; it is padded with the largest threshold
+  inline std::vector<tl_float>
+  EytzingerLayout(const std::vector<tl_float>& cut_pts, int depth) {
+    const size_t size = (static_cast<size_t>(1) << depth) - 1;
+    CHECK(!cut_pts.empty() && cut_pts.size() <= size);
+    std::vector<tl_float> block(size);
+    size_t rank = 0;
+    // visit nodes in order, which is the order of ascending thresholds
+    std::function<void(size_t)> visit = [&](size_t k) {
+      if (k <= size) {
+        visit(k * 2);
+        block[k - 1] = cut_pts[std::min(rank++, cut_pts.size() - 1)];
+        visit(k * 2 + 1);
+      }
+    };
+    visit(1);
+    return block;
+  }
+
   inline std::string
   RenderIsCategoricalArray(const std::vector<bool>& is_categorical) {
     common::ArrayFormatter formatter(80, 2);
@@ -487,7 +1123,58 @@ class ASTNativeCompiler : public Compiler {
     return formatter.str();
   }
 
+  // add the output of a leaf, looked up in [leaf_array_name] at
+  // [leaf_index], to the sum
+  inline std::string RenderLeafLookup(const std::string& leaf_array_name,
+                                      const std::string& leaf_index,
+                                      int tree_id, bool is_vector) {
+    const char* sum_multiclass_template
+      = batch_mode_ ? "result[rid * {num_output_group} + {group_id}]"
+                    : "sum[{group_id}]";
+    const char* sum = batch_mode_ ? "result[rid]" : "sum";
+    std::string output_statement;
+    if (num_output_group_ > 1) {
+      if (is_vector) {
+        // multi-class classification with random forest
+        for (int group_id = 0; group_id < num_output_group_; ++group_id) {
+          output_statement
+            += fmt::format("{sum} += {leaf}[({index}) * {num_output_group} "
+                           "+ {group_id}];\n",
+                 "sum"_a = fmt::format(sum_multiclass_template,
+                             "num_output_group"_a = num_output_group_,
+                             "group_id"_a = group_id),
+                 "leaf"_a = leaf_array_name,
+                 "index"_a = leaf_index,
+                 "num_output_group"_a = num_output_group_,
+                 "group_id"_a = group_id);
+        }
+      } else {
+        // multi-class classification with gradient boosted trees
+        output_statement
+          = fmt::format("{sum} += {leaf}[{index}];\n",
+              "sum"_a = fmt::format(sum_multiclass_template,
+                          "num_output_group"_a = num_output_group_,
+                          "group_id"_a = tree_id % num_output_group_),
+              "leaf"_a = leaf_array_name,
+              "index"_a = leaf_index);
+      }
+    } else {
+      output_statement
+        = fmt::format("{sum} += {leaf}[{index}];\n",
+            "sum"_a = sum,
+            "leaf"_a = leaf_array_name,
+            "index"_a = leaf_index);
+    }
+    return output_statement;
+  }
+
   inline std::string RenderOutputStatement(const OutputNode* node) {
+    // inside the batch prediction function, outputs are accumulated directly
+    // into the result[] array, one slot (or group of slots) per row
+    const char* sum_multiclass_template
+      = batch_mode_ ? "result[rid * {num_output_group} + {group_id}]"
+                    : "sum[{group_id}]";
+    const char* sum = batch_mode_ ? "result[rid]" : "sum";
     std::string output_statement;
     if (num_output_group_ > 1) {
       if (node->is_vector) {
@@ -496,21 +1183,26 @@ class ASTNativeCompiler : public Compiler {
           << "Ill-formed model: leaf vector must be of length [num_output_group]";
         for (int group_id = 0; group_id < num_output_group_; ++group_id) {
           output_statement
-            += fmt::format("sum[{group_id}] += (float){output};\n",
-                 "group_id"_a = group_id,
+            += fmt::format("{sum} += (float){output};\n",
+                 "sum"_a = fmt::format(sum_multiclass_template,
+                             "num_output_group"_a = num_output_group_,
+                             "group_id"_a = group_id),
                  "output"_a
                    = common::ToStringHighPrecision(node->vector[group_id]));
         }
       } else {
         // multi-class classification with gradient boosted trees
         output_statement
-          = fmt::format("sum[{group_id}] += (float){output};\n",
-              "group_id"_a = node->tree_id % num_output_group_,
+          = fmt::format("{sum} += (float){output};\n",
+              "sum"_a = fmt::format(sum_multiclass_template,
+                          "num_output_group"_a = num_output_group_,
+                          "group_id"_a = node->tree_id % num_output_group_),
               "output"_a = common::ToStringHighPrecision(node->scalar));
       }
     } else {
       output_statement
-        = fmt::format("sum += (float){output};\n",
+        = fmt::format("{sum} += (float){output};\n",
+            "sum"_a = sum,
             "output"_a = common::ToStringHighPrecision(node->scalar));
     }
     return output_statement;
@@ -0,0 +1,82 @@
+/*!
+ * Copyright (c) 2018 by Contributors
+ * \file float_threshold.h
+ * \author Philip Cho
+ * \brief Functions to store thresholds and leaf outputs as floats, while
+ *        giving the same predictions as the code generated by ast_native,
+ *        which writes them as double literals
+ */
+#ifndef TREELITE_COMPILER_COMMON_FLOAT_THRESHOLD_H_
+#define TREELITE_COMPILER_COMMON_FLOAT_THRESHOLD_H_
+
+#include <treelite/common.h>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <string>
+
+namespace treelite {
+namespace compiler {
+namespace common_util {
+
+/*!
+ * \brief get the value of the double literal ast_native writes for a
+ *        threshold or a leaf output
+ */
+inline double NativeLiteralValue(tl_float value) {
+  return std::strtod(common::ToStringHighPrecision(value).c_str(), nullptr);
+}
+
+/*!
+ * \brief find the nearest floats below and above the (double) threshold
+ *        ast_native compares feature values against. For every float x,
+ *        (x < threshold) iff (x < t_up), (x <= threshold) iff (x <= t_down),
+ *        (x > threshold) iff (x > t_down), and (x >= threshold) iff
+ *        (x >= t_up); (x == threshold) can hold only if t_down == t_up.
+ * \param threshold finite threshold of a numerical test
+ * \param t_down used to save the largest float not above the threshold
+ * \param t_up used to save the smallest float not below the threshold
+ */
+inline void GetFloatBounds(tl_float threshold, float* t_down, float* t_up) {
+  const double t = NativeLiteralValue(threshold);
+  *t_down = *t_up = static_cast<float>(t);
+  if (static_cast<double>(*t_down) > t) {
+    *t_down = std::nextafter(*t_down, -std::numeric_limits<float>::infinity());
+  }
+  if (static_cast<double>(*t_up) < t) {
+    *t_up = std::nextafter(*t_up, std::numeric_limits<float>::infinity());
+  }
+}
+
+/*!
+ * \brief render a float as a C literal that converts back to the same float
+ */
+inline std::string RenderFloatLiteral(float value) {
+  if (std::isinf(value)) {
+    return (value > 0) ? "INFINITY" : "-INFINITY";
+  }
+  std::ostringstream oss;
+  oss << std::setprecision(std::numeric_limits<float>::max_digits10) << value;
+  std::string literal = oss.str();
+  if (literal.find_first_of(".e") == std::string::npos) {
+    literal += ".0";
+  }
+  return literal + "f";
+}
+
+/*!
+ * \brief render a leaf output as a float literal; ast_native adds
+ *        (float)[double literal] to the sum, and the output is rounded the
+ *        same way here, so that predictions match
+ */
+inline std::string RenderLeafOutput(tl_float value) {
+  return RenderFloatLiteral(static_cast<float>(NativeLiteralValue(value)));
+}
+
+}  // namespace common_util
+}  // namespace compiler
+}  // namespace treelite
+
+#endif  // TREELITE_COMPILER_COMMON_FLOAT_THRESHOLD_H_
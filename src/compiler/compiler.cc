@@ -30,5 +30,8 @@ DMLC_REGISTER_PARAMETER(CompilerParam);
 // List of files that will be force linked in static links.
 DMLC_REGISTRY_LINK_TAG(ast_native);
 DMLC_REGISTRY_LINK_TAG(ast_java);
+DMLC_REGISTRY_LINK_TAG(simd_native);
+DMLC_REGISTRY_LINK_TAG(quickscorer);
+DMLC_REGISTRY_LINK_TAG(flat_native);
 }  // namespace compiler
 }  // namespace treelite
@@ -0,0 +1,581 @@
+/*!
+ * Copyright (c) 2018 by Contributors
+ * \file flat_native.cc
+ * \author Philip Cho
+ * \brief C code generator that stores all member trees in one table of
+ *        nodes, to be walked by a single loop. The size of the generated code
+ *        and the time to compile it grow linearly with the number of nodes.
+ */
+#include <treelite/compiler.h>
+#include <treelite/common.h>
+#include <treelite/annotator.h>
+#include <fmt/format.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+#include "./param.h"
+#include "./pred_transform.h"
+#include "./ast/builder.h"
+#include "./native/main_template.h"
+#include "./native/header_template.h"
+#include "./native/flat_template.h"
+#include "./common/categorical_bitmap.h"
+#include "./common/float_threshold.h"
+
+using namespace fmt::literals;
+
+namespace treelite {
+namespace compiler {
+
+DMLC_REGISTRY_FILE_TAG(flat_native);
+
+class FlatNativeCompiler : public Compiler {
+ public:
+  explicit FlatNativeCompiler(const CompilerParam& param)
+    : param(param) {
+    if (param.verbose > 0) {
+      LOG(INFO) << "Using FlatNativeCompiler";
+    }
+    CHECK(param.node_layout == "bfs" || param.node_layout == "dfs"
+          || param.node_layout == "hot_first" || param.node_layout == "veb")
+      << "Unknown node_layout '" << param.node_layout << "'; "
+      << "must be one of bfs, dfs, hot_first and veb";
+    if (param.quantize > 0) {
+      LOG(WARNING) << "\033[1;31mWARNING: Flat native backend does not support "
+                   << "quantization.\u001B[0m The parameter "
+                   << "\x1B[33mquantize\u001B[0m will be ignored.";
+    }
+    if (param.code_folding_req != std::numeric_limits<double>::infinity()) {
+      LOG(WARNING) << "\033[1;31mWARNING: Flat native backend does not support "
+                   << "code folding.\u001B[0m The parameter "
+                   << "\x1B[33mcode_folding_req\u001B[0m will be ignored.";
+    }
+  }
+
+  CompiledModel Compile(const Model& model) override {
+    CompiledModel cm;
+    cm.backend = "native";
+
+    num_feature_ = model.num_feature;
+    num_output_group_ = model.num_output_group;
+    CHECK_LE(static_cast<uint64_t>(num_feature_), kFidMask + 1)
+      << "FlatNativeCompiler supports at most " << (kFidMask + 1)
+      << " features";
+    files_.clear();
+
+    ASTBuilder builder;
+    builder.BuildAST(model);
+    if (param.annotate_in != "NULL") {
+      BranchAnnotator annotator;
+      std::unique_ptr<dmlc::Stream> fi(
+        dmlc::Stream::Create(param.annotate_in.c_str(), "r"));
+      annotator.Load(fi.get());
+      const auto annotation = annotator.Get();
+      builder.LoadDataCounts(annotation);
+      LOG(INFO) << "Loading node frequencies from `"
+                << param.annotate_in << "'";
+    } else if (param.node_layout == "hot_first") {
+      LOG(INFO) << "node_layout=hot_first without annotate_in: unless the "
+                << "model records data counts, nodes are laid out as in dfs";
+    }
+    const MainNode* main_node
+      = dynamic_cast<const MainNode*>(builder.GetRootNode());
+    CHECK(main_node);
+    CHECK_EQ(main_node->children.size(), 1);
+    const ASTNode* ac_node = main_node->children[0];
+    CHECK(dynamic_cast<const AccumulatorContextNode*>(ac_node));
+    num_tree_ = static_cast<int>(ac_node->children.size());
+    CHECK_GT(num_tree_, 0) << "Model must have at least one member tree";
+
+    LayOutNodes(ac_node->children);
+    RenderMain(model, main_node, builder.GenerateIsCategoricalArray());
+    RenderArrays();
+
+    {
+      /* write recipe.json */
+      std::vector<std::unordered_map<std::string, std::string>> source_list;
+      for (auto kv : files_) {
+        if (kv.first.compare(kv.first.length() - 2, 2, ".c") == 0) {
+          const size_t line_count
+            = std::count(kv.second.begin(), kv.second.end(), '\n');
+          source_list.push_back({ {"name",
+                                   kv.first.substr(0, kv.first.length() - 2)},
+                                  {"length", std::to_string(line_count)} });
+        }
+      }
+      std::ostringstream oss;
+      auto writer = common::make_unique<dmlc::JSONWriter>(&oss);
+      writer->BeginObject();
+      writer->WriteObjectKeyValue("target", param.native_lib_name);
+      writer->WriteObjectKeyValue("sources", source_list);
+      writer->EndObject();
+      files_["recipe.json"] = oss.str();
+    }
+    cm.files = std::move(files_);
+    return cm;
+  }
+
+ private:
+  // see struct FlatNode in native/flat_template.h
+  static constexpr uint32_t kFidMask = 0x03FFFFFFU;
+  static constexpr uint32_t kDefaultLeft = 1U << 26;
+  static constexpr uint32_t kGT = 1U << 27;
+  static constexpr uint32_t kEQ = 1U << 28;
+  static constexpr uint32_t kAlways = 1U << 29;
+  static constexpr uint32_t kCategorical = 1U << 30;
+
+  CompilerParam param;
+  int num_feature_;
+  int num_output_group_;
+  int num_tree_;
+  double average_tree_depth_;
+  std::unordered_map<std::string, std::string> files_;
+
+  // AST nodes of all trees, in the order they appear in the node table
+  std::vector<const ASTNode*> order_;
+  std::vector<int32_t> tree_root_;
+  std::vector<int32_t> tree_depth_;
+  bool has_categorical_;
+  bool output_vector_flag_;
+
+  // append content to a given buffer, with given level of indentation
+  inline void AppendToBuffer(const std::string& dest,
+                             const std::string& content,
+                             size_t indent) {
+    files_[dest] += common::IndentMultiLineString(content, indent);
+  }
+
+  static inline bool IsLeaf(const ASTNode* node) {
+    return node->children.empty();
+  }
+
+  void LayOutNodes(const std::vector<ASTNode*>& trees) {
+    order_.clear();
+    tree_root_.clear();
+    tree_depth_.clear();
+    has_categorical_ = false;
+    output_vector_flag_ = false;
+    double depth_sum = 0.0;
+    for (const ASTNode* tree_head : trees) {
+      tree_root_.push_back(static_cast<int32_t>(order_.size()));
+      tree_depth_.push_back(static_cast<int32_t>(GetHeight(tree_head) - 1));
+      if (param.node_layout == "bfs") {
+        LayOutBFS(tree_head);
+      } else if (param.node_layout == "veb") {
+        LayOutVEB(tree_head, GetHeight(tree_head));
+      } else {
+        LayOutDFS(tree_head, param.node_layout == "hot_first");
+      }
+      // average depth of leaves
+      size_t num_leaf = 0, leaf_depth_sum = 0;
+      std::queue<std::pair<const ASTNode*, size_t>> Q;
+      Q.push({tree_head, 0});
+      while (!Q.empty()) {
+        const ASTNode* node = Q.front().first;
+        const size_t depth = Q.front().second;
+        Q.pop();
+        if (IsLeaf(node)) {
+          ++num_leaf;
+          leaf_depth_sum += depth;
+        } else {
+          for (const ASTNode* child : node->children) {
+            Q.push({child, depth + 1});
+          }
+        }
+      }
+      depth_sum += static_cast<double>(leaf_depth_sum) / num_leaf;
+    }
+    CHECK_LE(order_.size(),
+             static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+      << "Too many nodes for FlatNativeCompiler";
+    average_tree_depth_ = depth_sum / num_tree_;
+  }
+
+  // level by level
+  void LayOutBFS(const ASTNode* root) {
+    std::queue<const ASTNode*> Q;
+    Q.push(root);
+    while (!Q.empty()) {
+      const ASTNode* node = Q.front();
+      Q.pop();
+      order_.push_back(node);
+      for (const ASTNode* child : node->children) {
+        Q.push(child);
+      }
+    }
+  }
+
+  // each node followed by one of its subtrees: the left one, or with
+  // [hot_first], the one visited more often
+  void LayOutDFS(const ASTNode* root, bool hot_first) {
+    std::vector<const ASTNode*> stack{root};
+    while (!stack.empty()) {
+      const ASTNode* node = stack.back();
+      stack.pop_back();
+      order_.push_back(node);
+      if (!IsLeaf(node)) {
+        const ASTNode* first = node->children[0];
+        const ASTNode* second = node->children[1];
+        if (hot_first && first->data_count && second->data_count
+            && second->data_count.value() > first->data_count.value()) {
+          std::swap(first, second);
+        }
+        stack.push_back(second);
+        stack.push_back(first);
+      }
+    }
+  }
+
+  // van Emde Boas layout: the top half of the levels first, then each of the
+  // subtrees hanging below it, all laid out the same way recursively
+  void LayOutVEB(const ASTNode* root, size_t height) {
+    if (height <= 1 || IsLeaf(root)) {
+      order_.push_back(root);
+      return;
+    }
+    const size_t top_height = height / 2;
+    LayOutVEB(root, top_height);
+    // roots of the subtrees below the top half, from left to right
+    std::vector<const ASTNode*> level{root};
+    for (size_t depth = 0; depth < top_height; ++depth) {
+      std::vector<const ASTNode*> next_level;
+      for (const ASTNode* node : level) {
+        for (const ASTNode* child : node->children) {
+          next_level.push_back(child);
+        }
+      }
+      level = std::move(next_level);
+    }
+    for (const ASTNode* node : level) {
+      LayOutVEB(node, height - top_height);
+    }
+  }
+
+  // number of levels in a tree
+  static size_t GetHeight(const ASTNode* root) {
+    size_t height = 0;
+    std::vector<const ASTNode*> level{root};
+    while (!level.empty()) {
+      ++height;
+      std::vector<const ASTNode*> next_level;
+      for (const ASTNode* node : level) {
+        for (const ASTNode* child : node->children) {
+          next_level.push_back(child);
+        }
+      }
+      level = std::move(next_level);
+    }
+    return height;
+  }
+
+  void RenderMain(const Model& model, const MainNode* main_node,
+                  const std::vector<bool>& is_categorical) {
+    const char* get_num_output_group_function_signature
+      = "size_t get_num_output_group(void)";
+    const char* get_num_feature_function_signature
+      = "size_t get_num_feature(void)";
+    const char* get_num_tree_function_signature
+      = "size_t get_num_tree(void)";
+    const char* get_average_tree_depth_function_signature
+      = "float get_average_tree_depth(void)";
+    const bool multiclass = (num_output_group_ > 1);
+    const char* predict_function_signature
+      = multiclass ?
+          "size_t predict_multiclass(union Entry* data, int pred_margin, "
+                                    "float* result)"
+        : "float predict(union Entry* data, int pred_margin)";
+    const char* predict_batch_function_signature
+      = multiclass ?
+          "size_t predict_multiclass_batch(union Entry* rows, size_t num_row, "
+                                          "int pred_margin, float* result)"
+        : "void predict_batch(union Entry* rows, size_t num_row, "
+                             "int pred_margin, float* result)";
+    for (bool e : is_categorical) {
+      has_categorical_ |= e;
+    }
+    output_vector_flag_
+      = (model.num_output_group > 1 && model.random_forest_flag);
+
+    std::string optional_array_declarations;
+    if (has_categorical_) {
+      optional_array_declarations
+        += "extern const uint64_t cat_bitmap[];\n"
+           "extern const size_t cat_begin[];\n";
+    }
+    if (output_vector_flag_) {
+      optional_array_declarations += "extern const float leaf_vector[];\n";
+    }
+    AppendToBuffer("header.h",
+      fmt::format(native::header_template,
+        "missing_bitmask_macro"_a = "",
+        "threshold_type"_a = "double",
+        "get_num_output_group_function_signature"_a
+          = get_num_output_group_function_signature,
+        "get_num_feature_function_signature"_a
+          = get_num_feature_function_signature,
+        "get_num_tree_function_signature"_a = get_num_tree_function_signature,
+        "get_average_tree_depth_function_signature"_a
+          = get_average_tree_depth_function_signature,
+        "predict_function_signature"_a = predict_function_signature), 0);
+    AppendToBuffer("header.h",
+      fmt::format("{};\n", predict_batch_function_signature), 0);
+    AppendToBuffer("header.h",
+      fmt::format(native::flat::header_template,
+        "optional_array_declarations"_a = optional_array_declarations,
+        "categorical_test"_a
+          = (has_categorical_ ? native::flat::categorical_test : "")), 0);
+
+    common::ArrayFormatter array_is_categorical(80, 2);
+    for (bool e : is_categorical) {
+      array_is_categorical << (e ? 1 : 0);
+    }
+    AppendToBuffer("main.c",
+      fmt::format(native::main_start_template,
+        "array_is_categorical"_a = array_is_categorical.str(),
+        "get_num_output_group_function_signature"_a
+          = get_num_output_group_function_signature,
+        "get_num_feature_function_signature"_a
+          = get_num_feature_function_signature,
+        "get_num_tree_function_signature"_a = get_num_tree_function_signature,
+        "get_average_tree_depth_function_signature"_a
+          = get_average_tree_depth_function_signature,
+        "num_output_group"_a = num_output_group_,
+        "num_feature"_a = num_feature_,
+        "num_tree"_a = num_tree_,
+        "average_tree_depth"_a
+          = common::ToStringHighPrecision(average_tree_depth_),
+        "pred_transform_function"_a = PredTransformFunction("native", model),
+        "predict_function_signature"_a = predict_function_signature), 0);
+
+    // add the output of [leaf] of tree [tree_id] to a sum
+    std::string sum_declaration, accumulate, accumulate_batch;
+    if (output_vector_flag_) {
+      // multi-class classification with random forest
+      sum_declaration
+        = fmt::format("float sum[{}] = {{0.0f}};", num_output_group_);
+      const char* accumulate_template
+        = "for (int k = 0; k < {num_output_group}; ++k) {{\n"
+          "  {sum} += leaf_vector[leaf->child[1] + k];\n"
+          "}}\n";
+      accumulate = fmt::format(accumulate_template,
+        "num_output_group"_a = num_output_group_,
+        "sum"_a = "sum[k]");
+      accumulate_batch = fmt::format(accumulate_template,
+        "num_output_group"_a = num_output_group_,
+        "sum"_a = fmt::format("result[rid * {} + k]", num_output_group_));
+    } else if (multiclass) {
+      // multi-class classification with gradient boosted trees
+      sum_declaration
+        = fmt::format("float sum[{}] = {{0.0f}};", num_output_group_);
+      accumulate = fmt::format("sum[tree_id % {}] += leaf->threshold;\n",
+                               num_output_group_);
+      accumulate_batch = fmt::format(
+        "result[rid * {0} + tree_id % {0}] += leaf->threshold;\n",
+        num_output_group_);
+    } else {
+      sum_declaration = "float sum = 0.0f;";
+      accumulate = "sum += leaf->threshold;\n";
+      accumulate_batch = "result[rid] += leaf->threshold;\n";
+    }
+    AppendToBuffer("main.c",
+      fmt::format(native::flat::predict_template,
+        "num_tree"_a = num_tree_,
+        "sum_declaration"_a = sum_declaration,
+        "accumulate"_a = common::IndentMultiLineString(accumulate, 4)), 0);
+    const std::string optional_average_field
+      = main_node->average_result ? fmt::format(" / {}", num_tree_)
+                                  : std::string("");
+    const std::string global_bias
+      = common::ToStringHighPrecision(main_node->global_bias);
+    if (multiclass) {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_end_multiclass_template,
+          "num_output_group"_a = num_output_group_,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    } else {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_end_template,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    }
+
+    AppendToBuffer("main.c",
+      fmt::format(native::flat::predict_batch_template,
+        "predict_batch_function_signature"_a = predict_batch_function_signature,
+        "num_tree"_a = num_tree_,
+        "num_output_group"_a = num_output_group_,
+        "num_feature"_a = num_feature_,
+        "accumulate"_a = common::IndentMultiLineString(accumulate_batch, 10)),
+      0);
+    if (multiclass) {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_batch_end_multiclass_template,
+          "num_output_group"_a = num_output_group_,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    } else {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_batch_end_template,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    }
+  }
+
+  void RenderArrays() {
+    std::unordered_map<const ASTNode*, int32_t> index;
+    for (size_t i = 0; i < order_.size(); ++i) {
+      index[order_[i]] = static_cast<int32_t>(i);
+    }
+    common::ArrayFormatter array_nodes(80, 2), array_tree_root(80, 2),
+                           array_cat_bitmap(80, 2), array_cat_begin(80, 2),
+                           array_leaf_vector(80, 2);
+    size_t cat_begin = 0, leaf_vector_begin = 0;
+    array_cat_begin << cat_begin;
+    for (const ASTNode* node : order_) {
+      std::string threshold = "0";
+      uint32_t info = 0;
+      int32_t left = index.at(node), right = 0;
+      if (IsLeaf(node)) {
+        info = kDefaultLeft | kAlways;
+        const OutputNode* output = dynamic_cast<const OutputNode*>(node);
+        CHECK(output) << "FlatNativeCompiler: unexpected AST node";
+        if (output->is_vector) {
+          CHECK_EQ(output->vector.size(),
+                   static_cast<size_t>(num_output_group_))
+            << "Ill-formed model: leaf vector must be of length "
+            << "[num_output_group]";
+          for (tl_float e : output->vector) {
+            array_leaf_vector << common_util::RenderLeafOutput(e);
+          }
+          right = static_cast<int32_t>(leaf_vector_begin);
+          leaf_vector_begin += output->vector.size();
+        } else {
+          threshold = common_util::RenderLeafOutput(output->scalar);
+        }
+      } else {
+        const ConditionNode* cond = dynamic_cast<const ConditionNode*>(node);
+        CHECK(cond) << "FlatNativeCompiler: unexpected AST node";
+        CHECK_EQ(node->children.size(), 2);
+        info = cond->split_index;
+        if (cond->default_left) {
+          info |= kDefaultLeft;
+        }
+        const NumericalConditionNode* t
+          = dynamic_cast<const NumericalConditionNode*>(node);
+        if (t) {
+          info |= RenderNumericalTest(t->op, t->threshold.float_val,
+                                      &threshold);
+        } else {
+          const CategoricalConditionNode* t2
+            = dynamic_cast<const CategoricalConditionNode*>(node);
+          CHECK(t2);
+          info |= kCategorical;
+          // an empty bitmap sends every (non-missing) row right
+          if (!t2->left_categories.empty()) {
+            for (uint64_t e
+                 : common_util::GetCategoricalBitmap(t2->left_categories)) {
+              array_cat_bitmap << fmt::format("{}U", e);
+              ++cat_begin;
+            }
+          }
+        }
+        left = index.at(node->children[0]);
+        right = index.at(node->children[1]);
+      }
+      array_nodes << fmt::format("{{{}, 0x{:08X}U, {{{}, {}}}}}",
+                                 threshold, info, left, right);
+      array_cat_begin << cat_begin;
+    }
+    common::ArrayFormatter array_tree_depth(80, 2);
+    for (size_t i = 0; i < tree_root_.size(); ++i) {
+      array_tree_root << tree_root_[i];
+      array_tree_depth << tree_depth_[i];
+    }
+
+    std::string optional_arrays;
+    if (has_categorical_) {
+      if (cat_begin == 0) {
+        array_cat_bitmap << "0";  // arrays may not be empty
+      }
+      optional_arrays
+        += fmt::format("\nconst uint64_t cat_bitmap[] = {{\n{}\n}};\n",
+                       array_cat_bitmap.str())
+         + fmt::format("\nconst size_t cat_begin[] = {{\n{}\n}};\n",
+                       array_cat_begin.str());
+    }
+    if (output_vector_flag_) {
+      optional_arrays
+        += fmt::format("\nconst float leaf_vector[] = {{\n{}\n}};\n",
+                       array_leaf_vector.str());
+    }
+    AppendToBuffer("arrays.c",
+      fmt::format(native::flat::arrays_template,
+        "array_nodes"_a = array_nodes.str(),
+        "array_tree_root"_a = array_tree_root.str(),
+        "array_tree_depth"_a = array_tree_depth.str(),
+        "optional_arrays"_a = optional_arrays), 0);
+  }
+
+  // Choose the flags and the (float) threshold of a numerical test, so that
+  // it gives the same results as the test generated by ast_native, which
+  // compares a float against a double literal. Except for equality, every
+  // test becomes (x < t) or (-x < t): for floats x, (x <= t) iff
+  // (x < [next float above t]), and (x > t) iff (-x < -t).
+  static uint32_t RenderNumericalTest(Operator op, tl_float threshold,
+                                      std::string* out_threshold) {
+    const float inf = std::numeric_limits<float>::infinity();
+    if (std::isinf(threshold)) {
+      // ast_native evaluates tests against infinity at compile time
+      if (common::CompareWithOp(0.0, op, threshold)) {
+        *out_threshold = "0";
+        return kAlways;
+      }
+      *out_threshold = "NAN";  // never equal to anything
+      return kEQ;
+    }
+    float t_down, t_up;
+    common_util::GetFloatBounds(threshold, &t_down, &t_up);
+    uint32_t flags = 0;
+    float result = t_up;
+    switch (op) {
+     case Operator::kLT:
+      result = t_up;
+      break;
+     case Operator::kLE:
+      result = std::nextafter(t_down, inf);
+      break;
+     case Operator::kGT:
+      flags = kGT;
+      result = -t_down;
+      break;
+     case Operator::kGE:
+      flags = kGT;
+      result = -std::nextafter(t_up, -inf);
+      break;
+     case Operator::kEQ:
+      flags = kEQ;
+      if (t_down != t_up) {
+        *out_threshold = "NAN";
+        return flags;
+      }
+      result = t_up;
+      break;
+     default:
+      LOG(FATAL) << "operator undefined";
+    }
+    *out_threshold = common_util::RenderFloatLiteral(result);
+    return flags;
+  }
+};
+
+TREELITE_REGISTER_COMPILER(FlatNativeCompiler, "flat_native")
+.describe("Compiler that produces C code storing member trees in one table "
+          "of nodes, for very large models")
+.set_body([](const CompilerParam& param) -> Compiler* {
+    return new FlatNativeCompiler(param);
+  });
+}  // namespace compiler
+}  // namespace treelite
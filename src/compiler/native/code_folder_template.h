@@ -53,6 +53,44 @@ extern const uint64_t {cat_bitmap_name}[];
 extern const size_t {cat_begin_name}[];
 )TREELITETEMPLATE";
 
+const char* dense_eval_loop_template =
+R"TREELITETEMPLATE(
+nid = 0;
+while (nid >= 0) {{  /* negative nid implies leaf */
+  fid = {node_array_name}[nid].split_index;
+  if (row[fid] != row[fid]) {{  /* NaN marks a missing value */
+    cond = {node_array_name}[nid].default_left;
+  }} else if (is_categorical[fid]) {{
+    tmp = (unsigned int)row[fid];
+    cond = ({cat_bitmap_name}[{cat_begin_name}[nid] + tmp / 64] >> (tmp % 64)) & 1;
+  }} else {{
+    cond = (row[fid] {comp_op} {node_array_name}[nid].threshold);
+  }}
+  nid = cond ? {node_array_name}[nid].left_child : {node_array_name}[nid].right_child;
+}}
+
+{output_switch_statement}
+)TREELITETEMPLATE";
+
+const char* masked_eval_loop_template =
+R"TREELITETEMPLATE(
+nid = 0;
+while (nid >= 0) {{  /* negative nid implies leaf */
+  fid = {node_array_name}[nid].split_index;
+  if (IS_MISSING(missing, fid)) {{
+    cond = {node_array_name}[nid].default_left;
+  }} else if (is_categorical[fid]) {{
+    tmp = (unsigned int)values[fid];
+    cond = ({cat_bitmap_name}[{cat_begin_name}[nid] + tmp / 64] >> (tmp % 64)) & 1;
+  }} else {{
+    cond = (values[fid] {comp_op} {node_array_name}[nid].threshold);
+  }}
+  nid = cond ? {node_array_name}[nid].left_child : {node_array_name}[nid].right_child;
+}}
+
+{output_switch_statement}
+)TREELITETEMPLATE";
+
 }  // namespace native
 }  // namespace compiler
 }  // namespace treelite
@@ -0,0 +1,178 @@
+/*!
+ * Copyright (c) 2018 by Contributors
+ * \file flat_template.h
+ * \author Philip Cho
+ * \brief templates for the flat_native compiler, which stores all member
+ *        trees in one table of nodes and walks it with a single loop
+ */
+
+#ifndef TREELITE_COMPILER_NATIVE_FLAT_TEMPLATE_H_
+#define TREELITE_COMPILER_NATIVE_FLAT_TEMPLATE_H_
+
+namespace treelite {
+namespace compiler {
+namespace native {
+namespace flat {
+
+const char* header_template =
+R"TREELITETEMPLATE(
+/* A test node sends a row to child[0] (left) if its feature value x
+   satisfies x < [threshold], or with NODE_GT, -x < [threshold], and to
+   child[1] (right) otherwise; other tests (x == [threshold], and those that
+   always hold) are flagged separately. The lower bits of [info] hold the
+   feature index. A leaf holds its output in [threshold] and points back to
+   itself with child[0]; it is flagged so that every row goes left, so that
+   walking a tree for more steps than needed stays at the leaf. child[1] of a
+   leaf is the offset of its leaf vector, if any. */
+#define NODE_FID_MASK      0x03FFFFFFU
+#define NODE_DEFAULT_LEFT  (1U << 26)
+#define NODE_GT            (1U << 27)
+#define NODE_EQ            (1U << 28)
+#define NODE_ALWAYS        (1U << 29)
+#define NODE_CATEGORICAL   (1U << 30)
+
+struct FlatNode {{
+  float threshold;
+  uint32_t info;
+  int32_t child[2];
+}};
+
+extern const struct FlatNode nodes[];
+extern const int32_t tree_root[];
+extern const int32_t tree_depth[];
+{optional_array_declarations}
+/* whether a row goes to the left child of node [nid] */
+static inline int go_left(const union Entry* data, int32_t nid) {{
+  const struct FlatNode* node = &nodes[nid];
+  const uint32_t info = node->info;
+  const union Entry* e = &data[info & NODE_FID_MASK];
+  if (e->missing == -1) {{
+    return (info & NODE_DEFAULT_LEFT) != 0;
+  }}{categorical_test}
+  if (info & (NODE_EQ | NODE_ALWAYS)) {{
+    return (info & NODE_ALWAYS) || e->fvalue == node->threshold;
+  }}
+  return ((info & NODE_GT) ? -e->fvalue : e->fvalue) < node->threshold;
+}}
+
+/* the node a row moves to from node [nid]; the common case (a comparison
+   with a threshold) is written without branches */
+static inline int32_t next_node(const union Entry* data, int32_t nid) {{
+  const struct FlatNode* node = &nodes[nid];
+  const uint32_t info = node->info;
+  const union Entry* e = &data[info & NODE_FID_MASK];
+  uint32_t is_missing, go_right;
+  float sign;
+  if (info & (NODE_EQ | NODE_CATEGORICAL)) {{
+    return node->child[!go_left(data, nid)];
+  }}
+  /* -1.0f with NODE_GT, 1.0f otherwise */
+  sign = (float)(1 - (int32_t)((info & NODE_GT) >> 26));
+  is_missing = (uint32_t)(e->missing == -1);
+  go_right = ((is_missing & ~(info >> 26))
+              | (~is_missing & ~(info >> 29)
+                 & (uint32_t)!(sign * e->fvalue < node->threshold))) & 1U;
+  return node->child[go_right];
+}}
+
+/* follow a row down the tree rooted at [nid]; returns the leaf reached */
+static inline const struct FlatNode*
+find_leaf(const union Entry* data, int32_t nid) {{
+  int32_t next;
+  while ((next = next_node(data, nid)) != nid) {{
+    nid = next;
+  }}
+  return &nodes[nid];
+}}
+)TREELITETEMPLATE";
+
+const char* categorical_test =
+R"TREELITETEMPLATE(
+  if (info & NODE_CATEGORICAL) {
+    const unsigned int tmp = (unsigned int)e->fvalue;
+    return tmp < (cat_begin[nid + 1] - cat_begin[nid]) * 64
+           && ((cat_bitmap[cat_begin[nid] + tmp / 64] >> (tmp % 64)) & 1);
+  })TREELITETEMPLATE";
+
+const char* arrays_template =
+R"TREELITETEMPLATE(
+#include "header.h"
+
+const struct FlatNode nodes[] = {{
+{array_nodes}
+}};
+
+const int32_t tree_root[] = {{
+{array_tree_root}
+}};
+
+const int32_t tree_depth[] = {{
+{array_tree_depth}
+}};
+{optional_arrays}
+)TREELITETEMPLATE";
+
+const char* predict_template =
+R"TREELITETEMPLATE(
+  {sum_declaration}
+  const struct FlatNode* leaf;
+  int tree_id;
+  for (tree_id = 0; tree_id < {num_tree}; ++tree_id) {{
+    leaf = find_leaf(data, tree_root[tree_id]);
+{accumulate}
+  }}
+)TREELITETEMPLATE";
+
+/* rows go through one tree at a time, so that the nodes of the tree stay in
+   cache, and FLAT_NUM_LANE rows at a time, walking the tree in lockstep for as
+   many steps as the tree is deep, so that the walks of different rows
+   overlap. Each row still adds up tree outputs in the same order. */
+const char* predict_batch_template =
+R"TREELITETEMPLATE(
+#define FLAT_BLOCK_SIZE 64
+#define FLAT_NUM_LANE 8
+
+{predict_batch_function_signature} {{
+  const struct FlatNode* leaf;
+  int32_t nid[FLAT_NUM_LANE];
+  size_t rid, block_begin, block_end, lane_begin, num_lane, k;
+  int tree_id, depth;
+  for (rid = 0; rid < num_row * {num_output_group}; ++rid) {{
+    result[rid] = 0.0f;
+  }}
+  for (block_begin = 0; block_begin < num_row;
+       block_begin += FLAT_BLOCK_SIZE) {{
+    block_end = block_begin + FLAT_BLOCK_SIZE;
+    if (block_end > num_row) {{
+      block_end = num_row;
+    }}
+    for (tree_id = 0; tree_id < {num_tree}; ++tree_id) {{
+      for (lane_begin = block_begin; lane_begin < block_end;
+           lane_begin += FLAT_NUM_LANE) {{
+        num_lane = block_end - lane_begin;
+        if (num_lane > FLAT_NUM_LANE) {{
+          num_lane = FLAT_NUM_LANE;
+        }}
+        for (k = 0; k < num_lane; ++k) {{
+          nid[k] = tree_root[tree_id];
+        }}
+        for (depth = 0; depth < tree_depth[tree_id]; ++depth) {{
+          for (k = 0; k < num_lane; ++k) {{
+            nid[k] = next_node(&rows[(lane_begin + k) * {num_feature}], nid[k]);
+          }}
+        }}
+        for (k = 0; k < num_lane; ++k) {{
+          rid = lane_begin + k;
+          leaf = &nodes[nid[k]];
+{accumulate}
+        }}
+      }}
+    }}
+  }}
+)TREELITETEMPLATE";
+
+}  // namespace flat
+}  // namespace native
+}  // namespace compiler
+}  // namespace treelite
+#endif  // TREELITE_COMPILER_NATIVE_FLAT_TEMPLATE_H_
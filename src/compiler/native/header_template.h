@@ -12,7 +12,15 @@ namespace treelite {
 namespace compiler {
 namespace native {
 
-const char* header_template =
+// tests whether feature i is marked missing in a bitmask passed to
+// predict_masked(); a null bitmask marks no feature missing
+const char* const missing_bitmask_macro =
+R"TREELITETEMPLATE(
+#define IS_MISSING(mask, i) \
+  ((mask) != NULL && (((mask)[(i) / 64] >> ((i) % 64)) & 1))
+)TREELITETEMPLATE";
+
+const char* const header_template =
 R"TREELITETEMPLATE(
 #include <stdlib.h>
 #include <string.h>
@@ -26,7 +34,7 @@ R"TREELITETEMPLATE(
 #define LIKELY(x)   (x)
 #define UNLIKELY(x) (x)
 #endif
-
+{missing_bitmask_macro}
 union Entry {{
   int missing;
   float fvalue;
@@ -45,6 +53,8 @@ extern const unsigned char is_categorical[];
 
 {get_num_output_group_function_signature};
 {get_num_feature_function_signature};
+{get_num_tree_function_signature};
+{get_average_tree_depth_function_signature};
 {predict_function_signature};
 )TREELITETEMPLATE";
 
@@ -12,7 +12,7 @@ namespace treelite {
 namespace compiler {
 namespace native {
 
-const char* main_start_template =
+const char* const main_start_template =
 R"TREELITETEMPLATE(
 #include "header.h"
 
@@ -28,11 +28,19 @@ const unsigned char is_categorical[] = {{
   return {num_feature};
 }}
 
+{get_num_tree_function_signature} {{
+  return {num_tree};
+}}
+
+{get_average_tree_depth_function_signature} {{
+  return {average_tree_depth};
+}}
+
 {pred_transform_function}
 {predict_function_signature} {{
 )TREELITETEMPLATE";
 
-const char* main_end_multiclass_template =
+const char* const main_end_multiclass_template =
 R"TREELITETEMPLATE(
   for (int i = 0; i < {num_output_group}; ++i) {{
     result[i] = sum[i]{optional_average_field} + (float)({global_bias});
@@ -45,7 +53,7 @@ R"TREELITETEMPLATE(
 }}
 )TREELITETEMPLATE";  // only for multiclass classification
 
-const char* main_end_template =
+const char* const main_end_template =
 R"TREELITETEMPLATE(
   sum = sum{optional_average_field} + (float)({global_bias});
   if (!pred_margin) {{
@@ -56,6 +64,66 @@ R"TREELITETEMPLATE(
 }}
 )TREELITETEMPLATE";
 
+const char* const main_batch_start_template =
+R"TREELITETEMPLATE(
+{predict_batch_function_signature} {{
+  union Entry* data;
+  size_t rid;
+  unsigned int tmp;
+  int nid, cond, fid;  /* used for folded subtrees and complete trees */
+  for (rid = 0; rid < num_row * {num_output_group}; ++rid) {{
+    result[rid] = 0.0f;
+  }}
+)TREELITETEMPLATE";
+
+const char* const main_batch_end_multiclass_template =
+R"TREELITETEMPLATE(
+  size_t query_size_per_instance = {num_output_group};
+  for (rid = 0; rid < num_row; ++rid) {{
+    for (int i = 0; i < {num_output_group}; ++i) {{
+      result[rid * {num_output_group} + i]
+        = result[rid * {num_output_group} + i]{optional_average_field}
+          + (float)({global_bias});
+    }}
+    if (!pred_margin) {{
+      query_size_per_instance = pred_transform(&result[rid * {num_output_group}]);
+    }}
+  }}
+  return query_size_per_instance;
+}}
+)TREELITETEMPLATE";  // only for multiclass classification
+
+const char* const main_batch_end_template =
+R"TREELITETEMPLATE(
+  for (rid = 0; rid < num_row; ++rid) {{
+    result[rid] = result[rid]{optional_average_field} + (float)({global_bias});
+    if (!pred_margin) {{
+      result[rid] = pred_transform(result[rid]);
+    }}
+  }}
+}}
+)TREELITETEMPLATE";
+
+const char* const row_loop_start_template =
+R"TREELITETEMPLATE(
+for (rid = 0; rid < num_row; ++rid) {{
+  data = &rows[rid * {num_feature}];
+)TREELITETEMPLATE";
+
+const char* const main_dense_start_template =
+R"TREELITETEMPLATE(
+{predict_dense_row_function_signature} {{
+)TREELITETEMPLATE";
+
+const char* const unit_batch_start_template =
+R"TREELITETEMPLATE(
+{unit_function_signature} {{
+  union Entry* data;
+  size_t rid;
+  unsigned int tmp;
+  int nid, cond, fid;  /* used for folded subtrees and complete trees */
+)TREELITETEMPLATE";
+
 }  // namespace native
 }  // namespace compiler
 }  // namespace treelite
@@ -14,64 +14,94 @@ namespace native {
 
 const char* qnode_template =
 R"TREELITETEMPLATE(
+#include <stdint.h>
+
 static const float threshold[] = {{
 {array_threshold}
 }};
-static const int th_begin[] = {{
+static const {th_begin_type} th_begin[] = {{
 {array_th_begin}
 }};
-static const int th_len[] = {{
+static const {th_len_type} th_len[] = {{
 {array_th_len}
 }};
+static const unsigned char th_depth[] = {{
+{array_th_depth}
+}};
+static const {qfeature_type} qfeature[] = {{
+{array_qfeature}
+}};
 
-#include <stdlib.h>
+/* bin index of a feature value, given the number of thresholds less than it
+   and whether it equals one of them. Values less than all thresholds get -10
+   rather than -1, as the bin index is stored in place of the value and -1
+   would read as a missing value. */
+#define QUANTIZE_BIN(rank, eq) \
+  ((rank) + (eq) == 0 ? -10 : (rank) * 2 - 1 + (eq))
 
 /*
- * \brief function to convert a feature value into bin index.
+ * \brief function to convert a feature value into bin index, for a feature
+ *        with few thresholds. Thresholds are stored in ascending order and
+ *        all of them are compared against the feature value.
  * \param val feature value, in floating-point
- * \param fid feature identifier
+ * \param qid position of the feature in qfeature[]
  * \return bin index corresponding to given feature value
  */
-static inline int quantize(float val, unsigned fid) {{
-  const size_t offset = th_begin[fid];
-  const float* array = &threshold[offset];
-  int len = th_len[fid];
-  int low = 0;
-  int high = len;
-  int mid;
-  float mval;
-  // It is possible th_begin[i] == [total_num_threshold]. This means that
-  // all features i, (i+1), ... are not used for any of the splits in the model.
-  // So in this case, just return something
-  if (offset == {total_num_threshold} || val < array[0]) {{
-    return -10;
+static inline int quantize_linear(float val, unsigned qid) {{
+  const float* array = &threshold[th_begin[qid]];
+  const int len = th_len[qid];
+  int rank = 0, eq = 0, i;
+  for (i = 0; i < len; ++i) {{
+    rank += !(array[i] >= val);
+    eq |= (array[i] == val);
   }}
-  while (low + 1 < high) {{
-    mid = (low + high) / 2;
-    mval = array[mid];
-    if (val == mval) {{
-      return mid * 2;
-    }} else if (val < mval) {{
-      high = mid;
-    }} else {{
-      low = mid;
-    }}
-  }}
-  if (array[low] == val) {{
-    return low * 2;
-  }} else if (high == len) {{
-    return len * 2;
-  }} else {{
-    return low * 2 + 1;
+  return QUANTIZE_BIN(rank, eq);
+}}
+
+/*
+ * \brief function to convert a feature value into bin index, for a feature
+ *        with many thresholds. Thresholds are stored as a complete binary
+ *        search tree with th_depth[qid] levels, in breadth-first (Eytzinger)
+ *        order, padded with copies of the largest threshold. The search takes
+ *        the same number of steps for every feature value, and its steps
+ *        don't branch.
+ * \param val feature value, in floating-point
+ * \param qid position of the feature in qfeature[]
+ * \return bin index corresponding to given feature value
+ */
+static inline int quantize_eytzinger(float val, unsigned qid) {{
+  const float* array = &threshold[th_begin[qid]];
+  const int len = th_len[qid];
+  const int depth = th_depth[qid];
+  int rank, eq = 0, k = 1, i;
+  for (i = 0; i < depth; ++i) {{
+    eq |= (array[k - 1] == val);
+    k = k * 2 + !(array[k - 1] >= val);
   }}
+  /* k - 2^depth thresholds are less than val, counting the padding */
+  rank = k - (1 << depth);
+  rank = (rank > len ? len : rank);
+  return QUANTIZE_BIN(rank, eq);
 }}
 )TREELITETEMPLATE";
 
+/* Feature values are quantized so that a value equal to the k-th threshold
+   (counting from 0) gets bin 2k, and one lying between the (k-1)-th and the
+   k-th thresholds gets bin 2k-1. NaN gets the largest bin. Only features
+   used in numerical splits are quantized; qfeature[] lists the ones with few
+   thresholds first. */
 const char* quantize_loop_template =
 R"TREELITETEMPLATE(
-for (int i = 0; i < {num_feature}; ++i) {{
-  if (data[i].missing != -1 && !is_categorical[i]) {{
-    data[i].qvalue = quantize(data[i].fvalue, i);
+for (int i = 0; i < {num_linear_feature}; ++i) {{
+  const unsigned fid = qfeature[i];
+  if (data[fid].missing != -1) {{
+    data[fid].qvalue = quantize_linear(data[fid].fvalue, i);
+  }}
+}}
+for (int i = {num_linear_feature}; i < {num_quantized_feature}; ++i) {{
+  const unsigned fid = qfeature[i];
+  if (data[fid].missing != -1) {{
+    data[fid].qvalue = quantize_eytzinger(data[fid].fvalue, i);
   }}
 }}
 )TREELITETEMPLATE";
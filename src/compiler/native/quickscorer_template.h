@@ -0,0 +1,160 @@
+/*!
+ * Copyright (c) 2018 by Contributors
+ * \file quickscorer_template.h
+ * \author Philip Cho
+ * \brief templates for the quickscorer compiler, which finds the leaf each
+ *        row reaches in every tree with bitwise operations instead of
+ *        branching down the trees
+ */
+
+#ifndef TREELITE_COMPILER_NATIVE_QUICKSCORER_TEMPLATE_H_
+#define TREELITE_COMPILER_NATIVE_QUICKSCORER_TEMPLATE_H_
+
+namespace treelite {
+namespace compiler {
+namespace native {
+namespace quickscorer {
+
+const char* header_template =
+R"TREELITETEMPLATE(
+/* leaves of tree i are numbered from left to right, starting at
+   leaf_begin[i]. quickscorer_scan() sets bit k of leaves[i] if and only if
+   the k-th leaf of tree i is still reachable; the leftmost reachable leaf is
+   the one the row ends up in. */
+extern const size_t leaf_begin[];
+extern const double leaf_value[];
+void quickscorer_scan(const union Entry* data, uint64_t* leaves);
+
+#if defined(__GNUC__) || defined(__clang__)
+#define EXIT_LEAF(leaves) __builtin_ctzll(leaves)
+#else
+static inline int EXIT_LEAF(uint64_t leaves) {{
+  int k = 0;
+  while (!((leaves >> k) & 1)) {{
+    ++k;
+  }}
+  return k;
+}}
+#endif
+)TREELITETEMPLATE";
+
+const char* scan_template =
+R"TREELITETEMPLATE(
+#include "header.h"
+
+const size_t leaf_begin[] = {{
+{array_leaf_begin}
+}};
+
+const double leaf_value[] = {{
+{array_leaf_value}
+}};
+
+/* Tests of the form (x < t) and (x > t), grouped by feature. Those of the
+   first form are sorted by ascending threshold, and those of the second by
+   descending threshold, so that the tests a row fails come first in both
+   lists. A failed test sends the row right: AND-ing the mask clears the
+   leaves of its left subtree. */
+const size_t lt_begin[] = {{
+{array_lt_begin}
+}};
+const float lt_threshold[] = {{
+{array_lt_threshold}
+}};
+const int32_t lt_tree[] = {{
+{array_lt_tree}
+}};
+const uint64_t lt_mask[] = {{
+{array_lt_mask}
+}};
+
+const size_t gt_begin[] = {{
+{array_gt_begin}
+}};
+const float gt_threshold[] = {{
+{array_gt_threshold}
+}};
+const int32_t gt_tree[] = {{
+{array_gt_tree}
+}};
+const uint64_t gt_mask[] = {{
+{array_gt_mask}
+}};
+
+/* the same tests, where the row goes right if the feature is missing */
+const size_t missing_begin[] = {{
+{array_missing_begin}
+}};
+const int32_t missing_tree[] = {{
+{array_missing_tree}
+}};
+const uint64_t missing_mask[] = {{
+{array_missing_mask}
+}};
+
+void quickscorer_scan(const union Entry* data, uint64_t* leaves) {{
+  size_t i;
+  unsigned int fid;
+  float fvalue;
+{optional_declarations}
+  for (i = 0; i < {num_tree}; ++i) {{
+    leaves[i] = ~(uint64_t)0;
+  }}
+  for (fid = 0; fid < {num_feature}; ++fid) {{
+    if (data[fid].missing == -1) {{
+      for (i = missing_begin[fid]; i < missing_begin[fid + 1]; ++i) {{
+        leaves[missing_tree[i]] &= missing_mask[i];
+      }}
+    }} else {{
+      fvalue = data[fid].fvalue;
+      for (i = lt_begin[fid];
+           i < lt_begin[fid + 1] && !(fvalue < lt_threshold[i]); ++i) {{
+        leaves[lt_tree[i]] &= lt_mask[i];
+      }}
+      for (i = gt_begin[fid];
+           i < gt_begin[fid + 1] && !(fvalue > gt_threshold[i]); ++i) {{
+        leaves[gt_tree[i]] &= gt_mask[i];
+      }}
+    }}
+  }}
+  /* other tests (equality, categorical) are evaluated one by one */
+{other_tests}
+}}
+)TREELITETEMPLATE";
+
+const char* predict_template =
+R"TREELITETEMPLATE(
+  uint64_t leaves[{num_tree}];
+  size_t leaf;
+  int tree_id;
+  {sum_declaration}
+  quickscorer_scan(data, leaves);
+  for (tree_id = 0; tree_id < {num_tree}; ++tree_id) {{
+    leaf = leaf_begin[tree_id] + EXIT_LEAF(leaves[tree_id]);
+{accumulate}
+  }}
+)TREELITETEMPLATE";
+
+const char* predict_batch_template =
+R"TREELITETEMPLATE(
+{predict_batch_function_signature} {{
+  uint64_t leaves[{num_tree}];
+  size_t rid, leaf;
+  int tree_id;
+  for (rid = 0; rid < num_row * {num_output_group}; ++rid) {{
+    result[rid] = 0.0f;
+  }}
+  for (rid = 0; rid < num_row; ++rid) {{
+    quickscorer_scan(&rows[rid * {num_feature}], leaves);
+    for (tree_id = 0; tree_id < {num_tree}; ++tree_id) {{
+      leaf = leaf_begin[tree_id] + EXIT_LEAF(leaves[tree_id]);
+{accumulate}
+    }}
+  }}
+)TREELITETEMPLATE";
+
+}  // namespace quickscorer
+}  // namespace native
+}  // namespace compiler
+}  // namespace treelite
+#endif  // TREELITE_COMPILER_NATIVE_QUICKSCORER_TEMPLATE_H_
@@ -0,0 +1,350 @@
+/*!
+ * Copyright (c) 2018 by Contributors
+ * \file simd_template.h
+ * \author Philip Cho
+ * \brief templates for the simd_native compiler, which lays out member trees
+ *        as arrays and evaluates several rows at once with vector instructions
+ */
+
+#ifndef TREELITE_COMPILER_NATIVE_SIMD_TEMPLATE_H_
+#define TREELITE_COMPILER_NATIVE_SIMD_TEMPLATE_H_
+
+namespace treelite {
+namespace compiler {
+namespace native {
+namespace simd {
+
+const char* header_template =
+R"TREELITETEMPLATE(
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+/* x86 vector code is compiled for AVX2 and AVX-512 regardless of the compiler
+   flags, and used only if the CPU running it supports the instruction set.
+   Define TREELITE_SIMD_LEVEL to cap the instruction set used:
+   0 = scalar code only, 1 = up to AVX2, 2 = up to AVX-512 (default) */
+#ifndef TREELITE_SIMD_LEVEL
+#define TREELITE_SIMD_LEVEL 2
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__)) && TREELITE_SIMD_LEVEL > 0
+#define TREELITE_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define TREELITE_SIMD_X86 0
+#endif
+
+union Entry {{
+  int missing;
+  float fvalue;
+  int qvalue;
+}};
+
+/* node_info[] holds the feature index of a test node in the lower bits and
+   the following flags in the upper bits. A numerical test sends a row left if
+   the feature value compares with node_threshold[] in one of the flagged
+   ways. A leaf sends every row to itself and holds its output in
+   node_threshold[]. The right child of a node always follows the left one. */
+#define NODE_FID_MASK      0x03FFFFFFU
+#define NODE_DEFAULT_LEFT  (1U << 26)
+#define NODE_LT            (1U << 27)
+#define NODE_EQ            (1U << 28)
+#define NODE_GT            (1U << 29)
+#define NODE_ALWAYS        (1U << 30)
+#define NODE_CATEGORICAL   (1U << 31)
+
+extern const uint32_t node_info[];
+extern const float node_threshold[];
+extern const int32_t node_left[];
+extern const int32_t tree_root[];
+extern const int32_t tree_depth[];
+{optional_array_declarations}
+{get_num_output_group_function_signature};
+{get_num_feature_function_signature};
+{get_num_tree_function_signature};
+{get_average_tree_depth_function_signature};
+{predict_function_signature};
+{predict_batch_function_signature};
+)TREELITETEMPLATE";
+
+const char* arrays_template =
+R"TREELITETEMPLATE(
+#include "header.h"
+
+const uint32_t node_info[] = {{
+{array_node_info}
+}};
+
+const float node_threshold[] = {{
+{array_node_threshold}
+}};
+
+const int32_t node_left[] = {{
+{array_node_left}
+}};
+
+const int32_t tree_root[] = {{
+{array_tree_root}
+}};
+
+const int32_t tree_depth[] = {{
+{array_tree_depth}
+}};
+{optional_arrays}
+)TREELITETEMPLATE";
+
+const char* main_start_template =
+R"TREELITETEMPLATE(
+#include "header.h"
+
+{get_num_output_group_function_signature} {{
+  return {num_output_group};
+}}
+
+{get_num_feature_function_signature} {{
+  return {num_feature};
+}}
+
+{get_num_tree_function_signature} {{
+  return {num_tree};
+}}
+
+{get_average_tree_depth_function_signature} {{
+  return {average_tree_depth};
+}}
+
+{pred_transform_function}
+/* follow a row down the tree rooted at [nid]; returns the leaf reached */
+static inline int find_leaf(const union Entry* data, int nid) {{
+  uint32_t info;
+  const union Entry* e;
+  int cond;
+  while (node_left[nid] != nid) {{
+    info = node_info[nid];
+    e = &data[info & NODE_FID_MASK];
+    if (e->missing == -1) {{
+      cond = (info & NODE_DEFAULT_LEFT) != 0;
+    }}{categorical_test} else {{
+      cond = ((info & NODE_LT) && e->fvalue < node_threshold[nid])
+             || ((info & NODE_EQ) && e->fvalue == node_threshold[nid])
+             || ((info & NODE_GT) && e->fvalue > node_threshold[nid])
+             || (info & NODE_ALWAYS);
+    }}
+    nid = node_left[nid] + !cond;
+  }}
+  return nid;
+}}
+
+{predict_function_signature} {{
+  {sum_declaration}
+  int tree_id, nid;
+  for (tree_id = 0; tree_id < {num_tree}; ++tree_id) {{
+    nid = find_leaf(data, tree_root[tree_id]);
+{accumulate_scalar}
+  }}
+)TREELITETEMPLATE";
+
+const char* categorical_test =
+R"TREELITETEMPLATE( else if (info & NODE_CATEGORICAL) {
+      const unsigned int tmp = (unsigned int)e->fvalue;
+      cond = tmp < (cat_begin[nid + 1] - cat_begin[nid]) * 64
+             && ((cat_bitmap[cat_begin[nid] + tmp / 64] >> (tmp % 64)) & 1);
+    })TREELITETEMPLATE";
+
+/* Vector kernels. Each evaluates [num_row] rows in groups of as many rows as
+   fit in a vector, adding the outputs of member trees to result[], and
+   returns the number of rows done; the remaining rows are left to the caller.
+   All rows in a group go down a tree together, for as many steps as the
+   tree is deep; rows reaching a leaf early stay there. */
+const char* kernel_template =
+R"TREELITETEMPLATE(
+#if TREELITE_SIMD_X86
+__attribute__((target("avx2")))
+static size_t predict_rows_avx2(union Entry* rows, size_t num_row,
+                                float* result) {{
+  const __m256i lane_offset
+    = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                         _mm256_set1_epi32({num_feature}));
+  const __m256i fid_mask = _mm256_set1_epi32((int)NODE_FID_MASK);
+  const __m256i default_left = _mm256_set1_epi32((int)NODE_DEFAULT_LEFT);
+  const __m256i lt_flag = _mm256_set1_epi32((int)NODE_LT);
+  const __m256i eq_flag = _mm256_set1_epi32((int)NODE_EQ);
+  const __m256i gt_flag = _mm256_set1_epi32((int)NODE_GT);
+  const __m256i always_flag = _mm256_set1_epi32((int)NODE_ALWAYS);
+  const __m256i missing = _mm256_set1_epi32(-1);
+  const __m256i zero = _mm256_setzero_si256();
+  float sum[{num_output_group} * 8];
+  int32_t leaf[8];
+  size_t rid;
+  int tree_id, depth, lane, k;
+  for (rid = 0; rid + 8 <= num_row; rid += 8) {{
+    const int* data = (const int*)&rows[rid * {num_feature}];
+    for (k = 0; k < {num_output_group} * 8; ++k) {{
+      sum[k] = 0.0f;
+    }}
+    for (tree_id = 0; tree_id < {num_tree}; ++tree_id) {{
+      __m256i nid = _mm256_set1_epi32(tree_root[tree_id]);
+{categorical_tree_check_avx2}
+      for (depth = 0; depth < {num_step}; ++depth) {{
+        const __m256i info
+          = _mm256_i32gather_epi32((const int*)node_info, nid, 4);
+        const __m256i raw = _mm256_i32gather_epi32(data,
+          _mm256_add_epi32(lane_offset, _mm256_and_si256(info, fid_mask)), 4);
+        const __m256 value = _mm256_castsi256_ps(raw);
+        const __m256 threshold = _mm256_i32gather_ps(node_threshold, nid, 4);
+        const __m256i left = _mm256_i32gather_epi32(node_left, nid, 4);
+        __m256i flags = always_flag;
+        flags = _mm256_or_si256(flags, _mm256_and_si256(lt_flag,
+          _mm256_castps_si256(_mm256_cmp_ps(value, threshold, _CMP_LT_OQ))));
+        flags = _mm256_or_si256(flags, _mm256_and_si256(eq_flag,
+          _mm256_castps_si256(_mm256_cmp_ps(value, threshold, _CMP_EQ_OQ))));
+        flags = _mm256_or_si256(flags, _mm256_and_si256(gt_flag,
+          _mm256_castps_si256(_mm256_cmp_ps(value, threshold, _CMP_GT_OQ))));
+        /* missing values go the default way */
+        flags = _mm256_blendv_epi8(flags, default_left,
+                                   _mm256_cmpeq_epi32(raw, missing));
+        /* go right (left + 1) wherever none of the flags is set */
+        nid = _mm256_sub_epi32(left, _mm256_cmpeq_epi32(
+          _mm256_and_si256(flags, info), zero));
+      }}
+      _mm256_storeu_si256((__m256i*)leaf, nid);
+{accumulate_avx2}
+    }}
+    for (k = 0; k < {num_output_group}; ++k) {{
+      for (lane = 0; lane < 8; ++lane) {{
+        result[(rid + lane) * {num_output_group} + k] = sum[k * 8 + lane];
+      }}
+    }}
+  }}
+  return rid;
+}}
+
+__attribute__((target("avx512f")))
+static size_t predict_rows_avx512(union Entry* rows, size_t num_row,
+                                  float* result) {{
+  const __m512i lane_offset
+    = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                           8, 9, 10, 11, 12, 13, 14, 15),
+                         _mm512_set1_epi32({num_feature}));
+  const __m512i fid_mask = _mm512_set1_epi32((int)NODE_FID_MASK);
+  const __m512i default_left = _mm512_set1_epi32((int)NODE_DEFAULT_LEFT);
+  const __m512i lt_flag = _mm512_set1_epi32((int)NODE_LT);
+  const __m512i eq_flag = _mm512_set1_epi32((int)NODE_EQ);
+  const __m512i gt_flag = _mm512_set1_epi32((int)NODE_GT);
+  const __m512i always_flag = _mm512_set1_epi32((int)NODE_ALWAYS);
+  const __m512i missing = _mm512_set1_epi32(-1);
+  const __m512i one = _mm512_set1_epi32(1);
+  float sum[{num_output_group} * 16];
+  int32_t leaf[16];
+  size_t rid;
+  int tree_id, depth, lane, k;
+  for (rid = 0; rid + 16 <= num_row; rid += 16) {{
+    const int* data = (const int*)&rows[rid * {num_feature}];
+    for (k = 0; k < {num_output_group} * 16; ++k) {{
+      sum[k] = 0.0f;
+    }}
+    for (tree_id = 0; tree_id < {num_tree}; ++tree_id) {{
+      __m512i nid = _mm512_set1_epi32(tree_root[tree_id]);
+{categorical_tree_check_avx512}
+      for (depth = 0; depth < {num_step}; ++depth) {{
+        const __m512i info
+          = _mm512_i32gather_epi32(nid, (const int*)node_info, 4);
+        const __m512i raw = _mm512_i32gather_epi32(
+          _mm512_add_epi32(lane_offset, _mm512_and_si512(info, fid_mask)),
+          data, 4);
+        const __m512 value = _mm512_castsi512_ps(raw);
+        const __m512 threshold = _mm512_i32gather_ps(nid, node_threshold, 4);
+        const __m512i left = _mm512_i32gather_epi32(nid, node_left, 4);
+        __m512i flags = always_flag;
+        flags = _mm512_mask_or_epi32(flags,
+          _mm512_cmp_ps_mask(value, threshold, _CMP_LT_OQ), flags, lt_flag);
+        flags = _mm512_mask_or_epi32(flags,
+          _mm512_cmp_ps_mask(value, threshold, _CMP_EQ_OQ), flags, eq_flag);
+        flags = _mm512_mask_or_epi32(flags,
+          _mm512_cmp_ps_mask(value, threshold, _CMP_GT_OQ), flags, gt_flag);
+        /* missing values go the default way */
+        flags = _mm512_mask_mov_epi32(flags,
+          _mm512_cmpeq_epi32_mask(raw, missing), default_left);
+        /* go right (left + 1) wherever none of the flags is set */
+        nid = _mm512_mask_add_epi32(left,
+          _mm512_testn_epi32_mask(flags, info), left, one);
+      }}
+      _mm512_storeu_si512((void*)leaf, nid);
+{accumulate_avx512}
+    }}
+    for (k = 0; k < {num_output_group}; ++k) {{
+      for (lane = 0; lane < 16; ++lane) {{
+        result[(rid + lane) * {num_output_group} + k] = sum[k * 16 + lane];
+      }}
+    }}
+  }}
+  return rid;
+}}
+#endif  /* TREELITE_SIMD_X86 */
+
+static size_t predict_rows_simd(union Entry* rows, size_t num_row,
+                                float* result) {{
+#if TREELITE_SIMD_X86
+  if (TREELITE_SIMD_LEVEL >= 2 && __builtin_cpu_supports("avx512f")) {{
+    return predict_rows_avx512(rows, num_row, result);
+  }}
+  if (__builtin_cpu_supports("avx2")) {{
+    return predict_rows_avx2(rows, num_row, result);
+  }}
+#endif
+  return 0;
+}}
+)TREELITETEMPLATE";
+
+/* Converting an out-of-range feature value to a category is undefined, and
+   compiles to different instructions for different targets; the vector
+   kernels therefore call find_leaf() through a copy that is never inlined
+   into them, so that every row gives the same result as in predict(). */
+const char* find_leaf_noinline_template =
+R"TREELITETEMPLATE(
+#if TREELITE_SIMD_X86
+__attribute__((noinline))
+static int find_leaf_noinline(const union Entry* data, int nid) {{
+  return find_leaf(data, nid);
+}}
+#endif  /* TREELITE_SIMD_X86 */
+)TREELITETEMPLATE";
+
+const char* categorical_tree_check_template =
+R"TREELITETEMPLATE(
+if (tree_categorical[tree_id]) {{
+  /* trees with categorical tests are evaluated one row at a time */
+  for (lane = 0; lane < {num_lane}; ++lane) {{
+    leaf[lane] = find_leaf_noinline(&rows[(rid + lane) * {num_feature}],
+                                    tree_root[tree_id]);
+  }}
+  nid = _mm{width}_loadu_si{width}((const void*)leaf);
+}}
+)TREELITETEMPLATE";
+
+const char* main_batch_start_template =
+R"TREELITETEMPLATE(
+{predict_batch_function_signature} {{
+  size_t rid;
+  int tree_id, nid;
+  for (rid = 0; rid < num_row * {num_output_group}; ++rid) {{
+    result[rid] = 0.0f;
+  }}
+  /* whole groups of rows go through the vector kernels, if available */
+  rid = predict_rows_simd(rows, num_row, result);
+  for (; rid < num_row; ++rid) {{
+    const union Entry* data = &rows[rid * {num_feature}];
+    for (tree_id = 0; tree_id < {num_tree}; ++tree_id) {{
+      nid = find_leaf(data, tree_root[tree_id]);
+{accumulate_batch}
+    }}
+  }}
+)TREELITETEMPLATE";
+
+}  // namespace simd
+}  // namespace native
+}  // namespace compiler
+}  // namespace treelite
+#endif  // TREELITE_COMPILER_NATIVE_SIMD_TEMPLATE_H_
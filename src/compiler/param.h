@@ -55,6 +55,54 @@ struct CompilerParam : public dmlc::Parameter<CompilerParam> {
   std::string ast_dump_path;
   /*! \brief whether AST dump should be binary (>0) or human-readable text (<=0) */
   int ast_dump_binary;
+  /*! \brief whether to also generate a batch prediction function
+             ``predict_batch()`` that evaluates a block of rows one tree
+             (or translation unit) at a time (0: no, >0: yes). This keeps
+             each tree's code and thresholds in cache across the block, at
+             the cost of roughly doubling the size of the generated code.
+             Not applicable to Java target */
+  int batch_function;
+  /*! \brief whether to also generate a prediction function
+             ``predict_dense_row()`` that reads a dense row of floats
+             directly, taking NaN as missing at each split (0: no,
+             >0: yes). This lets the runtime skip converting dense rows into
+             arrays of entries; the runtime uses it for dense batches whose
+             missing values are marked with NaN. Not generated if code
+             folding is combined with quantization. Not applicable to Java
+             target */
+  int dense_row_function;
+  /*! \brief whether to also generate a prediction function
+             ``predict_masked()`` that reads feature values from an array of
+             floats and missing features from a separate bitmask, instead of
+             from an array of entries marking missing values with -1 (0: no,
+             >0: yes). Rows with no missing values are passed without a
+             bitmask and skip the tests for missing values altogether.
+             Not generated if code folding is combined with quantization.
+             Not applicable to Java target */
+  int missing_bitmask;
+  /*! \brief whether to evaluate complete trees, whose leaves are all at the
+             same depth, without branches (0: no, >0: yes). Such a tree
+             computes the index of the leaf reached one level at a time and
+             looks up its output in a table; oblivious trees, which perform
+             the same test at every node of each level, need no other table.
+             Not applicable to Java target */
+  int branchless_tree;
+  /*! \brief with ``branchless_tree``, pad a tree that is not complete into
+             one if no more than this fraction of the test nodes of the
+             padded tree need to be added (0 to disable padding). Must be
+             between 0 and 1. Regardless of this value, a tree is never
+             padded to more than 4 times its number of leaves, and trees
+             deeper than 16 levels are left as they are */
+  double branchless_tree_padding;
+  /*! \brief order in which the flat_native compiler lays out the nodes of
+             each tree in its node table: ``bfs`` (level by level), ``dfs``
+             (each node followed by its left subtree), ``hot_first`` (each
+             node followed by its more frequently visited subtree, according
+             to the annotation given by ``annotate_in``), or ``veb`` (van
+             Emde Boas: the top half of the levels first, then each of the
+             subtrees below it, recursively). Not applicable to other
+             compilers */
+  std::string node_layout;
   /*! \} */
 
   // declare parameters
@@ -83,6 +131,24 @@ struct CompilerParam : public dmlc::Parameter<CompilerParam> {
        .describe("Path to save a dump of AST");
     DMLC_DECLARE_FIELD(ast_dump_binary)
        .set_default(1);
+    DMLC_DECLARE_FIELD(batch_function).set_lower_bound(0).set_default(0)
+      .describe("whether to generate a batch prediction function "
+                "(0: no, >0: yes)");
+    DMLC_DECLARE_FIELD(dense_row_function).set_lower_bound(0).set_default(0)
+      .describe("whether to generate a prediction function for dense rows "
+                "(0: no, >0: yes)");
+    DMLC_DECLARE_FIELD(missing_bitmask).set_lower_bound(0).set_default(0)
+      .describe("whether to generate a prediction function taking a bitmask "
+                "of missing values (0: no, >0: yes)");
+    DMLC_DECLARE_FIELD(branchless_tree).set_lower_bound(0).set_default(0)
+      .describe("whether to evaluate complete trees without branches "
+                "(0: no, >0: yes)");
+    DMLC_DECLARE_FIELD(branchless_tree_padding).set_range(0.0, 1.0)
+      .set_default(0.0)
+      .describe("largest fraction of test nodes to add when padding a tree "
+                "into a complete tree");
+    DMLC_DECLARE_FIELD(node_layout).set_default("bfs")
+      .describe("order of nodes in the node table of flat_native");
   }
 };
 
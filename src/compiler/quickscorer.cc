@@ -0,0 +1,522 @@
+/*!
+ * Copyright (c) 2018 by Contributors
+ * \file quickscorer.cc
+ * \author Philip Cho
+ * \brief C code generator that evaluates member trees with the QuickScorer
+ *        algorithm: instead of branching down each tree, it visits the tests
+ *        of every tree feature by feature, and marks the leaves each failed
+ *        test rules out in a bitvector per tree
+ */
+#include <treelite/compiler.h>
+#include <treelite/common.h>
+#include <fmt/format.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include "./param.h"
+#include "./pred_transform.h"
+#include "./ast/builder.h"
+#include "./native/main_template.h"
+#include "./native/header_template.h"
+#include "./native/quickscorer_template.h"
+#include "./common/categorical_bitmap.h"
+#include "./common/float_threshold.h"
+
+using namespace fmt::literals;
+
+namespace treelite {
+namespace compiler {
+
+DMLC_REGISTRY_FILE_TAG(quickscorer);
+
+class QuickScorerCompiler : public Compiler {
+ public:
+  explicit QuickScorerCompiler(const CompilerParam& param)
+    : param(param) {
+    if (param.verbose > 0) {
+      LOG(INFO) << "Using QuickScorerCompiler";
+    }
+    if (param.quantize > 0) {
+      LOG(WARNING) << "\033[1;31mWARNING: QuickScorer backend does not support "
+                   << "quantization.\u001B[0m The parameter "
+                   << "\x1B[33mquantize\u001B[0m will be ignored.";
+    }
+    if (param.annotate_in != "NULL") {
+      LOG(WARNING) << "\033[1;31mWARNING: QuickScorer backend does not support "
+                   << "branch annotation.\u001B[0m The parameter "
+                   << "\x1B[33mannotate_in\u001B[0m will be ignored.";
+    }
+    if (param.code_folding_req != std::numeric_limits<double>::infinity()) {
+      LOG(WARNING) << "\033[1;31mWARNING: QuickScorer backend does not support "
+                   << "code folding.\u001B[0m The parameter "
+                   << "\x1B[33mcode_folding_req\u001B[0m will be ignored.";
+    }
+  }
+
+  CompiledModel Compile(const Model& model) override {
+    CompiledModel cm;
+    cm.backend = "native";
+
+    num_feature_ = model.num_feature;
+    num_output_group_ = model.num_output_group;
+    files_.clear();
+    lt_tests_.assign(num_feature_, {});
+    gt_tests_.assign(num_feature_, {});
+    missing_tests_.assign(num_feature_, {});
+    other_tests_.clear();
+    leaf_begin_.clear();
+    leaf_value_.clear();
+    has_categorical_ = false;
+
+    ASTBuilder builder;
+    builder.BuildAST(model);
+    const MainNode* main_node
+      = dynamic_cast<const MainNode*>(builder.GetRootNode());
+    CHECK(main_node);
+    CHECK_EQ(main_node->children.size(), 1);
+    const ASTNode* ac_node = main_node->children[0];
+    CHECK(dynamic_cast<const AccumulatorContextNode*>(ac_node));
+    num_tree_ = static_cast<int>(ac_node->children.size());
+    CHECK_GT(num_tree_, 0) << "Model must have at least one member tree";
+
+    double depth_sum = 0.0;
+    for (const ASTNode* tree_head : ac_node->children) {
+      leaf_begin_.push_back(leaf_value_.size() / LeafSize(model));
+      size_t num_leaf = 0, leaf_depth_sum = 0;
+      CollectTests(tree_head, 0, &num_leaf, &leaf_depth_sum);
+      CHECK_LE(num_leaf, 64)
+        << "QuickScorerCompiler supports trees with at most 64 leaves; "
+        << "tree " << tree_head->tree_id << " has " << num_leaf << " leaves";
+      depth_sum += static_cast<double>(leaf_depth_sum) / num_leaf;
+    }
+    leaf_begin_.push_back(leaf_value_.size() / LeafSize(model));
+    average_tree_depth_ = depth_sum / num_tree_;
+    for (auto& tests : lt_tests_) {
+      std::stable_sort(tests.begin(), tests.end(),
+        [](const Test& a, const Test& b) { return a.threshold < b.threshold; });
+    }
+    for (auto& tests : gt_tests_) {
+      std::stable_sort(tests.begin(), tests.end(),
+        [](const Test& a, const Test& b) { return a.threshold > b.threshold; });
+    }
+
+    RenderMain(model, main_node, builder.GenerateIsCategoricalArray());
+    RenderScan();
+
+    {
+      /* write recipe.json */
+      std::vector<std::unordered_map<std::string, std::string>> source_list;
+      for (auto kv : files_) {
+        if (kv.first.compare(kv.first.length() - 2, 2, ".c") == 0) {
+          const size_t line_count
+            = std::count(kv.second.begin(), kv.second.end(), '\n');
+          source_list.push_back({ {"name",
+                                   kv.first.substr(0, kv.first.length() - 2)},
+                                  {"length", std::to_string(line_count)} });
+        }
+      }
+      std::ostringstream oss;
+      auto writer = common::make_unique<dmlc::JSONWriter>(&oss);
+      writer->BeginObject();
+      writer->WriteObjectKeyValue("target", param.native_lib_name);
+      writer->WriteObjectKeyValue("sources", source_list);
+      writer->EndObject();
+      files_["recipe.json"] = oss.str();
+    }
+    cm.files = std::move(files_);
+    return cm;
+  }
+
+ private:
+  // a test that clears [mask] from the leaves of tree [tree_id] if it fails
+  struct Test {
+    int tree_id;
+    uint64_t mask;
+    float threshold;
+  };
+
+  CompilerParam param;
+  int num_feature_;
+  int num_output_group_;
+  int num_tree_;
+  double average_tree_depth_;
+  bool has_categorical_;
+  std::unordered_map<std::string, std::string> files_;
+
+  // tests of the form (x < threshold), for each feature
+  std::vector<std::vector<Test>> lt_tests_;
+  // tests of the form (x > threshold), for each feature
+  std::vector<std::vector<Test>> gt_tests_;
+  // tests from lt_tests_ and gt_tests_ that fail for missing values
+  std::vector<std::vector<Test>> missing_tests_;
+  // remaining tests, rendered as C statements
+  std::string other_tests_;
+  // output of all leaves; leaves of tree i start at leaf_begin_[i]
+  std::vector<size_t> leaf_begin_;
+  std::vector<tl_float> leaf_value_;
+
+  // append content to a given buffer, with given level of indentation
+  inline void AppendToBuffer(const std::string& dest,
+                             const std::string& content,
+                             size_t indent) {
+    files_[dest] += common::IndentMultiLineString(content, indent);
+  }
+
+  inline size_t LeafSize(const Model& model) const {
+    return (model.num_output_group > 1 && model.random_forest_flag)
+           ? model.num_output_group : 1;
+  }
+
+  // visit leaves from left to right, numbering them, and collect the tests
+  // on the way; a test, if failed, rules out the leaves of its left subtree
+  void CollectTests(const ASTNode* node, size_t depth,
+                    size_t* num_leaf, size_t* leaf_depth_sum) {
+    const OutputNode* output = dynamic_cast<const OutputNode*>(node);
+    if (output) {
+      if (output->is_vector) {
+        CHECK_EQ(output->vector.size(), static_cast<size_t>(num_output_group_))
+          << "Ill-formed model: leaf vector must be of length [num_output_group]";
+        leaf_value_.insert(leaf_value_.end(), output->vector.begin(),
+                           output->vector.end());
+      } else {
+        leaf_value_.push_back(output->scalar);
+      }
+      ++(*num_leaf);
+      *leaf_depth_sum += depth;
+      return;
+    }
+    const ConditionNode* cond = dynamic_cast<const ConditionNode*>(node);
+    CHECK(cond) << "QuickScorerCompiler: unexpected AST node";
+    CHECK_EQ(node->children.size(), 2);
+    const size_t left_begin = *num_leaf;
+    CollectTests(node->children[0], depth + 1, num_leaf, leaf_depth_sum);
+    const size_t left_end = *num_leaf;
+    CollectTests(node->children[1], depth + 1, num_leaf, leaf_depth_sum);
+    if (left_end > 64) {
+      return;  // too many leaves; Compile() will report the error
+    }
+    const uint64_t left_leaves
+      = ((left_end - left_begin == 64) ? ~static_cast<uint64_t>(0)
+         : ((static_cast<uint64_t>(1) << (left_end - left_begin)) - 1))
+        << left_begin;
+    AddTest(cond, node->tree_id, ~left_leaves);
+  }
+
+  void AddTest(const ConditionNode* node, int tree_id, uint64_t mask) {
+    const unsigned fid = node->split_index;
+    const NumericalConditionNode* t
+      = dynamic_cast<const NumericalConditionNode*>(node);
+    if (t && !std::isinf(t->threshold.float_val) && t->op != Operator::kEQ) {
+      // write the test as (x < threshold) or (x > threshold), with a float
+      // threshold, so that it gives the same results as the one generated by
+      // ast_native, which compares a float against a double literal
+      float t_down, t_up;
+      common_util::GetFloatBounds(t->threshold.float_val, &t_down, &t_up);
+      Test test{tree_id, mask, 0.0f};
+      switch (t->op) {
+       case Operator::kLT:  // x < t_up
+        test.threshold = t_up;
+        lt_tests_[fid].push_back(test);
+        break;
+       case Operator::kLE:  // x <= t_down, i.e. x < (next float after t_down)
+        test.threshold
+          = std::nextafter(t_down, std::numeric_limits<float>::infinity());
+        lt_tests_[fid].push_back(test);
+        break;
+       case Operator::kGT:  // x > t_down
+        test.threshold = t_down;
+        gt_tests_[fid].push_back(test);
+        break;
+       case Operator::kGE:  // x >= t_up, i.e. x > (next float before t_up)
+        test.threshold
+          = std::nextafter(t_up, -std::numeric_limits<float>::infinity());
+        gt_tests_[fid].push_back(test);
+        break;
+       default:
+        LOG(FATAL) << "operator undefined";
+      }
+      if (!node->default_left) {
+        missing_tests_[fid].push_back(test);
+      }
+      return;
+    }
+    // other tests are few; render them as they are
+    std::string condition;
+    if (t) {
+      if (std::isinf(t->threshold.float_val)) {
+        condition = common::CompareWithOp(0.0, t->op, t->threshold.float_val)
+                    ? "1" : "0";
+      } else {
+        condition = fmt::format("data[{}].fvalue == {}", fid,
+          common::ToStringHighPrecision(t->threshold.float_val));
+      }
+    } else {
+      const CategoricalConditionNode* t2
+        = dynamic_cast<const CategoricalConditionNode*>(node);
+      CHECK(t2);
+      condition = RenderCategoricalCondition(t2);
+      has_categorical_ = true;
+    }
+    if (condition == "1" && node->default_left) {
+      return;  // never fails
+    }
+    const char* statement_template
+      = node->default_left ?
+          "if (data[{fid}].missing != -1 && !({condition})) {{\n"
+        : "if (data[{fid}].missing == -1 || !({condition})) {{\n";
+    other_tests_
+      += fmt::format(statement_template,
+           "fid"_a = fid, "condition"_a = condition)
+       + fmt::format("  leaves[{}] &= {};\n}}\n", tree_id, RenderMask(mask));
+  }
+
+  static std::string
+  RenderCategoricalCondition(const CategoricalConditionNode* node) {
+    if (node->left_categories.empty()) {
+      return "0";
+    }
+    std::vector<uint64_t> bitmap
+      = common_util::GetCategoricalBitmap(node->left_categories);
+    std::ostringstream oss;
+    oss << "(tmp = (unsigned int)(data[" << node->split_index << "].fvalue)), "
+        << "(tmp < " << (bitmap.size() * 64) << " && (";
+    for (size_t i = 0; i < bitmap.size(); ++i) {
+      if (i > 0) {
+        oss << " || ";
+      }
+      oss << "(tmp >= " << (i * 64) << " && tmp < " << ((i + 1) * 64)
+          << " && (((uint64_t)" << bitmap[i] << "U >> (tmp - " << (i * 64)
+          << ")) & 1))";
+    }
+    oss << "))";
+    return oss.str();
+  }
+
+  static std::string RenderMask(uint64_t mask) {
+    return fmt::format("0x{:016X}ULL", mask);
+  }
+
+  void RenderMain(const Model& model, const MainNode* main_node,
+                  const std::vector<bool>& is_categorical) {
+    const char* get_num_output_group_function_signature
+      = "size_t get_num_output_group(void)";
+    const char* get_num_feature_function_signature
+      = "size_t get_num_feature(void)";
+    const char* get_num_tree_function_signature
+      = "size_t get_num_tree(void)";
+    const char* get_average_tree_depth_function_signature
+      = "float get_average_tree_depth(void)";
+    const bool multiclass = (num_output_group_ > 1);
+    const char* predict_function_signature
+      = multiclass ?
+          "size_t predict_multiclass(union Entry* data, int pred_margin, "
+                                    "float* result)"
+        : "float predict(union Entry* data, int pred_margin)";
+    const char* predict_batch_function_signature
+      = multiclass ?
+          "size_t predict_multiclass_batch(union Entry* rows, size_t num_row, "
+                                          "int pred_margin, float* result)"
+        : "void predict_batch(union Entry* rows, size_t num_row, "
+                             "int pred_margin, float* result)";
+
+    AppendToBuffer("header.h",
+      fmt::format(native::header_template,
+        "missing_bitmask_macro"_a = "",
+        "threshold_type"_a = "double",
+        "get_num_output_group_function_signature"_a
+          = get_num_output_group_function_signature,
+        "get_num_feature_function_signature"_a
+          = get_num_feature_function_signature,
+        "get_num_tree_function_signature"_a = get_num_tree_function_signature,
+        "get_average_tree_depth_function_signature"_a
+          = get_average_tree_depth_function_signature,
+        "predict_function_signature"_a = predict_function_signature), 0);
+    AppendToBuffer("header.h",
+      fmt::format("{};\n", predict_batch_function_signature), 0);
+    AppendToBuffer("header.h",
+      fmt::format(native::quickscorer::header_template), 0);
+
+    common::ArrayFormatter array_is_categorical(80, 2);
+    for (bool e : is_categorical) {
+      array_is_categorical << (e ? 1 : 0);
+    }
+    AppendToBuffer("main.c",
+      fmt::format(native::main_start_template,
+        "array_is_categorical"_a = array_is_categorical.str(),
+        "get_num_output_group_function_signature"_a
+          = get_num_output_group_function_signature,
+        "get_num_feature_function_signature"_a
+          = get_num_feature_function_signature,
+        "get_num_tree_function_signature"_a = get_num_tree_function_signature,
+        "get_average_tree_depth_function_signature"_a
+          = get_average_tree_depth_function_signature,
+        "num_output_group"_a = num_output_group_,
+        "num_feature"_a = num_feature_,
+        "num_tree"_a = num_tree_,
+        "average_tree_depth"_a
+          = common::ToStringHighPrecision(average_tree_depth_),
+        "pred_transform_function"_a = PredTransformFunction("native", model),
+        "predict_function_signature"_a = predict_function_signature), 0);
+
+    // add the output of [leaf] of tree [tree_id] to a sum; as in ast_native,
+    // leaf outputs are added one tree at a time, in order
+    std::string sum_declaration, accumulate, accumulate_batch;
+    if (LeafSize(model) > 1) {
+      // multi-class classification with random forest
+      sum_declaration
+        = fmt::format("float sum[{}] = {{0.0f}};", num_output_group_);
+      const char* accumulate_template
+        = "for (int k = 0; k < {num_output_group}; ++k) {{\n"
+          "  {sum} += (float)leaf_value[leaf * {num_output_group} + k];\n"
+          "}}\n";
+      accumulate = fmt::format(accumulate_template,
+        "num_output_group"_a = num_output_group_,
+        "sum"_a = "sum[k]");
+      accumulate_batch = fmt::format(accumulate_template,
+        "num_output_group"_a = num_output_group_,
+        "sum"_a = fmt::format("result[rid * {} + k]", num_output_group_));
+    } else if (multiclass) {
+      // multi-class classification with gradient boosted trees
+      sum_declaration
+        = fmt::format("float sum[{}] = {{0.0f}};", num_output_group_);
+      accumulate = fmt::format(
+        "sum[tree_id % {}] += (float)leaf_value[leaf];\n", num_output_group_);
+      accumulate_batch = fmt::format(
+        "result[rid * {0} + tree_id % {0}] += (float)leaf_value[leaf];\n",
+        num_output_group_);
+    } else {
+      sum_declaration = "float sum = 0.0f;";
+      accumulate = "sum += (float)leaf_value[leaf];\n";
+      accumulate_batch = "result[rid] += (float)leaf_value[leaf];\n";
+    }
+    AppendToBuffer("main.c",
+      fmt::format(native::quickscorer::predict_template,
+        "num_tree"_a = num_tree_,
+        "sum_declaration"_a = sum_declaration,
+        "accumulate"_a = common::IndentMultiLineString(accumulate, 4)), 0);
+    const std::string optional_average_field
+      = main_node->average_result ? fmt::format(" / {}", num_tree_)
+                                  : std::string("");
+    const std::string global_bias
+      = common::ToStringHighPrecision(main_node->global_bias);
+    if (multiclass) {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_end_multiclass_template,
+          "num_output_group"_a = num_output_group_,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    } else {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_end_template,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    }
+
+    AppendToBuffer("main.c",
+      fmt::format(native::quickscorer::predict_batch_template,
+        "predict_batch_function_signature"_a = predict_batch_function_signature,
+        "num_tree"_a = num_tree_,
+        "num_output_group"_a = num_output_group_,
+        "num_feature"_a = num_feature_,
+        "accumulate"_a = common::IndentMultiLineString(accumulate_batch, 6)),
+      0);
+    if (multiclass) {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_batch_end_multiclass_template,
+          "num_output_group"_a = num_output_group_,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    } else {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_batch_end_template,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    }
+  }
+
+  void RenderScan() {
+    common::ArrayFormatter array_leaf_begin(80, 2), array_leaf_value(80, 2);
+    for (size_t e : leaf_begin_) {
+      array_leaf_begin << e;
+    }
+    for (tl_float e : leaf_value_) {
+      array_leaf_value << common::ToStringHighPrecision(e);
+    }
+    std::string array_lt_begin, array_lt_threshold, array_lt_tree,
+                array_lt_mask;
+    RenderTests(lt_tests_, &array_lt_begin, &array_lt_threshold,
+                &array_lt_tree, &array_lt_mask);
+    std::string array_gt_begin, array_gt_threshold, array_gt_tree,
+                array_gt_mask;
+    RenderTests(gt_tests_, &array_gt_begin, &array_gt_threshold,
+                &array_gt_tree, &array_gt_mask);
+    // missing-value tests fire on absence alone and carry no threshold
+    std::string array_missing_begin, array_missing_tree, array_missing_mask;
+    RenderTests(missing_tests_, &array_missing_begin, nullptr,
+                &array_missing_tree, &array_missing_mask);
+    AppendToBuffer("quickscorer.c",
+      fmt::format(native::quickscorer::scan_template,
+        "array_leaf_begin"_a = array_leaf_begin.str(),
+        "array_leaf_value"_a = array_leaf_value.str(),
+        "array_lt_begin"_a = array_lt_begin,
+        "array_lt_threshold"_a = array_lt_threshold,
+        "array_lt_tree"_a = array_lt_tree,
+        "array_lt_mask"_a = array_lt_mask,
+        "array_gt_begin"_a = array_gt_begin,
+        "array_gt_threshold"_a = array_gt_threshold,
+        "array_gt_tree"_a = array_gt_tree,
+        "array_gt_mask"_a = array_gt_mask,
+        "array_missing_begin"_a = array_missing_begin,
+        "array_missing_tree"_a = array_missing_tree,
+        "array_missing_mask"_a = array_missing_mask,
+        "optional_declarations"_a
+          = (has_categorical_ ? "  unsigned int tmp;" : ""),
+        "num_tree"_a = num_tree_,
+        "num_feature"_a = num_feature_,
+        "other_tests"_a = common::IndentMultiLineString(other_tests_, 2)), 0);
+  }
+
+  // lay out tests of all features one after another; tests on feature [fid]
+  // occupy [begin[fid], begin[fid + 1]); out_threshold may be null when the
+  // thresholds are not needed
+  static void RenderTests(const std::vector<std::vector<Test>>& tests,
+                          std::string* out_begin, std::string* out_threshold,
+                          std::string* out_tree, std::string* out_mask) {
+    common::ArrayFormatter array_begin(80, 2), array_threshold(80, 2),
+                           array_tree(80, 2), array_mask(80, 2);
+    size_t begin = 0;
+    array_begin << begin;
+    for (const auto& tests_for_feature : tests) {
+      for (const Test& test : tests_for_feature) {
+        if (out_threshold) {
+          array_threshold << common_util::RenderFloatLiteral(test.threshold);
+        }
+        array_tree << test.tree_id;
+        array_mask << RenderMask(test.mask);
+      }
+      begin += tests_for_feature.size();
+      array_begin << begin;
+    }
+    if (begin == 0) {  // arrays may not be empty
+      array_threshold << "0";
+      array_tree << "0";
+      array_mask << "0";
+    }
+    *out_begin = array_begin.str();
+    if (out_threshold) {
+      *out_threshold = array_threshold.str();
+    }
+    *out_tree = array_tree.str();
+    *out_mask = array_mask.str();
+  }
+};
+
+TREELITE_REGISTER_COMPILER(QuickScorerCompiler, "quickscorer")
+.describe("Compiler that produces C code evaluating member trees with "
+          "bitvectors (QuickScorer), for ensembles of small trees")
+.set_body([](const CompilerParam& param) -> Compiler* {
+    return new QuickScorerCompiler(param);
+  });
+}  // namespace compiler
+}  // namespace treelite
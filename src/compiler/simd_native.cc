@@ -0,0 +1,579 @@
+/*!
+ * Copyright (c) 2018 by Contributors
+ * \file simd_native.cc
+ * \author Philip Cho
+ * \brief C code generator that lays out member trees as arrays and evaluates
+ *        several rows at once with vector instructions
+ */
+#include <treelite/compiler.h>
+#include <treelite/common.h>
+#include <treelite/tree.h>
+#include <fmt/format.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
+#include "./param.h"
+#include "./pred_transform.h"
+#include "./native/main_template.h"
+#include "./native/simd_template.h"
+#include "./common/categorical_bitmap.h"
+#include "./common/float_threshold.h"
+
+using namespace fmt::literals;
+
+namespace treelite {
+namespace compiler {
+
+DMLC_REGISTRY_FILE_TAG(simd_native);
+
+class SIMDNativeCompiler : public Compiler {
+ public:
+  explicit SIMDNativeCompiler(const CompilerParam& param)
+    : param(param) {
+    if (param.verbose > 0) {
+      LOG(INFO) << "Using SIMDNativeCompiler";
+    }
+    if (param.quantize > 0) {
+      LOG(WARNING) << "\033[1;31mWARNING: SIMD native backend does not support "
+                   << "quantization.\u001B[0m The parameter "
+                   << "\x1B[33mquantize\u001B[0m will be ignored.";
+    }
+    if (param.annotate_in != "NULL") {
+      LOG(WARNING) << "\033[1;31mWARNING: SIMD native backend does not support "
+                   << "branch annotation.\u001B[0m The parameter "
+                   << "\x1B[33mannotate_in\u001B[0m will be ignored.";
+    }
+    if (param.code_folding_req != std::numeric_limits<double>::infinity()) {
+      LOG(WARNING) << "\033[1;31mWARNING: SIMD native backend does not support "
+                   << "code folding.\u001B[0m The parameter "
+                   << "\x1B[33mcode_folding_req\u001B[0m will be ignored.";
+    }
+  }
+
+  CompiledModel Compile(const Model& model) override {
+    CompiledModel cm;
+    cm.backend = "native";
+
+    num_feature_ = model.num_feature;
+    num_output_group_ = model.num_output_group;
+    num_tree_ = static_cast<int>(model.trees.size());
+    output_vector_flag_
+      = (model.num_output_group > 1 && model.random_forest_flag);
+    CHECK_LE(static_cast<uint64_t>(num_feature_), kFidMask + 1)
+      << "SIMDNativeCompiler supports at most " << (kFidMask + 1)
+      << " features";
+    CHECK_GT(num_tree_, 0) << "Model must have at least one member tree";
+
+    LayOutTrees(model);
+    files_.clear();
+    RenderMain(model);
+    RenderArrays();
+
+    {
+      /* write recipe.json */
+      std::vector<std::unordered_map<std::string, std::string>> source_list;
+      for (auto kv : files_) {
+        if (kv.first.compare(kv.first.length() - 2, 2, ".c") == 0) {
+          const size_t line_count
+            = std::count(kv.second.begin(), kv.second.end(), '\n');
+          source_list.push_back({ {"name",
+                                   kv.first.substr(0, kv.first.length() - 2)},
+                                  {"length", std::to_string(line_count)} });
+        }
+      }
+      std::ostringstream oss;
+      auto writer = common::make_unique<dmlc::JSONWriter>(&oss);
+      writer->BeginObject();
+      writer->WriteObjectKeyValue("target", param.native_lib_name);
+      writer->WriteObjectKeyValue("sources", source_list);
+      writer->EndObject();
+      files_["recipe.json"] = oss.str();
+    }
+    cm.files = std::move(files_);
+    return cm;
+  }
+
+ private:
+  // see node_info[] in native/simd_template.h
+  static constexpr uint32_t kFidMask = 0x03FFFFFFU;
+  static constexpr uint32_t kDefaultLeft = 1U << 26;
+  static constexpr uint32_t kLT = 1U << 27;
+  static constexpr uint32_t kEQ = 1U << 28;
+  static constexpr uint32_t kGT = 1U << 29;
+  static constexpr uint32_t kAlways = 1U << 30;
+  static constexpr uint32_t kCategorical = 1U << 31;
+
+  CompilerParam param;
+  int num_feature_;
+  int num_output_group_;
+  int num_tree_;
+  bool output_vector_flag_;  // do leaves hold vectors (random forest)?
+  std::unordered_map<std::string, std::string> files_;
+
+  // member trees, laid out as arrays; each node stores its children next to
+  // each other, so that the right child is found at (left child + 1)
+  std::vector<uint32_t> node_info_;
+  std::vector<std::string> node_threshold_;  // rendered as C literals
+  std::vector<int32_t> node_left_;
+  std::vector<int32_t> tree_root_;
+  std::vector<int32_t> tree_depth_;  // length of the longest path to a leaf
+  std::vector<bool> tree_categorical_;  // has the tree categorical tests?
+  bool has_categorical_;
+  double average_tree_depth_;
+  // categorical tests: bitmap of categories going left, for each node
+  std::vector<std::vector<uint64_t>> node_cat_bitmap_;
+  // leaf vectors (random forest), for each node
+  std::vector<tl_float> leaf_vector_;
+  std::vector<int32_t> leaf_vector_begin_;
+
+  // append content to a given buffer, with given level of indentation
+  inline void AppendToBuffer(const std::string& dest,
+                             const std::string& content,
+                             size_t indent) {
+    files_[dest] += common::IndentMultiLineString(content, indent);
+  }
+
+  void LayOutTrees(const Model& model) {
+    node_info_.clear();
+    node_threshold_.clear();
+    node_left_.clear();
+    tree_root_.clear();
+    tree_depth_.clear();
+    tree_categorical_.clear();
+    has_categorical_ = false;
+    node_cat_bitmap_.clear();
+    leaf_vector_.clear();
+    leaf_vector_begin_.clear();
+
+    double depth_sum = 0.0;
+    for (const Tree& tree : model.trees) {
+      const int root = AllocNodes(1);
+      tree_root_.push_back(root);
+      tree_categorical_.push_back(false);
+      size_t max_depth = 0, num_leaf = 0, leaf_depth_sum = 0;
+      // visit breadth-first, so that nodes near the root sit close together
+      std::queue<std::tuple<int, int, size_t>> Q;  // (node id, slot, depth)
+      Q.push(std::make_tuple(0, root, 0));
+      while (!Q.empty()) {
+        int nid, slot;
+        size_t depth;
+        std::tie(nid, slot, depth) = Q.front();
+        Q.pop();
+        const Tree::Node& node = tree[nid];
+        if (node.is_leaf()) {
+          SetLeaf(node, slot);
+          max_depth = std::max(max_depth, depth);
+          ++num_leaf;
+          leaf_depth_sum += depth;
+        } else {
+          const int left = AllocNodes(2);
+          SetTest(node, slot, left);
+          Q.push(std::make_tuple(node.cleft(), left, depth + 1));
+          Q.push(std::make_tuple(node.cright(), left + 1, depth + 1));
+        }
+      }
+      CHECK_LE(max_depth, static_cast<size_t>(std::numeric_limits<int>::max()));
+      tree_depth_.push_back(static_cast<int32_t>(max_depth));
+      depth_sum += static_cast<double>(leaf_depth_sum) / num_leaf;
+    }
+    average_tree_depth_ = depth_sum / num_tree_;
+  }
+
+  // allocate [count] consecutive nodes; returns the index of the first
+  inline int AllocNodes(int count) {
+    const size_t begin = node_info_.size();
+    CHECK_LE(begin + count,
+             static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+      << "Too many nodes for SIMDNativeCompiler";
+    node_info_.resize(begin + count, 0);
+    node_threshold_.resize(begin + count, "0");
+    node_left_.resize(begin + count, 0);
+    node_cat_bitmap_.resize(begin + count);
+    if (output_vector_flag_) {
+      leaf_vector_begin_.resize(begin + count, 0);
+    }
+    return static_cast<int>(begin);
+  }
+
+  void SetLeaf(const Tree::Node& node, int slot) {
+    // every row stays at a leaf, whether its first feature is missing or not
+    node_info_[slot] = kAlways | kDefaultLeft;
+    node_left_[slot] = slot;
+    if (output_vector_flag_) {
+      const std::vector<tl_float>& leaf_vector = node.leaf_vector();
+      CHECK_EQ(leaf_vector.size(), static_cast<size_t>(num_output_group_))
+        << "Ill-formed model: leaf vector must be of length [num_output_group]";
+      leaf_vector_begin_[slot] = static_cast<int32_t>(leaf_vector_.size());
+      leaf_vector_.insert(leaf_vector_.end(), leaf_vector.begin(),
+                          leaf_vector.end());
+    } else {
+      node_threshold_[slot] = common_util::RenderLeafOutput(node.leaf_value());
+    }
+  }
+
+  void SetTest(const Tree::Node& node, int slot, int left) {
+    uint32_t info = node.split_index();
+    if (node.default_left()) {
+      info |= kDefaultLeft;
+    }
+    if (node.split_type() == SplitFeatureType::kCategorical) {
+      // an empty bitmap sends every (non-missing) row right
+      if (!node.left_categories().empty()) {
+        node_cat_bitmap_[slot]
+          = common_util::GetCategoricalBitmap(node.left_categories());
+      }
+      info |= kCategorical;
+      tree_categorical_.back() = true;
+      has_categorical_ = true;
+    } else {
+      info |= RenderNumericalTest(node.comparison_op(), node.threshold(),
+                                  &node_threshold_[slot]);
+    }
+    node_info_[slot] = info;
+    node_left_[slot] = left;
+  }
+
+  // Choose the flags and the (float) threshold of a numerical test, so that
+  // it gives the same results as the test generated by ast_native, which
+  // compares a float against a double literal
+  static uint32_t RenderNumericalTest(Operator op, tl_float threshold,
+                                      std::string* out_threshold) {
+    if (std::isinf(threshold)) {
+      // ast_native evaluates tests against infinity at compile time
+      *out_threshold = "0";
+      return common::CompareWithOp(0.0, op, threshold) ? kAlways : 0;
+    }
+    float t_down, t_up;
+    common_util::GetFloatBounds(threshold, &t_down, &t_up);
+    uint32_t flags = 0;
+    float result = t_up;
+    switch (op) {
+     case Operator::kLT:
+      flags = kLT;
+      result = t_up;
+      break;
+     case Operator::kLE:
+      flags = kLT | kEQ;
+      result = t_down;
+      break;
+     case Operator::kGT:
+      flags = kGT;
+      result = t_down;
+      break;
+     case Operator::kGE:
+      flags = kGT | kEQ;
+      result = t_up;
+      break;
+     case Operator::kEQ:
+      flags = (t_down == t_up) ? kEQ : 0;
+      result = t_up;
+      break;
+     default:
+      LOG(FATAL) << "operator undefined";
+    }
+    *out_threshold = common_util::RenderFloatLiteral(result);
+    return flags;
+  }
+
+  void RenderMain(const Model& model) {
+    const char* get_num_output_group_function_signature
+      = "size_t get_num_output_group(void)";
+    const char* get_num_feature_function_signature
+      = "size_t get_num_feature(void)";
+    const char* get_num_tree_function_signature
+      = "size_t get_num_tree(void)";
+    const char* get_average_tree_depth_function_signature
+      = "float get_average_tree_depth(void)";
+    const bool multiclass = (num_output_group_ > 1);
+    const char* predict_function_signature
+      = multiclass ?
+          "size_t predict_multiclass(union Entry* data, int pred_margin, "
+                                    "float* result)"
+        : "float predict(union Entry* data, int pred_margin)";
+    const char* predict_batch_function_signature
+      = multiclass ?
+          "size_t predict_multiclass_batch(union Entry* rows, size_t num_row, "
+                                          "int pred_margin, float* result)"
+        : "void predict_batch(union Entry* rows, size_t num_row, "
+                             "int pred_margin, float* result)";
+
+    std::string optional_array_declarations;
+    if (multiclass && !output_vector_flag_) {
+      optional_array_declarations += "extern const int32_t tree_group[];\n";
+    }
+    if (has_categorical_) {
+      optional_array_declarations
+        += "extern const unsigned char tree_categorical[];\n"
+           "extern const uint64_t cat_bitmap[];\n"
+           "extern const size_t cat_begin[];\n";
+    }
+    if (output_vector_flag_) {
+      optional_array_declarations
+        += "extern const float leaf_vector[];\n"
+           "extern const int32_t leaf_vector_begin[];\n";
+    }
+    AppendToBuffer("header.h",
+      fmt::format(native::simd::header_template,
+        "optional_array_declarations"_a = optional_array_declarations,
+        "get_num_output_group_function_signature"_a
+          = get_num_output_group_function_signature,
+        "get_num_feature_function_signature"_a
+          = get_num_feature_function_signature,
+        "get_num_tree_function_signature"_a = get_num_tree_function_signature,
+        "get_average_tree_depth_function_signature"_a
+          = get_average_tree_depth_function_signature,
+        "predict_function_signature"_a = predict_function_signature,
+        "predict_batch_function_signature"_a
+          = predict_batch_function_signature), 0);
+
+    // how to add the output of leaf [nid] of tree [tree_id] to a sum
+    std::string sum_declaration, accumulate_scalar, accumulate_batch,
+                accumulate_avx2, accumulate_avx512;
+    if (output_vector_flag_) {
+      sum_declaration
+        = fmt::format("float sum[{}] = {{0.0f}};", num_output_group_);
+      accumulate_scalar = RenderAccumulateLeafVector("sum[k]");
+      accumulate_batch = RenderAccumulateLeafVector(
+        fmt::format("result[rid * {} + k]", num_output_group_));
+      accumulate_avx2 = RenderAccumulateLeafVectorLanes(8);
+      accumulate_avx512 = RenderAccumulateLeafVectorLanes(16);
+    } else if (multiclass) {
+      sum_declaration
+        = fmt::format("float sum[{}] = {{0.0f}};", num_output_group_);
+      accumulate_scalar
+        = "sum[tree_group[tree_id]] += node_threshold[nid];\n";
+      accumulate_batch
+        = fmt::format("result[rid * {} + tree_group[tree_id]] "
+                      "+= node_threshold[nid];\n", num_output_group_);
+      accumulate_avx2 = RenderAccumulateLanes(8, "tree_group[tree_id]");
+      accumulate_avx512 = RenderAccumulateLanes(16, "tree_group[tree_id]");
+    } else {
+      sum_declaration = "float sum = 0.0f;";
+      accumulate_scalar = "sum += node_threshold[nid];\n";
+      accumulate_batch = "result[rid] += node_threshold[nid];\n";
+      accumulate_avx2 = RenderAccumulateLanes(8, "0");
+      accumulate_avx512 = RenderAccumulateLanes(16, "0");
+    }
+
+    AppendToBuffer("main.c",
+      fmt::format(native::simd::main_start_template,
+        "get_num_output_group_function_signature"_a
+          = get_num_output_group_function_signature,
+        "get_num_feature_function_signature"_a
+          = get_num_feature_function_signature,
+        "get_num_tree_function_signature"_a = get_num_tree_function_signature,
+        "get_average_tree_depth_function_signature"_a
+          = get_average_tree_depth_function_signature,
+        "num_output_group"_a = num_output_group_,
+        "num_feature"_a = num_feature_,
+        "num_tree"_a = num_tree_,
+        "average_tree_depth"_a
+          = common::ToStringHighPrecision(average_tree_depth_),
+        "pred_transform_function"_a = PredTransformFunction("native", model),
+        "categorical_test"_a
+          = (has_categorical_ ? native::simd::categorical_test : ""),
+        "predict_function_signature"_a = predict_function_signature,
+        "sum_declaration"_a = sum_declaration,
+        "accumulate_scalar"_a
+          = common::IndentMultiLineString(accumulate_scalar, 4)), 0);
+    const std::string optional_average_field
+      = model.random_forest_flag ? fmt::format(" / {}", num_tree_)
+                                 : std::string("");
+    const std::string global_bias
+      = common::ToStringHighPrecision(model.param.global_bias);
+    if (multiclass) {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_end_multiclass_template,
+          "num_output_group"_a = num_output_group_,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    } else {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_end_template,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    }
+
+    // vector kernels, then predict_batch() calling them
+    const std::string num_step
+      = has_categorical_ ? "(tree_categorical[tree_id] ? 0 : tree_depth[tree_id])"
+                         : "tree_depth[tree_id]";
+    auto render_categorical_tree_check = [this](int num_lane, int width) {
+      if (!has_categorical_) {
+        return std::string();
+      }
+      return common::IndentMultiLineString(
+        fmt::format(native::simd::categorical_tree_check_template,
+          "num_lane"_a = num_lane,
+          "num_feature"_a = num_feature_,
+          "width"_a = width), 6);
+    };
+    if (has_categorical_) {
+      AppendToBuffer("main.c",
+        fmt::format(native::simd::find_leaf_noinline_template), 0);
+    }
+    AppendToBuffer("main.c",
+      fmt::format(native::simd::kernel_template,
+        "num_feature"_a = num_feature_,
+        "num_output_group"_a = num_output_group_,
+        "num_tree"_a = num_tree_,
+        "num_step"_a = num_step,
+        "categorical_tree_check_avx2"_a = render_categorical_tree_check(8, 256),
+        "categorical_tree_check_avx512"_a
+          = render_categorical_tree_check(16, 512),
+        "accumulate_avx2"_a = common::IndentMultiLineString(accumulate_avx2, 6),
+        "accumulate_avx512"_a
+          = common::IndentMultiLineString(accumulate_avx512, 6)), 0);
+    AppendToBuffer("main.c",
+      fmt::format(native::simd::main_batch_start_template,
+        "predict_batch_function_signature"_a = predict_batch_function_signature,
+        "num_output_group"_a = num_output_group_,
+        "num_feature"_a = num_feature_,
+        "num_tree"_a = num_tree_,
+        "accumulate_batch"_a
+          = common::IndentMultiLineString(accumulate_batch, 6)), 0);
+    if (multiclass) {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_batch_end_multiclass_template,
+          "num_output_group"_a = num_output_group_,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    } else {
+      AppendToBuffer("main.c",
+        fmt::format(native::main_batch_end_template,
+          "optional_average_field"_a = optional_average_field,
+          "global_bias"_a = global_bias), 0);
+    }
+  }
+
+  // add leaf outputs gathered from node_threshold[] to the sums of a group
+  // of rows, kept in sum[] one output group after another
+  static std::string RenderAccumulateLanes(int num_lane,
+                                           const std::string& group) {
+    const int width = num_lane * 32;
+    return fmt::format(
+      "{{\n"
+      "  float* dest = &sum[{group} * {num_lane}];\n"
+      "  _mm{width}_storeu_ps(dest, _mm{width}_add_ps(_mm{width}_loadu_ps(dest),\n"
+      "    _mm{width}_i32gather_ps({gather_args})));\n"
+      "}}\n",
+      "group"_a = group,
+      "num_lane"_a = num_lane,
+      "width"_a = width,
+      "gather_args"_a = (num_lane == 8) ? "node_threshold, nid, 4"
+                                        : "nid, node_threshold, 4");
+  }
+
+  inline std::string RenderAccumulateLeafVectorLanes(int num_lane) {
+    return fmt::format(
+      "for (lane = 0; lane < {num_lane}; ++lane) {{\n"
+      "  for (k = 0; k < {num_output_group}; ++k) {{\n"
+      "    sum[k * {num_lane} + lane]\n"
+      "      += leaf_vector[leaf_vector_begin[leaf[lane]] + k];\n"
+      "  }}\n"
+      "}}\n",
+      "num_lane"_a = num_lane,
+      "num_output_group"_a = num_output_group_);
+  }
+
+  inline std::string RenderAccumulateLeafVector(const std::string& sum) {
+    return fmt::format(
+      "for (int k = 0; k < {num_output_group}; ++k) {{\n"
+      "  {sum} += leaf_vector[leaf_vector_begin[nid] + k];\n"
+      "}}\n",
+      "num_output_group"_a = num_output_group_,
+      "sum"_a = sum);
+  }
+
+  void RenderArrays() {
+    common::ArrayFormatter array_node_info(80, 2), array_node_threshold(80, 2),
+                           array_node_left(80, 2), array_tree_root(80, 2),
+                           array_tree_depth(80, 2);
+    for (size_t i = 0; i < node_info_.size(); ++i) {
+      array_node_info << fmt::format("0x{:08X}U", node_info_[i]);
+      array_node_threshold << node_threshold_[i];
+      array_node_left << node_left_[i];
+    }
+    for (int tree_id = 0; tree_id < num_tree_; ++tree_id) {
+      array_tree_root << tree_root_[tree_id];
+      array_tree_depth << tree_depth_[tree_id];
+    }
+    std::string optional_arrays;
+    if (num_output_group_ > 1 && !output_vector_flag_) {
+      // multi-class classification with gradient boosted trees
+      common::ArrayFormatter array_tree_group(80, 2);
+      for (int tree_id = 0; tree_id < num_tree_; ++tree_id) {
+        array_tree_group << (tree_id % num_output_group_);
+      }
+      optional_arrays += RenderArray("const int32_t tree_group[]",
+                                     array_tree_group.str());
+    }
+    if (has_categorical_) {
+      common::ArrayFormatter array_tree_categorical(80, 2),
+                             array_cat_bitmap(80, 2), array_cat_begin(80, 2);
+      for (int tree_id = 0; tree_id < num_tree_; ++tree_id) {
+        array_tree_categorical << (tree_categorical_[tree_id] ? 1 : 0);
+      }
+      // bitmaps of all nodes, one after another; the bitmap of node [nid]
+      // occupies cat_bitmap[cat_begin[nid]:cat_begin[nid + 1]]
+      size_t cat_begin = 0;
+      array_cat_begin << cat_begin;
+      for (const std::vector<uint64_t>& bitmap : node_cat_bitmap_) {
+        for (uint64_t e : bitmap) {
+          array_cat_bitmap << fmt::format("{}U", e);
+        }
+        cat_begin += bitmap.size();
+        array_cat_begin << cat_begin;
+      }
+      if (cat_begin == 0) {
+        array_cat_bitmap << "0";  // arrays may not be empty
+      }
+      optional_arrays
+        += RenderArray("const unsigned char tree_categorical[]",
+                       array_tree_categorical.str())
+         + RenderArray("const uint64_t cat_bitmap[]", array_cat_bitmap.str())
+         + RenderArray("const size_t cat_begin[]", array_cat_begin.str());
+    }
+    if (output_vector_flag_) {
+      common::ArrayFormatter array_leaf_vector(80, 2),
+                             array_leaf_vector_begin(80, 2);
+      for (tl_float e : leaf_vector_) {
+        array_leaf_vector << common_util::RenderLeafOutput(e);
+      }
+      for (int32_t e : leaf_vector_begin_) {
+        array_leaf_vector_begin << e;
+      }
+      optional_arrays
+        += RenderArray("const float leaf_vector[]", array_leaf_vector.str())
+         + RenderArray("const int32_t leaf_vector_begin[]",
+                       array_leaf_vector_begin.str());
+    }
+    AppendToBuffer("arrays.c",
+      fmt::format(native::simd::arrays_template,
+        "array_node_info"_a = array_node_info.str(),
+        "array_node_threshold"_a = array_node_threshold.str(),
+        "array_node_left"_a = array_node_left.str(),
+        "array_tree_root"_a = array_tree_root.str(),
+        "array_tree_depth"_a = array_tree_depth.str(),
+        "optional_arrays"_a = optional_arrays), 0);
+  }
+
+  static std::string RenderArray(const std::string& declaration,
+                                 const std::string& elements) {
+    return fmt::format("\n{declaration} = {{\n{elements}\n}};\n",
+                       "declaration"_a = declaration,
+                       "elements"_a = elements);
+  }
+};
+
+TREELITE_REGISTER_COMPILER(SIMDNativeCompiler, "simd_native")
+.describe("Compiler that produces C code evaluating several rows at once "
+          "with vector instructions")
+.set_body([](const CompilerParam& param) -> Compiler* {
+    return new SIMDNativeCompiler(param);
+  });
+}  // namespace compiler
+}  // namespace treelite
@@ -0,0 +1,62 @@
+# -*- coding: utf-8 -*-
+"""Performance test for compile time, library size and throughput of the
+flat_native compiler as the number of trees grows"""
+from __future__ import print_function
+import numpy as np
+import xgboost
+import treelite
+import treelite.runtime
+import importlib.util
+import os
+import time
+
+def test_flat_native_scaling():
+  spec = importlib.util.spec_from_file_location(
+    'util',
+    os.path.join(os.path.dirname(__file__), os.pardir, 'python', 'util.py'))
+  util = importlib.util.module_from_spec(spec)
+  spec.loader.exec_module(util)
+
+  rng = np.random.RandomState(0)
+  num_row, num_col = 50000, 50
+  X = rng.rand(num_row, num_col)
+  X[rng.rand(num_row, num_col) < 0.05] = np.nan
+  y = rng.randint(2, size=num_row)
+  dtrain = xgboost.DMatrix(X, label=y)
+  param = {'max_depth': 8, 'eta': 0.1, 'silent': 1,
+           'objective': 'binary:logistic'}
+  toolchain = util.os_compatible_toolchains()[0]
+  batch = treelite.runtime.Batch.from_npy2d(X)
+  for num_tree in [100, 400, 1600]:
+    bst = xgboost.train(param, dtrain, num_tree)
+    model = treelite.Model.from_xgboost(bst)
+    # ast_native is only run on the smaller models, as it takes long to
+    # compile the larger ones; all should give the same predictions
+    configs = [('flat_native ({})'.format(layout), 'flat_native',
+                {'node_layout': layout}) for layout in ['bfs', 'dfs', 'veb']]
+    if num_tree <= 400:
+      configs = [('ast_native', 'ast_native', {})] + configs
+    reference = None
+    for name, compiler, params in configs:
+      libpath = util.libname('./scaling{}')
+      tstart = time.time()
+      model.export_lib(toolchain=toolchain, libpath=libpath, params=params,
+                       compiler=compiler)
+      compile_time = time.time() - tstart
+      predictor = treelite.runtime.Predictor(libpath=libpath)
+      predictor.predict(batch)  # warm up
+      record = []
+      for _ in range(5):
+        tstart = time.time()
+        out_prob = predictor.predict(batch)
+        tend = time.time()
+        record.append(tend - tstart)
+      if reference is None:
+        reference = out_prob
+      assert np.array_equal(out_prob, reference)
+      print('{} trees, {}: compiled in {:.1f} sec, {} bytes, {:.0f} rows/sec'
+            .format(num_tree, name, compile_time, os.path.getsize(libpath),
+                    num_row / np.median(record)))
+
+if __name__ == '__main__':
+  test_flat_native_scaling()
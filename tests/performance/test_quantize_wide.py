@@ -0,0 +1,53 @@
+# -*- coding: utf-8 -*-
+"""Performance test for prediction with quantized thresholds, on a model
+with many features, only a few of which are used in splits"""
+from __future__ import print_function
+import numpy as np
+import xgboost
+import treelite
+import treelite.runtime
+import importlib.util
+import os
+import time
+
+def test_quantize_wide():
+  spec = importlib.util.spec_from_file_location(
+    'util',
+    os.path.join(os.path.dirname(__file__), os.pardir, 'python', 'util.py'))
+  util = importlib.util.module_from_spec(spec)
+  spec.loader.exec_module(util)
+
+  rng = np.random.RandomState(0)
+  num_row, num_col = 5000, 3000
+  X = rng.rand(num_row, num_col)
+  # only the first 30 features carry any signal
+  y = (X[:, :30].sum(axis=1) + rng.rand(num_row) > 15.5).astype(int)
+  dtrain = xgboost.DMatrix(X, label=y)
+  param = {'max_depth': 6, 'eta': 0.1, 'silent': 1,
+           'objective': 'binary:logistic'}
+  bst = xgboost.train(param, dtrain, 200)
+  model = treelite.Model.from_xgboost(bst)
+  toolchain = util.os_compatible_toolchains()[0]
+  batch = treelite.runtime.Batch.from_npy2d(X)
+  reference = None
+  for name, params in [('no quantization', {}),
+                       ('quantization', {'quantize': 1}),
+                       ('quantization, batch', {'quantize': 1,
+                                                'batch_function': 1})]:
+    libpath = util.libname('./quantize_wide{}')
+    model.export_lib(toolchain=toolchain, libpath=libpath, params=params)
+    predictor = treelite.runtime.Predictor(libpath=libpath)
+    record = []
+    predictor.predict(batch)  # warm up
+    for _ in range(5):
+      tstart = time.time()
+      out_prob = predictor.predict(batch)
+      tend = time.time()
+      record.append(tend - tstart)
+    if reference is None:
+      reference = out_prob
+    assert np.array_equal(out_prob, reference)
+    print('{}: {:.0f} rows/sec'.format(name, num_row / np.median(record)))
+
+if __name__ == '__main__':
+  test_quantize_wide()
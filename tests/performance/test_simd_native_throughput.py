@@ -0,0 +1,56 @@
+# -*- coding: utf-8 -*-
+"""Performance test for throughput of the simd_native compiler on wide batches"""
+from __future__ import print_function
+import numpy as np
+import xgboost
+import treelite
+import treelite.runtime
+import importlib.util
+import os
+import time
+
+def test_simd_native_throughput():
+  spec = importlib.util.spec_from_file_location(
+    'util',
+    os.path.join(os.path.dirname(__file__), os.pardir, 'python', 'util.py'))
+  util = importlib.util.module_from_spec(spec)
+  spec.loader.exec_module(util)
+
+  rng = np.random.RandomState(0)
+  num_row, num_col = 200000, 50
+  X = rng.rand(num_row, num_col)
+  X[rng.rand(num_row, num_col) < 0.05] = np.nan
+  y = rng.randint(2, size=num_row)
+  dtrain = xgboost.DMatrix(X, label=y)
+  param = {'max_depth': 8, 'eta': 0.1, 'silent': 1,
+           'objective': 'binary:logistic'}
+  bst = xgboost.train(param, dtrain, 200)
+
+  model = treelite.Model.from_xgboost(bst)
+  toolchain = util.os_compatible_toolchains()[0]
+  batch = treelite.runtime.Batch.from_npy2d(X)
+  # Compare against ast_native, both with and without the batch function;
+  # all should give the same predictions
+  reference = None
+  for name, compiler, params in \
+      [('ast_native', 'ast_native', {}),
+       ('ast_native (batch_function)', 'ast_native', {'batch_function': 1}),
+       ('simd_native', 'simd_native', {})]:
+    libpath = util.libname('./throughput{}')
+    model.export_lib(toolchain=toolchain, libpath=libpath, params=params,
+                     compiler=compiler)
+    predictor = treelite.runtime.Predictor(libpath=libpath)
+    predictor.predict(batch)  # warm up
+    record = []
+    for _ in range(5):
+      tstart = time.time()
+      out_prob = predictor.predict(batch)
+      tend = time.time()
+      record.append(tend - tstart)
+    if reference is None:
+      reference = out_prob
+    assert np.array_equal(out_prob, reference)
+    print('{}: {:.0f} rows/sec'.format(name, num_row / np.median(record)))
+
+if __name__ == '__main__':
+  test_simd_native_throughput()
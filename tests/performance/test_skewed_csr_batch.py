@@ -0,0 +1,62 @@
+# -*- coding: utf-8 -*-
+"""Performance test for batch prediction with skewed CSR data, comparing
+   static and work-stealing row scheduling"""
+from __future__ import print_function
+import numpy as np
+import scipy.sparse
+import xgboost
+import treelite
+import treelite.runtime
+import importlib.util
+import os
+import time
+
+def test_skewed_csr_batch():
+  spec = importlib.util.spec_from_file_location(
+    'util',
+    os.path.join(os.path.dirname(__file__), os.pardir, 'python', 'util.py'))
+  util = importlib.util.module_from_spec(spec)
+  spec.loader.exec_module(util)
+
+  # Rows in the first quarter are fully dense; the remaining rows have only a
+  # couple of non-zeros. A static split hands all the dense rows to the first
+  # thread.
+  rng = np.random.RandomState(0)
+  num_row, num_col = 100000, 200
+  num_dense_row = num_row // 4
+  dense_part = scipy.sparse.csr_matrix(rng.rand(num_dense_row, num_col))
+  sparse_part = scipy.sparse.random(num_row - num_dense_row, num_col,
+                                    density=0.01, format='csr',
+                                    random_state=rng)
+  X = scipy.sparse.vstack([dense_part, sparse_part], format='csr')
+  y = rng.randint(2, size=num_row)
+  dtrain = xgboost.DMatrix(X, label=y)
+  param = {'max_depth': 8, 'eta': 0.1, 'silent': 1,
+           'objective': 'binary:logistic'}
+  bst = xgboost.train(param, dtrain, 100)
+
+  model = treelite.Model.from_xgboost(bst)
+  libpath = util.libname('./skewed{}')
+  toolchain = util.os_compatible_toolchains()[0]
+  model.export_lib(toolchain=toolchain, libpath=libpath, params={})
+  batch = treelite.runtime.Batch.from_csr(X)
+
+  expected = None
+  for policy in ['static', 'work_stealing']:
+    predictor = treelite.runtime.Predictor(libpath=libpath,
+                                           scheduling_policy=policy)
+    record = []
+    for _ in range(20):
+      tstart = time.time()
+      out_prob = predictor.predict(batch)
+      tend = time.time()
+      record.append(tend - tstart)
+    if expected is None:
+      expected = out_prob
+    else:
+      assert np.allclose(out_prob, expected, atol=1e-11, rtol=1e-6)
+    print('{}: Processed {} rows in {} seconds on average (std = {})'\
+      .format(policy, num_row, np.mean(record), np.std(record)))
+
+if __name__ == '__main__':
+  test_skewed_csr_batch()
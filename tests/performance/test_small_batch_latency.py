@@ -0,0 +1,52 @@
+# -*- coding: utf-8 -*-
+"""Performance test for prediction latency on small and large batches"""
+from __future__ import print_function
+import numpy as np
+import xgboost
+import treelite
+import treelite.runtime
+import importlib.util
+import os
+import time
+
+def test_small_batch_latency():
+  spec = importlib.util.spec_from_file_location(
+    'util',
+    os.path.join(os.path.dirname(__file__), os.pardir, 'python', 'util.py'))
+  util = importlib.util.module_from_spec(spec)
+  spec.loader.exec_module(util)
+
+  rng = np.random.RandomState(0)
+  num_row, num_col = 100000, 50
+  X = rng.rand(num_row, num_col)
+  y = rng.randint(2, size=num_row)
+  dtrain = xgboost.DMatrix(X, label=y)
+  param = {'max_depth': 6, 'eta': 0.1, 'silent': 1,
+           'objective': 'binary:logistic'}
+  bst = xgboost.train(param, dtrain, 100)
+
+  model = treelite.Model.from_xgboost(bst)
+  libpath = util.libname('./latency{}')
+  toolchain = util.os_compatible_toolchains()[0]
+  model.export_lib(toolchain=toolchain, libpath=libpath, params={})
+  predictor = treelite.runtime.Predictor(libpath=libpath)
+
+  # Small batches should run on the calling thread, without a trip through
+  # the worker queues; large batches should still use all threads.
+  for batch_size, num_rep in [(1, 2000), (3, 2000), (16, 2000), (256, 500),
+                              (num_row, 20)]:
+    batch = treelite.runtime.Batch.from_npy2d(X, rbegin=0, rend=batch_size)
+    expected = bst.predict(xgboost.DMatrix(X[0:batch_size, :]))
+    record = []
+    for _ in range(num_rep):
+      tstart = time.time()
+      out_prob = predictor.predict(batch)
+      tend = time.time()
+      record.append(tend - tstart)
+    assert np.allclose(out_prob, expected, atol=1e-6, rtol=1e-5)
+    print('batch size {}: p50 = {} ms, p99 = {} ms'\
+      .format(batch_size, np.percentile(record, 50) * 1000,
+              np.percentile(record, 99) * 1000))
+
+if __name__ == '__main__':
+  test_small_batch_latency()
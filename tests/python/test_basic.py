@@ -3,13 +3,17 @@
 from __future__ import print_function
 import unittest
 import os
+import ctypes
 import subprocess
+import sys
+import threading
 from zipfile import ZipFile
 import numpy as np
+import scipy.sparse
 import treelite
 import treelite.runtime
 from util import load_txt, os_compatible_toolchains, os_platform, libname, \
-                 run_pipeline_test, make_annotation
+                 run_pipeline_test, make_annotation, setup_test_lib, to_dense
 
 dpath = os.path.abspath(os.path.join(os.getcwd(), 'tests/examples/'))
 
@@ -45,6 +49,707 @@ class TestBasic(unittest.TestCase):
                             multiclass=multiclass, use_annotation=use_annotation,
                             use_quantize=use_quantize)
 
+  def test_batch_function(self):
+    """
+    Test generating a batch prediction function, with and without
+    quantization and code folding
+    """
+    for model_path, dtest_path, libname_fmt, \
+        expected_prob_path, expected_margin_path, multiclass in \
+        [('mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+          'mushroom/agaricus.test.prob',
+          'mushroom/agaricus.test.margin', False),
+         ('dermatology/dermatology.model', 'dermatology/dermatology.test',
+          './dermatology{}', 'dermatology/dermatology.test.prob',
+          'dermatology/dermatology.test.margin', True)]:
+      model_path = os.path.join(dpath, model_path)
+      model = treelite.Model.load(model_path, model_format='xgboost')
+      for use_quantize in [True, False]:
+        for code_folding_req in [None, 1.0]:
+          run_pipeline_test(model=model, dtest_path=dtest_path,
+                            libname_fmt=libname_fmt,
+                            expected_prob_path=expected_prob_path,
+                            expected_margin_path=expected_margin_path,
+                            multiclass=multiclass, use_annotation=None,
+                            use_quantize=use_quantize,
+                            use_batch_function=True,
+                            code_folding_req=code_folding_req)
+
+  def test_simd_native(self):
+    """
+    Test the compiler that evaluates several rows at once with vector
+    instructions; it should give the same predictions as ast_native
+    """
+    for model_path, dtest_path, libname_fmt, \
+        expected_prob_path, expected_margin_path, multiclass in \
+        [('mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+          'mushroom/agaricus.test.prob',
+          'mushroom/agaricus.test.margin', False),
+         ('dermatology/dermatology.model', 'dermatology/dermatology.test',
+          './dermatology{}', 'dermatology/dermatology.test.prob',
+          'dermatology/dermatology.test.margin', True),
+         ('letor/mq2008.model', 'letor/mq2008.test', './mq2008{}',
+          None, 'letor/mq2008.test.pred', False)]:
+      model_path = os.path.join(dpath, model_path)
+      model = treelite.Model.load(model_path, model_format='xgboost')
+      run_pipeline_test(model=model, dtest_path=dtest_path,
+                        libname_fmt=libname_fmt,
+                        expected_prob_path=expected_prob_path,
+                        expected_margin_path=expected_margin_path,
+                        multiclass=multiclass, use_annotation=None,
+                        use_quantize=False, compiler='simd_native')
+
+  def test_quickscorer(self):
+    """
+    Test the compiler that evaluates member trees with bitvectors
+    (QuickScorer); it should give the same predictions as ast_native
+    """
+    for model_path, dtest_path, libname_fmt, \
+        expected_prob_path, expected_margin_path, multiclass in \
+        [('mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+          'mushroom/agaricus.test.prob',
+          'mushroom/agaricus.test.margin', False),
+         ('dermatology/dermatology.model', 'dermatology/dermatology.test',
+          './dermatology{}', 'dermatology/dermatology.test.prob',
+          'dermatology/dermatology.test.margin', True),
+         ('letor/mq2008.model', 'letor/mq2008.test', './mq2008{}',
+          None, 'letor/mq2008.test.pred', False)]:
+      model_path = os.path.join(dpath, model_path)
+      model = treelite.Model.load(model_path, model_format='xgboost')
+      run_pipeline_test(model=model, dtest_path=dtest_path,
+                        libname_fmt=libname_fmt,
+                        expected_prob_path=expected_prob_path,
+                        expected_margin_path=expected_margin_path,
+                        multiclass=multiclass, use_annotation=None,
+                        use_quantize=False, compiler='quickscorer')
+
+  def test_flat_native(self):
+    """
+    Test the compiler that stores member trees in one table of nodes, with
+    every node layout; it should give the same predictions as ast_native
+    """
+    for model_path, dtrain_path, dtest_path, libname_fmt, \
+        expected_prob_path, expected_margin_path, multiclass in \
+        [('mushroom/mushroom.model', 'mushroom/agaricus.train',
+          'mushroom/agaricus.test', './agaricus{}',
+          'mushroom/agaricus.test.prob',
+          'mushroom/agaricus.test.margin', False),
+         ('dermatology/dermatology.model', 'dermatology/dermatology.train',
+          'dermatology/dermatology.test', './dermatology{}',
+          'dermatology/dermatology.test.prob',
+          'dermatology/dermatology.test.margin', True),
+         ('letor/mq2008.model', 'letor/mq2008.train', 'letor/mq2008.test',
+          './mq2008{}', None, 'letor/mq2008.test.pred', False)]:
+      model_path = os.path.join(dpath, model_path)
+      model = treelite.Model.load(model_path, model_format='xgboost')
+      make_annotation(model=model, dtrain_path=dtrain_path,
+                      annotation_path='./annotation.json')
+      for node_layout, use_annotation in \
+          [('bfs', None), ('dfs', None), ('veb', None),
+           ('hot_first', './annotation.json')]:
+        run_pipeline_test(model=model, dtest_path=dtest_path,
+                          libname_fmt=libname_fmt,
+                          expected_prob_path=expected_prob_path,
+                          expected_margin_path=expected_margin_path,
+                          multiclass=multiclass, use_annotation=use_annotation,
+                          use_quantize=False, compiler='flat_native',
+                          node_layout=node_layout)
+
+  def test_branchless_tree(self):
+    """
+    Test evaluating complete trees without branches, with and without
+    padding trees that are nearly complete
+    """
+    for model_path, dtest_path, libname_fmt, \
+        expected_prob_path, expected_margin_path, multiclass in \
+        [('mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+          'mushroom/agaricus.test.prob',
+          'mushroom/agaricus.test.margin', False),
+         ('dermatology/dermatology.model', 'dermatology/dermatology.test',
+          './dermatology{}', 'dermatology/dermatology.test.prob',
+          'dermatology/dermatology.test.margin', True),
+         ('letor/mq2008.model', 'letor/mq2008.test',
+          './mq2008{}', None, 'letor/mq2008.test.pred', False)]:
+      model_path = os.path.join(dpath, model_path)
+      model = treelite.Model.load(model_path, model_format='xgboost')
+      for padding, use_quantize, use_batch_function in \
+          [(0, False, False), (0.5, False, True), (1, True, False)]:
+        run_pipeline_test(model=model, dtest_path=dtest_path,
+                          libname_fmt=libname_fmt,
+                          expected_prob_path=expected_prob_path,
+                          expected_margin_path=expected_margin_path,
+                          multiclass=multiclass, use_annotation=None,
+                          use_quantize=use_quantize,
+                          use_batch_function=use_batch_function,
+                          branchless_padding=padding)
+
+  def test_parallel_comp(self):
+    """
+    Test dividing member trees into several translation units; each unit
+    should add its outputs to the sum, including for multiclass models
+    """
+    for model_path, dtest_path, libname_fmt, \
+        expected_prob_path, expected_margin_path, multiclass in \
+        [('mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+          'mushroom/agaricus.test.prob',
+          'mushroom/agaricus.test.margin', False),
+         ('dermatology/dermatology.model', 'dermatology/dermatology.test',
+          './dermatology{}', 'dermatology/dermatology.test.prob',
+          'dermatology/dermatology.test.margin', True)]:
+      model_path = os.path.join(dpath, model_path)
+      model = treelite.Model.load(model_path, model_format='xgboost')
+      run_pipeline_test(model=model, dtest_path=dtest_path,
+                        libname_fmt=libname_fmt,
+                        expected_prob_path=expected_prob_path,
+                        expected_margin_path=expected_margin_path,
+                        multiclass=multiclass, use_annotation=None,
+                        use_quantize=False, parallel_comp=3)
+
+  def test_dense_row_function(self):
+    """
+    Test generating a prediction function for dense rows, with and without
+    quantization
+    """
+    for model_path, dtest_path, libname_fmt, expected_margin_path in \
+        [('mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+          'mushroom/agaricus.test.margin'),
+         ('dermatology/dermatology.model', 'dermatology/dermatology.test',
+          './dermatology{}', 'dermatology/dermatology.test.margin')]:
+      for use_quantize in [True, False]:
+        params = {'dense_row_function': 1}
+        if use_quantize:
+          params['quantize'] = 1
+        libpath, dtest, expected_margin = setup_test_lib(
+          model_path, dtest_path, libname_fmt, expected_margin_path, params)
+        predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True)
+        # expand the test matrix into a dense matrix, with NaN marking
+        # missing values
+        mat = to_dense(dtest, predictor.num_feature)
+        batch = treelite.runtime.Batch.from_npy2d(mat)
+        out_margin = predictor.predict(batch, pred_margin=True)
+        assert np.allclose(out_margin, expected_margin, atol=1e-11, rtol=1e-6)
+        # the same matrix, laid out column by column, and as a view into a
+        # wider matrix, is read in place
+        padded = np.full((mat.shape[0], mat.shape[1] + 3), 1.0,
+                         dtype=np.float32)
+        padded[:, :mat.shape[1]] = mat
+        for view in [np.asfortranarray(mat), padded[:, :mat.shape[1]]]:
+          batch = treelite.runtime.Batch.from_npy2d(view)
+          assert np.shares_memory(batch.data, view)
+          out_margin = predictor.predict(batch, pred_margin=True)
+          assert np.allclose(out_margin, expected_margin, atol=1e-11,
+                             rtol=1e-6)
+        # NaN is rejected unless it marks missing values, as with the other
+        # prediction functions, whether the rows are predicted on the calling
+        # thread or on the workers
+        batch = treelite.runtime.Batch.from_npy2d(mat, missing=0.0)
+        self.assertRaises(Exception, predictor.predict, batch)
+        predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                               nthread=2,
+                                               include_master_thread=False,
+                                               min_work_per_thread=0)
+        self.assertRaises(Exception, predictor.predict, batch)
+        # the workers carry on after the error
+        batch = treelite.runtime.Batch.from_npy2d(mat)
+        out_margin = predictor.predict(batch, pred_margin=True)
+        assert np.allclose(out_margin, expected_margin, atol=1e-11, rtol=1e-6)
+
+  def test_missing_bitmask(self):
+    """
+    Test generating a prediction function taking a bitmask of missing values,
+    with and without quantization
+    """
+    for model_path, dtest_path, libname_fmt, expected_margin_path in \
+        [('mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+          'mushroom/agaricus.test.margin'),
+         ('dermatology/dermatology.model', 'dermatology/dermatology.test',
+          './dermatology{}', 'dermatology/dermatology.test.margin')]:
+      # rows with no missing value, to compare against predict()
+      libpath, dtest, _ = setup_test_lib(model_path, dtest_path,
+                                         libname_fmt)
+      predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True)
+      full_mat = to_dense(dtest, predictor.num_feature, missing=0)
+      batch = treelite.runtime.Batch.from_npy2d(full_mat)
+      full_margin = predictor.predict(batch, pred_margin=True)
+      del predictor
+      for use_quantize in [True, False]:
+        params = {'missing_bitmask': 1}
+        if use_quantize:
+          params['quantize'] = 1
+        libpath, dtest, expected_margin = setup_test_lib(
+          model_path, dtest_path, libname_fmt, expected_margin_path, params)
+        predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True)
+        batch = treelite.runtime.Batch.from_csr(dtest)
+        out_margin = predictor.predict(batch, pred_margin=True)
+        assert np.allclose(out_margin, expected_margin, atol=1e-11, rtol=1e-6)
+        mat = to_dense(dtest, predictor.num_feature)
+        batch = treelite.runtime.Batch.from_npy2d(mat)
+        out_margin = predictor.predict(batch, pred_margin=True)
+        assert np.allclose(out_margin, expected_margin, atol=1e-11, rtol=1e-6)
+        batch = treelite.runtime.Batch.from_npy2d(full_mat)
+        out_margin = predictor.predict(batch, pred_margin=True)
+        assert np.allclose(out_margin, full_margin, atol=1e-11, rtol=1e-6)
+
+  def test_concurrent_predict(self):
+    """Test calling predict() from multiple threads at the same time"""
+    libpath, dtest, expected_margin = setup_test_lib(
+      'dermatology/dermatology.model', 'dermatology/dermatology.test',
+      './dermatology{}', 'dermatology/dermatology.test.margin')
+    # spread every batch over the workers, however small
+    predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                           min_work_per_thread=0)
+    batch = treelite.runtime.Batch.from_csr(dtest)
+
+    errors = []
+    def worker():
+      try:
+        for _ in range(20):
+          out_margin = predictor.predict(batch, pred_margin=True)
+          assert np.allclose(out_margin, expected_margin,
+                             atol=1e-11, rtol=1e-6)
+      except Exception as e:  # pylint: disable=W0703
+        errors.append(e)
+    threads = [threading.Thread(target=worker) for _ in range(8)]
+    for t in threads:
+      t.start()
+    for t in threads:
+      t.join()
+    assert not errors, errors
+
+  def test_predict_batch_async(self):
+    """
+    Test the asynchronous prediction API of the runtime library, with and
+    without a callback
+    """
+    from treelite_runtime.predictor import _LIB, _check_call
+    libpath, dtest, expected_margin = setup_test_lib(
+      'dermatology/dermatology.model', 'dermatology/dermatology.test',
+      './dermatology{}', 'dermatology/dermatology.test.margin')
+    predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True)
+    # dense copy of the test matrix, with NaN marking missing values
+    mat = to_dense(dtest, predictor.num_feature)
+    callback_type = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_size_t)
+    for batch in [treelite.runtime.Batch.from_csr(dtest),
+                  treelite.runtime.Batch.from_npy2d(mat)]:
+      batch_sparse = ctypes.c_int(1 if batch.kind == 'sparse' else 0)
+      for use_callback in [False, True]:
+        callback_sizes = []
+        callback = callback_type(
+          lambda _, result_size: callback_sizes.append(result_size))
+        result_size = ctypes.c_size_t()
+        _check_call(_LIB.TreelitePredictorQueryResultSize(
+          predictor.handle, batch.handle, batch_sparse,
+          ctypes.byref(result_size)))
+        out_result = np.zeros(result_size.value, dtype=np.float32, order='C')
+        prediction = ctypes.c_void_p()
+        _check_call(_LIB.TreelitePredictorPredictBatchAsync(
+          predictor.handle, batch.handle, batch_sparse, ctypes.c_int(0),
+          ctypes.c_int(1),
+          out_result.ctypes.data_as(ctypes.POINTER(ctypes.c_float)),
+          callback if use_callback else callback_type(),
+          ctypes.c_void_p(None), ctypes.byref(prediction)))
+        done = ctypes.c_int(0)
+        while not done.value:
+          _check_call(_LIB.TreelitePredictorPoll(
+            predictor.handle, prediction, ctypes.byref(done)))
+        out_result_size = ctypes.c_size_t()
+        _check_call(_LIB.TreelitePredictorWait(
+          predictor.handle, prediction, ctypes.byref(out_result_size)))
+        assert out_result_size.value <= result_size.value
+        out_margin = out_result[0:out_result_size.value] \
+                       .reshape((dtest.shape[0], -1))
+        assert np.allclose(out_margin, expected_margin, atol=1e-11, rtol=1e-6)
+        if use_callback:
+          assert callback_sizes == [out_result_size.value]
+        else:
+          assert not callback_sizes
+
+  def test_scheduling_policy(self):
+    """Test static and work-stealing row scheduling"""
+    libpath, dtest, expected_prob = setup_test_lib(
+      'mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+      'mushroom/agaricus.test.prob')
+    batch = treelite.runtime.Batch.from_csr(dtest)
+    for policy, grain_size in [('static', None), ('work_stealing', None),
+                               ('work_stealing', 1), ('work_stealing', 100)]:
+      predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                             scheduling_policy=policy,
+                                             grain_size=grain_size,
+                                             min_work_per_thread=0)
+      out_prob = predictor.predict(batch)
+      assert np.allclose(out_prob, expected_prob, atol=1e-11, rtol=1e-6)
+
+    # Make the first quarter of the rows expensive by repeating their entries.
+    # The thread given those rows falls behind, and the calling thread, which
+    # holds the last share, steals them once it is done with its own rows.
+    num_heavy = dtest.shape[0] // 4
+    data, indices, indptr = [], [], [0]
+    for i in range(dtest.shape[0]):
+      ibegin, iend = dtest.indptr[i], dtest.indptr[i + 1]
+      repeat = 200 if i < num_heavy else 1
+      data.append(np.tile(dtest.data[ibegin:iend], repeat))
+      indices.append(np.tile(dtest.indices[ibegin:iend], repeat))
+      indptr.append(indptr[-1] + (iend - ibegin) * repeat)
+    skewed = scipy.sparse.csr_matrix(
+      (np.concatenate(data), np.concatenate(indices), np.array(indptr)),
+      shape=dtest.shape)
+    batch = treelite.runtime.Batch.from_csr(skewed)
+    out_prob = {}
+    for policy in ['static', 'work_stealing']:
+      predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                             nthread=3,
+                                             include_master_thread=True,
+                                             scheduling_policy=policy,
+                                             grain_size=1,
+                                             min_work_per_thread=0)
+      out_prob[policy] = predictor.predict(batch)
+      assert np.allclose(out_prob[policy], expected_prob,
+                         atol=1e-11, rtol=1e-6)
+    assert np.allclose(out_prob['work_stealing'], out_prob['static'],
+                       atol=1e-11, rtol=1e-6)
+
+  def test_min_work_per_thread(self):
+    """Test running small batches inline and spreading large ones"""
+    libpath, dtest, expected_prob = setup_test_lib(
+      'mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+      'mushroom/agaricus.test.prob')
+    # a row of this model visits fewer than 10 nodes
+    predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                           nthread=2,
+                                           include_master_thread=False,
+                                           min_work_per_thread=1000)
+    num_task = predictor.get_worker_stats()['num_task']
+    # a single row runs on the calling thread
+    batch = treelite.runtime.Batch.from_csr(dtest, rbegin=0, rend=1)
+    out_prob = predictor.predict(batch)
+    assert np.allclose(out_prob, expected_prob[0:1], atol=1e-11, rtol=1e-6)
+    assert np.array_equal(predictor.get_worker_stats()['num_task'], num_task)
+    # the whole test set is worth both workers
+    batch = treelite.runtime.Batch.from_csr(dtest)
+    out_prob = predictor.predict(batch)
+    assert np.allclose(out_prob, expected_prob, atol=1e-11, rtol=1e-6)
+    assert np.all(predictor.get_worker_stats()['num_task'] > num_task)
+    # with no minimum, even a single row goes to a worker
+    predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                           nthread=1,
+                                           include_master_thread=False,
+                                           min_work_per_thread=0)
+    num_task = predictor.get_worker_stats()['num_task']
+    batch = treelite.runtime.Batch.from_csr(dtest, rbegin=0, rend=1)
+    out_prob = predictor.predict(batch)
+    assert np.allclose(out_prob, expected_prob[0:1], atol=1e-11, rtol=1e-6)
+    assert np.all(predictor.get_worker_stats()['num_task'] > num_task)
+
+  def test_affinity_policy(self):
+    """Test placing worker threads on CPUs"""
+    libpath, dtest, expected_prob = setup_test_lib(
+      'mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+      'mushroom/agaricus.test.prob')
+    batch = treelite.runtime.Batch.from_csr(dtest)
+    for policy, cpu_list in [('none', None), ('compact', None),
+                             ('scatter', None), ('explicit', [0]),
+                             ('numa_local', None)]:
+      predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                             nthread=1,
+                                             affinity_policy=policy,
+                                             cpu_list=cpu_list,
+                                             min_work_per_thread=0)
+      out_prob = predictor.predict(batch)
+      assert np.allclose(out_prob, expected_prob, atol=1e-11, rtol=1e-6)
+      if policy == 'none':
+        assert np.array_equal(predictor.get_worker_cpus(), [-1])
+      elif policy == 'explicit':
+        assert np.array_equal(predictor.get_worker_cpus(), cpu_list)
+    # CPUs that don't exist are rejected when the pool is created
+    for cpu_list in [[-1], [0, 1 << 20]]:
+      self.assertRaises(Exception, treelite.runtime.Predictor, libpath,
+                        nthread=1, affinity_policy='explicit',
+                        cpu_list=cpu_list)
+
+    # live compact pools don't share CPUs, and a re-created pool gets the
+    # CPUs of the one it replaces
+    num_cpu = len(os.sched_getaffinity(0)) if hasattr(os, 'sched_getaffinity') \
+              else os.cpu_count()
+    first = treelite.runtime.Predictor(libpath=libpath, nthread=1)
+    second = treelite.runtime.Predictor(libpath=libpath, nthread=1)
+    first_cpus = first.get_worker_cpus()
+    second_cpus = second.get_worker_cpus()
+    if num_cpu >= 3:
+      assert not set(first_cpus) & set(second_cpus)
+    del second
+    third = treelite.runtime.Predictor(libpath=libpath, nthread=1)
+    assert np.array_equal(third.get_worker_cpus(), second_cpus)
+    assert np.array_equal(first.get_worker_cpus(), first_cpus)
+
+  def test_wait_strategy(self):
+    """Test strategies for idle worker threads to wait for tasks"""
+    libpath, dtest, expected_prob = setup_test_lib(
+      'mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+      'mushroom/agaricus.test.prob')
+    batch = treelite.runtime.Batch.from_csr(dtest)
+    for strategy in ['spin', 'spin_then_sleep', 'adaptive', 'blocking']:
+      predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                             nthread=1,
+                                             include_master_thread=False,
+                                             wait_strategy=strategy,
+                                             min_work_per_thread=0)
+      # the worker has already run a task while the library was loaded
+      before = predictor.get_worker_stats()
+      for _ in range(5):
+        out_prob = predictor.predict(batch)
+        assert np.allclose(out_prob, expected_prob, atol=1e-11, rtol=1e-6)
+      stats = predictor.get_worker_stats()
+      for key in ['spin_time', 'sleep_time', 'work_time', 'num_task']:
+        assert stats[key].shape == (1,)
+        assert np.all(stats[key] >= 0)
+      assert stats['num_task'][0] == before['num_task'][0] + 5
+      assert stats['work_time'][0] > before['work_time'][0]
+      if strategy == 'spin':
+        assert stats['sleep_time'][0] == 0
+
+  def test_predict_unordered(self):
+    """Test submitting many small batches at once"""
+    libpath, dtest, expected_margin = setup_test_lib(
+      'dermatology/dermatology.model', 'dermatology/dermatology.test',
+      './dermatology{}', 'dermatology/dermatology.test.margin')
+    # a shallow queue makes the submitting thread wait for the workers
+    for queue_depth in [None, 2]:
+      predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                             queue_depth=queue_depth)
+      bounds = list(range(0, dtest.shape[0], 7)) + [dtest.shape[0]]
+      batches = [treelite.runtime.Batch.from_csr(dtest, rbegin=x, rend=y)
+                 for x, y in zip(bounds[:-1], bounds[1:])]
+      seen = set()
+      for i, out_margin in predictor.predict_unordered(batches,
+                                                       pred_margin=True):
+        assert i not in seen
+        seen.add(i)
+        assert np.allclose(out_margin,
+                           expected_margin[bounds[i]:bounds[i + 1], :],
+                           atol=1e-11, rtol=1e-6)
+      assert len(seen) == len(batches)
+
+  def test_predict_file(self):
+    """Test streaming predictions from one file to another"""
+    dtest_path = os.path.join(dpath, 'dermatology/dermatology.test')
+    libpath, _, _ = setup_test_lib('dermatology/dermatology.model',
+                                   'dermatology/dermatology.test',
+                                   './dermatology{}')
+    predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True)
+    out_path = os.path.abspath('./dermatology.test.out')
+    for pred_margin, expected_path in \
+        [(False, 'dermatology/dermatology.test.prob'),
+         (True, 'dermatology/dermatology.test.margin')]:
+      num_row = predictor.predict_file(dtest_path, out_path, verbose=True,
+                                       pred_margin=pred_margin)
+      out = np.loadtxt(out_path, delimiter=',', ndmin=2)
+      os.remove(out_path)
+      expected = load_txt(os.path.join(dpath, expected_path))
+      assert num_row == out.shape[0]
+      assert out.shape[1] == predictor.num_output_group
+      assert np.allclose(out.ravel(), expected, atol=1e-11, rtol=1e-6)
+
+  def test_shared_worker_pool(self):
+    """Test running several predictors on one pool of worker threads"""
+    pool = treelite.runtime.WorkerPool(nthread=1)
+    predictors = []
+    for model_path, dtest_path, libname_fmt, expected_margin_path in \
+        [('mushroom/mushroom.model', 'mushroom/agaricus.test', './agaricus{}',
+          'mushroom/agaricus.test.margin'),
+         ('dermatology/dermatology.model', 'dermatology/dermatology.test',
+          './dermatology{}', 'dermatology/dermatology.test.margin')]:
+      libpath, dtest, expected_margin = setup_test_lib(
+        model_path, dtest_path, libname_fmt, expected_margin_path)
+      predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                             worker_pool=pool,
+                                             min_work_per_thread=0)
+      predictors.append((predictor, treelite.runtime.Batch.from_csr(dtest),
+                         expected_margin))
+    # the predictors keep the pool alive
+    del pool
+
+    errors = []
+    def worker(predictor, batch, expected_margin):
+      try:
+        for _ in range(20):
+          out_margin = predictor.predict(batch, pred_margin=True)
+          assert np.allclose(out_margin, expected_margin,
+                             atol=1e-11, rtol=1e-6)
+      except Exception as e:  # pylint: disable=W0703
+        errors.append(e)
+    threads = [threading.Thread(target=worker, args=x)
+               for x in predictors * 4]
+    for t in threads:
+      t.start()
+    for t in threads:
+      t.join()
+    assert not errors, errors
+
+  def test_predictor_stats(self):
+    """Test latency histograms and throughput statistics"""
+    libpath, dtest, _ = setup_test_lib('mushroom/mushroom.model',
+                                       'mushroom/agaricus.test',
+                                       './agaricus{}')
+    batch = treelite.runtime.Batch.from_csr(dtest)
+    predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True,
+                                           nthread=1)
+    stats = predictor.get_stats()
+    assert stats['num_batch'] == 0
+    assert stats['latency']['count'] == 0
+    for _ in range(10):
+      predictor.predict(batch)
+    stats = predictor.get_stats()
+    assert stats['num_batch'] == 10
+    assert stats['num_row'] == 10 * dtest.shape[0]
+    assert stats['rows_per_sec'] > 0
+    for stage in ['latency', 'queue_wait', 'compute', 'reshape']:
+      summary = stats[stage]
+      assert summary['count'] == 10
+      assert 0 <= summary['p50'] <= summary['p99'] <= summary['max']
+    assert stats['latency']['max'] > 0
+    assert len(stats['worker']) == 1
+    assert stats['worker'][0]['work_time'] >= 0
+
+    stats_path = os.path.abspath('./treelite_predictor.prom')
+    predictor.dump_stats(stats_path)
+    with open(stats_path, 'r') as f:
+      text = f.read()
+    os.remove(stats_path)
+    assert 'treelite_predictor_batches_total 10\n' in text
+    assert 'treelite_predictor_latency_seconds_count{stage="compute"} 10\n' \
+           in text
+    assert 'treelite_worker_busy_seconds_total{worker="0"}' in text
+
+    predictor.reset_stats()
+    stats = predictor.get_stats()
+    assert stats['num_batch'] == 0
+    assert stats['worker'][0]['num_task'] == 0
+
+  def test_reload(self):
+    """Test swapping the library while other threads are predicting"""
+    # two builds of the same model, which must give the same predictions
+    libpaths = []
+    for libname_fmt, params in \
+        [('./agaricus{}', {}), ('./agaricus_parallel{}', {'parallel_comp': 4})]:
+      libpath, dtest, expected_margin = setup_test_lib(
+        'mushroom/mushroom.model', 'mushroom/agaricus.test', libname_fmt,
+        'mushroom/agaricus.test.margin', params)
+      libpaths.append(libpath)
+    batch = treelite.runtime.Batch.from_csr(dtest)
+    predictor = treelite.runtime.Predictor(libpath=libpaths[0], verbose=True)
+    assert predictor.get_stats()['model_version'] == 1
+
+    errors = []
+    done = threading.Event()
+    def worker():
+      try:
+        while not done.is_set():
+          out_margin = predictor.predict(batch, pred_margin=True)
+          assert np.allclose(out_margin, expected_margin,
+                             atol=1e-11, rtol=1e-6)
+      except Exception as e:  # pylint: disable=W0703
+        errors.append(e)
+    threads = [threading.Thread(target=worker) for _ in range(4)]
+    for t in threads:
+      t.start()
+    for i in range(10):
+      predictor.reload(libpaths[(i + 1) % 2], verbose=True)
+    done.set()
+    for t in threads:
+      t.join()
+    assert not errors, errors
+    assert predictor.get_stats()['model_version'] == 11
+
+    # a model of a different shape is turned away; the old one stays
+    derm_libpath, _, _ = setup_test_lib('dermatology/dermatology.model',
+                                        'dermatology/dermatology.test',
+                                        './dermatology{}')
+    self.assertRaises(Exception, predictor.reload, derm_libpath)
+    assert predictor.get_stats()['model_version'] == 11
+    out_margin = predictor.predict(batch, pred_margin=True)
+    assert np.allclose(out_margin, expected_margin, atol=1e-11, rtol=1e-6)
+
+  def test_load_from_memory(self):
+    """Test loading a library held in memory"""
+    libpath, dtest, expected_margin = setup_test_lib(
+      'dermatology/dermatology.model', 'dermatology/dermatology.test',
+      './dermatology{}', 'dermatology/dermatology.test.margin')
+    with open(libpath, 'rb') as f:
+      libbuffer = f.read()
+    batch = treelite.runtime.Batch.from_csr(dtest)
+    pool = treelite.runtime.WorkerPool(nthread=1)
+    for worker_pool in [None, pool]:
+      predictor = treelite.runtime.Predictor(libbuffer=libbuffer, verbose=True,
+                                             worker_pool=worker_pool)
+      assert predictor.num_output_group == expected_margin.shape[1]
+      out_margin = predictor.predict(batch, pred_margin=True)
+      assert np.allclose(out_margin, expected_margin, atol=1e-11, rtol=1e-6)
+    self.assertRaises(Exception, treelite.runtime.Predictor,
+                      libbuffer=b'not a library')
+
+  def test_load_options(self):
+    """Test eager binding, pre-faulting and warm-up on loading"""
+    libpath, dtest, expected_margin = setup_test_lib(
+      'dermatology/dermatology.model', 'dermatology/dermatology.test',
+      './dermatology{}', 'dermatology/dermatology.test.margin')
+    batch = treelite.runtime.Batch.from_csr(dtest)
+    for prefault in ['none', 'touch', 'lock']:
+      predictor = treelite.runtime.Predictor(libpath, verbose=True,
+                                             bind_now=True, prefault=prefault,
+                                             num_warmup_row=100)
+      load = predictor.get_stats()['load']
+      assert load['total_time'] >= load['open_time'] + load['warmup_time']
+      if prefault == 'none':
+        assert load['prefault_bytes'] == 0
+      elif sys.platform.startswith('linux'):
+        assert load['prefault_bytes'] > 0
+      # the warm-up leaves no trace in the statistics
+      assert predictor.get_stats()['num_batch'] == 0
+      out_margin = predictor.predict(batch, pred_margin=True)
+      assert np.allclose(out_margin, expected_margin, atol=1e-11, rtol=1e-6)
+      predictor.reload(libpath)
+      out_margin = predictor.predict(batch, pred_margin=True)
+      assert np.allclose(out_margin, expected_margin, atol=1e-11, rtol=1e-6)
+    self.assertRaises(Exception, treelite.runtime.Predictor, libpath,
+                      prefault='bogus')
+
+  def test_typed_batch(self):
+    """Test batches of other types than float32, which are read in place"""
+    libpath, dtest, expected_margin = setup_test_lib(
+      'dermatology/dermatology.model', 'dermatology/dermatology.test',
+      './dermatology{}', 'dermatology/dermatology.test.margin')
+    predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True)
+    mat = to_dense(dtest, predictor.num_feature, dtype=np.float64)
+    # all feature values are small integers, so that every type holds them
+    # exactly; integer matrices mark missing values with -1
+    for dtype in [np.float64, np.float16, np.int32, np.int64]:
+      if np.issubdtype(dtype, np.integer):
+        typed_mat, missing = np.where(np.isnan(mat), -1, mat), -1
+      else:
+        typed_mat, missing = mat, None
+      for order in ['C', 'F']:
+        view = np.array(typed_mat, dtype=dtype, order=order)
+        batch = treelite.runtime.Batch.from_npy2d(view, missing=missing)
+        assert np.shares_memory(batch.data, view)
+        out_margin = predictor.predict(batch, pred_margin=True)
+        assert np.allclose(out_margin, expected_margin, atol=1e-11,
+                           rtol=1e-6)
+    for index_dtype in [np.int32, np.int64]:
+      csr = scipy.sparse.csr_matrix(
+        (np.asarray(dtest.data, dtype=np.float64),
+         np.asarray(dtest.indices, dtype=index_dtype),
+         np.asarray(dtest.indptr, dtype=index_dtype)), shape=dtest.shape)
+      batch = treelite.runtime.Batch.from_csr(csr)
+      assert np.shares_memory(batch.data, csr.data)
+      assert np.shares_memory(batch.indices, csr.indices)
+      out_margin = predictor.predict(batch, pred_margin=True)
+      assert np.allclose(out_margin, expected_margin, atol=1e-11, rtol=1e-6)
+      # a range of rows in the middle of the matrix
+      batch = treelite.runtime.Batch.from_csr(csr, rbegin=10, rend=50)
+      out_margin = predictor.predict(batch, pred_margin=True)
+      assert np.allclose(out_margin, expected_margin[10:50], atol=1e-11,
+                         rtol=1e-6)
+
   def test_srcpkg(self):
     """Test feature to export a source tarball"""
     model_path = os.path.join(dpath, 'mushroom/mushroom.model')
@@ -2,6 +2,7 @@
 """Tests for single-instance prediction"""
 from __future__ import print_function
 import os
+import threading
 import unittest
 from nose.tools import nottest
 from sklearn.datasets import load_svmlight_file
@@ -84,3 +85,54 @@ class TestSingleInst(unittest.TestCase):
                                  multiclass=multiclass,
                                  use_annotation=use_annotation,
                                  use_quantize=use_quantize)
+
+  def test_coalescing(self):
+    """Test merging single-instance predictions from many threads"""
+    model_path = os.path.join(dpath, 'dermatology/dermatology.model')
+    dtest_path = os.path.join(dpath, 'dermatology/dermatology.test')
+    libpath = libname('./dermatology{}')
+    model = treelite.Model.load(model_path, model_format='xgboost')
+    toolchain = os_compatible_toolchains()[0]
+    model.export_lib(toolchain=toolchain, libpath=libpath,
+                     params={}, verbose=True)
+    X_test, _ = load_svmlight_file(dtest_path, zero_based=True)
+    nrow = X_test.shape[0]
+    expected_prob = load_txt(
+      os.path.join(dpath, 'dermatology/dermatology.test.prob'))
+    expected_prob = expected_prob.reshape((nrow, -1))
+    expected_margin = load_txt(
+      os.path.join(dpath, 'dermatology/dermatology.test.margin'))
+    expected_margin = expected_margin.reshape((nrow, -1))
+
+    predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True)
+    predictor.set_coalescing(max_batch_size=8, max_delay_us=2000)
+    errors = []
+    def worker(tid, num_thread):
+      try:
+        for i in range(tid, nrow, num_thread):
+          out_prob = predictor.predict_instance(X_test[i,:])
+          out_margin = predictor.predict_instance(X_test[i,:],
+                                                  pred_margin=True)
+          assert np.allclose(out_prob, expected_prob[i],
+                             atol=1e-11, rtol=1e-6)
+          assert np.allclose(out_margin, expected_margin[i],
+                             atol=1e-11, rtol=1e-6)
+      except Exception as e:  # pylint: disable=W0703
+        errors.append(e)
+    threads = [threading.Thread(target=worker, args=(tid, 8))
+               for tid in range(8)]
+    for t in threads:
+      t.start()
+    for t in threads:
+      t.join()
+    assert not errors, errors
+    stats = predictor.get_coalescing_stats()
+    assert stats['num_request'] == 2 * nrow
+    assert 0 < stats['num_batch'] <= stats['num_request']
+    assert stats['coalescing_ratio'] >= 1.0
+
+    # an entry that is present but holds NaN would be taken as missing in the
+    # coalesced batch, so it is rejected; the next row is predicted as usual
+    self.assertRaises(Exception, predictor.predict_instance, {0: np.nan})
+    out_prob = predictor.predict_instance(X_test[0,:])
+    assert np.allclose(out_prob, expected_prob[0], atol=1e-11, rtol=1e-6)
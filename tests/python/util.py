@@ -45,10 +45,45 @@ def make_annotation(model, dtrain_path, annotation_path):
   annotator.annotate_branch(model=model, dmat=dtrain, verbose=True)
   annotator.save(path=annotation_path)
 
+@nottest
+def setup_test_lib(model_path, dtest_path, libname_fmt, expected_path=None,
+                   params=None):
+  """
+  Compile an example model into a shared library with the first compatible
+  toolchain, and load its test set along with the expected predictions
+  (one row per data instance for multiclass models).
+  Returns (libpath, dtest, expected)
+  """
+  dpath = os.path.abspath(os.path.join(os.getcwd(), 'tests/examples/'))
+  model = treelite.Model.load(os.path.join(dpath, model_path),
+                              model_format='xgboost')
+  libpath = libname(libname_fmt)
+  model.export_lib(toolchain=os_compatible_toolchains()[0], libpath=libpath,
+                   params=(params if params is not None else {}),
+                   verbose=True)
+  dtest = treelite.DMatrix(os.path.join(dpath, dtest_path))
+  expected = None
+  if expected_path is not None:
+    expected = load_txt(os.path.join(dpath, expected_path))
+    if expected.size > dtest.shape[0]:
+      expected = expected.reshape((dtest.shape[0], -1))
+  return libpath, dtest, expected
+
+def to_dense(dmat, num_col, missing=np.nan, dtype=np.float32):
+  """Expand a sparse matrix into a dense one, filling in missing values"""
+  mat = np.full((dmat.shape[0], num_col), missing, dtype=dtype)
+  for i in range(dmat.shape[0]):
+    ibegin, iend = dmat.indptr[i], dmat.indptr[i + 1]
+    mat[i, dmat.indices[ibegin:iend]] = dmat.data[ibegin:iend]
+  return mat
+
 @nottest
 def run_pipeline_test(model, dtest_path, libname_fmt,
                       expected_prob_path, expected_margin_path,
-                      multiclass, use_annotation, use_quantize):
+                      multiclass, use_annotation, use_quantize,
+                      use_batch_function=False, compiler='ast_native',
+                      node_layout=None, branchless_padding=None,
+                      parallel_comp=None, code_folding_req=None):
   dpath = os.path.abspath(os.path.join(os.getcwd(), 'tests/examples/'))
   dtest_path = os.path.join(dpath, dtest_path)
   libpath = libname(libname_fmt)
@@ -70,10 +105,21 @@ def run_pipeline_test(model, dtest_path, libname_fmt,
     params['annotate_in'] = use_annotation
   if use_quantize:
     params['quantize'] = 1
+  if use_batch_function:
+    params['batch_function'] = 1
+  if node_layout is not None:
+    params['node_layout'] = node_layout
+  if parallel_comp is not None:
+    params['parallel_comp'] = parallel_comp
+  if code_folding_req is not None:
+    params['code_folding_req'] = code_folding_req
+  if branchless_padding is not None:
+    params['branchless_tree'] = 1
+    params['branchless_tree_padding'] = branchless_padding
 
   for toolchain in os_compatible_toolchains():
     model.export_lib(toolchain=toolchain, libpath=libpath,
-                     params=params, verbose=True)
+                     params=params, compiler=compiler, verbose=True)
     predictor = treelite.runtime.Predictor(libpath=libpath, verbose=True)
     out_prob = predictor.predict(batch)
     if expected_prob is not None: